@@ -0,0 +1,188 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - echo-paced uploads
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "echopacer.h"
+
+
+// the monitor may echo lower case input as upper case
+static uint8_t fold(uint8_t c)
+{
+  c &= 0x7f;
+  return (c>='a' && c<='z') ? c-32 : c;
+}
+
+
+EchoPacer::EchoPacer()
+{
+  m_window = 1;
+  m_window_limit = DEFAULT_WINDOW;
+  m_window_max = m_window_limit;
+  m_clean_lines = 0;
+  m_prompt_len = 0;
+  m_timeout = 250000;
+  m_slowest = m_timeout/4;
+  m_cursor_row = -1;
+  num_lines = 0;
+  num_misses = 0;
+  reset();
+}
+
+
+void EchoPacer::reset()
+{
+  m_pending.clear();
+  m_wait_line = false;
+  m_line_row = -1;
+  m_echo_row = -1;
+  m_prompt_pos = 0;
+  m_prev_char = 0;
+  m_last_progress = 0;
+}
+
+
+void EchoPacer::set_prompt(const char *prompt)
+{
+  m_prompt_len = 0;
+  while( prompt!=NULL && prompt[m_prompt_len]!=0 && m_prompt_len<(int) sizeof(m_prompt) )
+    {
+      m_prompt[m_prompt_len] = fold(prompt[m_prompt_len]);
+      m_prompt_len++;
+    }
+}
+
+
+void EchoPacer::set_timeout(int timeout_ms)
+{
+  m_timeout = int64_t(timeout_ms) * 1000;
+  m_slowest = m_timeout/4;
+}
+
+
+void EchoPacer::set_max_window(int max_window)
+{
+  m_window_limit = max_window<1 ? 1 : (max_window>MAX_WINDOW ? MAX_WINDOW : max_window);
+  m_window_max = m_window_limit;
+  if( m_window>m_window_max ) m_window = m_window_max;
+}
+
+
+void EchoPacer::miss()
+{
+  num_misses++;
+  m_window_max = m_window>1 ? m_window-1 : 1;
+  m_window = m_window>1 ? m_window/2 : 1;
+  m_clean_lines = 0;
+  m_pending.clear();
+  m_wait_line = false;
+  m_echo_row = -1;
+}
+
+
+void EchoPacer::progress(int64_t now)
+{
+  // remember the slowest recent response, slowly forgetting old ones
+  int64_t t = now - m_last_progress;
+  m_slowest -= m_slowest/16;
+  if( t>m_slowest ) m_slowest = t;
+  m_last_progress = now;
+}
+
+
+bool EchoPacer::may_send(int64_t now, int64_t *wait)
+{
+  if( !m_wait_line && (int) m_pending.size()<m_window )
+    return true;
+
+  int64_t timeout = 4*m_slowest;
+  if( timeout<MIN_TIMEOUT ) timeout = MIN_TIMEOUT;
+  if( timeout>m_timeout )   timeout = m_timeout;
+
+  int64_t t = m_last_progress + timeout - now;
+  if( t<=0 )
+    {
+      // no echo within the timeout => characters were lost
+      miss();
+      m_last_progress = now;
+      return true;
+    }
+
+  *wait = t;
+  return false;
+}
+
+
+void EchoPacer::sent(uint8_t c, int64_t now)
+{
+  // the timeout counts from the first character in flight
+  if( !busy() ) m_last_progress = now;
+
+  if( c==13 || (c==10 && m_prev_char!=13) )
+    {
+      // line end: wait until the cursor leaves the row the line was on
+      m_wait_line = true;
+      m_line_row  = m_echo_row>=0 ? m_echo_row : m_cursor_row;
+      m_prompt_pos = 0;
+    }
+  else if( c>=32 && c<127 )
+    m_pending.push_back(fold(c));
+
+  m_prev_char = c;
+}
+
+
+bool EchoPacer::observe(int addr, uint8_t value, int64_t now)
+{
+  int row = (addr & 1023) / 64;
+
+  if( value & 0x80 )
+    {
+      // cursor (characters with bit 7 set are displayed inverted)
+      m_cursor_row = row;
+
+      if( m_wait_line && m_pending.empty() && row!=m_line_row && m_prompt_pos>=m_prompt_len )
+        {
+          // line was processed and the monitor waits for the next one
+          m_wait_line = false;
+          m_echo_row  = -1;
+          num_lines++;
+          if( ++m_clean_lines>=PROBE_LINES && m_window_max<m_window_limit )
+            { m_window_max++; m_clean_lines = 0; }
+          if( m_window<m_window_max ) m_window++;
+          progress(now);
+          return true;
+        }
+    }
+  else if( !m_pending.empty() && fold(value)==m_pending.front() )
+    {
+      m_pending.pop_front();
+      m_echo_row = row;
+      progress(now);
+      return true;
+    }
+  else if( m_wait_line && m_pending.empty() && m_prompt_pos<m_prompt_len && row!=m_line_row )
+    {
+      if( fold(value)==m_prompt[m_prompt_pos] )
+        m_prompt_pos++;
+      else if( value!=' ' )
+        m_prompt_pos = fold(value)==m_prompt[0] ? 1 : 0;
+    }
+
+  return false;
+}
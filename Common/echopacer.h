@@ -0,0 +1,95 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - echo-paced uploads
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef ECHOPACER_H
+#define ECHOPACER_H
+
+#include <stdint.h>
+#include <deque>
+
+
+// Paces uploads by watching what the monitor (e.g. CUTER) writes into video
+// memory instead of sleeping for fixed times:
+// - Printable characters that were sent count as "in flight" until the
+//   monitor has written them into video memory (i.e. echoed them).
+//   At most "window" characters may be in flight at once.
+// - After a line end (CR, or LF not preceded by CR) nothing more is sent
+//   until the monitor shows its cursor (a character with bit 7 set) on a
+//   different row, i.e. it has processed the line and waits for the next one.
+//   If a prompt string is set then it must also have been written after
+//   the line end.
+// - The window starts at one character (stop-and-wait) and grows by one
+//   character with each line that completes, up to the configured maximum
+//   (which should not exceed the input buffer size on the Altair side).
+// - If nothing happens for a while then the echo was missed (the monitor
+//   probably dropped characters because its input buffer overflowed). The
+//   window is halved and growth stops one below the window size that failed.
+//   Only after PROBE_LINES clean lines the window may grow beyond that again.
+//   "A while" is four times the slowest recent echo (at least MIN_TIMEOUT)
+//   but never more than the configured timeout.
+//
+// Not thread-safe, the owner must serialize calls.
+
+
+class EchoPacer
+{
+ public:
+  enum { DEFAULT_WINDOW = 16, MAX_WINDOW = 128, PROBE_LINES = 64, MIN_TIMEOUT = 10000 };
+
+  EchoPacer();
+
+  void reset();
+  void set_prompt(const char *prompt);
+  void set_timeout(int timeout_ms);
+  void set_max_window(int max_window);
+
+  // returns true if the next character may be sent now, otherwise
+  // *wait is set to the time (microseconds) after which to check again
+  bool may_send(int64_t now, int64_t *wait);
+
+  // a character has been sent
+  void sent(uint8_t c, int64_t now);
+
+  // a byte has been written to video memory, returns true if this
+  // may allow more characters to be sent
+  bool observe(int addr, uint8_t value, int64_t now);
+
+  // true while characters are in flight or a line end is pending
+  bool busy() { return !m_pending.empty() || m_wait_line; }
+
+  // statistics
+  int      window() { return m_window; }
+  uint32_t num_lines, num_misses;
+
+ private:
+  void miss();
+  void progress(int64_t now);
+
+  std::deque<uint8_t> m_pending;
+  bool    m_wait_line;
+  int     m_window, m_window_max, m_window_limit, m_clean_lines;
+  int     m_line_row, m_echo_row, m_cursor_row;
+  uint8_t m_prev_char;
+  char    m_prompt[16];
+  int     m_prompt_len, m_prompt_pos;
+  int64_t m_timeout, m_last_progress, m_slowest;
+};
+
+
+#endif
@@ -0,0 +1,96 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - value histograms
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "histogram.h"
+
+
+Histogram::Histogram(const char *n, const char *u)
+{
+  name = n;
+  unit = u;
+  reset();
+}
+
+
+void Histogram::reset()
+{
+  count = 0;
+  sum = 0;
+  max = 0;
+  memset(buckets, 0, sizeof(buckets));
+}
+
+
+void Histogram::merge(const Histogram &h)
+{
+  for(int i=0; i<BUCKETS; i++) buckets[i] += h.buckets[i];
+  count += h.count;
+  sum   += h.sum;
+  if( h.max>max ) max = h.max;
+}
+
+
+static uint64_t upper_bound(int b)
+{
+  return b==0 ? 0 : (uint64_t(1)<<b)-1;
+}
+
+
+uint64_t Histogram::percentile(double p) const
+{
+  uint64_t n = 0, target = uint64_t(p*count + 0.5);
+  if( target<1 ) target = 1;
+
+  for(int b=0; b<BUCKETS; b++)
+    {
+      n += buckets[b];
+      if( n>=target )
+        {
+          uint64_t u = upper_bound(b);
+          return u<max ? u : max;
+        }
+    }
+
+  return max;
+}
+
+
+void Histogram::print(FILE *f) const
+{
+  fprintf(f, "%s: %llu samples, mean %.1f %s, p50 <=%llu, p99 <=%llu, max %llu\n",
+          name, (unsigned long long) count, mean(), unit,
+          (unsigned long long) percentile(0.5), (unsigned long long) percentile(0.99),
+          (unsigned long long) max);
+
+  for(int b=0; b<BUCKETS; b++)
+    if( buckets[b]>0 )
+      {
+        // bar of up to 40 characters, relative to the total count
+        char bar[41];
+        int  len = int(buckets[b]*40/count);
+        memset(bar, '#', len);
+        bar[len] = 0;
+
+        fprintf(f, "  %10llu-%-10llu %10llu %s\n",
+                (unsigned long long) (b==0 ? 0 : uint64_t(1)<<(b-1)),
+                (unsigned long long) upper_bound(b),
+                (unsigned long long) buckets[b], bar);
+      }
+}
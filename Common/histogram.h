@@ -0,0 +1,70 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - value histograms
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+// Histogram with power-of-two buckets: bucket 0 counts zeros, bucket n
+// counts values in [2^(n-1), 2^n). Cheap enough to record every single
+// read/frame/request. Percentiles are reported as the upper bucket bound,
+// i.e. they are exact to within a factor of two.
+// Not thread-safe, the owner must serialize calls.
+
+
+class Histogram
+{
+ public:
+  enum { BUCKETS = 40 };
+
+  Histogram(const char *name, const char *unit);
+
+  void reset();
+
+  void add(uint64_t value)
+  {
+    int b = 0;
+    while( b<BUCKETS-1 && (value>>b)!=0 ) b++;
+    buckets[b]++;
+    count++;
+    sum += value;
+    if( value>max ) max = value;
+  }
+
+  // merge the counts of another histogram into this one
+  void merge(const Histogram &h);
+
+  // smallest bucket upper bound below which a fraction "p" (0-1) of the values lie
+  uint64_t percentile(double p) const;
+
+  double mean() const { return count>0 ? double(sum)/count : 0.0; }
+
+  // one summary line followed by one line per non-empty bucket
+  void print(FILE *f) const;
+
+  const char *name, *unit;
+  uint64_t    count, sum, max;
+  uint64_t    buckets[BUCKETS];
+};
+
+
+#endif
@@ -0,0 +1,258 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - single-producer/single-consumer ring buffer
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Lock-free ring buffer for exactly one producer and one consumer, for example
+// an interrupt handler (producer) and the main loop (consumer) or two threads.
+//
+// "head" is only ever written by the producer and "tail" only by the consumer.
+// Both are free-running counters, the buffer index is (counter & (size-1)),
+// so the buffer can be filled completely and fill level is simply head-tail.
+// The producer publishes data with a release-store of "head" after writing
+// the data, the consumer frees space with a release-store of "tail" after
+// reading the data. Each side reads the other side's counter with an acquire-load.
+//
+// high_watermark and overflows are maintained by the producer and may be
+// read (but not written) by anyone.
+
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RINGBUFFER_LOAD_ACQUIRE(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RINGBUFFER_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#elif defined(_MSC_VER)
+// with MSVC (/volatile:ms, the default on x86/x64) volatile accesses
+// already have acquire/release semantics
+#define RINGBUFFER_LOAD_ACQUIRE(p)     (*(p))
+#define RINGBUFFER_STORE_RELEASE(p, v) (*(p) = (v))
+#else
+#error Need acquire/release primitives for this compiler
+#endif
+
+
+typedef struct
+{
+  volatile uint32_t head;           // total number of bytes written (producer only)
+  volatile uint32_t tail;           // total number of bytes read (consumer only)
+  uint32_t          size;           // buffer size, must be a power of 2
+  uint8_t          *data;
+  volatile uint32_t high_watermark; // highest fill level seen by the producer
+  volatile uint32_t overflows;      // number of bytes dropped because the buffer was full
+} ringbuffer_t;
+
+
+static inline void ringbuffer_init(ringbuffer_t *rb, uint8_t *data, uint32_t size)
+{
+  rb->head = 0;
+  rb->tail = 0;
+  rb->size = size;
+  rb->data = data;
+  rb->high_watermark = 0;
+  rb->overflows = 0;
+}
+
+
+// discard all data currently in the buffer (consumer side)
+static inline void ringbuffer_clear(ringbuffer_t *rb)
+{
+  RINGBUFFER_STORE_RELEASE(&rb->tail, RINGBUFFER_LOAD_ACQUIRE(&rb->head));
+}
+
+
+// number of bytes that can be read (consumer side)
+static inline uint32_t ringbuffer_available_for_read(ringbuffer_t *rb)
+{
+  return RINGBUFFER_LOAD_ACQUIRE(&rb->head) - rb->tail;
+}
+
+
+// number of bytes that can be written (producer side)
+static inline uint32_t ringbuffer_available_for_write(ringbuffer_t *rb)
+{
+  return rb->size - (rb->head - RINGBUFFER_LOAD_ACQUIRE(&rb->tail));
+}
+
+
+static inline bool ringbuffer_empty(ringbuffer_t *rb)
+{
+  return ringbuffer_available_for_read(rb)==0;
+}
+
+
+static inline bool ringbuffer_full(ringbuffer_t *rb)
+{
+  return ringbuffer_available_for_write(rb)==0;
+}
+
+
+// -----------------------------------------------------------------------------
+// producer side
+// -----------------------------------------------------------------------------
+
+
+static inline void ringbuffer_note_fill_level(ringbuffer_t *rb, uint32_t head, uint32_t tail)
+{
+  uint32_t level = head - tail;
+  if( level > rb->high_watermark ) rb->high_watermark = level;
+}
+
+
+// add one byte, returns false (and counts an overflow) if the buffer is full
+static inline bool ringbuffer_enqueue(ringbuffer_t *rb, uint8_t b)
+{
+  uint32_t head = rb->head, tail = RINGBUFFER_LOAD_ACQUIRE(&rb->tail);
+
+  if( head-tail == rb->size )
+    {
+      rb->overflows++;
+      return false;
+    }
+
+  rb->data[head & (rb->size-1)] = b;
+  RINGBUFFER_STORE_RELEASE(&rb->head, head+1);
+  ringbuffer_note_fill_level(rb, head+1, tail);
+  return true;
+}
+
+
+// returns the contiguous free region starting at the write position in *p,
+// the return value is its length (which may be less than the total free space
+// if the free space wraps around the end of the buffer). Data written
+// there becomes visible to the consumer with ringbuffer_commit().
+static inline uint32_t ringbuffer_write_span(ringbuffer_t *rb, uint8_t **p)
+{
+  uint32_t idx = rb->head & (rb->size-1);
+  uint32_t n   = ringbuffer_available_for_write(rb);
+  if( n > rb->size-idx ) n = rb->size-idx;
+  *p = rb->data + idx;
+  return n;
+}
+
+
+// publish n bytes previously placed into the region returned by ringbuffer_write_span()
+static inline void ringbuffer_commit(ringbuffer_t *rb, uint32_t n)
+{
+  uint32_t head = rb->head + n;
+  RINGBUFFER_STORE_RELEASE(&rb->head, head);
+  ringbuffer_note_fill_level(rb, head, RINGBUFFER_LOAD_ACQUIRE(&rb->tail));
+}
+
+
+// add up to n bytes (at most two memcpy), returns the number of bytes written.
+// Bytes that do not fit are dropped and counted as overflows.
+static inline uint32_t ringbuffer_write(ringbuffer_t *rb, const void *data, uint32_t n)
+{
+  const uint8_t *src = (const uint8_t *) data;
+  uint32_t head = rb->head, tail = RINGBUFFER_LOAD_ACQUIRE(&rb->tail);
+  uint32_t avail = rb->size - (head-tail);
+  uint32_t idx = head & (rb->size-1), n1;
+
+  if( n > avail )
+    {
+      rb->overflows += n-avail;
+      n = avail;
+    }
+
+  n1 = rb->size-idx;
+  if( n1 > n ) n1 = n;
+  memcpy(rb->data+idx, src, n1);
+  memcpy(rb->data, src+n1, n-n1);
+
+  RINGBUFFER_STORE_RELEASE(&rb->head, head+n);
+  ringbuffer_note_fill_level(rb, head+n, tail);
+  return n;
+}
+
+
+// -----------------------------------------------------------------------------
+// consumer side
+// -----------------------------------------------------------------------------
+
+
+// remove one byte, returns false if the buffer is empty
+static inline bool ringbuffer_dequeue(ringbuffer_t *rb, uint8_t *b)
+{
+  uint32_t tail = rb->tail;
+
+  if( RINGBUFFER_LOAD_ACQUIRE(&rb->head)==tail )
+    return false;
+
+  *b = rb->data[tail & (rb->size-1)];
+  RINGBUFFER_STORE_RELEASE(&rb->tail, tail+1);
+  return true;
+}
+
+
+// returns the contiguous readable region starting at the read position in *p,
+// the return value is its length (which may be less than the total amount of
+// data if the data wraps around the end of the buffer). The data can be
+// processed in place and must then be released with ringbuffer_consume().
+static inline uint32_t ringbuffer_read_span(ringbuffer_t *rb, const uint8_t **p)
+{
+  uint32_t idx = rb->tail & (rb->size-1);
+  uint32_t n   = ringbuffer_available_for_read(rb);
+  if( n > rb->size-idx ) n = rb->size-idx;
+  *p = rb->data + idx;
+  return n;
+}
+
+
+// release n bytes previously obtained via ringbuffer_read_span()
+static inline void ringbuffer_consume(ringbuffer_t *rb, uint32_t n)
+{
+  RINGBUFFER_STORE_RELEASE(&rb->tail, rb->tail+n);
+}
+
+
+// remove up to n bytes (at most two memcpy), returns the number of bytes read
+static inline uint32_t ringbuffer_read(ringbuffer_t *rb, void *data, uint32_t n)
+{
+  uint8_t *dst = (uint8_t *) data;
+  uint32_t tail = rb->tail;
+  uint32_t avail = RINGBUFFER_LOAD_ACQUIRE(&rb->head) - tail;
+  uint32_t idx = tail & (rb->size-1), n1;
+
+  if( n > avail ) n = avail;
+
+  n1 = rb->size-idx;
+  if( n1 > n ) n1 = n;
+  memcpy(dst, rb->data+idx, n1);
+  memcpy(dst+n1, rb->data, n-n1);
+
+  RINGBUFFER_STORE_RELEASE(&rb->tail, tail+n);
+  return n;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,262 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - asynchronous key send queue
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <chrono>
+#include "sendqueue.h"
+#include "vdm1proto.h"
+
+
+static int64_t now_us()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+SendQueue::SendQueue(write_func write, void *ctx)
+{
+  m_write = write;
+  m_ctx   = ctx;
+  m_running = true;
+  m_bulk_pos = 0;
+  m_bulk_bytes = 0;
+  m_prev_char = 0;
+  m_key_blocks = false;
+  m_char_cost = 0;
+  m_line_cost = 0;
+  m_burst = 0;
+  m_tokens = 0;
+  m_last_refill = now_us();
+  m_echo_enabled = false;
+  m_echo_active = false;
+  num_writes = 0;
+  num_keys = 0;
+  num_dropped = 0;
+  num_bytes = 0;
+
+  m_thread = std::thread(&SendQueue::writer_thread, this);
+}
+
+
+SendQueue::~SendQueue()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running = false;
+  }
+
+  m_cond.notify_one();
+  m_thread.join();
+}
+
+
+bool SendQueue::send_key(uint8_t key)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if( m_interactive.size()>=MAX_INTERACTIVE ) { num_dropped++; return false; }
+
+  item it = {VDM_KEY, key};
+  m_interactive.push_back(it);
+  m_cond.notify_one();
+  return true;
+}
+
+
+bool SendQueue::send_connect()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  // a request that is still queued covers this one, no need to make the
+  // Altair send the full screen twice in a row
+  if( !m_interactive.empty() && m_interactive.back().cmd==VDM_CONNECT ) return true;
+  if( m_interactive.size()>=MAX_INTERACTIVE ) { num_dropped++; return false; }
+
+  item it = {VDM_CONNECT, 0};
+  m_interactive.push_back(it);
+  m_cond.notify_one();
+  return true;
+}
+
+
+bool SendQueue::send_bulk(const uint8_t *data, int size)
+{
+  if( size<=0 ) return true;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if( m_bulk_bytes+size > MAX_BULK_BYTES ) return false;
+
+  m_bulk.push_back(std::vector<uint8_t>(data, data+size));
+  m_bulk_bytes += size;
+  m_cond.notify_one();
+  return true;
+}
+
+
+void SendQueue::cancel_bulk()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_bulk.clear();
+  m_bulk_pos = 0;
+  m_bulk_bytes = 0;
+  m_echo.reset();
+  m_echo_active = false;
+  m_cond.notify_one();
+}
+
+
+void SendQueue::set_pacing(int char_delay_ms, int line_delay_ms, int burst_ms)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_char_cost = int64_t(char_delay_ms) * 1000;
+  m_line_cost = int64_t(line_delay_ms) * 1000;
+  m_burst     = int64_t(burst_ms) * 1000;
+  if( m_tokens>m_burst ) m_tokens = m_burst;
+  m_cond.notify_one();
+}
+
+
+void SendQueue::set_echo_pacing(bool enable, int max_window, const char *prompt)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_echo_enabled = enable;
+  m_echo.set_max_window(max_window);
+  m_echo.set_prompt(prompt);
+  m_echo.reset();
+  m_echo_active = false;
+  m_cond.notify_one();
+}
+
+
+void SendQueue::observe_write(int addr, uint8_t value)
+{
+  if( m_echo_active )
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if( m_echo_enabled && m_echo.observe(addr, value, now_us()) )
+        m_cond.notify_one();
+    }
+}
+
+
+void SendQueue::set_key_blocks(bool enable)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_key_blocks = enable;
+}
+
+
+int SendQueue::bulk_pending()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return (int) m_bulk_bytes;
+}
+
+
+int SendQueue::interactive_pending()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return (int) m_interactive.size();
+}
+
+
+void SendQueue::encode_keys(std::vector<uint8_t> &out, const uint8_t *keys, int n)
+{
+  size_t size = out.size();
+  out.resize(size + VDM_KEYS_ENCODED_SIZE(n));
+  out.resize(size + vdm_encode_keys(out.data()+size, keys, n, m_key_blocks));
+  num_keys += n;
+}
+
+
+void SendQueue::writer_thread()
+{
+  std::vector<uint8_t> out, keys;
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  out.reserve(MAX_WRITE+2);
+  keys.reserve(MAX_WRITE);
+
+  while( m_running )
+    {
+      int64_t wait = 0;
+      out.clear();
+      keys.clear();
+
+      // interactive items go first, consecutive keys are collected
+      // so they can be encoded together
+      while( !m_interactive.empty() && out.size()+keys.size()*2<MAX_WRITE )
+        {
+          item it = m_interactive.front();
+          m_interactive.pop_front();
+          if( it.cmd==VDM_KEY )
+            keys.push_back(it.key);
+          else
+            {
+              encode_keys(out, keys.data(), (int) keys.size());
+              keys.clear();
+              out.push_back(it.cmd);
+            }
+        }
+
+      // refill token bucket
+      int64_t now = now_us();
+      m_tokens += now-m_last_refill;
+      if( m_tokens>m_burst ) m_tokens = m_burst;
+      m_last_refill = now;
+
+      // add as much bulk data as the token bucket allows
+      bool paced = m_char_cost>0 || m_line_cost>0;
+      while( !m_bulk.empty() && out.size()+keys.size()*2<MAX_WRITE )
+        {
+          if( paced && m_tokens<0 ) { wait = -m_tokens; break; }
+          if( m_echo_enabled && !m_echo.may_send(now, &wait) ) break;
+
+          std::vector<uint8_t> &job = m_bulk.front();
+          uint8_t c = job[m_bulk_pos++];
+          keys.push_back(c);
+          m_bulk_bytes--;
+
+          if( paced )
+            {
+              m_tokens -= m_char_cost;
+              if( c==13 || (c==10 && m_prev_char!=13) ) m_tokens -= m_line_cost;
+            }
+
+          if( m_echo_enabled ) m_echo.sent(c, now);
+          m_prev_char = c;
+          if( m_bulk_pos>=job.size() ) { m_bulk.pop_front(); m_bulk_pos = 0; }
+        }
+
+      encode_keys(out, keys.data(), (int) keys.size());
+      m_echo_active = m_echo_enabled && m_echo.busy();
+
+      if( !out.empty() )
+        {
+          // write without holding the lock so new data can be queued meanwhile
+          lock.unlock();
+          m_write(m_ctx, out.data(), (int) out.size());
+          lock.lock();
+          num_writes++;
+          num_bytes += out.size();
+        }
+      else if( wait>0 )
+        m_cond.wait_for(lock, std::chrono::microseconds(wait));
+      else
+        m_cond.wait(lock);
+    }
+}
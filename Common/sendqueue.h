@@ -0,0 +1,130 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - asynchronous key send queue
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef SENDQUEUE_H
+#define SENDQUEUE_H
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "echopacer.h"
+
+
+// One long-lived writer thread for everything the display sends to the
+// Altair. Interactive keys (typed on the keyboard) and connect requests always
+// go ahead of bulk data (pasted text, uploaded files). All packets that are
+// ready at the same time are coalesced into a single write() call.
+// Runs of keys can optionally be encoded as VDM_KEYS blocks (see vdm1proto.h).
+//
+// Bulk data is paced by a token bucket: each character costs char_delay,
+// each line end (CR, or LF not preceded by CR) additionally costs line_delay.
+// A character may be sent while the bucket is not in debt, the bucket refills
+// in real time and holds at most "burst" microseconds of credit.
+//
+// With echo pacing enabled bulk data is additionally held back until the
+// Altair has echoed it to the screen (see echopacer.h). For that the receive
+// path must pass every video memory write to observe_write().
+
+
+class SendQueue
+{
+ public:
+  // called from the writer thread only, must write all bytes or fail
+  typedef void (*write_func)(void *ctx, const uint8_t *data, int size);
+
+  // limits for queued data
+  enum { MAX_INTERACTIVE = 256, MAX_BULK_BYTES = 1024*1024, MAX_WRITE = 4096 };
+
+  SendQueue(write_func write, void *ctx);
+  ~SendQueue();
+
+  // queue a typed key (interactive priority), returns false if the queue is full
+  bool send_key(uint8_t key);
+
+  // queue a VDM_CONNECT request (interactive priority), requests made
+  // while one is still waiting to be sent are merged into it
+  bool send_connect();
+
+  // queue text to be sent as key presses (bulk priority), the data is copied
+  // returns false if the data would exceed MAX_BULK_BYTES of queued bulk data
+  bool send_bulk(const uint8_t *data, int size);
+
+  // drop all bulk data not sent yet, interactive keys are unaffected
+  void cancel_bulk();
+
+  // pacing for bulk data in milliseconds (0/0 = as fast as possible)
+  void set_pacing(int char_delay_ms, int line_delay_ms, int burst_ms = 0);
+
+  // enable/disable waiting for the echo of bulk data, "max_window" is the
+  // maximum number of characters sent ahead of the echo, "prompt" is the
+  // text the monitor shows when ready for the next line (NULL/"" = only
+  // wait for the cursor to move to the next line)
+  void set_echo_pacing(bool enable, int max_window = EchoPacer::DEFAULT_WINDOW, const char *prompt = NULL);
+
+  // to be called for each byte written to video memory (any thread)
+  void observe_write(int addr, uint8_t value);
+
+  // send runs of keys as VDM_KEYS blocks (the Altair side must support them)
+  void set_key_blocks(bool enable);
+
+  // number of bulk bytes not sent yet
+  int bulk_pending();
+
+  // number of interactive keys and connect requests not sent yet
+  int interactive_pending();
+
+  // statistics
+  uint64_t num_writes, num_keys, num_dropped, num_bytes;
+
+ private:
+  struct item { uint8_t cmd, key; };
+
+  void writer_thread();
+  void encode_keys(std::vector<uint8_t> &out, const uint8_t *keys, int n);
+
+  write_func m_write;
+  void      *m_ctx;
+
+  std::mutex              m_mutex;
+  std::condition_variable m_cond;
+  std::thread             m_thread;
+  bool                    m_running;
+
+  std::deque<item>                 m_interactive;
+  std::deque<std::vector<uint8_t>> m_bulk;
+  size_t                           m_bulk_pos, m_bulk_bytes;
+  uint8_t                          m_prev_char;
+  bool                             m_key_blocks;
+
+  // token bucket state (microseconds)
+  int64_t m_char_cost, m_line_cost, m_burst, m_tokens, m_last_refill;
+
+  // echo pacing, m_echo_active is only checked to skip locking the
+  // mutex for screen updates while there is nothing to watch for
+  EchoPacer         m_echo;
+  bool              m_echo_enabled;
+  std::atomic<bool> m_echo_active;
+};
+
+
+#endif
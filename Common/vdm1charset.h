@@ -0,0 +1,42 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - character set
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef VDM1CHARSET_H
+#define VDM1CHARSET_H
+
+#include <stdint.h>
+
+
+// MCM6475 ROM character set: 128 characters of 12 rows with 7 pixels each
+// (bit 6 = leftmost pixel). The top row and the two rightmost columns of
+// each 9x13 character cell are always blank.
+extern const uint8_t vdm1_charset[128][12];
+
+
+// Draws character "ch" (0-127) scaled from its 9x26 pixel cell (every row
+// is shown twice) to w x h pixels into "out" (rows "stride" bytes apart):
+// each pixel is the fraction of its area covered by lit character pixels,
+// from 0 (background) to "max" (foreground). At integer scales all pixels
+// are 0 or "max", at fractional scales only pixels on the edge of a
+// character pixel are in between, so the characters stay sharp.
+// Meant for building glyph caches, not for drawing each frame.
+void vdm1_render_glyph(int ch, int w, int h, uint8_t max, uint8_t *out, int stride);
+
+
+#endif
@@ -0,0 +1,548 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - platform-independent display core
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "vdm1core.h"
+#include "vdm1proto.h"
+#include "vdm1scan.h"
+#include "vdm1hash.h"
+
+
+VDM1Core::VDM1Core()
+{
+  memset(mem, ' ', sizeof(mem));
+  ctrl = 0;
+  dip  = 2+4+16;
+  blink_on = false;
+  hash = vdm1_hash_state(mem, ctrl, dip, row_hash);
+  memset(&stats, 0, sizeof(stats));
+
+  m_surface = NULL;
+  m_write_func = NULL;
+  m_state_func = NULL;
+  m_frame_func = NULL;
+  m_write_ctx = NULL;
+  m_state_ctx = NULL;
+  m_frame_ctx = NULL;
+
+  m_colVT = 255; m_rowVT = 255;
+  for(int i=0; i<16; i++) m_colCR[i] = 255;
+
+  m_frame_sync = false;
+  m_paced = false;
+  m_redraw_pending = false;
+  m_num_dirty = 0;
+  memset(m_dirty, 0, sizeof(m_dirty));
+
+  reset_decoder();
+}
+
+
+void VDM1Core::set_surface(VDM1Surface *surface)
+{
+  m_surface = surface;
+}
+
+
+void VDM1Core::set_write_callback(write_func f, void *ctx)
+{
+  m_write_func = f;
+  m_write_ctx  = ctx;
+}
+
+
+void VDM1Core::set_state_callback(state_func f, void *ctx)
+{
+  m_state_func = f;
+  m_state_ctx  = ctx;
+}
+
+
+void VDM1Core::set_frame_callback(frame_func f, void *ctx)
+{
+  m_frame_func = f;
+  m_frame_ctx  = ctx;
+}
+
+
+// -----------------------------------------------------------------------------
+// rendering
+// -----------------------------------------------------------------------------
+
+
+void VDM1Core::fill(int row, int col, int h, int w)
+{
+  m_surface->fill(row, col, h, w, (dip&1)!=0);
+}
+
+
+void VDM1Core::draw_char(int row, int col, uint8_t ch)
+{
+  bool blank = false;
+  bool inv = false;
+
+  // DIP switch 5+6 (control character blanking)
+  if( (dip & 0x30)==0x20 )
+    blank = (ch&0x7f)<32;
+  else if( (dip & 0x30)==0x00 )
+    blank = true;
+
+  // DIP switch 3+4 (cursor handling)
+  if( ch & 0x80 )
+    {
+      if( dip & 0x04 )
+        inv = !inv;
+      else if( dip & 0x08 )
+        inv = blink_on;
+    }
+
+  // DIP switch 1 (whole screen inversion)
+  if( dip & 1 ) inv = !inv;
+
+  if( blank )
+    m_surface->fill(row, col, 1, 1, inv);
+  else
+    m_surface->draw_char(row, col, ch&0x7f, inv);
+
+  stats.chars_drawn++;
+}
+
+
+void VDM1Core::update_frame()
+{
+  int firstDisplayed = (ctrl & 0xF0)/16;
+
+  stats.frame_redraws++;
+
+  // whole screen blanked
+  if( (dip & 3)==0 )
+    {
+      fill(0, 0, 16, 64);
+      return;
+    }
+
+  // curtain blanking
+  if( firstDisplayed>0 )
+    fill(0, 0, firstDisplayed, 64);
+
+  // reset VT blanking
+  m_colVT=255; m_rowVT=255;
+
+  int r;
+  for(r=0; r<16 && m_rowVT==255; r++)
+    {
+      // compute row (with scrolling)
+      int ra = ((r+(ctrl&15))*64) & 0x3ff;
+
+      // reset CR blanking
+      m_colCR[r] = 255;
+
+      // VT-CR blanking: the row ends with its first VT or CR
+      int end = (dip & 0x30)!=0x30 ? vdm1_scan_row(mem+ra, NULL) : VDM1_SCAN_NONE;
+      if( end!=VDM1_SCAN_NONE )
+        {
+          if( (mem[ra+end]&0x7f)==11 )
+            { m_rowVT = r; m_colVT = end; }
+          else
+            m_colCR[r] = end;
+        }
+
+      // the VT-CR logic must happen even within curtain-blanked screen,
+      // so we can't just start the "r" loop above at firstDisplayed
+      int c = end!=VDM1_SCAN_NONE ? end+1 : 64;
+      if( r>=firstDisplayed )
+        for(int i=0; i<c; i++)
+          draw_char(r, i, mem[ra+i]);
+
+      if( c<64 )
+        {
+          // blank end of line
+          fill(r, c, 1, 64-c);
+        }
+    }
+
+  if( r<16 )
+    {
+      // blank bottom of screen
+      fill(r, 0, 16-r, 64);
+    }
+}
+
+
+void VDM1Core::update_byte(int a)
+{
+  int firstDisplayed = (ctrl & 0xF0)/16;
+  int firstLine      = ctrl & 0x0F;
+
+  // if whole screen is blanked then don't display
+  if( (dip & 3)==0 ) return;
+
+  uint8_t ch = mem[a] & 0x7f;
+  if( (ch==11 || ch==13) && (dip & 0x30)!=0x30 )
+    {
+      // if this is a VT or CR character then redraw whole screen
+      update_frame();
+    }
+  else
+    {
+      // compute row/col from memory address
+      int row = (a & 0x03C0) >> 6;
+      int col = a & 0x003F;
+
+      // scrolling
+      row -= firstLine;
+      if( row<0 ) row += 16;
+
+      // if within curtain blanking region then don't display
+      if( row<firstDisplayed )
+        return;
+
+      // if we are changing a CR/VT character then redraw whole screen
+      if( ((row==m_rowVT && col==m_colVT ) || col==m_colCR[row]) && (dip & 0x30)!=0x30 )
+        { update_frame(); return; }
+
+      // if within CR/VT blanking region then don't display
+      if( (dip & 0x30)!=0x30 )
+        if( row>m_rowVT || (row==m_rowVT && col>m_colVT) || col>m_colCR[row] )
+          return;
+
+      // draw character on screen
+      draw_char(row, col, mem[a]);
+    }
+}
+
+
+bool VDM1Core::needs_frame(int a)
+{
+  // same checks as update_byte(): is or was this cell a CR/VT
+  if( (dip & 3)==0 || (dip & 0x30)==0x30 ) return false;
+
+  uint8_t ch = mem[a] & 0x7f;
+  if( ch==11 || ch==13 ) return true;
+
+  int row = ((a & 0x03C0) >> 6) - (ctrl & 0x0F);
+  int col = a & 0x003F;
+  if( row<0 ) row += 16;
+  if( row<(ctrl & 0xF0)/16 ) return false;
+
+  return (row==m_rowVT && col==m_colVT) || col==m_colCR[row];
+}
+
+
+void VDM1Core::redraw()
+{
+  if( m_surface!=NULL )
+    {
+      m_surface->begin_update();
+      update_frame();
+      m_surface->end_update();
+      stats.presents++;
+    }
+}
+
+
+void VDM1Core::changed()
+{
+  // something other than single characters changed
+  if( m_frame_sync || m_paced )
+    m_redraw_pending = true;
+  else
+    redraw();
+}
+
+
+void VDM1Core::present()
+{
+  if( !frame_pending() ) return;
+
+  if( m_surface!=NULL )
+    {
+      m_surface->begin_update();
+
+      // past a quarter of the screen a full redraw is cheaper than
+      // looking at each cell. A CR/VT anywhere in the batch redraws the
+      // whole screen anyway, so do that once up front.
+      bool frame = m_redraw_pending || m_num_dirty>256;
+      for(int i=0; i<m_num_dirty && !frame; i++)
+        frame = needs_frame(m_dirty_list[i]);
+
+      if( frame )
+        update_frame();
+      else
+        for(int i=0; i<m_num_dirty; i++)
+          update_byte(m_dirty_list[i]);
+
+      m_surface->end_update();
+      stats.presents++;
+    }
+
+  for(int i=0; i<m_num_dirty; i++)
+    m_dirty[m_dirty_list[i]] = 0;
+  m_num_dirty = 0;
+  m_redraw_pending = false;
+}
+
+
+void VDM1Core::set_frame_sync(bool on)
+{
+  if( !on && !m_paced ) present();
+  m_frame_sync = on;
+}
+
+
+void VDM1Core::set_paced(bool on)
+{
+  m_paced = on;
+  if( !on && !m_frame_sync ) present();
+}
+
+
+// -----------------------------------------------------------------------------
+// state changes
+// -----------------------------------------------------------------------------
+
+
+void VDM1Core::write_byte(int addr, uint8_t value)
+{
+  addr &= 0x3ff;
+  vdm1_hash_write(mem, addr, &value, 1, &hash, row_hash);
+  stats.cells_written++;
+
+  if( m_frame_sync || m_paced )
+    {
+      if( !m_dirty[addr] )
+        {
+          m_dirty[addr] = 1;
+          m_dirty_list[m_num_dirty++] = addr;
+        }
+    }
+  else if( m_surface!=NULL )
+    {
+      m_surface->begin_update();
+      update_byte(addr);
+      m_surface->end_update();
+      stats.presents++;
+    }
+
+  if( m_write_func!=NULL ) m_write_func(m_write_ctx, addr, value);
+}
+
+
+void VDM1Core::write_frame(const uint8_t *data)
+{
+  vdm1_hash_write(mem, 0, data, sizeof(mem), &hash, row_hash);
+  stats.cells_written += sizeof(mem);
+  changed();
+  if( m_frame_func!=NULL ) m_frame_func(m_frame_ctx);
+}
+
+
+void VDM1Core::set_ctrl(uint8_t value)
+{
+  hash ^= vdm1_hash_key(VDM1_HASH_CTRL, ctrl) ^ vdm1_hash_key(VDM1_HASH_CTRL, value);
+  ctrl = value;
+  changed();
+  if( m_state_func!=NULL ) m_state_func(m_state_ctx);
+}
+
+
+void VDM1Core::set_dip(uint8_t value)
+{
+  hash ^= vdm1_hash_key(VDM1_HASH_DIP, dip) ^ vdm1_hash_key(VDM1_HASH_DIP, value);
+  dip = value;
+  changed();
+  if( m_state_func!=NULL ) m_state_func(m_state_ctx);
+}
+
+
+void VDM1Core::toggle_blink()
+{
+  blink_on = !blink_on;
+
+  // only need to redraw if cursor characters are blinking
+  if( (dip & 0x0C)==0x08 ) update_cursors();
+}
+
+
+void VDM1Core::update_cursors()
+{
+  // only the cursor characters change, found 64 at a time (see vdm1scan.h)
+  if( m_frame_sync || m_paced )
+    {
+      if( m_redraw_pending ) return;
+      for(int a=0; a<1024; a+=64)
+        {
+          uint64_t cursor;
+          vdm1_scan_row(mem+a, &cursor);
+          while( cursor!=0 )
+            {
+              int addr = a + vdm1_scan_next(&cursor);
+              if( !m_dirty[addr] )
+                {
+                  m_dirty[addr] = 1;
+                  m_dirty_list[m_num_dirty++] = addr;
+                }
+            }
+        }
+    }
+  else if( m_surface!=NULL )
+    {
+      m_surface->begin_update();
+      for(int a=0; a<1024; a+=64)
+        {
+          uint64_t cursor;
+          vdm1_scan_row(mem+a, &cursor);
+          while( cursor!=0 ) update_byte(a + vdm1_scan_next(&cursor));
+        }
+      m_surface->end_update();
+      stats.presents++;
+    }
+}
+
+
+int VDM1Core::get_text(char *buf, const char *eol)
+{
+  int firstDisplayed = (ctrl & 0xF0)/16;
+  int firstLine      = ctrl & 0x0F;
+  int n = 0, eollen = (int) strlen(eol);
+
+  for(int i=0; i<16; i++)
+    {
+      for(int c=0; c<64; c++)
+        {
+          uint8_t ch = i>=firstDisplayed ? (mem[((i+firstLine)&0x0f)*64+c] & 0x7f) : ' ';
+          buf[n++] = (ch<32 || ch==127) ? ' ' : ch;
+        }
+
+      memcpy(buf+n, eol, eollen);
+      n += eollen;
+    }
+
+  buf[n] = 0;
+  return n;
+}
+
+
+// -----------------------------------------------------------------------------
+// decoder
+// -----------------------------------------------------------------------------
+
+
+void VDM1Core::reset_decoder()
+{
+  // the next sender may not know VDM_ENDFRAME
+  set_frame_sync(false);
+
+  m_recv_status = 0;
+  m_recv_bytes  = 0;
+  m_recv_ptr    = 0;
+}
+
+
+void VDM1Core::receive(const uint8_t *data, int size)
+{
+  int i = 0;
+
+  stats.bytes += size;
+  while( i<size )
+    {
+      if( m_recv_bytes>0 )
+        {
+          int n = m_recv_bytes > (size-i) ? (size-i) : m_recv_bytes;
+
+          if( m_recv_status==VDM_FULLFRAME )
+            {
+              vdm1_hash_write(mem, m_recv_ptr, data+i, n, &hash, row_hash);
+              stats.cells_written += n;
+            }
+          else
+            memcpy(m_recv_buf+m_recv_ptr, data+i, n);
+
+          m_recv_bytes -= n;
+          m_recv_ptr   += n;
+          i            += n;
+
+          if( m_recv_bytes == 0 )
+            {
+              switch( m_recv_status )
+                {
+                case VDM_FULLFRAME:
+                  stats.fullframe++;
+                  changed();
+                  if( m_frame_func!=NULL ) m_frame_func(m_frame_ctx);
+                  break;
+
+                case VDM_MEMBYTE:
+                  stats.membyte++;
+                  write_byte(m_recv_buf[0]*256+m_recv_buf[1], m_recv_buf[2]);
+                  break;
+
+                case VDM_CTRL:
+                  stats.ctrl++;
+                  set_ctrl(m_recv_buf[0]);
+                  break;
+
+                case VDM_DIP:
+                  stats.dip++;
+                  set_dip(m_recv_buf[0]);
+                  break;
+                }
+
+              m_recv_status = 0;
+            }
+        }
+      else
+        {
+          m_recv_status = data[i] & 0xf0;
+          m_recv_bytes = 0;
+          m_recv_ptr   = 0;
+
+          switch( m_recv_status )
+            {
+            case VDM_FULLFRAME:
+              m_recv_bytes = 1024;
+              break;
+
+            case VDM_MEMBYTE:
+              m_recv_bytes = 2;
+              m_recv_buf[m_recv_ptr++] = data[i]&0x07;
+              break;
+
+            case VDM_CTRL:
+            case VDM_DIP:
+              m_recv_bytes = 1;
+              break;
+
+            case VDM_ENDFRAME:
+              stats.endframe++;
+              m_frame_sync = true;
+              if( !m_paced ) present();
+              m_recv_status = 0;
+              break;
+
+            default:
+              stats.unknown++;
+              m_recv_status = 0;
+              break;
+            }
+
+          i++;
+        }
+    }
+}
@@ -0,0 +1,187 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - platform-independent display core
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef VDM1CORE_H
+#define VDM1CORE_H
+
+#include <stdint.h>
+
+
+// screen geometry: 16 rows of 64 characters, each character cell
+// is 9x13 pixels with every pixel row shown twice
+#define VDM1_ROWS    16
+#define VDM1_COLS    64
+#define VDM1_CHAR_W  9
+#define VDM1_CHAR_H  26
+#define VDM1_HPIX    (VDM1_COLS*VDM1_CHAR_W)
+#define VDM1_VPIX    (VDM1_ROWS*VDM1_CHAR_H)
+
+
+// Something the core can draw on. All coordinates are in character cells
+// (row 0-15, column 0-63) as shown on the screen, i.e. after scrolling.
+// begin_update()/end_update() enclose each batch of drawing calls.
+class VDM1Surface
+{
+ public:
+  virtual ~VDM1Surface() {}
+
+  virtual void begin_update() {}
+  virtual void end_update() {}
+
+  // draw 7-bit character "ch", inverse swaps foreground and background
+  virtual void draw_char(int row, int col, uint8_t ch, bool inverse) = 0;
+
+  // fill h rows of w cells with the background (foreground if inverse) color
+  virtual void fill(int row, int col, int h, int w, bool inverse) = 0;
+};
+
+
+// Video state of one VDM-1 (memory, control register, DIP switches,
+// cursor blink), the decoder for the data stream sent by the Altair
+// and the logic that decides what is visible on the screen.
+// Not thread-safe: feed data from one thread or serialize calls.
+class VDM1Core
+{
+ public:
+  // called for each VDM_MEMBYTE write (after it has been drawn or,
+  // in frame sync mode, queued for the next present())
+  typedef void (*write_func)(void *ctx, int addr, uint8_t value);
+
+  // called after the control register or DIP switches changed
+  typedef void (*state_func)(void *ctx);
+
+  // called after the whole video memory was replaced (VDM_FULLFRAME)
+  typedef void (*frame_func)(void *ctx);
+
+  VDM1Core();
+
+  void set_surface(VDM1Surface *surface);
+  void set_write_callback(write_func f, void *ctx);
+  void set_state_callback(state_func f, void *ctx);
+  void set_frame_callback(frame_func f, void *ctx);
+
+  // process data received from the Altair simulator, commands may be
+  // split at any point between calls
+  void receive(const uint8_t *data, int size);
+  void reset_decoder();
+
+  // direct state changes (also used by the decoder)
+  void write_byte(int addr, uint8_t value);
+  void write_frame(const uint8_t *data);
+  void set_ctrl(uint8_t value);
+  void set_dip(uint8_t value);
+
+  // with frame sync or pacing this queues the cursor characters with the
+  // written cells, so a blink timer in another thread than the one feeding
+  // the data has to share its lock
+  void toggle_blink();
+
+  // redraw the whole screen
+  void redraw();
+
+  // Frame sync: changes are only drawn by present(). Switched on by each
+  // VDM_ENDFRAME received and off by reset_decoder(). In case the sender
+  // stops sending VDM_ENDFRAME the caller should switch it off (which
+  // presents the pending changes) once frame_pending() has been true
+  // for a while, e.g. 50ms.
+  void set_frame_sync(bool on);
+  bool frame_sync() const { return m_frame_sync; }
+  bool frame_pending() const { return m_num_dirty>0 || m_redraw_pending; }
+  void present();
+
+  // Paced: changes are only drawn by present(), which the caller calls at
+  // its own rate (see Linux/pacer.h), VDM_ENDFRAME doesn't draw anything.
+  void set_paced(bool on);
+  bool paced() const { return m_paced; }
+
+  // screen contents as text: 16 lines of 64 characters (bit 7 stripped,
+  // control characters and curtain-blanked lines as spaces), each followed by "eol"
+  // returns the number of characters stored (excluding the terminating 0),
+  // buf must hold 16*(64+strlen(eol))+1 characters
+  int get_text(char *buf, const char *eol);
+
+  // video state, read-only for users of this class
+  uint8_t mem[1024];
+
+  // 4 upper bits define the first line shown, all lines above this are blanked
+  // 4 lower bits define the top line on the screen. e.g. if 3 then the order
+  //              of lines displayed on the screen is 3-15, 0, 1, 2
+  uint8_t ctrl;
+
+  // DIP switches (SW1-6 = bit 0-5):
+  // bit 0-1: off/off: all blank
+  //          off/on : normal video
+  //          on /off: inverse video
+  //          on /on : illegal
+  // bit 2-3: off/off: cursor characters (bit 7 on) shown regular
+  //          off/on : cursor characters blink at 2 Hz
+  //          on /off: cursor characters shown inverted
+  //          on /on : illegal
+  // bit 4-5: off/off: all characters blanked (cursor characters shown as blocks)
+  //          off/on : control characters (0-31) blanked, CR/VT blanking enabled
+  //          on /off: all characters shown, CR/VT blanking enabled
+  //          on /on : all characters shown, CR/VT blanking disabled
+  uint8_t dip;
+
+  bool blink_on;
+
+  // fingerprint of mem, ctrl and dip and of each row of mem (row r =
+  // addresses r*64 to r*64+63), kept up to date with each change (see vdm1hash.h)
+  uint64_t hash, row_hash[16];
+
+  // statistics
+  struct stats_t
+  {
+    uint64_t bytes, membyte, fullframe, ctrl, dip, endframe, unknown;
+    uint64_t cells_written;  // video memory writes (full frames count 1024)
+    uint64_t chars_drawn, frame_redraws;
+    uint64_t presents; // begin_update()/end_update() batches
+  } stats;
+
+ private:
+  void draw_char(int row, int col, uint8_t ch);
+  void fill(int row, int col, int h, int w);
+  void update_frame();
+  void update_byte(int a);
+  bool needs_frame(int a);
+  void update_cursors();
+  void changed();
+
+  VDM1Surface *m_surface;
+  write_func   m_write_func;
+  state_func   m_state_func;
+  frame_func   m_frame_func;
+  void        *m_write_ctx, *m_state_ctx, *m_frame_ctx;
+
+  // CR/VT blanking positions as of the last full redraw
+  int m_colCR[16], m_colVT, m_rowVT;
+
+  // frame sync: cells written since the last present()
+  bool     m_frame_sync, m_paced, m_redraw_pending;
+  int      m_num_dirty;
+  uint16_t m_dirty_list[1024];
+  uint8_t  m_dirty[1024];
+
+  // decoder state
+  int     m_recv_status, m_recv_bytes, m_recv_ptr;
+  uint8_t m_recv_buf[4];
+};
+
+
+#endif
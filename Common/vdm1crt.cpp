@@ -0,0 +1,475 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - CRT look post-processing
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include "vdm1crt.h"
+
+// SSE2 kernels where available (always on x86-64), plain C otherwise
+// or if VDM1CRT_NO_SIMD is defined
+#if !defined(VDM1CRT_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2))
+#define VDM1CRT_SSE2
+#include <emmintrin.h>
+#endif
+
+
+// most cells computed in one go, also how often the time budget is checked
+#define MAX_SPAN 16
+
+// frames using less than half of the budget before the quality is raised again
+#define EASY_FRAMES 60
+
+
+// -----------------------------------------------------------------------------
+// kernels
+// -----------------------------------------------------------------------------
+
+
+// phosphor p of one pixel row from framebuffer pixels s: p = max(s, p*decay/256),
+// "binary" if s is 0/1 instead of 0-255. Returns bit 0 set if any p changed
+// and bit 1 set if any p is still above its s (fading out).
+static int persist_row(uint8_t *p, const uint8_t *s, int n, bool binary, int decay)
+{
+  int i = 0, result = 0;
+
+#ifdef VDM1CRT_SSE2
+  const __m128i zero = _mm_setzero_si128(), vdecay = _mm_set1_epi16((short) decay);
+  __m128i changed = zero, fading = zero;
+  for(; i+16<=n; i+=16)
+    {
+      __m128i vs = _mm_loadu_si128((const __m128i *) (s+i));
+      __m128i vp = _mm_loadu_si128((const __m128i *) (p+i));
+      if( binary ) vs = _mm_sub_epi8(zero, vs);
+      __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(vp, zero), vdecay), 8);
+      __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(vp, zero), vdecay), 8);
+      __m128i np = _mm_max_epu8(_mm_packus_epi16(lo, hi), vs);
+      changed = _mm_or_si128(changed, _mm_xor_si128(np, vp));
+      fading  = _mm_or_si128(fading, _mm_xor_si128(np, vs));
+      _mm_storeu_si128((__m128i *) (p+i), np);
+    }
+
+  if( _mm_movemask_epi8(_mm_cmpeq_epi8(changed, zero))!=0xFFFF ) result |= 1;
+  if( _mm_movemask_epi8(_mm_cmpeq_epi8(fading, zero))!=0xFFFF ) result |= 2;
+#endif
+
+  for(; i<n; i++)
+    {
+      int v = binary ? (s[i] ? 255 : 0) : s[i];
+      int q = (p[i]*decay)>>8;
+      if( q<v ) q = v;
+      if( q!=p[i] ) result |= 1;
+      if( q!=v ) result |= 2;
+      p[i] = (uint8_t) q;
+    }
+
+  return result;
+}
+
+
+// output pixel row: out = min(255, p*weight/256 + glow), without glow if NULL
+static void output_row(uint8_t *out, const uint8_t *p, const uint8_t *glow, int n, int weight)
+{
+  int i = 0;
+
+#ifdef VDM1CRT_SSE2
+  const __m128i zero = _mm_setzero_si128(), vweight = _mm_set1_epi16((short) weight);
+  for(; i+16<=n; i+=16)
+    {
+      __m128i vp = _mm_loadu_si128((const __m128i *) (p+i));
+      __m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(vp, zero), vweight), 8);
+      __m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(vp, zero), vweight), 8);
+      __m128i v  = _mm_packus_epi16(lo, hi);
+      if( glow!=NULL ) v = _mm_adds_epu8(v, _mm_loadu_si128((const __m128i *) (glow+i)));
+      _mm_storeu_si128((__m128i *) (out+i), v);
+    }
+#endif
+
+  for(; i<n; i++)
+    {
+      int v = (p[i]*weight>>8) + (glow!=NULL ? glow[i] : 0);
+      out[i] = (uint8_t) (v>255 ? 255 : v);
+    }
+}
+
+
+// horizontal box blur: h[i] = average of p[x0+i-r] to p[x0+i+r] (pixels outside
+// 0 to width-1 count as 0), inv = 65536/(2r+1)
+static void hblur_row(uint8_t *h, const uint8_t *p, int x0, int n, int width, int r, int inv)
+{
+  int i = 0;
+
+#ifdef VDM1CRT_SSE2
+  // away from the picture's edges: sum 2r+1 shifted copies, 16 pixels at a time
+  const __m128i zero = _mm_setzero_si128(), vinv = _mm_set1_epi16((short) inv);
+  for(; i<n && x0+i-r<0; i++)
+    {
+      int sum = 0;
+      for(int x=0; x<=x0+i+r && x<width; x++) sum += p[x];
+      h[i] = (uint8_t) ((sum*inv)>>16);
+    }
+  for(; i+16<=n && x0+i+15+r<width; i+=16)
+    {
+      __m128i lo = zero, hi = zero;
+      for(const uint8_t *q=p+x0+i-r; q<=p+x0+i+r; q++)
+        {
+          __m128i v = _mm_loadu_si128((const __m128i *) q);
+          lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+          hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+        }
+      lo = _mm_mulhi_epu16(lo, vinv);
+      hi = _mm_mulhi_epu16(hi, vinv);
+      _mm_storeu_si128((__m128i *) (h+i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+  // sliding window
+  int sum = 0;
+  for(int x=x0+i-r; x<=x0+i+r; x++)
+    if( x>=0 && x<width ) sum += p[x];
+
+  for(; i<n; i++)
+    {
+      h[i] = (uint8_t) ((sum*inv)>>16);
+      if( x0+i+r+1<width ) sum += p[x0+i+r+1];
+      if( x0+i-r>=0 ) sum -= p[x0+i-r];
+    }
+}
+
+
+// v += h (add>0) or v -= h (add<0)
+static void vsum_row(uint16_t *v, const uint8_t *h, int n, int add)
+{
+  int i = 0;
+
+#ifdef VDM1CRT_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  for(; i+16<=n; i+=16)
+    {
+      __m128i vh = _mm_loadu_si128((const __m128i *) (h+i));
+      __m128i lo = _mm_loadu_si128((const __m128i *) (v+i));
+      __m128i hi = _mm_loadu_si128((const __m128i *) (v+i+8));
+      if( add>0 )
+        {
+          lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(vh, zero));
+          hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(vh, zero));
+        }
+      else
+        {
+          lo = _mm_sub_epi16(lo, _mm_unpacklo_epi8(vh, zero));
+          hi = _mm_sub_epi16(hi, _mm_unpackhi_epi8(vh, zero));
+        }
+      _mm_storeu_si128((__m128i *) (v+i), lo);
+      _mm_storeu_si128((__m128i *) (v+i+8), hi);
+    }
+#endif
+
+  for(; i<n; i++)
+    v[i] = (uint16_t) (add>0 ? v[i]+h[i] : v[i]-h[i]);
+}
+
+
+// g = v*k/65536
+static void glow_row(uint8_t *g, const uint16_t *v, int n, int k)
+{
+  int i = 0;
+
+#ifdef VDM1CRT_SSE2
+  const __m128i vk = _mm_set1_epi16((short) k);
+  for(; i+16<=n; i+=16)
+    {
+      __m128i lo = _mm_mulhi_epu16(_mm_loadu_si128((const __m128i *) (v+i)), vk);
+      __m128i hi = _mm_mulhi_epu16(_mm_loadu_si128((const __m128i *) (v+i+8)), vk);
+      _mm_storeu_si128((__m128i *) (g+i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+  for(; i<n; i++)
+    g[i] = (uint8_t) ((v[i]*k)>>16);
+}
+
+
+// -----------------------------------------------------------------------------
+// VDM1CRT
+// -----------------------------------------------------------------------------
+
+
+VDM1CRT::VDM1CRT(VDM1Framebuffer *fb)
+{
+  m_fb = fb;
+  width = height = 0;
+  m_cell_w = m_cell_h = 0;
+  pixels = m_persist = m_glow = NULL;
+  m_weight = NULL;
+  m_hblur = NULL;
+  m_vsum = NULL;
+
+  quality = 2;
+  m_budget_us = 0;
+  m_next_row = 0;
+  m_easy_frames = 0;
+  memset(&stats, 0, sizeof(stats));
+
+  m_gap   = (int) (0.4*256);
+  m_decay = (int) (0.5*256);
+  m_bloom = (int) (0.3*256);
+  resize();
+}
+
+
+VDM1CRT::~VDM1CRT()
+{
+  free(pixels);
+  free(m_persist);
+  free(m_weight);
+  free(m_hblur);
+  free(m_vsum);
+  free(m_glow);
+}
+
+
+void VDM1CRT::resize()
+{
+  width    = m_fb->width;
+  height   = m_fb->height;
+  m_cell_w = m_fb->cell_w;
+  m_cell_h = m_fb->cell_h;
+
+  // the glow reaches about a sixth of a character cell's width
+  m_radius = m_cell_w/6;
+  if( m_radius<1 ) m_radius = 1;
+  if( m_radius>100 ) m_radius = 100;
+
+  free(pixels);
+  free(m_persist);
+  free(m_weight);
+  free(m_hblur);
+  free(m_vsum);
+  free(m_glow);
+  pixels    = (uint8_t *) calloc(width*height, 1);
+  m_persist = (uint8_t *) calloc(width*height, 1);
+  m_weight  = (uint16_t *) malloc(m_cell_h*sizeof(uint16_t));
+  m_hblur   = (uint8_t *) malloc(MAX_SPAN*m_cell_w*(m_cell_h+2*m_radius));
+  m_vsum    = (uint16_t *) malloc(MAX_SPAN*m_cell_w*sizeof(uint16_t));
+  m_glow    = (uint8_t *) malloc(MAX_SPAN*m_cell_w);
+
+  update_weights();
+}
+
+
+void VDM1CRT::update_weights()
+{
+  // height of one VGA line (two per VDM line)
+  double line_h = double(m_cell_h)/VDM1_CHAR_H;
+
+  for(int y=0; y<m_cell_h; y++)
+    {
+      double c = y+0.5;
+      bool gap;
+      if( line_h<1 )
+        gap = false;                       // no room for gaps
+      else if( line_h<1.5 )
+        gap = ((int) (c/line_h)) & 1;      // every other pixel row
+      else
+        gap = c-floor(c/line_h)*line_h > line_h*0.66; // lower third of each VGA line
+
+      m_weight[y] = (uint16_t) (gap ? 256-m_gap : 256);
+    }
+
+  memset(m_active, 1, sizeof(m_active));
+}
+
+
+static int fixed_point(double v)
+{
+  return v<0 ? 0 : v>1 ? 256 : (int) (v*256);
+}
+
+
+void VDM1CRT::set_scanlines(double depth)
+{
+  m_gap = fixed_point(depth);
+  update_weights();
+}
+
+
+void VDM1CRT::set_persistence(double level)
+{
+  m_decay = fixed_point(level);
+  memset(m_active, 1, sizeof(m_active));
+}
+
+
+void VDM1CRT::set_bloom(double strength)
+{
+  m_bloom = fixed_point(strength);
+  memset(m_active, 1, sizeof(m_active));
+}
+
+
+void VDM1CRT::set_budget(int us)
+{
+  m_budget_us = us;
+  if( us==0 ) quality = 2;
+}
+
+
+// horizontally blurred phosphor of the w pixels starting at x0 for each pixel
+// row from radius rows above the cell row starting at y0 to radius rows below
+// it (within the picture)
+void VDM1CRT::blur_rows(int x0, int y0, int w)
+{
+  int r = m_radius;
+  int ey0 = y0-r<0 ? 0 : y0-r, ey1 = y0+m_cell_h+r>height ? height : y0+m_cell_h+r;
+
+  for(int y=ey0; y<ey1; y++)
+    hblur_row(m_hblur+(y-ey0)*w, m_persist+y*width, x0, w, width, r, 65536/(2*r+1));
+}
+
+
+void VDM1CRT::process_span(int row, int col0, int col1)
+{
+  int x0 = col0*m_cell_w, y0 = row*m_cell_h, w = (col1-col0)*m_cell_w;
+  bool binary = m_fb->max_value==1;
+  bool bloom  = quality>=2 && m_bloom>0;
+
+  // phosphor
+  int result = 0, decay = quality>=1 ? m_decay : 0;
+  for(int y=y0; y<y0+m_cell_h; y++)
+    result |= persist_row(m_persist+y*width+x0, m_fb->pixels+y*width+x0, w, binary, decay);
+
+  // cells still fading out are computed again next frame
+  memset(m_active+row*VDM1_COLS+col0, (result & 2) ? 1 : 0, col1-col0);
+
+  // so is the glow around these cells if their phosphor changed
+  if( bloom && (result & 1) )
+    for(int r=row-1; r<=row+1; r++)
+      if( r>=0 && r<VDM1_ROWS )
+        for(int c=col0-1; c<=col1; c++)
+          if( c>=0 && c<VDM1_COLS && (r!=row || c<col0 || c>=col1) )
+            m_active[r*VDM1_COLS+c] = 1;
+
+  if( !bloom )
+    {
+      for(int y=y0; y<y0+m_cell_h; y++)
+        output_row(pixels+y*width+x0, m_persist+y*width+x0, NULL, w, m_weight[y-y0]);
+      return;
+    }
+
+  // glow: box blur over (2*radius+1)^2 pixels scaled by the bloom strength,
+  // the vertical sums (at most 255*(2*radius+1)) fit into 16 bits and so does k
+  int r = m_radius;
+  int ey0 = y0-r<0 ? 0 : y0-r, ey1 = y0+m_cell_h+r>height ? height : y0+m_cell_h+r;
+  int k = (m_bloom<<8)/(2*r+1);
+
+  blur_rows(x0, y0, w);
+  memset(m_vsum, 0, w*sizeof(uint16_t));
+  for(int y=y0-r; y<=y0+r; y++)
+    if( y>=ey0 && y<ey1 )
+      vsum_row(m_vsum, m_hblur+(y-ey0)*w, w, 1);
+
+  for(int y=y0; y<y0+m_cell_h; y++)
+    {
+      glow_row(m_glow, m_vsum, w, k);
+      output_row(pixels+y*width+x0, m_persist+y*width+x0, m_glow, w, m_weight[y-y0]);
+
+      // slide the window down one row
+      if( y+r+1<ey1 ) vsum_row(m_vsum, m_hblur+(y+r+1-ey0)*w, w, 1);
+      if( y-r>=ey0 )  vsum_row(m_vsum, m_hblur+(y-r-ey0)*w, w, -1);
+    }
+}
+
+
+bool VDM1CRT::process()
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  int64_t us = 0;
+
+  stats.frames++;
+  if( m_fb->width!=width || m_fb->height!=height || m_fb->cell_w!=m_cell_w || m_fb->cell_h!=m_cell_h )
+    resize();
+
+  // pick up what was drawn since the last frame
+  for(int i=0; i<VDM1_ROWS*VDM1_COLS; i++)
+    if( m_fb->dirty[i] )
+      {
+        m_fb->dirty[i] = 0;
+        m_active[i] = 1;
+      }
+
+  // compute runs of active cells, at least one per frame no matter the budget
+  bool busy = false, done = true;
+  int row = m_next_row;
+  for(int n=0; n<VDM1_ROWS && done; n++, row=(row+1)%VDM1_ROWS)
+    {
+      const uint8_t *a = m_active + row*VDM1_COLS;
+      int c = 0;
+      while( c<VDM1_COLS )
+        {
+          if( !a[c] ) { c++; continue; }
+
+          int c1 = c+1;
+          while( c1<VDM1_COLS && c1-c<MAX_SPAN && a[c1] ) c1++;
+
+          if( busy && m_budget_us>0 )
+            {
+              us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count();
+              if( us>=m_budget_us )
+                {
+                  // out of time, continue here next frame
+                  m_next_row = row;
+                  done = false;
+                  break;
+                }
+            }
+
+          process_span(row, c, c1);
+          stats.cells += c1-c;
+          busy = true;
+          c = c1;
+        }
+    }
+
+  if( busy ) stats.busy_frames++;
+  if( m_budget_us>0 )
+    {
+      us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count();
+      if( !done )
+        {
+          stats.over_budget++;
+          m_easy_frames = 0;
+          if( quality>0 ) { quality--; stats.quality_changes++; }
+        }
+      else if( quality<2 && us<m_budget_us/2 && ++m_easy_frames>=EASY_FRAMES )
+        {
+          quality++;
+          stats.quality_changes++;
+          m_easy_frames = 0;
+        }
+    }
+
+  return busy;
+}
+
+
+bool VDM1CRT::write_ppm(const char *fname, uint32_t fg, uint32_t bg)
+{
+  return vdm1_write_ppm(fname, pixels, width, height, 255, fg, bg);
+}
@@ -0,0 +1,101 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - CRT look post-processing
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef VDM1CRT_H
+#define VDM1CRT_H
+
+#include <stdint.h>
+#include "vdm1framebuffer.h"
+
+
+// Makes the picture of a VDM1Framebuffer look like it is shown on a CRT:
+// darker gaps between the VGA lines (the PIC32 version shows each VDM line
+// as two VGA lines), phosphor persistence (pixels that go dark fade out over
+// a few frames) and a mild bloom (bright pixels glow into their surroundings).
+// The result is a separate picture of the same size with pixels from 0 to 255.
+//
+// Only character cells that changed (see VDM1Framebuffer::dirty), are still
+// fading out or are next to a cell whose phosphor changed (bloom) are
+// computed again, an idle screen costs nothing. Each call of process() stops
+// when its time budget is used up: the remaining cells are computed by the
+// following calls (starting where this one stopped) and the quality is
+// lowered one step (first without bloom, then without persistence) until
+// the frames fit into the budget again, after a second of frames using less
+// than half of it the quality is raised again.
+// Not thread-safe, call process() from the thread drawing into the framebuffer.
+class VDM1CRT
+{
+ public:
+  VDM1CRT(VDM1Framebuffer *fb);
+  ~VDM1CRT();
+
+  // effect strengths from 0 (off) to 1
+  void set_scanlines(double depth);    // how much darker the gaps are (default 0.4)
+  void set_persistence(double level);  // brightness left one frame after a pixel went dark (default 0.5)
+  void set_bloom(double strength);     // brightness of the glow (default 0.3)
+
+  // microseconds each process() may take (0 = unlimited)
+  void set_budget(int us);
+
+  // compute the next frame, to be called once per frame shown (persistence
+  // decays per call), returns true if any pixel may have changed
+  bool process();
+
+  // write the picture as binary PPM (P6) in the given RGB colors (0xRRGGBB)
+  bool write_ppm(const char *fname, uint32_t fg = 0x00FF00, uint32_t bg = 0x000000);
+
+  int      width, height;
+  uint8_t *pixels;
+
+  // 2 = all effects, 1 = without bloom, 0 = scanlines only
+  int quality;
+
+  // statistics
+  struct stats_t
+  {
+    uint64_t frames, busy_frames; // process() calls, those that computed anything
+    uint64_t cells;               // character cells computed
+    uint64_t over_budget;         // frames that ran out of time (cells left for the next frame)
+    uint64_t quality_changes;
+  } stats;
+
+ private:
+  void resize();
+  void update_weights();
+  void process_span(int row, int col0, int col1);
+  void blur_rows(int x0, int y0, int w);
+
+  VDM1Framebuffer *m_fb;
+  int      m_cell_w, m_cell_h, m_radius;
+  int      m_gap, m_decay, m_bloom; // effect strengths, 256 = 1
+  int      m_budget_us;
+  int      m_next_row, m_easy_frames;
+
+  uint8_t   m_active[VDM1_ROWS*VDM1_COLS]; // cells to compute
+  uint8_t  *m_persist;                     // phosphor brightness per pixel
+  uint16_t *m_weight;                      // scanline brightness per pixel row of a cell
+
+  // bloom: horizontally blurred rows, vertical sums per column, glow per pixel of one row
+  uint8_t  *m_hblur;
+  uint16_t *m_vsum;
+  uint8_t  *m_glow;
+};
+
+
+#endif
@@ -0,0 +1,298 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - in-process embedding API
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include "vdm1embed.h"
+#include "vdm1core.h"
+#include "vdm1framebuffer.h"
+#include "vdm1hash.h"
+#include "ringbuffer.h"
+
+
+#define KEY_BUFFER 256
+
+
+struct vdm1_display
+{
+  // odd while the writer is changing the state below
+  std::atomic<uint32_t> seq;
+
+  uint8_t mem[1024];
+  uint8_t ctrl, dip;
+  uint64_t hash, row_hash[16];
+
+  ringbuffer_t keys;
+  uint8_t      key_data[KEY_BUFFER];
+};
+
+
+struct vdm1_view
+{
+  vdm1_display_t *display;
+  VDM1Core        core;
+  VDM1Framebuffer framebuffer;
+  uint32_t        generation, changes;
+  std::chrono::steady_clock::time_point next_blink;
+
+  vdm1_view(int scale) : framebuffer(scale) {}
+};
+
+
+// -----------------------------------------------------------------------------
+// writer side
+// -----------------------------------------------------------------------------
+
+
+static inline void begin_write(vdm1_display_t *d)
+{
+  // only the writer changes seq, so a relaxed load is enough
+  d->seq.store(d->seq.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+
+static inline void end_write(vdm1_display_t *d)
+{
+  d->seq.store(d->seq.load(std::memory_order_relaxed)+1, std::memory_order_release);
+}
+
+
+vdm1_display_t *vdm1_create(void)
+{
+  vdm1_display_t *d = new vdm1_display_t;
+
+  // same power-on state as VDM1Core
+  VDM1Core core;
+  d->seq = 0;
+  memcpy(d->mem, core.mem, sizeof(d->mem));
+  d->ctrl = core.ctrl;
+  d->dip  = core.dip;
+  d->hash = vdm1_hash_state(d->mem, d->ctrl, d->dip, d->row_hash);
+  ringbuffer_init(&d->keys, d->key_data, KEY_BUFFER);
+  return d;
+}
+
+
+void vdm1_destroy(vdm1_display_t *d)
+{
+  delete d;
+}
+
+
+void vdm1_write(vdm1_display_t *d, int addr, uint8_t value)
+{
+  // the hash change is computed before the write begins (only the writer
+  // changes mem), so readers are kept waiting as briefly as before
+  addr &= 0x3ff;
+  uint64_t k = vdm1_hash_change(addr, d->mem[addr], value);
+
+  begin_write(d);
+  d->mem[addr] = value;
+  d->hash ^= k;
+  d->row_hash[addr>>6] ^= k;
+  end_write(d);
+}
+
+
+void vdm1_write_range(vdm1_display_t *d, int addr, const uint8_t *data, int n)
+{
+  addr &= 0x3ff;
+  if( n>1024 ) n = 1024;
+
+  uint64_t k[16] = {0};
+  for(int i=0; i<n; i++)
+    {
+      int a = (addr+i) & 0x3ff;
+      k[a>>6] ^= vdm1_hash_change(a, d->mem[a], data[i]);
+    }
+
+  begin_write(d);
+  int n1 = 1024-addr < n ? 1024-addr : n;
+  memcpy(d->mem+addr, data, n1);
+  memcpy(d->mem, data+n1, n-n1);
+  for(int r=0; r<16; r++)
+    {
+      d->row_hash[r] ^= k[r];
+      d->hash ^= k[r];
+    }
+  end_write(d);
+}
+
+
+void vdm1_set_ctrl(vdm1_display_t *d, uint8_t value)
+{
+  uint64_t k = vdm1_hash_key(VDM1_HASH_CTRL, d->ctrl) ^ vdm1_hash_key(VDM1_HASH_CTRL, value);
+
+  begin_write(d);
+  d->hash ^= k;
+  d->ctrl = value;
+  end_write(d);
+}
+
+
+void vdm1_set_dip(vdm1_display_t *d, uint8_t value)
+{
+  uint64_t k = vdm1_hash_key(VDM1_HASH_DIP, d->dip) ^ vdm1_hash_key(VDM1_HASH_DIP, value);
+
+  begin_write(d);
+  d->hash ^= k;
+  d->dip = value;
+  end_write(d);
+}
+
+
+int vdm1_poll_keys(vdm1_display_t *d, uint8_t *keys, int max)
+{
+  return (int) ringbuffer_read(&d->keys, keys, max);
+}
+
+
+bool vdm1_push_key(vdm1_display_t *d, uint8_t key)
+{
+  return ringbuffer_enqueue(&d->keys, key);
+}
+
+
+// -----------------------------------------------------------------------------
+// reader side
+// -----------------------------------------------------------------------------
+
+
+uint32_t vdm1_read(vdm1_display_t *d, uint8_t *mem, uint8_t *ctrl, uint8_t *dip)
+{
+  uint32_t s1, s2;
+  uint8_t  c, p;
+
+  do
+    {
+      // wait until the writer is not in the middle of a change
+      while( (s1=d->seq.load(std::memory_order_acquire)) & 1 ) {}
+
+      memcpy(mem, d->mem, sizeof(d->mem));
+      c = d->ctrl;
+      p = d->dip;
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      s2 = d->seq.load(std::memory_order_relaxed);
+    }
+  while( s1!=s2 );
+
+  if( ctrl!=NULL ) *ctrl = c;
+  if( dip!=NULL )  *dip  = p;
+  return s1/2;
+}
+
+
+uint64_t vdm1_hash(vdm1_display_t *d, uint64_t *rows)
+{
+  uint32_t s1, s2;
+  uint64_t h, r[16];
+
+  do
+    {
+      while( (s1=d->seq.load(std::memory_order_acquire)) & 1 ) {}
+
+      h = d->hash;
+      if( rows!=NULL ) memcpy(r, d->row_hash, sizeof(r));
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      s2 = d->seq.load(std::memory_order_relaxed);
+    }
+  while( s1!=s2 );
+
+  if( rows!=NULL ) memcpy(rows, r, sizeof(r));
+  return h;
+}
+
+
+vdm1_view_t *vdm1_view_create(vdm1_display_t *d, int scale)
+{
+  vdm1_view_t *v = new vdm1_view_t(scale);
+  v->display = d;
+  v->core.set_surface(&v->framebuffer);
+  v->generation = 0;
+  v->changes = 0;
+  v->next_blink = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+  v->core.redraw();
+  return v;
+}
+
+
+void vdm1_view_destroy(vdm1_view_t *v)
+{
+  delete v;
+}
+
+
+bool vdm1_view_update(vdm1_view_t *v)
+{
+  uint8_t  mem[1024], ctrl, dip;
+  uint32_t generation = vdm1_read(v->display, mem, &ctrl, &dip);
+
+  if( generation!=v->generation )
+    {
+      v->generation = generation;
+
+      if( dip!=v->core.dip )   v->core.set_dip(dip);
+      if( ctrl!=v->core.ctrl ) v->core.set_ctrl(ctrl);
+
+      // a few changed characters are drawn one by one, otherwise the
+      // whole screen is redrawn once
+      int n = 0, changed[64];
+      for(int a=0; a<1024 && n<=64; a++)
+        if( mem[a]!=v->core.mem[a] )
+          {
+            if( n<64 ) changed[n] = a;
+            n++;
+          }
+
+      if( n>64 )
+        v->core.write_frame(mem);
+      else
+        for(int i=0; i<n; i++)
+          v->core.write_byte(changed[i], mem[changed[i]]);
+    }
+
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if( now>=v->next_blink )
+    {
+      v->core.toggle_blink();
+      v->next_blink = now + std::chrono::milliseconds(500);
+    }
+
+  bool changed = v->framebuffer.changes!=v->changes;
+  v->changes = v->framebuffer.changes;
+  return changed;
+}
+
+
+const uint8_t *vdm1_view_pixels(vdm1_view_t *v, int *width, int *height)
+{
+  if( width!=NULL )  *width  = v->framebuffer.width;
+  if( height!=NULL ) *height = v->framebuffer.height;
+  return v->framebuffer.pixels;
+}
+
+
+int vdm1_view_text(vdm1_view_t *v, char *buf, const char *eol)
+{
+  return v->core.get_text(buf, eol);
+}
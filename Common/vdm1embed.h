@@ -0,0 +1,90 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - in-process embedding API
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef VDM1EMBED_H
+#define VDM1EMBED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// For software Altair emulators running on the same machine: instead of
+// encoding each write to video memory as VDM_MEMBYTE and sending it over
+// a serial or TCP link, the emulator calls vdm1_write() from its memory
+// write hook (for addresses 0xCC00-0xCFFF) and vdm1_set_ctrl() from its
+// OUT 0xC8 handler.
+//
+// Threads: exactly one writer (the emulator) calls vdm1_write*(),
+// vdm1_set_*() and vdm1_poll_keys(). Any number of readers (display,
+// screenshots, ...) read the state through vdm1_read() or their own view,
+// without ever blocking the writer: the state is protected by a sequence
+// lock, readers simply retry if the writer changed it while they copied.
+// Keys are pushed by one (other) thread.
+
+typedef struct vdm1_display vdm1_display_t;
+typedef struct vdm1_view    vdm1_view_t;
+
+vdm1_display_t *vdm1_create(void);
+void vdm1_destroy(vdm1_display_t *d);
+
+// writer side: addresses are offsets into video memory (0-1023)
+void vdm1_write(vdm1_display_t *d, int addr, uint8_t value);
+void vdm1_write_range(vdm1_display_t *d, int addr, const uint8_t *data, int n);
+void vdm1_set_ctrl(vdm1_display_t *d, uint8_t value);
+void vdm1_set_dip(vdm1_display_t *d, uint8_t value);
+
+// returns up to "max" keys typed since the last call (writer side)
+int  vdm1_poll_keys(vdm1_display_t *d, uint8_t *keys, int max);
+
+// key typed on the display, returns false if the key buffer is full
+bool vdm1_push_key(vdm1_display_t *d, uint8_t key);
+
+// consistent copy of the state (mem must hold 1024 bytes, ctrl/dip may be
+// NULL), returns the generation: the number of changes so far
+uint32_t vdm1_read(vdm1_display_t *d, uint8_t *mem, uint8_t *ctrl, uint8_t *dip);
+
+// fingerprint of the state (see vdm1hash.h), kept up to date by the writer,
+// so polling it is cheaper than reading the state; "rows" (the hashes of the
+// 16 rows of video memory) may be NULL
+uint64_t vdm1_hash(vdm1_display_t *d, uint64_t *rows);
+
+// a reader's rendered copy of the screen, one byte per pixel (0/1),
+// VDM1_HPIX*scale x VDM1_VPIX*scale pixels (see vdm1core.h)
+vdm1_view_t *vdm1_view_create(vdm1_display_t *d, int scale);
+void vdm1_view_destroy(vdm1_view_t *v);
+
+// bring the view up to date (including cursor blinking), returns true if
+// the picture changed since the last call
+bool vdm1_view_update(vdm1_view_t *v);
+
+const uint8_t *vdm1_view_pixels(vdm1_view_t *v, int *width, int *height);
+
+// screen contents as text, see VDM1Core::get_text()
+int vdm1_view_text(vdm1_view_t *v, char *buf, const char *eol);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,284 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - software framebuffer renderer
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vdm1framebuffer.h"
+#include "vdm1charset.h"
+
+
+// below this many queued pixels waking up the workers costs more than it saves
+#define MIN_PARALLEL_PIXELS (64*1024)
+
+
+VDM1Framebuffer::VDM1Framebuffer(double scale)
+{
+  pixels   = NULL;
+  m_glyphs = NULL;
+  changes  = 0;
+  m_queueing = false;
+  m_queued_cells = 0;
+  m_generation = 0;
+  m_busy = 0;
+  m_quit = false;
+  m_next_row = 0;
+  set_scale(scale);
+}
+
+
+VDM1Framebuffer::~VDM1Framebuffer()
+{
+  stop_workers();
+  free(pixels);
+  free(m_glyphs);
+}
+
+
+void VDM1Framebuffer::set_scale(double s)
+{
+  // at least one pixel per character cell
+  scale  = s<1.0/VDM1_CHAR_W ? 1.0/VDM1_CHAR_W : s;
+  cell_w = (int) (VDM1_CHAR_W*scale + 1e-6);
+  cell_h = (int) (VDM1_CHAR_H*scale + 1e-6);
+  width  = VDM1_COLS*cell_w;
+  height = VDM1_ROWS*cell_h;
+
+  // 0/1 pixels at integer scales (where they can only be 0 or 1 anyway)
+  int k = cell_w/VDM1_CHAR_W;
+  max_value = (cell_w==k*VDM1_CHAR_W && cell_h==k*VDM1_CHAR_H) ? 1 : 255;
+
+  free(pixels);
+  pixels = (uint8_t *) calloc(width*height, 1);
+
+  // render all glyphs for this scale, normal and inverse
+  free(m_glyphs);
+  m_glyphs = (uint8_t *) malloc(2*128*cell_w*cell_h);
+  for(int ch=0; ch<128; ch++)
+    {
+      uint8_t *p = m_glyphs + ch*cell_w*cell_h;
+      uint8_t *q = p + 128*cell_w*cell_h;
+      vdm1_render_glyph(ch, cell_w, cell_h, max_value, p, cell_w);
+      for(int i=0; i<cell_w*cell_h; i++) q[i] = max_value-p[i];
+    }
+
+  memset(dirty, 1, sizeof(dirty));
+  changes++;
+}
+
+
+// -----------------------------------------------------------------------------
+// drawing
+// -----------------------------------------------------------------------------
+
+
+void VDM1Framebuffer::begin_update()
+{
+  m_queueing = !m_workers.empty();
+}
+
+
+void VDM1Framebuffer::end_update()
+{
+  if( !m_queueing ) return;
+  m_queueing = false;
+
+  if( m_queued_cells*cell_w*cell_h < MIN_PARALLEL_PIXELS )
+    {
+      for(int r=0; r<VDM1_ROWS; r++) draw_row(r);
+    }
+  else
+    {
+      // start the workers and take rows along with them
+      m_next_row = 0;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_generation++;
+        m_busy = (int) m_workers.size();
+      }
+      m_start.notify_all();
+      draw_rows();
+
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while( m_busy>0 ) m_done.wait(lock);
+    }
+
+  m_queued_cells = 0;
+}
+
+
+void VDM1Framebuffer::draw_char(int row, int col, uint8_t ch, bool inverse)
+{
+  changes++;
+  dirty[row*VDM1_COLS+col] = 1;
+
+  if( m_queueing )
+    {
+      op_t op = {(uint8_t) col, 1, ch, false, inverse};
+      m_ops[row].push_back(op);
+      m_queued_cells++;
+      return;
+    }
+
+  // one memcpy per pixel row, the glyph rows are already expanded
+  int gw = cell_w, gh = cell_h;
+  const uint8_t *g = m_glyphs + ((inverse ? 128 : 0) + (ch&0x7f))*gw*gh;
+  uint8_t *p = pixels + row*gh*width + col*gw;
+
+  for(int y=0; y<gh; y++, p+=width, g+=gw)
+    memcpy(p, g, gw);
+}
+
+
+void VDM1Framebuffer::fill(int row, int col, int h, int w, bool inverse)
+{
+  changes++;
+  for(int r=row; r<row+h; r++)
+    memset(dirty+r*VDM1_COLS+col, 1, w);
+
+  if( m_queueing )
+    {
+      op_t op = {(uint8_t) col, (uint8_t) w, 0, true, inverse};
+      for(int r=row; r<row+h; r++) m_ops[r].push_back(op);
+      m_queued_cells += h*w;
+      return;
+    }
+
+  int gw = cell_w, gh = cell_h;
+  uint8_t *p = pixels + row*gh*width + col*gw;
+
+  for(int y=0; y<h*gh; y++, p+=width)
+    memset(p, inverse ? max_value : 0, w*gw);
+}
+
+
+void VDM1Framebuffer::draw_row(int row)
+{
+  std::vector<op_t> &ops = m_ops[row];
+  int gw = cell_w, gh = cell_h;
+  uint8_t *line = pixels + row*gh*width;
+
+  for(size_t i=0; i<ops.size(); i++)
+    {
+      const op_t &op = ops[i];
+      uint8_t *p = line + op.col*gw;
+
+      if( op.fill )
+        for(int y=0; y<gh; y++, p+=width)
+          memset(p, op.inverse ? max_value : 0, op.w*gw);
+      else
+        {
+          const uint8_t *g = m_glyphs + ((op.inverse ? 128 : 0) + (op.ch&0x7f))*gw*gh;
+          for(int y=0; y<gh; y++, p+=width, g+=gw)
+            memcpy(p, g, gw);
+        }
+    }
+
+  ops.clear();
+}
+
+
+void VDM1Framebuffer::draw_rows()
+{
+  int r;
+  while( (r=m_next_row++)<VDM1_ROWS )
+    draw_row(r);
+}
+
+
+// -----------------------------------------------------------------------------
+// worker pool
+// -----------------------------------------------------------------------------
+
+
+void VDM1Framebuffer::set_threads(int n)
+{
+  stop_workers();
+  for(int i=1; i<n; i++)
+    m_workers.push_back(std::thread(&VDM1Framebuffer::worker, this, m_generation));
+}
+
+
+void VDM1Framebuffer::stop_workers()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_start.notify_all();
+  for(size_t i=0; i<m_workers.size(); i++) m_workers[i].join();
+  m_workers.clear();
+  m_quit = false;
+}
+
+
+void VDM1Framebuffer::worker(uint32_t generation)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  while( true )
+    {
+      while( !m_quit && m_generation==generation ) m_start.wait(lock);
+      if( m_quit ) return;
+      generation = m_generation;
+
+      lock.unlock();
+      draw_rows();
+      lock.lock();
+
+      if( --m_busy==0 ) m_done.notify_one();
+    }
+}
+
+
+bool VDM1Framebuffer::write_ppm(const char *fname, uint32_t fg, uint32_t bg)
+{
+  return vdm1_write_ppm(fname, pixels, width, height, max_value, fg, bg);
+}
+
+
+bool vdm1_write_ppm(const char *fname, const uint8_t *pixels, int width, int height,
+                    uint8_t max_value, uint32_t fg, uint32_t bg)
+{
+  FILE *f = fopen(fname, "wb");
+  if( f==NULL ) return false;
+
+  // blend the colors for partially covered pixels
+  uint8_t colors[256][3];
+  for(int v=0; v<=max_value; v++)
+    for(int i=0; i<3; i++)
+      {
+        int b = (bg>>(16-8*i)) & 255, f = (fg>>(16-8*i)) & 255;
+        colors[v][i] = (uint8_t) (b + (f-b)*v/max_value);
+      }
+
+  uint8_t *line = (uint8_t *) malloc(width*3);
+
+  fprintf(f, "P6\n%i %i\n255\n", width, height);
+  for(int y=0; y<height; y++)
+    {
+      const uint8_t *p = pixels + y*width;
+      for(int x=0; x<width; x++)
+        memcpy(line+x*3, colors[p[x]], 3);
+      fwrite(line, 3, width, f);
+    }
+
+  free(line);
+  return fclose(f)==0;
+}
@@ -0,0 +1,116 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - software framebuffer renderer
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef VDM1FRAMEBUFFER_H
+#define VDM1FRAMEBUFFER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "vdm1core.h"
+
+
+// Renders into memory: one byte per pixel, 0 = background, 1 = foreground.
+// The picture is VDM1_HPIX x VDM1_VPIX pixels scaled by any factor: each
+// character cell is VDM1_CHAR_W*scale x VDM1_CHAR_H*scale pixels (rounded
+// down). At fractional scales pixels range from 0 to 255 (max_value) and
+// pixels on the edge of a character pixel get the fraction covered by it
+// (see vdm1_render_glyph()). Glyphs are rendered for the current scale
+// once (normal and inverse), drawing a character then is just a copy of
+// its rows, at any scale.
+//
+// With more than one thread (set_threads()) drawing calls between
+// begin_update() and end_update() are queued per character row and drawn
+// by end_update(): each row is a band of pixel rows that no other row
+// touches, so rows are handed out to a persistent pool of worker threads
+// (and the calling thread) without any locking. Small updates are drawn
+// by the calling thread alone.
+class VDM1Framebuffer : public VDM1Surface
+{
+ public:
+  VDM1Framebuffer(double scale = 1);
+  ~VDM1Framebuffer();
+
+  void set_scale(double scale);
+
+  // number of threads drawing (including the caller), 1 = draw each call immediately
+  void set_threads(int n);
+  int  threads() const { return (int) m_workers.size()+1; }
+
+  virtual void begin_update();
+  virtual void end_update();
+  virtual void draw_char(int row, int col, uint8_t ch, bool inverse);
+  virtual void fill(int row, int col, int h, int w, bool inverse);
+
+  // write the picture as binary PPM (P6) in the given RGB colors (0xRRGGBB)
+  bool write_ppm(const char *fname, uint32_t fg = 0x00FF00, uint32_t bg = 0x000000);
+
+  double   scale;
+  int      width, height, cell_w, cell_h;
+  uint8_t *pixels, max_value;
+
+  // number of drawing operations so far, can be used to detect changes
+  uint32_t changes;
+
+  // cells drawn since their flag was last cleared (by whoever uses them, e.g. VDM1CRT),
+  // all set by set_scale()
+  uint8_t dirty[VDM1_ROWS*VDM1_COLS];
+
+ private:
+  // a queued drawing call within one row
+  struct op_t
+  {
+    uint8_t col, w, ch;
+    bool    fill, inverse;
+  };
+
+  void draw_row(int row);
+  void draw_rows();
+  void worker(uint32_t generation);
+  void stop_workers();
+
+  uint8_t *m_glyphs; // 2x128 glyphs (normal, inverse) of cell_h rows with cell_w pixels
+
+  // queued drawing calls per row (only with more than one thread)
+  bool              m_queueing;
+  int               m_queued_cells;
+  std::vector<op_t> m_ops[VDM1_ROWS];
+
+  // worker pool: each end_update() that needs the workers starts a new
+  // generation, workers take rows from m_next_row until none are left
+  std::vector<std::thread> m_workers;
+  std::mutex               m_mutex;
+  std::condition_variable  m_start, m_done;
+  uint32_t                 m_generation;
+  int                      m_busy;
+  bool                     m_quit;
+  std::atomic<int>         m_next_row;
+};
+
+
+// write "pixels" (0 to max_value) as binary PPM (P6) in the given RGB colors (0xRRGGBB),
+// values in between are blended
+bool vdm1_write_ppm(const char *fname, const uint8_t *pixels, int width, int height,
+                    uint8_t max_value, uint32_t fg, uint32_t bg);
+
+
+#endif
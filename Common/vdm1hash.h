@@ -0,0 +1,93 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - video state fingerprint
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef VDM1HASH_H
+#define VDM1HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// 64 bit fingerprint of the video state (Zobrist hashing): each value of
+// each cell has its own pseudo-random key and the hash is the XOR of the
+// keys of all 1024 cells plus those of the control register and the DIP
+// switches. Changing one cell changes the hash by key(old) ^ key(new), so
+// the owner of the state keeps it up to date in O(1) per write and users
+// compare 8 bytes instead of 1026. Row hashes (the 64 cells of one row of
+// video memory, without ctrl/dip) are kept the same way.
+// The keys are computed (SplitMix64 of index and value) rather than looked
+// up in a 2MB table, so hashes are the same in every process and build.
+
+#define VDM1_HASH_CTRL 1024  // key index of the control register
+#define VDM1_HASH_DIP  1025  // key index of the DIP switches
+
+static inline uint64_t vdm1_hash_key(int index, uint8_t value)
+{
+  uint64_t z = ((uint64_t) index << 8 | value) + 0x9E3779B97F4A7C15ull;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+// the hash from scratch, "rows" (16 row hashes) may be NULL
+static inline uint64_t vdm1_hash_state(const uint8_t *mem, uint8_t ctrl, uint8_t dip, uint64_t *rows)
+{
+  uint64_t h = vdm1_hash_key(VDM1_HASH_CTRL, ctrl) ^ vdm1_hash_key(VDM1_HASH_DIP, dip);
+  for(int r=0; r<16; r++)
+    {
+      uint64_t rh = 0;
+      for(int c=0; c<64; c++) rh ^= vdm1_hash_key(r*64+c, mem[r*64+c]);
+      if( rows!=NULL ) rows[r] = rh;
+      h ^= rh;
+    }
+
+  return h;
+}
+
+// how the hash changes when the cell at addr changes from old to value
+static inline uint64_t vdm1_hash_change(int addr, uint8_t old, uint8_t value)
+{
+  return old==value ? 0 : vdm1_hash_key(addr, old) ^ vdm1_hash_key(addr, value);
+}
+
+// writes n bytes to mem at addr (no wrap around) and updates the hash and
+// row hashes, in O(n)
+static inline void vdm1_hash_write(uint8_t *mem, int addr, const uint8_t *data, int n,
+                                   uint64_t *hash, uint64_t *rows)
+{
+  for(int i=0; i<n; i++, addr++)
+    if( mem[addr]!=data[i] )
+      {
+        uint64_t k = vdm1_hash_change(addr, mem[addr], data[i]);
+        rows[addr>>6] ^= k;
+        *hash ^= k;
+        mem[addr] = data[i];
+      }
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,219 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - live metrics
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "vdm1metrics.h"
+
+
+VDM1Metrics::VDM1Metrics(const VDM1Core *core) :
+  m_last_latency("latency", "us")
+{
+  m_core     = core;
+  m_queue    = NULL;
+  m_connects = NULL;
+  m_latency  = NULL;
+  m_last_time = -1;
+  memset(&m_last, 0, sizeof(m_last));
+  m_summary[0] = 0;
+}
+
+
+void VDM1Metrics::set_send_queue(SendQueue *queue)
+{
+  m_queue = queue;
+}
+
+
+void VDM1Metrics::set_connects(const uint64_t *connects)
+{
+  m_connects = connects;
+}
+
+
+void VDM1Metrics::set_latency(const Histogram *latency)
+{
+  m_latency = latency;
+}
+
+
+void VDM1Metrics::add_counter(const char *name, const char *help, const uint64_t *value)
+{
+  counter c = { name, help, value };
+  m_counters.push_back(c);
+}
+
+
+void VDM1Metrics::add_histogram(const char *name, const char *help, const Histogram *h)
+{
+  histogram e = { name, help, h };
+  m_histograms.push_back(e);
+}
+
+
+static void print_value(std::string &out, const char *name, const char *help, const char *type, uint64_t value)
+{
+  char buf[512];
+  snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name,
+           (unsigned long long) value);
+  out += buf;
+}
+
+
+void VDM1Metrics::print_histogram(std::string &out, const char *name, const char *help, const Histogram &h)
+{
+  char buf[512];
+  snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+  out += buf;
+
+  // bucket b holds values up to 2^b-1, cumulative up to the last one used
+  int last = Histogram::BUCKETS-1;
+  while( last>0 && h.buckets[last]==0 ) last--;
+
+  uint64_t n = 0;
+  for(int b=0; b<=last; b++)
+    {
+      n += h.buckets[b];
+      snprintf(buf, sizeof(buf), "%s_bucket{le=\"%llu\"} %llu\n", name,
+               (unsigned long long) (b==0 ? 0 : (uint64_t(1)<<b)-1), (unsigned long long) n);
+      out += buf;
+    }
+
+  snprintf(buf, sizeof(buf), "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %llu\n%s_count %llu\n",
+           name, (unsigned long long) h.count, name, (unsigned long long) h.sum,
+           name, (unsigned long long) h.count);
+  out += buf;
+}
+
+
+std::string VDM1Metrics::text()
+{
+  const VDM1Core::stats_t &s = m_core->stats;
+  std::string out;
+  char buf[512];
+
+  print_value(out, "vdm1_received_bytes_total", "Bytes received from the Altair", "counter", s.bytes);
+
+  snprintf(buf, sizeof(buf),
+           "# HELP vdm1_commands_total Commands received by type\n"
+           "# TYPE vdm1_commands_total counter\n"
+           "vdm1_commands_total{type=\"membyte\"} %llu\n"
+           "vdm1_commands_total{type=\"fullframe\"} %llu\n"
+           "vdm1_commands_total{type=\"ctrl\"} %llu\n"
+           "vdm1_commands_total{type=\"dip\"} %llu\n"
+           "vdm1_commands_total{type=\"endframe\"} %llu\n",
+           (unsigned long long) s.membyte, (unsigned long long) s.fullframe,
+           (unsigned long long) s.ctrl, (unsigned long long) s.dip,
+           (unsigned long long) s.endframe);
+  out += buf;
+
+  print_value(out, "vdm1_decoder_errors_total", "Bytes that did not start a known command", "counter", s.unknown);
+  print_value(out, "vdm1_cells_written_total", "Video memory writes (a full frame counts 1024)", "counter", s.cells_written);
+  print_value(out, "vdm1_cells_drawn_total", "Character cells drawn", "counter", s.chars_drawn);
+  print_value(out, "vdm1_full_redraws_total", "Whole screen redraws", "counter", s.frame_redraws);
+  print_value(out, "vdm1_presents_total", "Batches of drawing shown", "counter", s.presents);
+
+  if( m_queue!=NULL )
+    {
+      print_value(out, "vdm1_send_queue_keys", "Interactive keys waiting to be sent", "gauge",
+                  m_queue->interactive_pending());
+      print_value(out, "vdm1_send_queue_bulk_bytes", "Pasted/uploaded bytes waiting to be sent", "gauge",
+                  m_queue->bulk_pending());
+      print_value(out, "vdm1_sent_keys_total", "Keys sent to the Altair", "counter", m_queue->num_keys);
+      print_value(out, "vdm1_dropped_keys_total", "Keys dropped because the queue was full", "counter",
+                  m_queue->num_dropped);
+    }
+
+  if( m_connects!=NULL )
+    print_value(out, "vdm1_connects_total", "Connections made (the first one and reconnects)", "counter",
+                *m_connects);
+
+  for(size_t i=0; i<m_counters.size(); i++)
+    print_value(out, m_counters[i].name, m_counters[i].help, "counter", *m_counters[i].value);
+
+  if( m_latency!=NULL )
+    print_histogram(out, "vdm1_latency_us", "Microseconds from receiving data until it was shown", *m_latency);
+
+  for(size_t i=0; i<m_histograms.size(); i++)
+    print_histogram(out, m_histograms[i].name, m_histograms[i].help, *m_histograms[i].h);
+
+  return out;
+}
+
+
+const char *VDM1Metrics::summary(double now)
+{
+  const VDM1Core::stats_t &s = m_core->stats;
+  double dt = m_last_time>=0 && now>m_last_time ? now-m_last_time : 1;
+  int n = snprintf(m_summary, sizeof(m_summary), "%.1f kB/s, %.0f writes/s, %.0f drawn/s, %.0f redraws/s, %.0f presents/s",
+                   (s.bytes-m_last.bytes)/dt/1000, (s.cells_written-m_last.cells_written)/dt,
+                   (s.chars_drawn-m_last.chars_drawn)/dt, (s.frame_redraws-m_last.frame_redraws)/dt,
+                   (s.presents-m_last.presents)/dt);
+
+  if( m_latency!=NULL )
+    {
+      // percentile of the values added since the last call only
+      Histogram h = *m_latency;
+      for(int b=0; b<Histogram::BUCKETS; b++) h.buckets[b] -= m_last_latency.buckets[b];
+      h.count -= m_last_latency.count;
+      h.sum   -= m_last_latency.sum;
+      if( h.count>0 )
+        n += snprintf(m_summary+n, sizeof(m_summary)-n, ", latency p99 <=%llu us",
+                      (unsigned long long) h.percentile(0.99));
+      m_last_latency = *m_latency;
+    }
+
+  if( m_queue!=NULL )
+    n += snprintf(m_summary+n, sizeof(m_summary)-n, ", queue %i",
+                  m_queue->interactive_pending() + m_queue->bulk_pending());
+  if( s.unknown>0 )
+    n += snprintf(m_summary+n, sizeof(m_summary)-n, ", %llu errors", (unsigned long long) s.unknown);
+  if( m_connects!=NULL && *m_connects>1 )
+    n += snprintf(m_summary+n, sizeof(m_summary)-n, ", %llu reconnects", (unsigned long long) (*m_connects-1));
+
+  m_last = s;
+  m_last_time = now;
+  return m_summary;
+}
+
+
+bool VDM1Metrics::write_file(const char *fname)
+{
+  std::string tmp = std::string(fname) + ".tmp", t = text();
+  FILE *f = fopen(tmp.c_str(), "w");
+  bool ok = f!=NULL && fwrite(t.data(), 1, t.size(), f)==t.size();
+  if( f!=NULL && fclose(f)!=0 ) ok = false;
+
+#ifdef _WIN32
+  // rename() does not replace an existing file there
+  if( ok ) remove(fname);
+#endif
+
+  if( !ok || rename(tmp.c_str(), fname)!=0 )
+    {
+      // errno of the failed call for the caller's message
+      int err = errno;
+      remove(tmp.c_str());
+      errno = err;
+      return false;
+    }
+
+  return true;
+}
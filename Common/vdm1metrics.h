@@ -0,0 +1,90 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - live metrics
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef VDM1METRICS_H
+#define VDM1METRICS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "vdm1core.h"
+#include "sendqueue.h"
+#include "histogram.h"
+
+
+// Live metrics of a display host, for finding out where a display "lags":
+// what VDM1Core counts (bytes received, commands by type, decoder errors,
+// cells written and drawn, full redraws, presents), the send queue's depth
+// and whatever the host keeps itself (connections made, latency from
+// receiving data until it is shown, ...). The counters are the plain
+// increments the parts do anyway, reading them costs nothing on the
+// ingest path.
+// - text() has all values, one per line in Prometheus' text format (a
+//   file for node_exporter's textfile collector, or just "cat"), latency
+//   histograms with cumulative power-of-two buckets
+// - summary() is one line of rates since the last call for an overlay
+//   (window title, status line), with the latency percentile over that
+//   time only
+// Values owned by other threads (the send queue's counters, the core fed
+// by a reader thread) are read without locking, which is good enough for
+// statistics.
+class VDM1Metrics
+{
+ public:
+  VDM1Metrics(const VDM1Core *core);
+
+  // parts the host has (all must stay valid)
+  void set_send_queue(SendQueue *queue);
+  void set_connects(const uint64_t *connects);
+  void set_latency(const Histogram *latency);
+
+  // further values
+  void add_counter(const char *name, const char *help, const uint64_t *value);
+  void add_histogram(const char *name, const char *help, const Histogram *h);
+
+  std::string text();
+
+  // one line like "12.3 kB/s, 4100 writes/s, 3800 drawn/s, ..." ("now" in seconds)
+  const char *summary(double now);
+
+  // write text() to a file (through a temporary file, so readers never see a partial one)
+  bool write_file(const char *fname);
+
+ private:
+  struct counter   { const char *name, *help; const uint64_t *value; };
+  struct histogram { const char *name, *help; const Histogram *h; };
+
+  void print_histogram(std::string &out, const char *name, const char *help, const Histogram &h);
+
+  const VDM1Core *m_core;
+  SendQueue       *m_queue;
+  const uint64_t  *m_connects;
+  const Histogram *m_latency;
+  std::vector<counter>   m_counters;
+  std::vector<histogram> m_histograms;
+
+  // for summary(): values at the last call
+  double           m_last_time;
+  VDM1Core::stats_t m_last;
+  Histogram        m_last_latency;
+  char             m_summary[256];
+};
+
+
+#endif
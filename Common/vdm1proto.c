@@ -0,0 +1,172 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - communication protocol
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include "vdm1proto.h"
+
+// key decoder states
+#define KS_IDLE   0
+#define KS_KEY    1
+#define KS_COUNT  2
+#define KS_BLOCK  3
+
+
+int vdm_encode_keys(uint8_t *buf, const uint8_t *keys, int n, bool blocks)
+{
+  uint8_t *p = buf;
+
+  while( n>0 )
+    {
+      if( blocks && n>=3 )
+        {
+          int i, k = n>VDM_KEYS_MAX ? VDM_KEYS_MAX : n;
+          *p++ = VDM_KEYS;
+          *p++ = k;
+          for(i=0; i<k; i++) *p++ = keys[i];
+          keys += k;
+          n    -= k;
+        }
+      else
+        {
+          *p++ = VDM_KEY;
+          *p++ = *keys++;
+          n--;
+        }
+    }
+
+  return (int) (p-buf);
+}
+
+
+void vdm_keydecoder_init(vdm_keydecoder_t *d, vdm_keys_func keys, vdm_connect_func connect, void *ctx)
+{
+  d->state     = KS_IDLE;
+  d->remaining = 0;
+  d->keys      = keys;
+  d->connect   = connect;
+  d->ctx       = ctx;
+}
+
+
+void vdm_keydecoder_feed(vdm_keydecoder_t *d, const uint8_t *data, int n)
+{
+  int i = 0;
+
+  while( i<n )
+    {
+      switch( d->state )
+        {
+        case KS_IDLE:
+          switch( data[i++] & 0xf0 )
+            {
+            case VDM_CONNECT: if( d->connect ) d->connect(d->ctx); break;
+            case VDM_KEY:     d->state = KS_KEY;   break;
+            case VDM_KEYS:    d->state = KS_COUNT; break;
+            }
+          break;
+
+        case KS_KEY:
+          if( d->keys ) d->keys(d->ctx, data+i, 1);
+          i++;
+          d->state = KS_IDLE;
+          break;
+
+        case KS_COUNT:
+          d->remaining = data[i++];
+          d->state = d->remaining>0 ? KS_BLOCK : KS_IDLE;
+          break;
+
+        case KS_BLOCK:
+          {
+            // one bounds check for the whole (rest of the) block
+            int k = n-i < d->remaining ? n-i : d->remaining;
+            if( d->keys ) d->keys(d->ctx, data+i, k);
+            i += k;
+            d->remaining -= k;
+            if( d->remaining==0 ) d->state = KS_IDLE;
+            break;
+          }
+        }
+    }
+}
+
+
+int vdm_dg_header(uint8_t *buf, uint8_t type, uint32_t seq)
+{
+  buf[0] = VDM_DG_MAGIC;
+  buf[1] = type;
+  buf[2] = 0;
+  buf[3] = 0;
+  buf[4] = seq & 255;
+  buf[5] = (seq >> 8) & 255;
+  buf[6] = (seq >> 16) & 255;
+  buf[7] = (seq >> 24) & 255;
+  return VDM_DG_HEADER;
+}
+
+
+void vdm_dgreceiver_init(vdm_dgreceiver_t *r)
+{
+  r->last_seq = 0;
+  r->started  = false;
+  r->late_run = 0;
+  r->num_lost = 0;
+  r->num_late = 0;
+  r->num_bad  = 0;
+}
+
+
+int vdm_dgreceiver_accept(vdm_dgreceiver_t *r, const uint8_t *dg, int size, bool *resync)
+{
+  uint32_t seq;
+  int32_t  diff;
+
+  *resync = false;
+  if( size<VDM_DG_HEADER || dg[0]!=VDM_DG_MAGIC || (dg[1]!=VDM_DG_DELTA && dg[1]!=VDM_DG_KEYFRAME) )
+    {
+      r->num_bad++;
+      return 0;
+    }
+
+  seq  = dg[4] | (dg[5]<<8) | (dg[6]<<16) | ((uint32_t) dg[7]<<24);
+  diff = (int32_t) (seq - r->last_seq);
+
+  if( !r->started )
+    {
+      // changes before the first datagram are unknown
+      *resync = dg[1]!=VDM_DG_KEYFRAME;
+      r->started = true;
+    }
+  else if( diff<=0 )
+    {
+      // older than what is shown already
+      r->num_late++;
+      if( ++r->late_run>=VDM_DG_LATE_RESTART )
+        r->started = false;
+      return 0;
+    }
+  else if( diff>1 )
+    {
+      r->num_lost += diff-1;
+      *resync = dg[1]!=VDM_DG_KEYFRAME;
+    }
+
+  r->last_seq = seq;
+  r->late_run = 0;
+  return VDM_DG_HEADER;
+}
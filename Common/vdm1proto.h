@@ -0,0 +1,136 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - communication protocol
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef VDM1PROTO_H
+#define VDM1PROTO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// vdm1 commands received from the Altair simulator
+// (upper 4 bits of the first byte are the command)
+#define VDM_MEMBYTE   0x10  // 0x10|addr(10-8), addr(7-0), data
+#define VDM_FULLFRAME 0x20  // 0x20, 1024 bytes of video memory
+#define VDM_CTRL      0x30  // 0x30, control register
+#define VDM_DIP       0x40  // 0x40, DIP switch settings
+#define VDM_ENDFRAME  0x50  // 0x50, end of a batch of changes (see below)
+
+// VDM_ENDFRAME is optional: a display that has seen it once holds back
+// all following changes and shows them at once on the next VDM_ENDFRAME
+// (or after a timeout, in case the sender stops sending it). Displays
+// that don't know it ignore it as an unknown command.
+// A sender can send one right after connecting to switch on frame sync
+// before the first frame.
+
+// vdm1 commands sent to the Altair simulator
+#define VDM_CONNECT   0x10  // 0x10
+#define VDM_KEY       0x30  // 0x30, key
+#define VDM_KEYS      0x50  // 0x50, n (1-255), n keys
+
+// maximum number of keys in one VDM_KEYS block
+#define VDM_KEYS_MAX  255
+
+// buffer size needed to encode n keys (with or without VDM_KEYS blocks)
+#define VDM_KEYS_ENCODED_SIZE(n) (2*(n))
+
+
+// Encodes n keys into buf and returns the number of bytes used.
+// With "blocks" set, runs of three or more keys are sent as VDM_KEYS
+// blocks (n+2 bytes per block instead of 2*n), otherwise (and for
+// one or two keys) each key is sent as a separate VDM_KEY command.
+// VDM_KEYS must only be used if the receiving side supports it.
+int vdm_encode_keys(uint8_t *buf, const uint8_t *keys, int n, bool blocks);
+
+
+// Streaming decoder for data sent by the display (used on the Altair side).
+// Commands may be split at any point between calls to vdm_keydecoder_feed().
+// Runs of keys are passed to the "keys" callback in as few calls as possible,
+// the contents of a VDM_KEYS block are passed on without looking at each byte.
+typedef void (*vdm_keys_func)(void *ctx, const uint8_t *keys, int n);
+typedef void (*vdm_connect_func)(void *ctx);
+
+typedef struct
+{
+  uint8_t          state;     // receiver state
+  uint8_t          remaining; // keys still to come in the current VDM_KEYS block
+  vdm_keys_func    keys;
+  vdm_connect_func connect;
+  void            *ctx;
+} vdm_keydecoder_t;
+
+void vdm_keydecoder_init(vdm_keydecoder_t *d, vdm_keys_func keys, vdm_connect_func connect, void *ctx);
+void vdm_keydecoder_feed(vdm_keydecoder_t *d, const uint8_t *data, int n);
+
+
+// Datagram transport (e.g. UDP over a lossy link where a TCP connection
+// would stall the whole display until a lost segment is retransmitted).
+// Each datagram starts with an 8-byte header: 'V', type, 0, 0 and a 32-bit
+// sequence number (little endian). Datagrams to the display carry complete
+// commands only, so each one can be applied on its own:
+// - VDM_DG_DELTA:    VDM_MEMBYTE, VDM_CTRL and VDM_DIP commands
+// - VDM_DG_KEYFRAME: VDM_DIP, VDM_CTRL and VDM_FULLFRAME (the whole state)
+// Datagrams from the display:
+// - VDM_DG_HELLO:    subscribe/keep-alive, the payload (if any) is data for
+//                    the Altair (VDM_CONNECT, VDM_KEY, ...)
+// - VDM_DG_RESYNC:   a datagram was lost, please send a keyframe
+#define VDM_DG_MAGIC    'V'
+#define VDM_DG_DELTA    1
+#define VDM_DG_KEYFRAME 2
+#define VDM_DG_HELLO    3
+#define VDM_DG_RESYNC   4
+#define VDM_DG_HEADER   8
+#define VDM_DG_MAX      1200  // bytes per datagram (fits any common MTU)
+
+// writes a datagram header to buf, returns VDM_DG_HEADER
+int vdm_dg_header(uint8_t *buf, uint8_t type, uint32_t seq);
+
+// Receiving side: late and duplicate datagrams (sequence number not above
+// the last one applied) are dropped. A gap in the sequence numbers means
+// a datagram was lost, its changes are only repaired by the next keyframe.
+// A run of VDM_DG_LATE_RESTART late datagrams means the sender restarted
+// (its sequence numbers start over), the receiver then starts over too.
+#define VDM_DG_LATE_RESTART 16
+
+typedef struct
+{
+  uint32_t last_seq;
+  bool     started;   // at least one datagram was applied
+  uint32_t late_run;  // late datagrams in a row
+  uint32_t num_lost, num_late, num_bad;
+} vdm_dgreceiver_t;
+
+void vdm_dgreceiver_init(vdm_dgreceiver_t *r);
+
+// checks a received datagram, returns the offset of its payload if it is to
+// be applied or 0 if it is to be dropped. "resync" is set if a keyframe
+// should be requested.
+int vdm_dgreceiver_accept(vdm_dgreceiver_t *r, const uint8_t *dg, int size, bool *resync);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,187 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - video memory row scanning
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "vdm1scan.h"
+
+#if defined(__AVX2__)
+#define SCAN_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#define SCAN_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+
+#if defined(SCAN_AVX2) || defined(SCAN_SSE2) || defined(SCAN_NEON)
+static int first_bit(uint64_t mask)
+{
+  return mask==0 ? VDM1_SCAN_NONE : vdm1_scan_next(&mask);
+}
+#endif
+
+
+int vdm1_scan_row_scalar(const uint8_t *row, uint64_t *cursor)
+{
+  int first = VDM1_SCAN_NONE;
+  uint64_t m = 0;
+
+  for(int c=0; c<64; c++)
+    {
+      uint8_t ch = row[c] & 0x7f;
+      if( (ch==11 || ch==13) && first==VDM1_SCAN_NONE ) first = c;
+      if( row[c] & 0x80 ) m |= (uint64_t) 1 << c;
+    }
+
+  if( cursor!=NULL ) *cursor = m;
+  return first;
+}
+
+
+int vdm1_scan_row_portable(const uint8_t *row, uint64_t *cursor)
+{
+  // 4 characters at a time: a word has a VT or CR if (w & 0x7f..) ^ 11 or ^ 13 has
+  // a zero byte, cursor characters have their top bit in 0x80808080
+  int first = VDM1_SCAN_NONE;
+  uint64_t m = 0;
+
+  for(int c=0; c<64; c+=4)
+    {
+      uint32_t w, x, y;
+      memcpy(&w, row+c, 4);
+
+      if( first==VDM1_SCAN_NONE )
+        {
+          x = (w & 0x7f7f7f7f) ^ 0x0b0b0b0b;
+          y = (w & 0x7f7f7f7f) ^ 0x0d0d0d0d;
+          if( ((x-0x01010101) & ~x & 0x80808080) || ((y-0x01010101) & ~y & 0x80808080) )
+            for(int i=c; i<c+4; i++)
+              if( (row[i] & 0x7f)==11 || (row[i] & 0x7f)==13 )
+                {
+                  first = i;
+                  break;
+                }
+
+          if( cursor==NULL && first!=VDM1_SCAN_NONE ) break;
+        }
+
+      if( cursor!=NULL && (w & 0x80808080)!=0 )
+        for(int i=c; i<c+4; i++)
+          if( row[i] & 0x80 ) m |= (uint64_t) 1 << i;
+    }
+
+  if( cursor!=NULL ) *cursor = m;
+  return first;
+}
+
+
+#if defined(SCAN_AVX2)
+
+int vdm1_scan_row(const uint8_t *row, uint64_t *cursor)
+{
+  const __m256i low = _mm256_set1_epi8(0x7f), vt = _mm256_set1_epi8(11), cr = _mm256_set1_epi8(13);
+  __m256i a = _mm256_loadu_si256((const __m256i *) row);
+  __m256i b = _mm256_loadu_si256((const __m256i *) (row+32));
+  __m256i al = _mm256_and_si256(a, low), bl = _mm256_and_si256(b, low);
+  uint64_t ma = (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(al, vt), _mm256_cmpeq_epi8(al, cr)));
+  uint64_t mb = (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(bl, vt), _mm256_cmpeq_epi8(bl, cr)));
+
+  if( cursor!=NULL )
+    *cursor = (uint32_t) _mm256_movemask_epi8(a) | (uint64_t) (uint32_t) _mm256_movemask_epi8(b) << 32;
+  return first_bit(ma | mb << 32);
+}
+
+const char *vdm1_scan_impl(void) { return "AVX2"; }
+
+#elif defined(SCAN_SSE2)
+
+// CR/VT and cursor bits of 16 characters
+static inline void sse2_scan16(const uint8_t *p, uint32_t *crvt, uint32_t *cursor)
+{
+  const __m128i low = _mm_set1_epi8(0x7f), vt = _mm_set1_epi8(11), cr = _mm_set1_epi8(13);
+  __m128i v = _mm_loadu_si128((const __m128i *) p);
+  __m128i l = _mm_and_si128(v, low);
+  *crvt   = (uint32_t) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(l, vt), _mm_cmpeq_epi8(l, cr)));
+  *cursor = (uint32_t) _mm_movemask_epi8(v);
+}
+
+int vdm1_scan_row(const uint8_t *row, uint64_t *cursor)
+{
+  uint32_t e0, e1, e2, e3, c0, c1, c2, c3;
+  sse2_scan16(row,    &e0, &c0);
+  sse2_scan16(row+16, &e1, &c1);
+  sse2_scan16(row+32, &e2, &c2);
+  sse2_scan16(row+48, &e3, &c3);
+
+  if( cursor!=NULL )
+    *cursor = (uint64_t) (c0 | c1<<16) | (uint64_t) (c2 | c3<<16) << 32;
+  return first_bit((uint64_t) (e0 | e1<<16) | (uint64_t) (e2 | e3<<16) << 32);
+}
+
+const char *vdm1_scan_impl(void) { return "SSE2"; }
+
+#elif defined(SCAN_NEON)
+
+// bit i of the result set if byte i of a, b, c, d (64 bytes) is 0xff
+static uint64_t neon_mask(uint8x16_t a, uint8x16_t b, uint8x16_t c, uint8x16_t d)
+{
+  static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+  const uint8x16_t w = vld1q_u8(weights);
+
+  // pairwise additions until each byte holds the bits of 8 bytes
+  uint8x16_t ab = vpaddq_u8(vandq_u8(a, w), vandq_u8(b, w));
+  uint8x16_t cd = vpaddq_u8(vandq_u8(c, w), vandq_u8(d, w));
+  uint8x16_t s  = vpaddq_u8(ab, cd);
+  s = vpaddq_u8(s, s);
+  return vgetq_lane_u64(vreinterpretq_u64_u8(s), 0);
+}
+
+int vdm1_scan_row(const uint8_t *row, uint64_t *cursor)
+{
+  const uint8x16_t low = vdupq_n_u8(0x7f), top = vdupq_n_u8(0x80);
+  const uint8x16_t vt = vdupq_n_u8(11), cr = vdupq_n_u8(13);
+  uint8x16_t v[4], e[4];
+
+  for(int i=0; i<4; i++)
+    {
+      v[i] = vld1q_u8(row+16*i);
+      uint8x16_t l = vandq_u8(v[i], low);
+      e[i] = vorrq_u8(vceqq_u8(l, vt), vceqq_u8(l, cr));
+    }
+
+  if( cursor!=NULL )
+    *cursor = neon_mask(vtstq_u8(v[0], top), vtstq_u8(v[1], top), vtstq_u8(v[2], top), vtstq_u8(v[3], top));
+  return first_bit(neon_mask(e[0], e[1], e[2], e[3]));
+}
+
+const char *vdm1_scan_impl(void) { return "NEON"; }
+
+#else
+
+int vdm1_scan_row(const uint8_t *row, uint64_t *cursor)
+{
+  return vdm1_scan_row_portable(row, cursor);
+}
+
+const char *vdm1_scan_impl(void) { return "portable"; }
+
+#endif
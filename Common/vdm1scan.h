@@ -0,0 +1,76 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - video memory row scanning
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef VDM1SCAN_H
+#define VDM1SCAN_H
+
+#include <stdint.h>
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Scanning one row of 64 characters of video memory for the two things
+// that need a look at every character: the first CR (13) or VT (11),
+// where CR/VT blanking starts, and the cursor characters (bit 7 set).
+// The implementation is picked at compile time: AVX2, SSE2 (any x86-64),
+// NEON (AArch64) or, everywhere else, a portable one looking at 4
+// characters at a time.
+
+#define VDM1_SCAN_NONE 64
+
+// returns the position of the first CR or VT (bit 7 ignored) in the row,
+// VDM1_SCAN_NONE if there is none; if "cursor" is not NULL it gets bit c
+// set for each character c with bit 7 set
+int vdm1_scan_row(const uint8_t *row, uint64_t *cursor);
+
+// the portable implementation and a plain loop over each character
+// (reference for tests and benchmarks)
+int vdm1_scan_row_portable(const uint8_t *row, uint64_t *cursor);
+int vdm1_scan_row_scalar(const uint8_t *row, uint64_t *cursor);
+
+// name of the implementation vdm1_scan_row() uses
+const char *vdm1_scan_impl(void);
+
+// position of the lowest bit set in "mask" (which must not be 0), cleared in "mask"
+static inline int vdm1_scan_next(uint64_t *mask)
+{
+#if defined(__GNUC__)
+  int c = __builtin_ctzll(*mask);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  unsigned long c;
+  _BitScanForward64(&c, *mask);
+#else
+  int c = 0;
+  while( ((*mask >> c) & 1)==0 ) c++;
+#endif
+  *mask &= *mask-1;
+  return (int) c;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
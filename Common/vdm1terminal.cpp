@@ -0,0 +1,251 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - ANSI text terminal renderer
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include "vdm1terminal.h"
+
+
+// UTF-8 look-alikes of the character ROM's glyphs for 0-31 and 127
+static const char *glyphs[32] =
+  {"□", "┌", "┴", "┘", "ϟ", "⊠", "✓", "Ω",
+   "↰", "→", "≡", "↓", "↡", "←", "⊗", "⊙",
+   "⊟", "◷", "◶", "◵", "◴", "↙", "Π", "┤",
+   "⧖", "†", "ʔ", "⊖", "◰", "◱", "◲", "◳"};
+static const char *glyph_del = "▒";
+
+
+VDM1Terminal::VDM1Terminal(write_func f, void *ctx)
+{
+  m_write_func = f;
+  m_write_ctx  = ctx;
+  m_ascii = false;
+  memset(m_want, ' ', sizeof(m_want));
+  memset(m_shown, ' ', sizeof(m_shown));
+  m_dirty = false;
+  m_row = m_col = m_inverse = -1;
+  num_bytes = num_flushes = num_cells = 0;
+}
+
+
+void VDM1Terminal::set_ascii(bool ascii)
+{
+  m_ascii = ascii;
+}
+
+
+void VDM1Terminal::reset()
+{
+  // the terminal is blank afterwards
+  // lines 1-16 scroll on their own (see scroll()), no auto wrap after column 64
+  m_out += "\033[m\033[1;16r\033[H\033[2J\033[?25l\033[?7l";
+  m_row = m_col = m_inverse = 0;
+  memset(m_shown, ' ', sizeof(m_shown));
+  m_status.clear();
+  m_dirty = true;
+  flush();
+}
+
+
+void VDM1Terminal::finish()
+{
+  m_out += "\033[m\033[r\033[17;1H\033[?25h\033[?7h";
+  m_row = m_col = m_inverse = -1;
+  send();
+}
+
+
+void VDM1Terminal::status(const char *text)
+{
+  if( m_status==text ) return;
+  m_status = text;
+
+  m_out += "\033[m\033[18;1H\033[K";
+  m_out += text;
+  m_row = m_col = -1;
+  m_inverse = 0;
+  send();
+}
+
+
+// -----------------------------------------------------------------------------
+// drawing
+// -----------------------------------------------------------------------------
+
+
+void VDM1Terminal::end_update()
+{
+  flush();
+}
+
+
+void VDM1Terminal::draw_char(int row, int col, uint8_t ch, bool inverse)
+{
+  m_want[row*VDM1_COLS+col] = (ch & 0x7f) | (inverse ? 0x80 : 0);
+  m_dirty = true;
+}
+
+
+void VDM1Terminal::fill(int row, int col, int h, int w, bool inverse)
+{
+  for(int r=row; r<row+h; r++)
+    memset(m_want+r*VDM1_COLS+col, ' ' | (inverse ? 0x80 : 0), w);
+  m_dirty = true;
+}
+
+
+void VDM1Terminal::flush()
+{
+  if( !m_dirty ) return;
+  m_dirty = false;
+
+  scroll();
+
+  uint64_t cells = num_cells;
+  for(int r=0; r<VDM1_ROWS; r++)
+    for(int c=0; c<VDM1_COLS; c++)
+      {
+        int i = r*VDM1_COLS+c;
+        if( m_want[i]==m_shown[i] ) continue;
+
+        move(r, c);
+        attr((m_want[i] & 0x80)!=0);
+        put(m_want[i]);
+        m_shown[i] = m_want[i];
+        num_cells++;
+      }
+
+  if( num_cells!=cells ) num_flushes++;
+  send();
+}
+
+
+// -----------------------------------------------------------------------------
+// output
+// -----------------------------------------------------------------------------
+
+
+static int glyph_len(uint8_t cell, bool ascii)
+{
+  uint8_t ch = cell & 0x7f;
+  if( ascii || (ch>=32 && ch<127) ) return 1;
+  return (int) strlen(ch==127 ? glyph_del : glyphs[ch]);
+}
+
+
+void VDM1Terminal::scroll()
+{
+  // the picture moved up by k lines (e.g. the start row register changed
+  // for a scrolling listing) if more lines match that way than in place
+  int best = 0, best_k = 0;
+  for(int k=0; k<VDM1_ROWS/2; k++)
+    {
+      int n = 0;
+      for(int r=0; r<VDM1_ROWS-k; r++)
+        if( memcmp(m_want+r*VDM1_COLS, m_shown+(r+k)*VDM1_COLS, VDM1_COLS)==0 ) n++;
+      if( n>best ) { best = n; best_k = k; }
+    }
+  if( best_k==0 ) return;
+
+  // line feeds on the last line of the scrolling region (lines 1-16)
+  attr(false);
+  move(VDM1_ROWS-1, 0);
+  for(int k=0; k<best_k; k++) m_out += '\n';
+
+  memmove(m_shown, m_shown+best_k*VDM1_COLS, (VDM1_ROWS-best_k)*VDM1_COLS);
+  memset(m_shown+(VDM1_ROWS-best_k)*VDM1_COLS, ' ', best_k*VDM1_COLS);
+}
+
+
+void VDM1Terminal::move(int row, int col)
+{
+  if( row==m_row && col==m_col ) return;
+
+  // cheapest of: absolute position, carriage return/line feed plus
+  // moving right, or re-sending the characters in between
+  char best[32], buf[32];
+  snprintf(best, sizeof(best), col>0 ? "\033[%i;%iH" : "\033[%iH", row+1, col+1);
+
+  if( m_row>=0 && (row==m_row || row==m_row+1) )
+    {
+      const char *start = row==m_row ? "\r" : "\r\n";
+      if( col==0 )
+        snprintf(buf, sizeof(buf), "%s", start);
+      else
+        snprintf(buf, sizeof(buf), col==1 ? "%s\033[C" : "%s\033[%iC", start, col);
+      if( strlen(buf)<strlen(best) ) strcpy(best, buf);
+    }
+
+  if( row==m_row && m_col>=0 && col>m_col )
+    {
+      snprintf(buf, sizeof(buf), col-m_col==1 ? "\033[C" : "\033[%iC", col-m_col);
+      if( strlen(buf)<strlen(best) ) strcpy(best, buf);
+
+      // the characters in between must be shown with the current attribute
+      int len = 0;
+      for(int c=m_col; c<col && len<=(int) strlen(best); c++)
+        {
+          uint8_t s = m_shown[row*VDM1_COLS+c];
+          if( m_inverse<0 || ((s & 0x80)!=0)!=(m_inverse==1) ) { len = 1000; break; }
+          len += glyph_len(s, m_ascii);
+        }
+
+      if( len<=(int) strlen(best) )
+        {
+          for(int c=m_col; c<col; c++) put(m_shown[row*VDM1_COLS+c]);
+          return;
+        }
+    }
+
+  m_out += best;
+  m_row = row;
+  m_col = col;
+}
+
+
+void VDM1Terminal::attr(bool inverse)
+{
+  if( m_inverse==(inverse ? 1 : 0) ) return;
+  m_out += inverse ? "\033[7m" : "\033[m";
+  m_inverse = inverse ? 1 : 0;
+}
+
+
+void VDM1Terminal::put(uint8_t cell)
+{
+  uint8_t ch = cell & 0x7f;
+  if( ch>=32 && ch<127 )
+    m_out += (char) ch;
+  else if( m_ascii )
+    m_out += '.';
+  else
+    m_out += ch==127 ? glyph_del : glyphs[ch];
+
+  // without auto wrap the cursor stays on the last column
+  if( ++m_col>=VDM1_COLS ) m_col = -1;
+}
+
+
+void VDM1Terminal::send()
+{
+  if( m_out.empty() ) return;
+  m_write_func(m_write_ctx, m_out.data(), (int) m_out.size());
+  num_bytes += m_out.size();
+  m_out.clear();
+}
@@ -0,0 +1,96 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - ANSI text terminal renderer
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef VDM1TERMINAL_H
+#define VDM1TERMINAL_H
+
+#include <stdint.h>
+#include <string>
+#include "vdm1core.h"
+
+
+// Renders into a text terminal (VT100/ANSI escape sequences, UTF-8): each
+// character cell is one character of the terminal's top 16 lines, cursor
+// characters and inverse video in reverse video, the character ROM's
+// glyphs for control characters (0-31, 127) as similar looking Unicode
+// characters (or '.' in ASCII mode). Line 18 can show a status message.
+//
+// Drawing only changes the wanted picture, end_update() (or flush()) then
+// compares it with what the terminal shows and sends the difference: the
+// changed characters plus the cursor movements and attribute changes to
+// get to them, where re-sending a few unchanged characters is cheaper than
+// a cursor movement it does that instead. Nothing is sent for cells that
+// were drawn with what they already show, so several writes to a cell or a
+// sprite erased and drawn again within one update cost nothing. When the
+// picture moved up (a listing scrolling with the start row register) the
+// terminal scrolls its lines instead of getting all of them again. Meant to
+// be driven by a FramePacer (i.e. one update per frame) for remote
+// viewing over slow links.
+class VDM1Terminal : public VDM1Surface
+{
+ public:
+  // receives the terminal output
+  typedef void (*write_func)(void *ctx, const char *data, int size);
+
+  VDM1Terminal(write_func f, void *ctx);
+
+  // control characters as '.' (for terminals without UTF-8)
+  void set_ascii(bool ascii);
+
+  // clear the terminal and hide its cursor, everything is sent again
+  void reset();
+
+  // reset the attributes and put the terminal's cursor below the screen
+  void finish();
+
+  // show "text" in line 18 (below the screen)
+  void status(const char *text);
+
+  virtual void end_update();
+  virtual void draw_char(int row, int col, uint8_t ch, bool inverse);
+  virtual void fill(int row, int col, int h, int w, bool inverse);
+
+  // send what changed
+  void flush();
+
+  // statistics
+  uint64_t num_bytes, num_flushes, num_cells; // bytes sent, flushes that sent anything, cells sent
+
+ private:
+  void scroll();
+  void move(int row, int col);
+  void attr(bool inverse);
+  void put(uint8_t cell);
+  void send();
+
+  write_func  m_write_func;
+  void       *m_write_ctx;
+  bool        m_ascii;
+
+  // cells: character (bits 0-6) and inverse (bit 7)
+  uint8_t     m_want[VDM1_ROWS*VDM1_COLS], m_shown[VDM1_ROWS*VDM1_COLS];
+  bool        m_dirty;
+
+  // terminal state: cursor position (row -1 = unknown), reverse video (-1 = unknown)
+  int         m_row, m_col, m_inverse;
+  std::string m_out, m_status;
+};
+
+
+#endif
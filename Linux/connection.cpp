@@ -0,0 +1,340 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - connections to the Altair simulator (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "connection.h"
+#include "custombaud.h"
+
+
+static speed_t baud_constant(int baud)
+{
+  switch( baud )
+    {
+    case 1200:    return B1200;
+    case 2400:    return B2400;
+    case 4800:    return B4800;
+    case 9600:    return B9600;
+    case 19200:   return B19200;
+    case 38400:   return B38400;
+    case 57600:   return B57600;
+    case 115200:  return B115200;
+    case 230400:  return B230400;
+    case 460800:  return B460800;
+    case 500000:  return B500000;
+    case 576000:  return B576000;
+    case 921600:  return B921600;
+    case 1000000: return B1000000;
+    case 1152000: return B1152000;
+    case 1500000: return B1500000;
+    case 2000000: return B2000000;
+    default:      return 0;
+    }
+}
+
+
+static bool set_raw(int fd)
+{
+  struct termios tio;
+  if( tcgetattr(fd, &tio)<0 ) return false;
+
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+
+  // With VTIME=0 the tty layer only reports the descriptor readable once
+  // VMIN bytes have arrived, so anything above 1 would hold back the last
+  // bytes of a screen update indefinitely. A VTIME>0 does not help either
+  // (it is ignored for poll/epoll). Wake up on the first byte and let the
+  // reader take everything that has accumulated by then.
+  tio.c_cc[VMIN]  = 1;
+  tio.c_cc[VTIME] = 0;
+
+  return tcsetattr(fd, TCSANOW, &tio)==0;
+}
+
+
+int open_serial(const char *device, int baud)
+{
+  int fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if( fd<0 )
+    {
+      fprintf(stderr, "Unable to open %s: %s\n", device, strerror(errno));
+      return -1;
+    }
+
+  bool ok = set_raw(fd);
+  if( ok )
+    {
+      speed_t b = baud_constant(baud);
+      if( b!=0 )
+        {
+          struct termios tio;
+          ok = tcgetattr(fd, &tio)==0 && cfsetispeed(&tio, b)==0 && cfsetospeed(&tio, b)==0
+            && tcsetattr(fd, TCSANOW, &tio)==0;
+        }
+      else
+        ok = set_custom_baud(fd, baud)==0;
+    }
+
+  if( !ok )
+    {
+      fprintf(stderr, "Unable to configure %s for %i baud: %s\n", device, baud, strerror(errno));
+      close(fd);
+      return -1;
+    }
+
+  // ask the driver to pass received data on right away instead of
+  // collecting it (USB serial adapters otherwise wait up to 16ms)
+  struct serial_struct ss;
+  if( ioctl(fd, TIOCGSERIAL, &ss)==0 )
+    {
+      ss.flags |= ASYNC_LOW_LATENCY;
+      ioctl(fd, TIOCSSERIAL, &ss);
+    }
+
+  tcflush(fd, TCIOFLUSH);
+  return fd;
+}
+
+
+int open_pty(char *slave, int slave_size, int *slave_fd)
+{
+  *slave_fd = -1;
+  int fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if( fd<0 || grantpt(fd)<0 || unlockpt(fd)<0 || ptsname_r(fd, slave, slave_size)!=0 )
+    {
+      fprintf(stderr, "Unable to create pseudo terminal: %s\n", strerror(errno));
+      if( fd>=0 ) close(fd);
+      return -1;
+    }
+
+  // make sure nothing is translated until the simulator configures the
+  // slave side itself
+  *slave_fd = open(slave, O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if( *slave_fd>=0 ) set_raw(*slave_fd);
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  return fd;
+}
+
+
+static void set_nodelay(int fd)
+{
+  // key presses are tiny packets that should go out immediately
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+
+int open_tcp(const char *host, int port)
+{
+  struct addrinfo hints, *res, *ai;
+  char service[16];
+  int fd = -1, err;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(service, sizeof(service), "%i", port);
+
+  err = getaddrinfo(host, service, &hints, &res);
+  if( err!=0 )
+    {
+      fprintf(stderr, "Unable to resolve %s: %s\n", host, gai_strerror(err));
+      return -1;
+    }
+
+  for(ai=res; ai!=NULL && fd<0; ai=ai->ai_next)
+    {
+      fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+      if( fd>=0 && connect(fd, ai->ai_addr, ai->ai_addrlen)<0 )
+        { close(fd); fd = -1; }
+    }
+  freeaddrinfo(res);
+
+  if( fd<0 )
+    {
+      fprintf(stderr, "Unable to connect to %s:%i: %s\n", host, port, strerror(errno));
+      return -1;
+    }
+
+  set_nodelay(fd);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+
+int open_udp(const char *host, int port)
+{
+  struct addrinfo hints, *res, *ai;
+  char service[16];
+  int fd = -1, err;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  snprintf(service, sizeof(service), "%i", port);
+
+  err = getaddrinfo(host, service, &hints, &res);
+  if( err!=0 )
+    {
+      fprintf(stderr, "Unable to resolve %s: %s\n", host, gai_strerror(err));
+      return -1;
+    }
+
+  // "connecting" only sets the default destination and makes the kernel
+  // drop datagrams from anyone else
+  for(ai=res; ai!=NULL && fd<0; ai=ai->ai_next)
+    {
+      fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+      if( fd>=0 && connect(fd, ai->ai_addr, ai->ai_addrlen)<0 )
+        { close(fd); fd = -1; }
+    }
+  freeaddrinfo(res);
+
+  if( fd<0 )
+    fprintf(stderr, "Unable to set up UDP to %s:%i: %s\n", host, port, strerror(errno));
+
+  return fd;
+}
+
+
+static void split_host_port(const char *spec, char *host, int host_size, int *port)
+{
+  snprintf(host, host_size, "%s", spec);
+  char *colon = strrchr(host, ':');
+  if( colon!=NULL && strchr(host, ':')==colon )
+    {
+      *colon = 0;
+      *port = atoi(colon+1);
+    }
+}
+
+
+int open_connection(const char *spec, int baud, bool *is_tcp,
+                    char *pty_slave, int pty_slave_size, int *pty_slave_fd)
+{
+  *is_tcp = false;
+
+  if( strncmp(spec, "/dev/", 5)==0 )
+    return open_serial(spec, baud);
+  else if( strcmp(spec, "pty")==0 )
+    return open_pty(pty_slave, pty_slave_size, pty_slave_fd);
+  else if( strncmp(spec, "udp:", 4)==0 )
+    {
+      char host[256];
+      int  port = 8801;
+      split_host_port(spec+4, host, sizeof(host), &port);
+      return open_udp(host, port);
+    }
+  else
+    {
+      char host[256];
+      int  port = 8800;
+      split_host_port(spec, host, sizeof(host), &port);
+
+      *is_tcp = true;
+      return open_tcp(host, port);
+    }
+}
+
+
+struct addrinfo *resolve_tcp(const char *spec)
+{
+  struct addrinfo hints, *res;
+  char host[256], service[16];
+  int port = 8800, err;
+
+  split_host_port(spec, host, sizeof(host), &port);
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(service, sizeof(service), "%i", port);
+
+  err = getaddrinfo(host, service, &hints, &res);
+  if( err!=0 )
+    {
+      fprintf(stderr, "Unable to resolve %s: %s\n", host, gai_strerror(err));
+      return NULL;
+    }
+
+  return res;
+}
+
+
+int start_tcp(const struct addrinfo *ai)
+{
+  int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+  if( fd>=0 && connect(fd, ai->ai_addr, ai->ai_addrlen)<0 && errno!=EINPROGRESS )
+    {
+      int err = errno;
+      close(fd);
+      errno = err;
+      return -1;
+    }
+
+  return fd;
+}
+
+
+int finish_tcp(int fd)
+{
+  int err = 0;
+  socklen_t len = sizeof(err);
+  if( getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len)<0 ) err = errno;
+  if( err==0 ) set_nodelay(fd);
+  return err;
+}
+
+
+bool write_all(int fd, const uint8_t *data, int size)
+{
+  while( size>0 )
+    {
+      ssize_t n = write(fd, data, size);
+      if( n>0 )
+        { data += n; size -= n; }
+      else if( n<0 && (errno==EAGAIN || errno==EWOULDBLOCK) )
+        {
+          struct pollfd p = {fd, POLLOUT, 0};
+          poll(&p, 1, 1000);
+        }
+      else if( n<0 && errno==EINTR )
+        continue;
+      else
+        return false;
+    }
+
+  return true;
+}
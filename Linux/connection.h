@@ -0,0 +1,71 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - connections to the Altair simulator (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stdint.h>
+#include <netdb.h>
+
+
+// All functions return a non-blocking file descriptor or -1 on error
+// (with a message printed to stderr).
+
+// serial port in raw 8N1 mode, any baud rate supported by the driver
+int open_serial(const char *device, int baud);
+
+// new pseudo terminal in raw mode, the name of the slave side (to be
+// given to the simulator) is stored in "slave" (at least 64 bytes)
+// the slave side is kept open as "slave_fd" (-1 if that failed) until
+// the caller closes it together with the master, otherwise the master
+// reports a hangup whenever the simulator does not have it open
+int open_pty(char *slave, int slave_size, int *slave_fd);
+
+// TCP connection to the simulator's VDM-1 socket
+int open_tcp(const char *host, int port);
+
+// UDP socket connected to a datagram sender (see VDM_DG_* in vdm1proto.h)
+int open_udp(const char *host, int port);
+
+// open a connection given as "/dev/..." (serial), "pty", "udp:host[:port]"
+// or "host[:port]"
+// for TCP connections "is_tcp" is set (the server sends a greeting line),
+// for "pty" see open_pty()
+int open_connection(const char *spec, int baud, bool *is_tcp,
+                    char *pty_slave, int pty_slave_size, int *pty_slave_fd);
+
+// The steps of open_tcp() for a caller that must not block (a Reactor):
+// - resolve_tcp() looks up the addresses for "host[:port]" (this may
+//   take a while, so run it in a thread), the result is released with
+//   freeaddrinfo() and NULL on error
+// - start_tcp() begins connecting to one of them, the returned socket
+//   becomes writable once the outcome is known (-1 and errno set if the
+//   attempt failed right away, nothing is printed)
+// - finish_tcp() then returns 0 if the connection is up, otherwise the
+//   errno value it failed with
+struct addrinfo *resolve_tcp(const char *spec);
+int start_tcp(const struct addrinfo *ai);
+int finish_tcp(int fd);
+
+// write all data, waiting while the descriptor is not writable
+// returns false on error
+bool write_all(int fd, const uint8_t *data, int size);
+
+
+#endif
@@ -0,0 +1,41 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - non-standard serial baud rates (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// The kernel's termios2 interface can not be used in the same source file
+// as the C library's <termios.h>, hence this separate file.
+
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+#include "custombaud.h"
+
+
+int set_custom_baud(int fd, int baud)
+{
+  struct termios2 tio;
+
+  if( ioctl(fd, TCGETS2, &tio)<0 )
+    return -1;
+
+  tio.c_cflag &= ~CBAUD;
+  tio.c_cflag |= BOTHER;
+  tio.c_ispeed = baud;
+  tio.c_ospeed = baud;
+
+  return ioctl(fd, TCSETS2, &tio);
+}
@@ -0,0 +1,35 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - non-standard serial baud rates (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef CUSTOMBAUD_H
+#define CUSTOMBAUD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// set an arbitrary baud rate (such as 750000) on a serial port
+// returns 0 on success, -1 on error (errno set)
+int set_custom_baud(int fd, int baud);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,380 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - automation scripts
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <time.h>
+#include "expectscript.h"
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+ExpectScript::ExpectScript(Reactor *reactor, VDM1Core *core) :
+  matcher(core), wait_time("script waits", "ms")
+{
+  m_reactor   = reactor;
+  m_core      = core;
+  m_send_func = NULL;
+  m_send_ctx  = NULL;
+  m_done_func = NULL;
+  m_done_ctx  = NULL;
+  m_pc        = 0;
+  m_timeout   = 10;
+  m_timer     = reactor->add_timer(timer, this);
+  m_running   = m_done = m_ok = m_busy = false;
+  m_pattern   = -1;
+  m_only_new  = false;
+  m_wait_start = 0;
+  num_waits = num_sends = 0;
+}
+
+
+ExpectScript::~ExpectScript()
+{
+  m_reactor->remove_timer(m_timer);
+}
+
+
+void ExpectScript::set_send_callback(send_func f, void *ctx)
+{
+  m_send_func = f;
+  m_send_ctx  = ctx;
+}
+
+
+void ExpectScript::set_done_callback(done_func f, void *ctx)
+{
+  m_done_func = f;
+  m_done_ctx  = ctx;
+}
+
+
+bool ExpectScript::load(const char *fname)
+{
+  FILE *f = fopen(fname, "r");
+  if( f==NULL )
+    {
+      fprintf(stderr, "Unable to open %s: %s\n", fname, strerror(errno));
+      return false;
+    }
+
+  std::string text;
+  char buf[4096];
+  size_t n;
+  while( (n=fread(buf, 1, sizeof(buf), f))>0 ) text.append(buf, n);
+  fclose(f);
+
+  return parse(text.c_str(), fname);
+}
+
+
+bool ExpectScript::parse(const char *text, const char *name)
+{
+  bool ok = true;
+  m_name = name;
+  m_commands.clear();
+
+  for(int line=1; *text!=0; line++)
+    {
+      const char *end = strchr(text, '\n');
+      std::string s(text, end!=NULL ? end-text : strlen(text));
+      text = end!=NULL ? end+1 : text+s.size();
+
+      // blank lines and comments
+      const char *p = s.c_str();
+      while( *p==' ' || *p=='\t' || *p=='\r' ) p++;
+      if( *p==0 || *p=='#' ) continue;
+
+      command c;
+      std::string error;
+      if( parse_line(p, line, c, error) )
+        m_commands.push_back(c);
+      else
+        {
+          fprintf(stderr, "%s:%i: %s\n", name, line, error.c_str());
+          ok = false;
+        }
+    }
+
+  return ok;
+}
+
+
+// a quoted string with C-like escapes, "p" is left after the closing quote
+static bool parse_string(const char *&p, std::string &out)
+{
+  if( *p!='"' ) return false;
+
+  for(p++; *p!='"'; p++)
+    {
+      if( *p==0 ) return false;
+      if( *p!='\\' )
+        {
+          out += *p;
+          continue;
+        }
+
+      switch( *++p )
+        {
+        case 'r':  out += '\r'; break;
+        case 'n':  out += '\n'; break;
+        case 't':  out += '\t'; break;
+        case 'e':  out += '\033'; break;
+        case '\\': out += '\\'; break;
+        case '"':  out += '"'; break;
+        case 'x':
+          {
+            int v = 0, n;
+            for(n=0; n<2 && isxdigit((unsigned char) p[1]); n++, p++)
+              v = v*16 + (isdigit((unsigned char) p[1]) ? p[1]-'0' : (tolower((unsigned char) p[1])-'a'+10));
+            if( n==0 ) return false;
+            out += (char) v;
+            break;
+          }
+        default: return false;
+        }
+    }
+
+  p++;
+  return true;
+}
+
+
+bool ExpectScript::parse_line(const char *p, int line, command &c, std::string &error)
+{
+  const char *word = p;
+  while( isalpha((unsigned char) *p) ) p++;
+  std::string op(word, p-word);
+  while( *p==' ' || *p=='\t' ) p++;
+
+  c.line  = line;
+  c.regex = false;
+  c.value = 0;
+
+  if( op=="wait" || op=="expect" )
+    {
+      c.op = op=="wait" ? OP_WAIT : OP_EXPECT;
+      if( *p=='/' )
+        {
+          // up to the last slash, so the expression may contain slashes
+          const char *last = strrchr(p, '/');
+          if( last==p )
+            {
+              error = "missing / at the end of the regular expression";
+              return false;
+            }
+
+          c.arg.assign(p+1, last-p-1);
+          c.regex = true;
+          p = last+1;
+          regex_t re;
+          int err = regcomp(&re, c.arg.c_str(), REG_EXTENDED | REG_NOSUB);
+          if( err!=0 )
+            {
+              char msg[256];
+              regerror(err, &re, msg, sizeof(msg));
+              error = std::string("invalid regular expression: ") + msg;
+              return false;
+            }
+          regfree(&re);
+        }
+      else if( !parse_string(p, c.arg) )
+        {
+          error = "expected \"text\" or /regex/";
+          return false;
+        }
+
+      if( c.arg.empty() )
+        {
+          error = "empty pattern";
+          return false;
+        }
+    }
+  else if( op=="send" )
+    {
+      c.op = OP_SEND;
+      if( !parse_string(p, c.arg) )
+        {
+          error = "expected \"text\"";
+          return false;
+        }
+    }
+  else if( op=="sleep" || op=="timeout" )
+    {
+      c.op = op=="sleep" ? OP_SLEEP : OP_TIMEOUT;
+      char *end;
+      c.value = strtod(p, &end);
+      if( end==p || c.value<0 )
+        {
+          error = "expected seconds";
+          return false;
+        }
+      p = end;
+    }
+  else
+    {
+      error = "unknown command \"" + op + "\"";
+      return false;
+    }
+
+  while( *p==' ' || *p=='\t' || *p=='\r' ) p++;
+  if( *p!=0 )
+    {
+      error = std::string("unexpected \"") + p + "\"";
+      return false;
+    }
+
+  return true;
+}
+
+
+void ExpectScript::start()
+{
+  m_pc      = 0;
+  m_timeout = 10;
+  m_running = true;
+  m_done    = false;
+  matcher.mark();
+  next();
+}
+
+
+void ExpectScript::poll()
+{
+  if( !m_running || m_busy || m_pattern<0 ) return;
+
+  if( matcher.find(m_pattern, m_only_new)>=0 )
+    {
+      wait_time.add((uint64_t) ((now_sec()-m_wait_start)*1000));
+      matcher.remove(m_pattern);
+      m_pattern = -1;
+      m_reactor->set_timer(m_timer, 0);
+      next();
+    }
+}
+
+
+void ExpectScript::next()
+{
+  // sending may make the owner call poll()
+  m_busy = true;
+
+  while( m_running && m_pc<m_commands.size() )
+    {
+      const command &c = m_commands[m_pc++];
+      switch( c.op )
+        {
+        case OP_TIMEOUT:
+          m_timeout = c.value;
+          break;
+
+        case OP_SEND:
+          // what was on the screen before is not the answer
+          matcher.mark();
+          num_sends++;
+          if( m_send_func!=NULL ) m_send_func(m_send_ctx, (const uint8_t *) c.arg.data(), (int) c.arg.size());
+          break;
+
+        case OP_SLEEP:
+          if( c.value>0 )
+            {
+              m_reactor->set_timer(m_timer, c.value);
+              m_busy = false;
+              return;
+            }
+          break;
+
+        case OP_WAIT:
+        case OP_EXPECT:
+          num_waits++;
+          m_only_new = c.op==OP_EXPECT;
+          if( matcher.find(m_pattern=matcher.add(c.arg.c_str(), c.regex), m_only_new)>=0 )
+            {
+              wait_time.add(0);
+              matcher.remove(m_pattern);
+              m_pattern = -1;
+              break;
+            }
+
+          m_wait_start = now_sec();
+          if( m_timeout>0 ) m_reactor->set_timer(m_timer, m_timeout);
+          m_busy = false;
+          return;
+        }
+    }
+
+  m_busy = false;
+  if( m_running ) finish(true);
+}
+
+
+void ExpectScript::finish(bool ok)
+{
+  m_running = false;
+  m_done    = true;
+  m_ok      = ok;
+  m_reactor->set_timer(m_timer, 0);
+  if( m_pattern>=0 ) matcher.remove(m_pattern);
+  m_pattern = -1;
+
+  if( m_done_func!=NULL ) m_done_func(m_done_ctx, ok);
+}
+
+
+void ExpectScript::timer(void *ctx)
+{
+  ExpectScript *s = (ExpectScript *) ctx;
+  if( !s->m_running ) return;
+
+  if( s->m_pattern<0 )
+    {
+      // sleep is over
+      s->next();
+      return;
+    }
+
+  // the last change may not have been polled yet
+  s->poll();
+  if( s->m_pattern<0 ) return;
+
+  const command &c = s->m_commands[s->m_pc-1];
+  char screen[VDM1_ROWS*(VDM1_COLS+1)+1];
+  s->m_core->get_text(screen, "\n");
+  fprintf(stderr, "%s:%i: timed out after %gs waiting for %s%s%s\n%s", s->m_name.c_str(), c.line,
+          s->m_timeout, c.regex ? "/" : "\"", c.arg.c_str(), c.regex ? "/" : "\"", screen);
+  s->finish(false);
+}
+
+
+void ExpectScript::print_stats(FILE *f)
+{
+  fprintf(f, "script: %llu waits, %llu sends; matcher: %llu checks, %llu rows converted, %llu searches\n",
+          (unsigned long long) num_waits, (unsigned long long) num_sends,
+          (unsigned long long) matcher.num_checks, (unsigned long long) matcher.num_rows,
+          (unsigned long long) matcher.num_searches);
+  wait_time.print(f);
+}
@@ -0,0 +1,121 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - automation scripts
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef EXPECTSCRIPT_H
+#define EXPECTSCRIPT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "reactor.h"
+#include "vdm1core.h"
+#include "screenmatcher.h"
+#include "histogram.h"
+
+
+// Runs a script that types into the Altair and waits for its output on the
+// screen, for regression runs of CUTER, CP/M and the like. One command per
+// line, "#" starts a comment:
+//   wait "text" | /regex/    wait until it is on the screen
+//   expect "text" | /regex/  wait until it shows up in a row that changed
+//                            since the last send (the old prompt does not
+//                            count, but the echo of the command does, so
+//                            anchor prompts: /^A>$/)
+//   send "text"              type the text (\r, \n, \t, \e, \\, \", \xHH)
+//   sleep seconds
+//   timeout seconds          limit for the following waits (default 10, 0 = none)
+// Patterns are matched against one row at a time (see screenmatcher.h).
+// A wait that times out ends the script with an error message and the
+// screen's text. The owner calls poll() whenever the screen may have
+// changed (after passing received data to the core), checking costs a
+// comparison of 16 row hashes plus a look at the rows that changed.
+class ExpectScript
+{
+ public:
+  typedef void (*send_func)(void *ctx, const uint8_t *data, int size);
+  typedef void (*done_func)(void *ctx, bool ok);
+
+  ExpectScript(Reactor *reactor, VDM1Core *core);
+  ~ExpectScript();
+
+  void set_send_callback(send_func f, void *ctx);
+  void set_done_callback(done_func f, void *ctx);
+
+  // load a script from a file or from text ("name" for messages), errors
+  // are printed to stderr, returns false on errors
+  bool load(const char *fname);
+  bool parse(const char *text, const char *name);
+
+  // run from the first command
+  void start();
+
+  // the screen may have changed
+  void poll();
+
+  bool running() const { return m_running; }
+  bool succeeded() const { return m_done && m_ok; }
+
+  void print_stats(FILE *f);
+
+  ScreenMatcher matcher;
+
+  // statistics
+  uint64_t  num_waits, num_sends;
+  Histogram wait_time;  // milliseconds from starting a wait until the pattern was found
+
+ private:
+  enum op_t { OP_WAIT, OP_EXPECT, OP_SEND, OP_SLEEP, OP_TIMEOUT };
+
+  struct command
+  {
+    op_t        op;
+    int         line;
+    std::string arg;     // pattern or text to send
+    bool        regex;
+    double      value;   // seconds
+  };
+
+  bool parse_line(const char *p, int line, command &c, std::string &error);
+  void next();
+  void finish(bool ok);
+  static void timer(void *ctx);
+
+  Reactor  *m_reactor;
+  VDM1Core *m_core;
+  send_func m_send_func;
+  void     *m_send_ctx;
+  done_func m_done_func;
+  void     *m_done_ctx;
+
+  std::string          m_name;
+  std::vector<command> m_commands;
+  size_t    m_pc;
+  double    m_timeout;
+  int       m_timer;
+  bool      m_running, m_done, m_ok, m_busy;
+
+  // the wait in progress: pattern id (-1 = none) and when it started
+  int       m_pattern;
+  bool      m_only_new;
+  double    m_wait_start;
+};
+
+
+#endif
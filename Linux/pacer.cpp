@@ -0,0 +1,150 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - fixed-rate frame pacer
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <time.h>
+#include "pacer.h"
+
+
+static int64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+
+FramePacer::FramePacer(Reactor *reactor, VDM1Core *core) :
+  frame_time("frame time", "us"),
+  latency("update-to-present latency", "us"),
+  lateness("tick lateness", "us")
+{
+  m_reactor = reactor;
+  m_core = core;
+  m_present_func = NULL;
+  m_present_ctx = NULL;
+  m_timer = -1;
+  m_hz = 0;
+  m_start = m_pending_since = 0;
+  m_deadlines = 0;
+  num_ticks = num_presents = num_missed = 0;
+}
+
+
+FramePacer::~FramePacer()
+{
+  stop();
+}
+
+
+void FramePacer::set_present_callback(present_func f, void *ctx)
+{
+  m_present_func = f;
+  m_present_ctx  = ctx;
+}
+
+
+void FramePacer::start(double hz)
+{
+  stop();
+  m_core->set_paced(true);
+  m_hz = hz;
+
+  if( hz>0 )
+    {
+      // timerfd intervals don't drift, deadlines are start + n/hz
+      if( m_timer<0 ) m_timer = m_reactor->add_timer(tick, this);
+      m_start = now_us();
+      m_deadlines = 0;
+      m_reactor->set_timer(m_timer, 1/hz, 1/hz);
+    }
+}
+
+
+void FramePacer::stop()
+{
+  if( m_timer>=0 )
+    {
+      m_reactor->remove_timer(m_timer);
+      m_timer = -1;
+    }
+
+  // back to drawing each change as it arrives
+  if( m_core->paced() ) m_core->set_paced(false);
+}
+
+
+void FramePacer::data_received(int64_t t)
+{
+  if( m_pending_since==0 && m_core->frame_pending() )
+    m_pending_since = t!=0 ? t : now_us();
+}
+
+
+void FramePacer::tick(void *ctx)
+{
+  FramePacer *p = (FramePacer *) ctx;
+  int64_t now = now_us();
+
+  // more than one expiration: the previous tick took so long (or some other
+  // event handler did) that whole frames went by without a present
+  uint64_t n = p->m_reactor->timer_expirations(p->m_timer);
+  if( n>1 ) p->num_missed += n-1;
+  p->m_deadlines += n;
+
+  int64_t deadline = p->m_start + (int64_t) (p->m_deadlines*1e6/p->m_hz);
+  p->lateness.add(now>deadline ? now-deadline : 0);
+
+  p->vsync();
+}
+
+
+void FramePacer::vsync()
+{
+  num_ticks++;
+  if( m_core->frame_pending() )
+    {
+      int64_t t = now_us();
+      m_core->present();
+      int64_t done = now_us();
+
+      frame_time.add(done-t);
+      if( m_pending_since!=0 ) latency.add(done-m_pending_since);
+      num_presents++;
+
+      if( m_present_func!=NULL ) m_present_func(m_present_ctx);
+    }
+
+  m_pending_since = 0;
+}
+
+
+void FramePacer::print_stats(FILE *f)
+{
+  if( m_hz>0 )
+    fprintf(f, "pacer: %.0f Hz, %llu ticks, %llu presents, %llu missed deadlines\n", m_hz,
+            (unsigned long long) num_ticks, (unsigned long long) num_presents,
+            (unsigned long long) num_missed);
+  else
+    fprintf(f, "pacer: vsync, %llu ticks, %llu presents\n",
+            (unsigned long long) num_ticks, (unsigned long long) num_presents);
+
+  frame_time.print(f);
+  latency.print(f);
+  if( m_hz>0 ) lateness.print(f);
+}
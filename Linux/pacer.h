@@ -0,0 +1,85 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - fixed-rate frame pacer
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "reactor.h"
+#include "vdm1core.h"
+#include "histogram.h"
+
+
+// Presents the screen at a fixed rate (a virtual vsync) instead of drawing
+// each change as it arrives: the core is switched to paced mode, so it only
+// collects changes (see VDM1Core::set_paced()), and on each tick everything
+// that changed since the last one is drawn in one batch. At most one present
+// per tick no matter how much data arrives, and every change shows up at the
+// next tick no matter how little.
+// With a rate of 0 there is no timer, call vsync() from the display's
+// vertical blank instead.
+
+
+class FramePacer
+{
+ public:
+  // called after each present (e.g. to pass the picture on)
+  typedef void (*present_func)(void *ctx);
+
+  FramePacer(Reactor *reactor, VDM1Core *core);
+  ~FramePacer();
+
+  void set_present_callback(present_func f, void *ctx);
+
+  // start presenting at "hz" frames per second (0 = on vsync() only)
+  void start(double hz);
+  void stop();
+
+  // to be called after passing data to the core, "t" is the time the data
+  // was read in microseconds (CLOCK_MONOTONIC, 0 = now)
+  void data_received(int64_t t = 0);
+
+  // present now if anything changed
+  void vsync();
+
+  void print_stats(FILE *f);
+
+  // statistics
+  uint64_t  num_ticks, num_presents;
+  uint64_t  num_missed;  // deadlines that passed without a tick
+  Histogram frame_time;  // microseconds spent drawing one present
+  Histogram latency;     // microseconds from reading a change until it was presented
+  Histogram lateness;    // microseconds a tick came after its deadline
+
+ private:
+  static void tick(void *ctx);
+
+  Reactor     *m_reactor;
+  VDM1Core    *m_core;
+  present_func m_present_func;
+  void        *m_present_ctx;
+  int          m_timer;
+  double       m_hz;
+  int64_t      m_start, m_pending_since;
+  uint64_t     m_deadlines;
+};
+
+
+#endif
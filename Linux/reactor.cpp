@@ -0,0 +1,236 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - epoll event loop (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include "reactor.h"
+
+
+Reactor::Reactor()
+{
+  m_epoll = epoll_create1(EPOLL_CLOEXEC);
+  if( m_epoll<0 ) perror("epoll_create1");
+  m_running = false;
+  num_wakeups = 0;
+  num_events = 0;
+
+  // lets other threads interrupt epoll_wait()
+  m_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  add(m_wakeup, EPOLLIN, wakeup_event, NULL);
+}
+
+
+Reactor::~Reactor()
+{
+  for(size_t i=0; i<m_handlers.size(); i++)
+    {
+      if( m_handlers[i]->timer ) close(m_handlers[i]->fd);
+      delete m_handlers[i];
+    }
+
+  for(size_t i=0; i<m_removed.size(); i++)
+    delete m_removed[i];
+
+  if( m_epoll>=0 ) close(m_epoll);
+  close(m_wakeup);
+}
+
+
+Reactor::handler *Reactor::find(int fd)
+{
+  for(size_t i=0; i<m_handlers.size(); i++)
+    if( m_handlers[i]->fd==fd )
+      return m_handlers[i];
+
+  return NULL;
+}
+
+
+bool Reactor::add(int fd, uint32_t events, event_func f, void *ctx)
+{
+  handler *h = new handler;
+  h->fd = fd;
+  h->timer = false;
+  h->removed = false;
+  h->func = f;
+  h->ctx = ctx;
+  h->tfunc = NULL;
+  h->expirations = 0;
+  h->tctx = NULL;
+
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = h;
+  if( epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev)<0 )
+    {
+      perror("epoll_ctl");
+      delete h;
+      return false;
+    }
+
+  m_handlers.push_back(h);
+  return true;
+}
+
+
+bool Reactor::modify(int fd, uint32_t events)
+{
+  handler *h = find(fd);
+  if( h==NULL ) return false;
+
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = h;
+  return epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &ev)==0;
+}
+
+
+void Reactor::remove(int fd)
+{
+  for(size_t i=0; i<m_handlers.size(); i++)
+    if( m_handlers[i]->fd==fd )
+      {
+        handler *h = m_handlers[i];
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, NULL);
+
+        // events for this handler may still be pending in the current
+        // batch, so only free it once the batch is done
+        h->removed = true;
+        m_removed.push_back(h);
+        m_handlers.erase(m_handlers.begin()+i);
+        return;
+      }
+}
+
+
+void Reactor::timer_event(void *ctx, int fd, uint32_t events)
+{
+  handler *h = (handler *) ctx;
+  if( read(fd, &h->expirations, sizeof(h->expirations))==sizeof(h->expirations) )
+    h->tfunc(h->tctx);
+}
+
+
+int Reactor::add_timer(timer_func f, void *ctx)
+{
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if( fd<0 )
+    {
+      perror("timerfd_create");
+      return -1;
+    }
+
+  if( !add(fd, EPOLLIN, timer_event, NULL) )
+    {
+      close(fd);
+      return -1;
+    }
+
+  // the event callback gets the handler itself, which holds the timer callback
+  handler *h = find(fd);
+  h->timer = true;
+  h->ctx   = h;
+  h->tfunc = f;
+  h->tctx  = ctx;
+  return fd;
+}
+
+
+void Reactor::set_timer(int id, double delay, double interval)
+{
+  struct itimerspec its;
+  its.it_value.tv_sec     = (time_t) delay;
+  its.it_value.tv_nsec    = (long) ((delay-its.it_value.tv_sec)*1e9);
+  its.it_interval.tv_sec  = (time_t) interval;
+  its.it_interval.tv_nsec = (long) ((interval-its.it_interval.tv_sec)*1e9);
+
+  // a zero it_value would stop the timer, make tiny delays expire right away
+  if( delay>0 && its.it_value.tv_sec==0 && its.it_value.tv_nsec==0 )
+    its.it_value.tv_nsec = 1;
+
+  timerfd_settime(id, 0, &its, NULL);
+}
+
+
+uint64_t Reactor::timer_expirations(int id)
+{
+  handler *h = find(id);
+  return h!=NULL ? h->expirations : 0;
+}
+
+
+void Reactor::remove_timer(int id)
+{
+  remove(id);
+  close(id);
+}
+
+
+bool Reactor::run_once(int timeout_ms)
+{
+  struct epoll_event events[32];
+
+  int n = epoll_wait(m_epoll, events, 32, timeout_ms);
+  if( n<0 )
+    {
+      if( errno==EINTR ) return true;
+      perror("epoll_wait");
+      return false;
+    }
+
+  num_wakeups++;
+  num_events += n;
+  for(int i=0; i<n; i++)
+    {
+      handler *h = (handler *) events[i].data.ptr;
+      if( !h->removed ) h->func(h->ctx, h->fd, events[i].events);
+    }
+
+  for(size_t i=0; i<m_removed.size(); i++)
+    delete m_removed[i];
+  m_removed.clear();
+
+  return true;
+}
+
+
+void Reactor::run()
+{
+  m_running = true;
+  while( m_running && run_once(-1) );
+}
+
+
+void Reactor::wakeup_event(void *ctx, int fd, uint32_t events)
+{
+  uint64_t n;
+  while( read(fd, &n, sizeof(n))==sizeof(n) );
+}
+
+
+void Reactor::stop()
+{
+  uint64_t one = 1;
+  m_running = false;
+  if( write(m_wakeup, &one, sizeof(one))<0 ) perror("eventfd");
+}
@@ -0,0 +1,98 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - epoll event loop (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+
+
+// Single-threaded event loop on top of epoll. File descriptors and timers
+// (timerfd) are registered with a callback that is invoked from run() when
+// the descriptor is ready or the timer expires. Callbacks may add and
+// remove descriptors (including their own) at any time.
+// All functions except stop() must be called from the thread that calls run().
+
+
+class Reactor
+{
+ public:
+  // "events" is a combination of EPOLLIN, EPOLLOUT, EPOLLHUP, EPOLLERR, ...
+  typedef void (*event_func)(void *ctx, int fd, uint32_t events);
+  typedef void (*timer_func)(void *ctx);
+
+  Reactor();
+  ~Reactor();
+
+  // watch a descriptor, returns false on error
+  bool add(int fd, uint32_t events, event_func f, void *ctx);
+  bool modify(int fd, uint32_t events);
+
+  // stop watching a descriptor (does not close it)
+  void remove(int fd);
+
+  // create a timer (initially stopped), returns its id or -1 on error
+  int  add_timer(timer_func f, void *ctx);
+
+  // start a timer to expire after "delay" seconds and then every "interval"
+  // seconds (0 = only once), a delay of 0 stops the timer
+  void set_timer(int id, double delay, double interval = 0);
+  void remove_timer(int id);
+
+  // number of times a timer expired since its callback was last called
+  // (more than 1 if the callback was late by more than an interval),
+  // valid in the callback
+  uint64_t timer_expirations(int id);
+
+  // process events until stop() is called (from any thread)
+  void run();
+  void stop();
+
+  // process events for at most "timeout_ms" milliseconds (-1 = until something happens)
+  // returns false on error
+  bool run_once(int timeout_ms);
+
+  // statistics
+  uint64_t num_wakeups, num_events;
+
+ private:
+  struct handler
+  {
+    int        fd;
+    bool       timer, removed;
+    event_func func;
+    void      *ctx;
+    timer_func tfunc;
+    void      *tctx;
+    uint64_t   expirations;
+  };
+
+  handler *find(int fd);
+  static void timer_event(void *ctx, int fd, uint32_t events);
+  static void wakeup_event(void *ctx, int fd, uint32_t events);
+
+  int  m_epoll, m_wakeup;
+  std::atomic<bool> m_running;
+  std::vector<handler *> m_handlers, m_removed;
+};
+
+
+#endif
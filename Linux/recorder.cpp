@@ -0,0 +1,598 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - PNG pictures and Y4M/GIF recording
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <zlib.h>
+#include "recorder.h"
+
+
+// the frame queue holds at most QUEUE_FRAMES pictures and about QUEUE_BYTES
+// (but at least 2 pictures)
+#define QUEUE_FRAMES 32
+#define QUEUE_BYTES  (64*1024*1024)
+
+
+static int64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+
+// color of pixel value v (0 to max)
+static void blend(uint32_t fg, uint32_t bg, int v, int max, uint8_t rgb[3])
+{
+  for(int i=0; i<3; i++)
+    {
+      int b = (bg>>(16-8*i)) & 255, f = (fg>>(16-8*i)) & 255;
+      rgb[i] = (uint8_t) (b + (f-b)*v/max);
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// PNG
+// -----------------------------------------------------------------------------
+
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+  p[0] = v>>24; p[1] = v>>16; p[2] = v>>8; p[3] = v;
+}
+
+
+static void png_chunk(FILE *f, const char *type, const uint8_t *data, uint32_t len)
+{
+  uint8_t hdr[8], crc[4];
+  put_be32(hdr, len);
+  memcpy(hdr+4, type, 4);
+  uLong sum = crc32(0, hdr+4, 4);
+  if( len>0 ) sum = crc32(sum, data, len);  // crc32() of NULL is its initial value
+  put_be32(crc, sum);
+
+  fwrite(hdr, 1, 8, f);
+  fwrite(data, 1, len, f);
+  fwrite(crc, 1, 4, f);
+}
+
+
+bool write_png(const char *fname, const uint8_t *pixels, int width, int height,
+               uint8_t max_value, uint32_t fg, uint32_t bg)
+{
+  // rows of filter type 0 (none) followed by the packed pixels
+  bool   bits1  = max_value==1;
+  int    stride = bits1 ? (width+7)/8 : width;
+  uLong  raw_size = (uLong) (stride+1)*height;
+  uint8_t *raw = (uint8_t *) calloc(raw_size, 1);
+  for(int y=0; y<height; y++)
+    {
+      const uint8_t *p = pixels + y*width;
+      uint8_t *q = raw + y*(stride+1) + 1;
+      if( bits1 )
+        {
+          for(int x=0; x<width; x++)
+            if( p[x] ) q[x/8] |= 0x80>>(x&7);
+        }
+      else
+        memcpy(q, p, width);
+    }
+
+  uLongf   zsize = compressBound(raw_size);
+  uint8_t *z = (uint8_t *) malloc(zsize);
+  bool     ok = compress2(z, &zsize, raw, raw_size, 6)==Z_OK;
+  free(raw);
+
+  FILE *f = ok ? fopen(fname, "wb") : NULL;
+  if( f!=NULL )
+    {
+      static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+      uint8_t ihdr[13], plte[256*3];
+
+      put_be32(ihdr, width);
+      put_be32(ihdr+4, height);
+      ihdr[8]  = bits1 ? 1 : 8;  // bit depth
+      ihdr[9]  = 3;              // palette
+      ihdr[10] = ihdr[11] = ihdr[12] = 0;
+      for(int v=0; v<=max_value; v++) blend(fg, bg, v, max_value, plte+v*3);
+
+      fwrite(signature, 1, 8, f);
+      png_chunk(f, "IHDR", ihdr, 13);
+      png_chunk(f, "PLTE", plte, (max_value+1)*3);
+      png_chunk(f, "IDAT", z, (uint32_t) zsize);
+      png_chunk(f, "IEND", NULL, 0);
+      ok = !ferror(f);
+      if( fclose(f)!=0 ) ok = false;
+    }
+  else
+    ok = false;
+
+  free(z);
+  return ok;
+}
+
+
+// -----------------------------------------------------------------------------
+// Recorder
+// -----------------------------------------------------------------------------
+
+
+Recorder::Recorder() :
+  encode_time("encode time", "us")
+{
+  m_file    = NULL;
+  m_queue   = NULL;
+  m_pending = m_prev = NULL;
+  m_child   = NULL;
+  m_y4m     = NULL;
+  m_size    = 0;
+  num_frames = num_dropped = num_written = num_bytes = 0;
+}
+
+
+Recorder::~Recorder()
+{
+  stop();
+}
+
+
+bool Recorder::format_of(const char *fname, format_t *format)
+{
+  size_t len = strlen(fname);
+  if( len>4 && strcmp(fname+len-4, ".gif")==0 )
+    *format = FORMAT_GIF;
+  else if( len>4 && strcmp(fname+len-4, ".y4m")==0 )
+    *format = FORMAT_Y4M;
+  else
+    return false;
+
+  return true;
+}
+
+
+bool Recorder::start(const char *fname, format_t format, int width, int height, uint8_t max_value,
+                     double fps, uint32_t fg, uint32_t bg)
+{
+  stop();
+
+  m_file = fopen(fname, "wb");
+  if( m_file==NULL ) return false;
+
+  m_format = format;
+  m_width = width;
+  m_height = height;
+  m_max_value = max_value;
+  m_fps = fps>0 ? fps : 30;
+  m_fg = fg;
+  m_bg = bg;
+  m_error = false;
+  num_frames = num_dropped = num_written = num_bytes = 0;
+  encode_time.reset();
+
+  m_size = QUEUE_BYTES/(width*height);
+  if( m_size>QUEUE_FRAMES ) m_size = QUEUE_FRAMES;
+  if( m_size<2 ) m_size = 2;
+  m_queue = new frame_t[m_size];
+  for(int i=0; i<m_size; i++) m_queue[i].pixels = (uint8_t *) malloc(width*height);
+  m_head = m_count = 0;
+  m_quit = false;
+
+  m_pending = (uint8_t *) malloc(width*height);
+  m_prev    = (uint8_t *) malloc(width*height);
+  m_have_pending = m_have_prev = false;
+
+  if( m_format==FORMAT_GIF )
+    {
+      // two colors, or 16 levels of blending (most of a resampled
+      // character's edge pixels are close to either color anyway)
+      m_colors = max_value==1 ? 2 : 16;
+      m_depth  = max_value==1 ? 2 : 4;  // LZW minimum code size (at least 2)
+      for(int v=0; v<256; v++)
+        m_index[v] = (uint8_t) (max_value==1 ? (v!=0) : (v*15+127)/255);
+      m_child = (uint16_t *) calloc(4096*m_colors, sizeof(uint16_t));
+      gif_header();
+    }
+  else
+    {
+      m_y4m = (uint8_t *) malloc(width*height + 2*((width+1)/2)*((height+1)/2));
+      y4m_header();
+    }
+
+  m_thread = std::thread(&Recorder::worker, this);
+  return true;
+}
+
+
+bool Recorder::stop(int64_t t)
+{
+  if( m_file==NULL ) return true;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+    m_stop_time = t!=0 ? t : now_us();
+  }
+  m_ready.notify_one();
+  m_thread.join();
+
+  bool ok = !m_error;
+  if( fclose(m_file)!=0 ) ok = false;
+  m_file = NULL;
+
+  for(int i=0; i<m_size; i++) free(m_queue[i].pixels);
+  delete [] m_queue;
+  free(m_pending);
+  free(m_prev);
+  free(m_child);
+  free(m_y4m);
+  m_queue = NULL;
+  m_pending = m_prev = NULL;
+  m_child = NULL;
+  m_y4m = NULL;
+  m_size = 0;
+
+  return ok;
+}
+
+
+bool Recorder::add_frame(const uint8_t *pixels, int64_t t, bool wait)
+{
+  if( m_file==NULL ) return false;
+  if( t==0 ) t = now_us();
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if( m_count==m_size )
+    {
+      if( !wait )
+        {
+          num_dropped++;
+          return false;
+        }
+
+      while( m_count==m_size ) m_room.wait(lock);
+    }
+
+  // the encoder doesn't touch slots beyond the queued ones
+  frame_t &f = m_queue[(m_head+m_count)%m_size];
+  lock.unlock();
+  memcpy(f.pixels, pixels, m_width*m_height);
+  f.t = t;
+  lock.lock();
+  m_count++;
+  num_frames++;
+  lock.unlock();
+
+  m_ready.notify_one();
+  return true;
+}
+
+
+void Recorder::worker()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  while( true )
+    {
+      while( m_count==0 && !m_quit ) m_ready.wait(lock);
+      if( m_count==0 ) break;
+
+      frame_t &f = m_queue[m_head];
+      lock.unlock();
+      int64_t t = now_us();
+      encode(f);
+      encode_time.add(now_us()-t);
+      lock.lock();
+
+      m_head = (m_head+1)%m_size;
+      m_count--;
+      m_room.notify_one();
+    }
+
+  int64_t t = m_stop_time;
+  lock.unlock();
+  finish(t);
+}
+
+
+void Recorder::encode(const frame_t &frame)
+{
+  if( m_have_pending )
+    {
+      if( memcmp(frame.pixels, m_pending, m_width*m_height)==0 ) return;
+
+      // the pending picture was shown until now (if long enough to show up at all)
+      if( m_format==FORMAT_GIF )
+        {
+          int delay = (int) ((frame.t-m_start_t)/10000 - (m_pending_t-m_start_t)/10000);
+          if( delay>0 )
+            {
+              gif_frame(m_pending, delay);
+              uint8_t *p = m_prev; m_prev = m_pending; m_pending = p;
+              m_have_prev = true;
+            }
+        }
+      else
+        {
+          int64_t slot = llround((frame.t-m_start_t)*m_fps/1e6);
+          if( slot>m_pending_slot ) y4m_frames(m_pending, slot-m_pending_slot);
+          m_pending_slot = slot;
+        }
+    }
+  else
+    {
+      m_start_t = frame.t;
+      m_pending_slot = 0;
+      m_have_pending = true;
+    }
+
+  memcpy(m_pending, frame.pixels, m_width*m_height);
+  m_pending_t = frame.t;
+}
+
+
+void Recorder::finish(int64_t t)
+{
+  if( m_have_pending )
+    {
+      if( m_format==FORMAT_GIF )
+        {
+          int delay = (int) ((t-m_start_t)/10000 - (m_pending_t-m_start_t)/10000);
+          gif_frame(m_pending, delay>0 ? delay : 1);
+        }
+      else
+        {
+          int64_t slot = llround((t-m_start_t)*m_fps/1e6);
+          y4m_frames(m_pending, slot>m_pending_slot ? slot-m_pending_slot : 1);
+        }
+    }
+
+  if( m_format==FORMAT_GIF )
+    {
+      uint8_t trailer = 0x3B;
+      write(&trailer, 1);
+    }
+}
+
+
+void Recorder::write(const void *data, size_t size)
+{
+  if( fwrite(data, 1, size, m_file)!=size ) m_error = true;
+  num_bytes += size;
+}
+
+
+void Recorder::print_stats(FILE *f)
+{
+  fprintf(f, "recorder: %llu pictures, %llu dropped, %llu frames written (%llu bytes)\n",
+          (unsigned long long) num_frames, (unsigned long long) num_dropped,
+          (unsigned long long) num_written, (unsigned long long) num_bytes);
+  encode_time.print(f);
+}
+
+
+// -----------------------------------------------------------------------------
+// GIF
+// -----------------------------------------------------------------------------
+
+
+void Recorder::gif_header()
+{
+  int bits = m_colors==2 ? 1 : 4;
+  uint8_t hdr[13] = {'G', 'I', 'F', '8', '9', 'a',
+                     (uint8_t) m_width, (uint8_t) (m_width>>8),
+                     (uint8_t) m_height, (uint8_t) (m_height>>8),
+                     (uint8_t) (0xF0 | (bits-1)), 0, 0};  // global palette, 8 bit colors
+  write(hdr, 13);
+
+  uint8_t palette[16*3];
+  for(int i=0; i<m_colors; i++) blend(m_fg, m_bg, i, m_colors-1, palette+i*3);
+  write(palette, m_colors*3);
+
+  // loop forever
+  static const uint8_t loop[19] = {0x21, 0xFF, 11, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0',
+                                   3, 1, 0, 0, 0};
+  write(loop, 19);
+}
+
+
+void Recorder::gif_frame(const uint8_t *pixels, int delay)
+{
+  // the rectangle that changed since the previous frame
+  int x0 = 0, y0 = 0, x1 = m_width, y1 = m_height;
+  if( m_have_prev )
+    {
+      while( y0<m_height && memcmp(pixels+y0*m_width, m_prev+y0*m_width, m_width)==0 ) y0++;
+      while( y1>y0 && memcmp(pixels+(y1-1)*m_width, m_prev+(y1-1)*m_width, m_width)==0 ) y1--;
+
+      x0 = m_width; x1 = 0;
+      for(int y=y0; y<y1; y++)
+        {
+          const uint8_t *p = pixels+y*m_width, *q = m_prev+y*m_width;
+          int x = 0;
+          while( x<x0 && p[x]==q[x] ) x++;
+          if( x<x0 ) x0 = x;
+          x = m_width-1;
+          while( x>=x1 && p[x]==q[x] ) x--;
+          if( x+1>x1 ) x1 = x+1;
+        }
+
+      // unchanged: a single pixel carries the delay
+      if( y0==y1 ) { x0 = y0 = 0; x1 = y1 = 1; }
+    }
+
+  if( delay>65535 ) delay = 65535;
+  int w = x1-x0, h = y1-y0;
+  uint8_t gce[8] = {0x21, 0xF9, 4, 1<<2, (uint8_t) delay, (uint8_t) (delay>>8), 0, 0};  // leave in place
+  uint8_t desc[10] = {0x2C, (uint8_t) x0, (uint8_t) (x0>>8), (uint8_t) y0, (uint8_t) (y0>>8),
+                      (uint8_t) w, (uint8_t) (w>>8), (uint8_t) h, (uint8_t) (h>>8), 0};
+  write(gce, 8);
+  write(desc, 10);
+  gif_lzw(pixels, x0, y0, w, h);
+  num_written++;
+}
+
+
+void Recorder::gif_lzw(const uint8_t *pixels, int x0, int y0, int w, int h)
+{
+  int clear = 1<<m_depth, eoi = clear+1;
+  int next = eoi+1, size = m_depth+1, code = -1;
+
+  uint8_t depth = (uint8_t) m_depth;
+  write(&depth, 1);
+  m_bits = 0;
+  m_num_bits = 0;
+  m_block_len = 0;
+  gif_code(clear, size);
+
+  for(int y=y0; y<y0+h; y++)
+    {
+      const uint8_t *p = pixels + y*m_width;
+      for(int x=x0; x<x0+w; x++)
+        {
+          int k = m_index[p[x]];
+          if( code<0 ) { code = k; continue; }
+
+          // longest string in the dictionary so far
+          uint16_t c = m_child[code*m_colors+k];
+          if( c!=0 ) { code = c; continue; }
+
+          gif_code(code, size);
+          if( next<4096 )
+            {
+              if( next==(1<<size) ) size++;
+              m_child[code*m_colors+k] = (uint16_t) next++;
+            }
+          else
+            {
+              // dictionary full: start over
+              gif_code(clear, size);
+              memset(m_child, 0, 4096*m_colors*sizeof(uint16_t));
+              next = eoi+1;
+              size = m_depth+1;
+            }
+          code = k;
+        }
+    }
+
+  gif_code(code, size);
+  gif_code(eoi, size);
+  gif_flush(true);
+  uint8_t end = 0;
+  write(&end, 1);
+
+  // leave the dictionary empty for the next frame
+  memset(m_child, 0, next*m_colors*sizeof(uint16_t));
+}
+
+
+void Recorder::gif_code(int code, int size)
+{
+  m_bits |= (uint32_t) code << m_num_bits;
+  m_num_bits += size;
+  while( m_num_bits>=8 )
+    {
+      m_block[m_block_len++] = (uint8_t) m_bits;
+      m_bits >>= 8;
+      m_num_bits -= 8;
+      if( m_block_len==255 ) gif_flush(false);
+    }
+}
+
+
+void Recorder::gif_flush(bool all)
+{
+  if( all && m_num_bits>0 )
+    {
+      m_block[m_block_len++] = (uint8_t) m_bits;
+      m_bits = 0;
+      m_num_bits = 0;
+    }
+
+  // data sub-block: length byte and up to 255 bytes
+  if( m_block_len>0 )
+    {
+      uint8_t len = (uint8_t) m_block_len;
+      write(&len, 1);
+      write(m_block, m_block_len);
+      m_block_len = 0;
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// Y4M
+// -----------------------------------------------------------------------------
+
+
+void Recorder::y4m_header()
+{
+  char hdr[128];
+  int n;
+  if( m_fps==floor(m_fps) )
+    n = snprintf(hdr, sizeof(hdr), "YUV4MPEG2 W%i H%i F%i:1 Ip A1:1 C420jpeg\n", m_width, m_height, (int) m_fps);
+  else
+    n = snprintf(hdr, sizeof(hdr), "YUV4MPEG2 W%i H%i F%li:1000 Ip A1:1 C420jpeg\n", m_width, m_height, lround(m_fps*1000));
+  write(hdr, n);
+
+  // full range BT.601 (JPEG)
+  for(int v=0; v<=m_max_value; v++)
+    {
+      uint8_t rgb[3];
+      blend(m_fg, m_bg, v, m_max_value, rgb);
+      double y = 0.299*rgb[0] + 0.587*rgb[1] + 0.114*rgb[2];
+      double u = 128 - 0.168736*rgb[0] - 0.331264*rgb[1] + 0.5*rgb[2];
+      double w = 128 + 0.5*rgb[0] - 0.418688*rgb[1] - 0.081312*rgb[2];
+      m_yuv[v][0] = (uint8_t) lround(y);
+      m_yuv[v][1] = (uint8_t) (u>255 ? 255 : lround(u));
+      m_yuv[v][2] = (uint8_t) (w>255 ? 255 : lround(w));
+    }
+}
+
+
+void Recorder::y4m_frames(const uint8_t *pixels, int64_t count)
+{
+  int cw = (m_width+1)/2, ch = (m_height+1)/2;
+  uint8_t *py = m_y4m, *pu = m_y4m + m_width*m_height, *pv = pu + cw*ch;
+
+  for(int i=0; i<m_width*m_height; i++) py[i] = m_yuv[pixels[i]][0];
+
+  // chroma of 2x2 pixels (the last row/column stands in for the missing ones)
+  for(int y=0; y<ch; y++)
+    {
+      const uint8_t *p0 = pixels + 2*y*m_width;
+      const uint8_t *p1 = 2*y+1<m_height ? p0+m_width : p0;
+      for(int x=0; x<cw; x++)
+        {
+          int a = 2*x, b = 2*x+1<m_width ? 2*x+1 : 2*x;
+          pu[y*cw+x] = (uint8_t) ((m_yuv[p0[a]][1] + m_yuv[p0[b]][1] + m_yuv[p1[a]][1] + m_yuv[p1[b]][1] + 2)/4);
+          pv[y*cw+x] = (uint8_t) ((m_yuv[p0[a]][2] + m_yuv[p0[b]][2] + m_yuv[p1[a]][2] + m_yuv[p1[b]][2] + 2)/4);
+        }
+    }
+
+  for(int64_t i=0; i<count; i++)
+    {
+      write("FRAME\n", 6);
+      write(m_y4m, m_width*m_height + 2*cw*ch);
+    }
+
+  num_written += count;
+}
@@ -0,0 +1,147 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - PNG pictures and Y4M/GIF recording
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "histogram.h"
+
+
+// Pictures are one byte per pixel from 0 (background) to max_value
+// (foreground), as rendered by VDM1Framebuffer or VDM1CRT, shown in two
+// RGB colors (0xRRGGBB) with the values in between blended.
+
+
+// write a picture as PNG: 1 bit per pixel if max_value is 1, otherwise 8 bits
+// with a palette of blended colors
+bool write_png(const char *fname, const uint8_t *pixels, int width, int height,
+               uint8_t max_value, uint32_t fg = 0x00FF00, uint32_t bg = 0x000000);
+
+
+// Records the screen as video:
+// - GIF:  animated GIF with one global palette (the two colors, or 16
+//         blended levels if max_value is 255) where each frame only holds
+//         the rectangle that changed since the previous one and is shown
+//         as long as it was on the screen (in 1/100s)
+// - Y4M:  YUV4MPEG2 (4:2:0) at a fixed frame rate, frames are repeated
+//         for as long as the picture did not change
+// Pictures are only passed in when they changed. They are copied into a
+// bounded queue and encoded by a thread of their own, so recording never
+// holds up the caller: if the encoder falls behind pictures are dropped
+// (until the queue has room again).
+class Recorder
+{
+ public:
+  enum format_t { FORMAT_GIF, FORMAT_Y4M };
+
+  Recorder();
+  ~Recorder();
+
+  // format by file name extension (.gif or .y4m), false if none of these
+  static bool format_of(const char *fname, format_t *format);
+
+  // start recording pictures of the given size into "fname", "fps" is the
+  // frame rate of Y4M video, returns false if the file can't be created
+  bool start(const char *fname, format_t format, int width, int height, uint8_t max_value,
+             double fps, uint32_t fg = 0x00FF00, uint32_t bg = 0x000000);
+
+  // stop recording, the last picture is shown until time "t" (microseconds,
+  // CLOCK_MONOTONIC, 0 = now), returns false if writing the file failed
+  bool stop(int64_t t = 0);
+
+  bool recording() const { return m_file!=NULL; }
+
+  // queue a picture shown from time "t" (0 = now) on, returns false if it
+  // was dropped because the queue is full (with "wait" it waits for room)
+  bool add_frame(const uint8_t *pixels, int64_t t = 0, bool wait = false);
+
+  void print_stats(FILE *f);
+
+  // statistics (written by the encoder thread, exact once stopped)
+  uint64_t  num_frames, num_dropped;  // pictures queued, dropped
+  uint64_t  num_written;              // frames in the file (GIF: changed pictures, Y4M: with repeats)
+  uint64_t  num_bytes;                // size of the file
+  Histogram encode_time;              // microseconds per picture encoded
+
+ private:
+  struct frame_t
+  {
+    uint8_t *pixels;
+    int64_t  t;
+  };
+
+  void worker();
+  void encode(const frame_t &frame);
+  void finish(int64_t t);
+  void write(const void *data, size_t size);
+
+  void gif_header();
+  void gif_frame(const uint8_t *pixels, int delay);
+  void gif_lzw(const uint8_t *pixels, int x0, int y0, int w, int h);
+  void gif_code(int code, int size);
+  void gif_flush(bool all);
+
+  void y4m_header();
+  void y4m_frames(const uint8_t *pixels, int64_t count);
+
+  FILE     *m_file;
+  format_t  m_format;
+  int       m_width, m_height;
+  uint8_t   m_max_value;
+  double    m_fps;
+  uint32_t  m_fg, m_bg;
+  bool      m_error;
+
+  // queue: m_count frames starting at m_head in a ring of m_size slots
+  frame_t                 *m_queue;
+  int                      m_size, m_head, m_count;
+  bool                     m_quit;
+  int64_t                  m_stop_time;
+  std::mutex               m_mutex;
+  std::condition_variable  m_ready, m_room;
+  std::thread              m_thread;
+
+  // encoder thread: the picture not written yet (its duration is only known
+  // when the next one comes in) and the last one written
+  uint8_t *m_pending, *m_prev;
+  int64_t  m_pending_t, m_start_t;
+  bool     m_have_pending, m_have_prev;
+
+  // GIF: palette index per pixel value, LZW dictionary (child code per code
+  // and palette index) and output bits/block
+  int       m_colors, m_depth;
+  uint8_t   m_index[256];
+  uint16_t *m_child;
+  uint32_t  m_bits;
+  int       m_num_bits, m_block_len;
+  uint8_t   m_block[256];
+
+  // Y4M: Y/U/V value per pixel value and one frame
+  uint8_t   m_yuv[256][3];
+  uint8_t  *m_y4m;
+  int64_t   m_pending_slot;
+};
+
+
+#endif
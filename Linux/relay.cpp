@@ -0,0 +1,675 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - fan-out relay for remote viewers (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "relay.h"
+#include "vdm1proto.h"
+
+
+// datagram viewers that have not sent anything for this long are dropped
+#define DG_TIMEOUT 5.0
+
+
+static int64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+
+Relay::Relay(Reactor *reactor, VDM1Core *core)
+{
+  m_reactor = reactor;
+  m_core = core;
+  m_listen = -1;
+  m_rate = 0;
+  m_interval = 0.02;
+  m_num_viewers = 0;
+  m_timer = m_reactor->add_timer(flush_timer, this);
+  m_timer_armed = false;
+  m_udp = -1;
+  m_key_timer = -1;
+  m_key_interval = 0.5;
+
+  m_seq = 0;
+  m_frame_seq = 0;
+  m_state_seq = 0;
+  memset(m_cell_seq, 0, sizeof(m_cell_seq));
+  m_upstream_writes = 0;
+}
+
+
+Relay::~Relay()
+{
+  while( !m_viewers.empty() )
+    drop(m_viewers.back(), NULL);
+
+  if( m_listen>=0 )
+    {
+      m_reactor->remove(m_listen);
+      close(m_listen);
+    }
+
+  while( !m_dgviewers.empty() )
+    {
+      delete m_dgviewers.back();
+      m_dgviewers.pop_back();
+    }
+
+  if( m_udp>=0 )
+    {
+      m_reactor->remove(m_udp);
+      close(m_udp);
+      m_reactor->remove_timer(m_key_timer);
+    }
+
+  m_reactor->remove_timer(m_timer);
+}
+
+
+int Relay::listen(int port)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  int one = 1;
+
+  m_listen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  setsockopt(m_listen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if( m_listen<0 || bind(m_listen, (struct sockaddr *) &addr, sizeof(addr))<0 || ::listen(m_listen, 64)<0 ||
+      getsockname(m_listen, (struct sockaddr *) &addr, &len)<0 ||
+      !m_reactor->add(m_listen, EPOLLIN, listen_event, this) )
+    {
+      fprintf(stderr, "Unable to listen on port %i: %s\n", port, strerror(errno));
+      if( m_listen>=0 ) close(m_listen);
+      m_listen = -1;
+      return -1;
+    }
+
+  return ntohs(addr.sin_port);
+}
+
+
+int Relay::listen_udp(int port)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+
+  m_udp = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if( m_udp<0 || bind(m_udp, (struct sockaddr *) &addr, sizeof(addr))<0 ||
+      getsockname(m_udp, (struct sockaddr *) &addr, &len)<0 ||
+      !m_reactor->add(m_udp, EPOLLIN, udp_event, this) )
+    {
+      fprintf(stderr, "Unable to listen on UDP port %i: %s\n", port, strerror(errno));
+      if( m_udp>=0 ) close(m_udp);
+      m_udp = -1;
+      return -1;
+    }
+
+  m_key_timer = m_reactor->add_timer(keyframe_timer, this);
+  m_reactor->set_timer(m_key_timer, m_key_interval, m_key_interval);
+  return ntohs(addr.sin_port);
+}
+
+
+void Relay::set_rate(int rate)
+{
+  m_rate = rate<0 ? 0 : rate;
+}
+
+
+void Relay::set_interval(double interval)
+{
+  m_interval = interval>0.001 ? interval : 0.001;
+}
+
+
+void Relay::set_keyframe_interval(double interval)
+{
+  m_key_interval = interval>0.01 ? interval : 0.01;
+  if( m_udp>=0 ) m_reactor->set_timer(m_key_timer, m_key_interval, m_key_interval);
+}
+
+
+void Relay::changed(int addr)
+{
+  m_cell_seq[addr & 1023] = ++m_seq;
+  m_upstream_writes++;
+
+  if( !m_timer_armed )
+    {
+      m_reactor->set_timer(m_timer, m_interval);
+      m_timer_armed = true;
+    }
+}
+
+
+void Relay::frame_changed()
+{
+  m_frame_seq = ++m_seq;
+  changed(0);
+}
+
+
+void Relay::state_changed()
+{
+  m_state_seq = ++m_seq;
+  changed(0);
+}
+
+
+void Relay::reset()
+{
+  for(size_t i=0; i<m_viewers.size(); i++)
+    m_viewers[i]->need_full = true;
+  for(size_t i=0; i<m_dgviewers.size(); i++)
+    m_dgviewers[i]->need_key = true;
+
+  frame_changed();
+}
+
+
+void Relay::listen_event(void *ctx, int fd, uint32_t events)
+{
+  ((Relay *) ctx)->accept_all();
+}
+
+
+void Relay::accept_all()
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  int fd;
+
+  while( (fd=accept4(m_listen, (struct sockaddr *) &addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC))>=0 )
+    {
+      if( m_viewers.size()>=MAX_VIEWERS )
+        {
+          close(fd);
+          continue;
+        }
+
+      // only report the socket writable once the kernel has (almost) sent
+      // everything, otherwise a slow viewer would have its socket buffer
+      // (megabytes on a fast network) filled with old updates
+      int one = 1, lowat = NOTSENT_LOWAT;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+
+      viewer *v = new viewer;
+      v->relay = this;
+      v->fd = fd;
+      snprintf(v->name, sizeof(v->name), "%s:%i", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+      v->synced = 0;
+      v->state_synced = 0;
+      v->need_full = true;
+      v->out_pos = 0;
+      v->tokens = 0;
+      v->last_refill = now_us();
+      v->bytes = v->updates = v->cells = v->fullframes = v->deferred = 0;
+
+      if( !m_reactor->add(fd, EPOLLIN, viewer_event, v) )
+        {
+          close(fd);
+          delete v;
+          continue;
+        }
+
+      m_viewers.push_back(v);
+      m_num_viewers++;
+
+      // greeting line (like the simulator sends), then the current state right away
+      char greeting[80];
+      int n = snprintf(greeting, sizeof(greeting), "[connected as viewer %i of VDM-1 relay]\r\n", m_num_viewers);
+      v->out.assign(greeting, greeting+n);
+      if( send_out(v) ) update(v, now_us());
+      len = sizeof(addr);
+    }
+}
+
+
+void Relay::drop(viewer *v, const char *reason)
+{
+  if( reason!=NULL ) fprintf(stderr, "viewer %s: %s\n", v->name, reason);
+
+  m_reactor->remove(v->fd);
+  close(v->fd);
+
+  for(size_t i=0; i<m_viewers.size(); i++)
+    if( m_viewers[i]==v )
+      {
+        m_viewers.erase(m_viewers.begin()+i);
+        break;
+      }
+
+  delete v;
+}
+
+
+// write as much of the output buffer as the socket takes, returns false
+// if the viewer was dropped
+bool Relay::send_out(viewer *v)
+{
+  while( v->out_pos<v->out.size() )
+    {
+      ssize_t n = send(v->fd, v->out.data()+v->out_pos, v->out.size()-v->out_pos, MSG_NOSIGNAL);
+      if( n>0 )
+        {
+          v->out_pos += n;
+          v->bytes += n;
+        }
+      else if( n<0 && (errno==EAGAIN || errno==EWOULDBLOCK) )
+        {
+          // continue when the viewer has taken some data
+          m_reactor->modify(v->fd, EPOLLIN | EPOLLOUT);
+          return true;
+        }
+      else if( n<0 && errno==EINTR )
+        continue;
+      else
+        {
+          drop(v, strerror(errno));
+          return false;
+        }
+    }
+
+  v->out.clear();
+  v->out_pos = 0;
+  m_reactor->modify(v->fd, EPOLLIN);
+  return true;
+}
+
+
+void Relay::update(viewer *v, int64_t now)
+{
+  // still busy with the last update
+  if( v->out_pos<v->out.size() )
+    {
+      v->deferred++;
+      return;
+    }
+
+  // nothing new
+  if( !v->need_full && v->synced==m_seq && v->out.empty() )
+    return;
+
+  // the kernel has not sent the last update yet, continue when it has
+  int unsent;
+  if( ioctl(v->fd, SIOCOUTQNSD, &unsent)==0 && unsent>NOTSENT_LOWAT )
+    {
+      v->deferred++;
+      m_reactor->modify(v->fd, EPOLLIN | EPOLLOUT);
+      return;
+    }
+
+  if( m_rate>0 )
+    {
+      // token bucket, may go into debt by one update but not save up
+      // for more than one interval
+      v->tokens += (now-v->last_refill) * m_rate / 1e6;
+      if( v->tokens > m_rate*m_interval ) v->tokens = m_rate*m_interval;
+      v->last_refill = now;
+
+      if( v->tokens<0 && !v->need_full && v->out.empty() )
+        {
+          v->deferred++;
+          return;
+        }
+    }
+
+  if( v->need_full || v->state_synced<m_state_seq )
+    {
+      v->out.push_back(VDM_DIP);
+      v->out.push_back(m_core->dip);
+      v->out.push_back(VDM_CTRL);
+      v->out.push_back(m_core->ctrl);
+    }
+
+  // collect the cells changed since the last update
+  int changed[1024], n = 0;
+  if( !v->need_full && v->synced>=m_frame_seq )
+    {
+      for(int a=0; a<1024; a++)
+        if( m_cell_seq[a]>v->synced )
+          changed[n++] = a;
+    }
+  else
+    n = 1024;
+
+  if( n*3 > 1+1024 )
+    {
+      // whole screen is shorter
+      v->out.push_back(VDM_FULLFRAME);
+      v->out.insert(v->out.end(), m_core->mem, m_core->mem+1024);
+      v->fullframes++;
+      v->cells += 1024;
+    }
+  else
+    {
+      for(int i=0; i<n; i++)
+        {
+          int a = changed[i];
+          v->out.push_back(VDM_MEMBYTE | (a>>8));
+          v->out.push_back(a & 255);
+          v->out.push_back(m_core->mem[a]);
+        }
+      v->cells += n;
+    }
+
+  v->need_full = false;
+  v->synced = m_seq;
+  v->state_synced = m_seq;
+  v->updates++;
+  if( m_rate>0 ) v->tokens -= v->out.size();
+
+  send_out(v);
+}
+
+
+void Relay::flush_timer(void *ctx)
+{
+  Relay *r = (Relay *) ctx;
+  r->m_timer_armed = false;
+  r->flush();
+}
+
+
+void Relay::flush()
+{
+  int64_t now = now_us();
+  bool pending = false;
+
+  // (update() may drop viewers)
+  std::vector<viewer *> viewers = m_viewers;
+  for(size_t i=0; i<viewers.size(); i++)
+    {
+      viewer *v = viewers[i];
+      update(v, now);
+
+      // throttled by its token bucket (a viewer that is still sending
+      // continues from viewer_event when the socket is writable)
+      bool still_here = false;
+      for(size_t j=0; j<m_viewers.size() && !still_here; j++) still_here = m_viewers[j]==v;
+      if( still_here && v->synced!=m_seq && v->out.empty() ) pending = true;
+    }
+
+  for(size_t i=0; i<m_dgviewers.size(); i++)
+    dg_update(m_dgviewers[i], now);
+
+  if( pending && !m_timer_armed )
+    {
+      m_reactor->set_timer(m_timer, m_interval);
+      m_timer_armed = true;
+    }
+}
+
+
+void Relay::viewer_event(void *ctx, int fd, uint32_t events)
+{
+  viewer *v = (viewer *) ctx;
+  Relay  *r = v->relay;
+
+  if( events & EPOLLIN )
+    {
+      // viewers only watch, but a VDM_CONNECT asks for the full screen
+      uint8_t buf[256];
+      ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if( n==0 || (n<0 && errno!=EAGAIN && errno!=EINTR) )
+        {
+          r->drop(v, n==0 ? "disconnected" : strerror(errno));
+          return;
+        }
+
+      for(ssize_t i=0; i<n; i++)
+        if( buf[i]==VDM_CONNECT )
+          v->need_full = true;
+    }
+  else if( events & (EPOLLHUP | EPOLLERR) )
+    {
+      r->drop(v, "connection lost");
+      return;
+    }
+
+  if( (events & EPOLLOUT) && !r->send_out(v) )
+    return;
+
+  // catch up right away once the viewer has taken the last update
+  if( v->out.empty() && (v->need_full || v->synced!=r->m_seq) )
+    r->update(v, now_us());
+}
+
+
+// -----------------------------------------------------------------------------
+// datagram viewers
+// -----------------------------------------------------------------------------
+
+
+void Relay::udp_event(void *ctx, int fd, uint32_t events)
+{
+  ((Relay *) ctx)->receive_datagrams();
+}
+
+
+void Relay::receive_datagrams()
+{
+  uint8_t dg[VDM_DG_MAX];
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  ssize_t n;
+
+  while( (n=recvfrom(m_udp, dg, sizeof(dg), 0, (struct sockaddr *) &addr, &len))>=0 || errno==EINTR )
+    {
+      if( n<VDM_DG_HEADER || dg[0]!=VDM_DG_MAGIC || (dg[1]!=VDM_DG_HELLO && dg[1]!=VDM_DG_RESYNC) )
+        {
+          len = sizeof(addr);
+          continue;
+        }
+
+      dgviewer *v = NULL;
+      for(size_t i=0; i<m_dgviewers.size() && v==NULL; i++)
+        if( m_dgviewers[i]->addrlen==len && memcmp(&m_dgviewers[i]->addr, &addr, len)==0 )
+          v = m_dgviewers[i];
+
+      if( v==NULL )
+        {
+          if( m_viewers.size()+m_dgviewers.size()>=MAX_VIEWERS )
+            {
+              len = sizeof(addr);
+              continue;
+            }
+
+          v = new dgviewer;
+          memcpy(&v->addr, &addr, len);
+          v->addrlen = len;
+          struct sockaddr_in *in = (struct sockaddr_in *) &addr;
+          snprintf(v->name, sizeof(v->name), "udp:%s:%i", inet_ntoa(in->sin_addr), ntohs(in->sin_port));
+          v->seq = 0;
+          v->synced = 0;
+          v->state_synced = 0;
+          v->need_key = true;
+          v->last_key = 0;
+          v->bytes = v->datagrams = v->keyframes = v->resyncs = 0;
+          m_dgviewers.push_back(v);
+          m_num_viewers++;
+        }
+
+      v->last_heard = now_us();
+      if( dg[1]==VDM_DG_RESYNC )
+        {
+          v->need_key = true;
+          v->resyncs++;
+        }
+      else
+        for(ssize_t i=VDM_DG_HEADER; i<n; i++)
+          if( dg[i]==VDM_CONNECT )
+            v->need_key = true;
+
+      // keyframes go out with the next update (at most one per interval)
+      if( v->need_key && !m_timer_armed )
+        {
+          m_reactor->set_timer(m_timer, m_interval);
+          m_timer_armed = true;
+        }
+
+      len = sizeof(addr);
+    }
+}
+
+
+void Relay::dg_send(dgviewer *v, uint8_t type, const uint8_t *payload, int size)
+{
+  uint8_t dg[VDM_DG_MAX];
+  int n = vdm_dg_header(dg, type, ++v->seq);
+  memcpy(dg+n, payload, size);
+
+  // a datagram the socket can not take right now is lost like any other
+  if( sendto(m_udp, dg, n+size, MSG_DONTWAIT, (struct sockaddr *) &v->addr, v->addrlen)>0 )
+    {
+      v->bytes += n+size;
+      v->datagrams++;
+    }
+}
+
+
+void Relay::dg_update(dgviewer *v, int64_t now)
+{
+  uint8_t buf[VDM_DG_MAX];
+  int n = 0;
+
+  if( !v->need_key && v->synced==m_seq )
+    return;
+
+  if( !v->need_key && v->synced>=m_frame_seq )
+    {
+      if( v->state_synced<m_state_seq )
+        {
+          buf[n++] = VDM_DIP;
+          buf[n++] = m_core->dip;
+          buf[n++] = VDM_CTRL;
+          buf[n++] = m_core->ctrl;
+        }
+
+      for(int a=0; a<1024 && n>=0; a++)
+        if( m_cell_seq[a]>v->synced )
+          {
+            if( n+3 > VDM_DG_MAX-VDM_DG_HEADER )
+              n = -1;
+            else
+              {
+                buf[n++] = VDM_MEMBYTE | (a>>8);
+                buf[n++] = a & 255;
+                buf[n++] = m_core->mem[a];
+              }
+          }
+    }
+  else
+    n = -1;
+
+  if( n>=0 )
+    dg_send(v, VDM_DG_DELTA, buf, n);
+  else
+    {
+      // the whole state is shorter (or needed anyway)
+      buf[0] = VDM_DIP;
+      buf[1] = m_core->dip;
+      buf[2] = VDM_CTRL;
+      buf[3] = m_core->ctrl;
+      buf[4] = VDM_FULLFRAME;
+      memcpy(buf+5, m_core->mem, 1024);
+      dg_send(v, VDM_DG_KEYFRAME, buf, 5+1024);
+      v->keyframes++;
+      v->last_key = now;
+      v->need_key = false;
+    }
+
+  v->synced = m_seq;
+  v->state_synced = m_seq;
+}
+
+
+void Relay::keyframe_timer(void *ctx)
+{
+  Relay  *r = (Relay *) ctx;
+  int64_t now = now_us();
+
+  for(size_t i=0; i<r->m_dgviewers.size(); )
+    {
+      dgviewer *v = r->m_dgviewers[i];
+      if( now-v->last_heard > DG_TIMEOUT*1e6 )
+        {
+          fprintf(stderr, "viewer %s: timed out\n", v->name);
+          r->m_dgviewers.erase(r->m_dgviewers.begin()+i);
+          delete v;
+          continue;
+        }
+
+      // repairs whatever was lost since the last keyframe, even if
+      // the viewer did not notice (nothing was sent after the loss)
+      if( now-v->last_key >= r->m_key_interval*1e6*0.9 )
+        {
+          v->need_key = true;
+          r->dg_update(v, now);
+        }
+
+      i++;
+    }
+}
+
+
+void Relay::print_stats(FILE *f)
+{
+  fprintf(f, "relay: %llu upstream writes, %i viewers\n",
+          (unsigned long long) m_upstream_writes, (int) (m_viewers.size()+m_dgviewers.size()));
+  for(size_t i=0; i<m_viewers.size(); i++)
+    {
+      viewer *v = m_viewers[i];
+      fprintf(f, "  %-22s %10llu bytes %8llu updates %10llu cells %6llu full %8llu deferred\n", v->name,
+              (unsigned long long) v->bytes, (unsigned long long) v->updates,
+              (unsigned long long) v->cells, (unsigned long long) v->fullframes,
+              (unsigned long long) v->deferred);
+    }
+  for(size_t i=0; i<m_dgviewers.size(); i++)
+    {
+      dgviewer *v = m_dgviewers[i];
+      fprintf(f, "  %-22s %10llu bytes %8llu datagrams %6llu keyframes %6llu resyncs\n", v->name,
+              (unsigned long long) v->bytes, (unsigned long long) v->datagrams,
+              (unsigned long long) v->keyframes, (unsigned long long) v->resyncs);
+    }
+}
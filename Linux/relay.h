@@ -0,0 +1,152 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - fan-out relay for remote viewers (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stdint.h>
+#include <vector>
+#include <sys/socket.h>
+#include "reactor.h"
+#include "vdm1core.h"
+
+
+// Forwards one VDM-1 stream (decoded once) to any number of viewers
+// connected over TCP. A viewer can be anything that understands the
+// Altair side of the protocol, e.g. vdm1-headless or the Windows display
+// connected to "host:port" (a greeting line is sent first, like the
+// simulator does).
+// - a new viewer (or one that sends VDM_CONNECT) immediately gets the
+//   full state: DIP switches, control register and the whole video memory
+// - after that it gets the changes, collected over "interval" and sent as
+//   VDM_MEMBYTE commands (or VDM_FULLFRAME if that is shorter). Several
+//   writes to the same cell in between are sent only once.
+// - each viewer has its own token bucket ("rate" bytes/second) and its
+//   own output buffer. New changes are only encoded once a viewer has
+//   taken everything sent before, a slow viewer just gets fewer, larger
+//   updates and never holds up the upstream connection or other viewers.
+//
+// Viewers on a lossy link can use datagrams instead (UDP, see VDM_DG_* in
+// vdm1proto.h), a lost datagram then does not hold up the ones after it.
+// A datagram viewer subscribes by sending VDM_DG_HELLO (at least every few
+// seconds) and gets the same coalesced changes, each delta in a single
+// datagram (a keyframe with the whole state if that is shorter). Keyframes
+// are also sent every "keyframe interval" and when the viewer asks for one
+// after a loss. There is no rate limit for datagram viewers: one datagram
+// of at most VDM_DG_MAX bytes per update interval.
+//
+// Instead of per-viewer dirty lists the relay stamps each cell with the
+// sequence number of its last change, a viewer remembers the sequence
+// number it is synchronized to. Upstream writes cost the same no matter
+// how many viewers there are.
+
+
+class Relay
+{
+ public:
+  Relay(Reactor *reactor, VDM1Core *core);
+  ~Relay();
+
+  // accept viewers on a TCP port, returns the port or -1 on error
+  int listen(int port);
+
+  // accept datagram viewers on a UDP port, returns the port or -1 on error
+  int listen_udp(int port);
+
+  // bytes/second per viewer (0 = unlimited) and update interval in seconds
+  void set_rate(int rate);
+  void set_interval(double interval);
+  void set_keyframe_interval(double interval);
+
+  // to be called for each write to video memory, after the whole video
+  // memory was replaced and after the control register or DIP switches changed
+  void changed(int addr);
+  void frame_changed();
+  void state_changed();
+
+  // everything changed (e.g. upstream reconnected)
+  void reset();
+
+  void print_stats(FILE *f);
+
+  // NOTSENT_LOWAT: unsent bytes in a viewer's socket above which no new
+  // update is encoded
+  enum { MAX_VIEWERS = 1024, NOTSENT_LOWAT = 4096 };
+
+ private:
+  struct viewer
+  {
+    Relay   *relay;
+    int      fd;
+    char     name[64];
+    uint32_t synced, state_synced;
+    bool     need_full;
+    std::vector<uint8_t> out;
+    size_t   out_pos;
+    double   tokens;
+    int64_t  last_refill;
+
+    uint64_t bytes, updates, cells, fullframes, deferred;
+  };
+
+  struct dgviewer
+  {
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    char      name[64];
+    uint32_t  seq, synced, state_synced;
+    bool      need_key;
+    int64_t   last_key, last_heard;
+
+    uint64_t  bytes, datagrams, keyframes, resyncs;
+  };
+
+  void accept_all();
+  void receive_datagrams();
+  void dg_update(dgviewer *v, int64_t now);
+  void dg_send(dgviewer *v, uint8_t type, const uint8_t *payload, int size);
+  void flush();
+  void update(viewer *v, int64_t now);
+  bool send_out(viewer *v);
+  void drop(viewer *v, const char *reason);
+
+  static void listen_event(void *ctx, int fd, uint32_t events);
+  static void viewer_event(void *ctx, int fd, uint32_t events);
+  static void flush_timer(void *ctx);
+  static void udp_event(void *ctx, int fd, uint32_t events);
+  static void keyframe_timer(void *ctx);
+
+  Reactor  *m_reactor;
+  VDM1Core *m_core;
+  int       m_listen, m_timer, m_rate, m_num_viewers;
+  int       m_udp, m_key_timer;
+  bool      m_timer_armed;
+  double    m_interval, m_key_interval;
+
+  // sequence number of the last change of each cell, of the last full
+  // frame and of the last ctrl/dip change
+  uint32_t  m_seq, m_cell_seq[1024], m_frame_seq, m_state_seq;
+  uint64_t  m_upstream_writes;
+
+  std::vector<viewer *>   m_viewers;
+  std::vector<dgviewer *> m_dgviewers;
+};
+
+
+#endif
@@ -0,0 +1,1193 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - RFB (VNC) server
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "rfbserver.h"
+
+
+// client to server messages
+#define RFB_SET_PIXEL_FORMAT  0
+#define RFB_SET_ENCODINGS     2
+#define RFB_UPDATE_REQUEST    3
+#define RFB_KEY_EVENT         4
+#define RFB_POINTER_EVENT     5
+#define RFB_CUT_TEXT          6
+
+// server to client messages
+#define RFB_FRAMEBUFFER_UPDATE 0
+#define RFB_SET_COLOUR_MAP     1
+
+// encodings
+#define RFB_ENC_RAW           0
+#define RFB_ENC_HEXTILE       5
+#define RFB_ENC_ZRLE         16
+
+// hextile subencoding bits
+#define HEXTILE_RAW           1
+#define HEXTILE_BG            2
+#define HEXTILE_FG            4
+#define HEXTILE_SUBRECTS      8
+#define HEXTILE_COLOURED     16
+
+// ZRLE tile size
+#define ZRLE_TILE            64
+
+// longest cut text accepted (and ignored)
+#define MAX_CUT_TEXT    (1<<20)
+
+
+static int64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+
+static void put16(std::vector<uint8_t> &out, int v)
+{
+  out.push_back((uint8_t) (v>>8));
+  out.push_back((uint8_t) v);
+}
+
+
+static void put32(std::vector<uint8_t> &out, uint32_t v)
+{
+  put16(out, (int) (v>>16));
+  put16(out, (int) (v & 0xffff));
+}
+
+
+static int get16(const uint8_t *p)
+{
+  return (p[0]<<8) | p[1];
+}
+
+
+static uint32_t get32(const uint8_t *p)
+{
+  return (uint32_t(p[0])<<24) | (uint32_t(p[1])<<16) | (uint32_t(p[2])<<8) | p[3];
+}
+
+
+// one step of the tile hash (64 bit multiply-rotate, collisions are not a
+// practical concern for a few thousand tiles per update)
+static inline uint64_t hash_mix(uint64_t h, uint64_t v)
+{
+  h ^= v * 0x9E3779B97F4A7C15ull;
+  h  = (h<<27 | h>>37) * 0xC2B2AE3D27D4EB4Full;
+  return h;
+}
+
+
+RFBServer::RFBServer(Reactor *reactor) :
+  hash_time("rfb hash time", "us"),
+  encode_time("rfb encode time", "us")
+{
+  m_reactor = reactor;
+  m_listen = -1;
+  m_key_func = NULL;
+  m_key_ctx = NULL;
+  m_pixels = NULL;
+  m_width = m_height = 0;
+  m_max_value = 1;
+  m_tiles_x = m_tiles_y = 0;
+  m_seq = 0;
+  num_updates = num_tiles = num_encoded = num_reused = 0;
+  for(int i=0; i<NUM_LAST; i++) m_last[i].valid = false;
+  m_last_next = 0;
+}
+
+
+RFBServer::~RFBServer()
+{
+  while( !m_clients.empty() )
+    drop(m_clients.back(), NULL);
+
+  if( m_listen>=0 )
+    {
+      m_reactor->remove(m_listen);
+      close(m_listen);
+    }
+}
+
+
+void RFBServer::set_picture(const uint8_t *pixels, int width, int height, uint8_t max_value,
+                            uint32_t fg, uint32_t bg)
+{
+  m_pixels = pixels;
+  m_width = width;
+  m_height = height;
+  m_max_value = max_value>0 ? max_value : 1;
+
+  // blend the colors for partially covered pixels (like vdm1_write_ppm())
+  for(int v=0; v<256; v++)
+    for(int i=0; i<3; i++)
+      {
+        int b = (bg>>(16-8*i)) & 255, f = (fg>>(16-8*i)) & 255;
+        m_rgb[v][i] = (uint8_t) (v<=m_max_value ? b + (f-b)*v/m_max_value : f);
+      }
+
+  m_tiles_x = (width+TILE-1)/TILE;
+  m_tiles_y = (height+TILE-1)/TILE;
+  m_hash.assign(m_tiles_x*m_tiles_y, 0);
+  m_tile_seq.assign(m_tiles_x*m_tiles_y, 0);
+  m_seq = 0;
+  for(int i=0; i<NUM_LAST; i++) m_last[i].valid = false;
+  update();
+}
+
+
+void RFBServer::set_key_callback(key_func f, void *ctx)
+{
+  m_key_func = f;
+  m_key_ctx = ctx;
+}
+
+
+int RFBServer::listen(const char *host, int port)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  int one = 1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if( host!=NULL && inet_aton(host, &addr.sin_addr)==0 )
+    {
+      fprintf(stderr, "Invalid address %s\n", host);
+      return -1;
+    }
+
+  m_listen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  setsockopt(m_listen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if( m_listen<0 || bind(m_listen, (struct sockaddr *) &addr, sizeof(addr))<0 || ::listen(m_listen, 16)<0 ||
+      getsockname(m_listen, (struct sockaddr *) &addr, &len)<0 ||
+      !m_reactor->add(m_listen, EPOLLIN, listen_event, this) )
+    {
+      fprintf(stderr, "Unable to listen on port %i: %s\n", port, strerror(errno));
+      if( m_listen>=0 ) close(m_listen);
+      m_listen = -1;
+      return -1;
+    }
+
+  return ntohs(addr.sin_port);
+}
+
+
+// -----------------------------------------------------------------------------
+// changes
+// -----------------------------------------------------------------------------
+
+
+void RFBServer::update()
+{
+  if( m_pixels==NULL ) return;
+
+  // hash each tile row by row, 16 pixels are two 64 bit words
+  int64_t t = now_us();
+  int changed = 0;
+  m_seq++;
+  for(int ty=0; ty<m_tiles_y; ty++)
+    for(int tx=0; tx<m_tiles_x; tx++)
+      {
+        int x = tx*TILE, y = ty*TILE;
+        int w = m_width-x<TILE ? m_width-x : TILE, h = m_height-y<TILE ? m_height-y : TILE;
+        const uint8_t *p = m_pixels + y*m_width + x;
+        uint64_t hash = 0, a, b;
+
+        for(int r=0; r<h; r++, p+=m_width)
+          {
+            if( w==TILE )
+              {
+                memcpy(&a, p, 8);
+                memcpy(&b, p+8, 8);
+              }
+            else
+              {
+                uint8_t buf[TILE] = {0};
+                memcpy(buf, p, w);
+                memcpy(&a, buf, 8);
+                memcpy(&b, buf+8, 8);
+              }
+            hash = hash_mix(hash_mix(hash, a), b);
+          }
+
+        int i = ty*m_tiles_x+tx;
+        if( hash!=m_hash[i] || m_seq==1 )
+          {
+            m_hash[i] = hash;
+            m_tile_seq[i] = m_seq;
+            changed++;
+          }
+      }
+
+  if( changed==0 )
+    {
+      m_seq--;
+      return;
+    }
+
+  hash_time.add(now_us()-t);
+  num_updates++;
+  num_tiles += changed;
+
+  // (serve() may drop clients)
+  std::vector<client *> clients = m_clients;
+  for(size_t i=0; i<clients.size(); i++)
+    serve(clients[i]);
+}
+
+
+// -----------------------------------------------------------------------------
+// connections
+// -----------------------------------------------------------------------------
+
+
+void RFBServer::listen_event(void *ctx, int fd, uint32_t events)
+{
+  ((RFBServer *) ctx)->accept_all();
+}
+
+
+void RFBServer::accept_all()
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  int fd;
+
+  while( (fd=accept4(m_listen, (struct sockaddr *) &addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC))>=0 )
+    {
+      if( m_clients.size()>=MAX_CLIENTS )
+        {
+          close(fd);
+          continue;
+        }
+
+      // like the relay: only report the socket writable once the kernel
+      // has (almost) sent everything so slow viewers get fewer updates
+      int one = 1, lowat = NOTSENT_LOWAT;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+
+      client *c = new client;
+      c->server = this;
+      c->fd = fd;
+      snprintf(c->name, sizeof(c->name), "%s:%i", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+      c->state = STATE_VERSION;
+      c->minor = 3;
+      c->out_pos = 0;
+      c->encoding = RFB_ENC_RAW;
+      c->update_requested = c->full_requested = c->control = false;
+      c->req_x = c->req_y = c->req_w = c->req_h = 0;
+      c->synced = 0;
+      c->zs_init = false;
+      c->bytes = c->updates = c->rects = c->keys = c->deferred = 0;
+
+      // 32 bit true color until the viewer asks for something else
+      static const uint8_t pf[16] = {32, 24, 0, 1, 0, 255, 0, 255, 0, 255, 16, 8, 0, 0, 0, 0};
+      set_pixel_format(c, pf);
+
+      if( !m_reactor->add(fd, EPOLLIN, client_event, c) )
+        {
+          close(fd);
+          delete c;
+          continue;
+        }
+
+      m_clients.push_back(c);
+
+      static const char version[] = "RFB 003.008\n";
+      c->out.assign(version, version+12);
+      send_out(c);
+      len = sizeof(addr);
+    }
+}
+
+
+void RFBServer::drop(client *c, const char *reason)
+{
+  if( reason!=NULL ) fprintf(stderr, "VNC viewer %s: %s\n", c->name, reason);
+
+  m_reactor->remove(c->fd);
+  close(c->fd);
+  if( c->zs_init ) deflateEnd(&c->zs);
+
+  for(size_t i=0; i<m_clients.size(); i++)
+    if( m_clients[i]==c )
+      {
+        m_clients.erase(m_clients.begin()+i);
+        break;
+      }
+
+  delete c;
+}
+
+
+// write as much of the output buffer as the socket takes, returns false
+// if the client was dropped
+bool RFBServer::send_out(client *c)
+{
+  while( c->out_pos<c->out.size() )
+    {
+      ssize_t n = send(c->fd, c->out.data()+c->out_pos, c->out.size()-c->out_pos, MSG_NOSIGNAL);
+      if( n>0 )
+        {
+          c->out_pos += n;
+          c->bytes += n;
+        }
+      else if( n<0 && (errno==EAGAIN || errno==EWOULDBLOCK) )
+        {
+          m_reactor->modify(c->fd, EPOLLIN | EPOLLOUT);
+          return true;
+        }
+      else if( n<0 && errno==EINTR )
+        continue;
+      else
+        {
+          drop(c, strerror(errno));
+          return false;
+        }
+    }
+
+  c->out.clear();
+  c->out_pos = 0;
+  m_reactor->modify(c->fd, EPOLLIN);
+  return true;
+}
+
+
+void RFBServer::client_event(void *ctx, int fd, uint32_t events)
+{
+  client    *c = (client *) ctx;
+  RFBServer *s = c->server;
+
+  if( events & EPOLLIN )
+    {
+      if( !s->receive(c) ) return;
+    }
+  else if( events & (EPOLLHUP | EPOLLERR) )
+    {
+      s->drop(c, "connection lost");
+      return;
+    }
+
+  if( (events & EPOLLOUT) && !s->send_out(c) )
+    return;
+
+  // catch up once the viewer has taken the last update
+  if( c->out.empty() ) s->serve(c);
+}
+
+
+// read and handle everything that arrived, returns false if the client was dropped
+bool RFBServer::receive(client *c)
+{
+  uint8_t buf[4096];
+  ssize_t n;
+
+  while( (n=recv(c->fd, buf, sizeof(buf), 0))!=0 )
+    {
+      if( n<0 && errno==EINTR ) continue;
+      if( n<0 && (errno==EAGAIN || errno==EWOULDBLOCK) ) break;
+      if( n<0 )
+        {
+          drop(c, strerror(errno));
+          return false;
+        }
+      c->in.insert(c->in.end(), buf, buf+n);
+    }
+
+  if( n==0 )
+    {
+      drop(c, NULL);
+      return false;
+    }
+
+  // complete messages only, the rest waits for more data
+  size_t pos = 0;
+  int used = 0;
+  while( pos<c->in.size() && (used=handle(c, c->in.data()+pos, (int) (c->in.size()-pos)))>0 )
+    pos += used;
+  if( used<0 ) return false;
+  c->in.erase(c->in.begin(), c->in.begin()+pos);
+
+  return send_out(c);
+}
+
+
+// handle the message at "p" (n bytes received), returns its length,
+// 0 if it is incomplete or -1 if the client was dropped
+int RFBServer::handle(client *c, const uint8_t *p, int n)
+{
+  switch( c->state )
+    {
+    case STATE_VERSION:
+      {
+        if( n<12 ) return 0;
+        int major, minor;
+        if( memcmp(p, "RFB ", 4)!=0 || sscanf((const char *) p+4, "%3d.%3d", &major, &minor)!=2 || major!=3 )
+          {
+            drop(c, "not a VNC viewer");
+            return -1;
+          }
+
+        // unknown 3.x versions must be treated as 3.3
+        c->minor = minor>=8 ? 8 : minor==7 ? 7 : 3;
+        if( c->minor==3 )
+          {
+            put32(c->out, 1);  // no authentication
+            c->state = STATE_INIT;
+          }
+        else
+          {
+            c->out.push_back(1);
+            c->out.push_back(1);
+            c->state = STATE_SECURITY;
+          }
+        return 12;
+      }
+
+    case STATE_SECURITY:
+      if( p[0]!=1 )
+        {
+          if( c->minor>=8 )
+            {
+              static const char reason[] = "only security type None is supported";
+              put32(c->out, 1);
+              put32(c->out, sizeof(reason)-1);
+              c->out.insert(c->out.end(), reason, reason+sizeof(reason)-1);
+              send_out(c);
+            }
+          drop(c, "unsupported security type");
+          return -1;
+        }
+      if( c->minor>=8 ) put32(c->out, 0);
+      c->state = STATE_INIT;
+      return 1;
+
+    case STATE_INIT:
+      {
+        // the picture is always shared, ServerInit: size, pixel format, name
+        static const char name[] = "VDM-1";
+        static const uint8_t pf[16] = {32, 24, 0, 1, 0, 255, 0, 255, 0, 255, 16, 8, 0, 0, 0, 0};
+        put16(c->out, m_width);
+        put16(c->out, m_height);
+        c->out.insert(c->out.end(), pf, pf+16);
+        put32(c->out, sizeof(name)-1);
+        c->out.insert(c->out.end(), name, name+sizeof(name)-1);
+        c->state = STATE_NORMAL;
+        c->synced = 0;
+        return 1;
+      }
+
+    case STATE_NORMAL:
+      break;
+    }
+
+  switch( p[0] )
+    {
+    case RFB_SET_PIXEL_FORMAT:
+      if( n<20 ) return 0;
+      if( p[4]!=8 && p[4]!=16 && p[4]!=32 )
+        {
+          drop(c, "unsupported pixel format");
+          return -1;
+        }
+      set_pixel_format(c, p+4);
+      return 20;
+
+    case RFB_SET_ENCODINGS:
+      {
+        if( n<4 ) return 0;
+        int num = get16(p+2);
+        if( n<4+4*num ) return 0;
+        set_encodings(c, p+4, num);
+        return 4+4*num;
+      }
+
+    case RFB_UPDATE_REQUEST:
+      {
+        if( n<10 ) return 0;
+        int x = get16(p+2), y = get16(p+4), w = get16(p+6), h = get16(p+8);
+        if( x>m_width ) x = m_width;
+        if( y>m_height ) y = m_height;
+        if( x+w>m_width ) w = m_width-x;
+        if( y+h>m_height ) h = m_height-y;
+
+        c->update_requested = true;
+        if( p[1]==0 && w>0 && h>0 )
+          {
+            c->full_requested = true;
+            c->req_x = x;
+            c->req_y = y;
+            c->req_w = w;
+            c->req_h = h;
+          }
+        return 10;
+      }
+
+    case RFB_KEY_EVENT:
+      if( n<8 ) return 0;
+      key_event(c, p[1]!=0, get32(p+4));
+      return 8;
+
+    case RFB_POINTER_EVENT:
+      return n<6 ? 0 : 6;
+
+    case RFB_CUT_TEXT:
+      {
+        if( n<8 ) return 0;
+        uint32_t len = get32(p+4);
+        if( len>MAX_CUT_TEXT )
+          {
+            drop(c, "cut text too long");
+            return -1;
+          }
+        return n<8+(int) len ? 0 : 8+(int) len;
+      }
+
+    default:
+      drop(c, "unknown message");
+      return -1;
+    }
+}
+
+
+void RFBServer::set_pixel_format(client *c, const uint8_t *pf)
+{
+  memcpy(c->format, pf, sizeof(c->format));
+  c->bpp = pf[0];
+  c->big_endian = pf[2]!=0;
+  c->true_colour = pf[3]!=0;
+  for(int i=0; i<3; i++)
+    {
+      c->max[i] = (uint16_t) get16(pf+4+2*i);
+      c->shift[i] = pf[10+i];
+    }
+
+  // the bytes of each level
+  for(int v=0; v<256; v++)
+    {
+      uint32_t value = 0;
+      if( c->true_colour )
+        for(int i=0; i<3; i++)
+          value |= uint32_t((m_rgb[v][i]*c->max[i] + 127)/255) << c->shift[i];
+      else
+        value = v;
+
+      int bytes = c->bpp/8;
+      for(int b=0; b<bytes; b++)
+        c->pix[v][c->big_endian ? bytes-1-b : b] = (uint8_t) (value >> (8*b));
+    }
+
+  // ZRLE's CPIXEL: 3 bytes if the colors fit in the lower or upper 3 bytes of a 32 bit pixel
+  c->cpixel = c->bpp/8;
+  c->cpixel_offset = 0;
+  if( c->bpp==32 && c->true_colour && pf[1]<=24 )
+    {
+      bool low = true, high = true;
+      for(int i=0; i<3; i++)
+        {
+          uint32_t bits = uint32_t(c->max[i]) << c->shift[i];
+          if( bits>=(1u<<24) ) low = false;
+          if( (bits & 0xff)!=0 ) high = false;
+        }
+      if( low || high )
+        {
+          c->cpixel = 3;
+          c->cpixel_offset = (low==c->big_endian) ? 1 : 0;
+        }
+    }
+
+  // a palette based viewer gets the levels as its color map
+  if( !c->true_colour )
+    {
+      c->out.push_back(RFB_SET_COLOUR_MAP);
+      c->out.push_back(0);
+      put16(c->out, 0);
+      put16(c->out, m_max_value+1);
+      for(int v=0; v<=m_max_value; v++)
+        for(int i=0; i<3; i++)
+          put16(c->out, m_rgb[v][i]*257);
+    }
+
+  // everything must be sent again in the new format
+  c->synced = 0;
+}
+
+
+void RFBServer::set_encodings(client *c, const uint8_t *list, int n)
+{
+  // the viewer lists them in order of preference
+  c->encoding = RFB_ENC_RAW;
+  for(int i=0; i<n; i++)
+    {
+      int32_t e = (int32_t) get32(list+4*i);
+      if( e==RFB_ENC_ZRLE || e==RFB_ENC_HEXTILE || e==RFB_ENC_RAW )
+        {
+          c->encoding = e;
+          break;
+        }
+    }
+}
+
+
+void RFBServer::key_event(client *c, bool down, uint32_t k)
+{
+  if( k==0xffe3 || k==0xffe4 )
+    {
+      c->control = down;
+      return;
+    }
+  if( !down ) return;
+
+  int ch = -1;
+  if( k>=0x20 && k<=0xff )
+    {
+      // Latin-1 keysyms are the character codes
+      ch = (int) k;
+      if( c->control && ch>='@' && ch<=0x7f ) ch &= 0x1f;
+    }
+  else if( k>=0xffb0 && k<=0xffb9 )
+    ch = '0' + (int) (k-0xffb0);
+  else
+    switch( k )
+      {
+      case 0xff08: ch = 8; break;      // BackSpace
+      case 0xff09: ch = 9; break;      // Tab
+      case 0xff0a: ch = 10; break;     // Linefeed
+      case 0xff0d: ch = 13; break;     // Return
+      case 0xff1b: ch = 27; break;     // Escape
+      case 0xffff: ch = 0x7f; break;   // Delete
+      case 0xff63: ch = 0x80; break;   // Insert
+      case 0xff80: ch = ' '; break;    // keypad
+      case 0xff8d: ch = 13; break;
+      case 0xffaa: ch = '*'; break;
+      case 0xffab: ch = '+'; break;
+      case 0xffac: ch = ','; break;
+      case 0xffad: ch = '-'; break;
+      case 0xffae: ch = '.'; break;
+      case 0xffaf: ch = '/'; break;
+      }
+
+  if( ch>=0 && m_key_func!=NULL )
+    {
+      c->keys++;
+      m_key_func(m_key_ctx, (uint8_t) ch);
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// updates
+// -----------------------------------------------------------------------------
+
+
+void RFBServer::serve(client *c)
+{
+  if( c->state!=STATE_NORMAL || !c->update_requested || m_pixels==NULL ) return;
+  if( !c->full_requested && c->synced==m_seq ) return;
+
+  // still busy with the last update
+  if( c->out_pos<c->out.size() )
+    {
+      c->deferred++;
+      return;
+    }
+
+  // the kernel has not sent the last update yet, continue when it has
+  int unsent;
+  if( ioctl(c->fd, SIOCOUTQNSD, &unsent)==0 && unsent>NOTSENT_LOWAT )
+    {
+      c->deferred++;
+      m_reactor->modify(c->fd, EPOLLIN | EPOLLOUT);
+      return;
+    }
+
+  int64_t t = now_us();
+  bool whole = c->synced==0 || (c->full_requested && c->req_x==0 && c->req_y==0 &&
+                                c->req_w==m_width && c->req_h==m_height);
+  bool region = c->full_requested && !whole;
+  uint32_t from = whole ? 0 : c->synced;
+
+  // the same changes were just encoded in the same way for another viewer,
+  // otherwise replace an outdated encoding (or each in turn)
+  int found = -1, slot = -1;
+  for(int i=0; i<NUM_LAST && found<0; i++)
+    {
+      const encoded &l = m_last[i];
+      if( !l.valid || l.to!=m_seq )
+        { if( slot<0 ) slot = i; }
+      else if( !region && l.encoding==c->encoding && l.from==from &&
+               memcmp(l.format, c->format, sizeof(l.format))==0 )
+        found = i;
+    }
+  if( found<0 && slot<0 )
+    {
+      slot = m_last_next;
+      m_last_next = (m_last_next+1) % NUM_LAST;
+    }
+
+  encoded &e = m_last[found>=0 ? found : slot];
+  if( found<0 )
+    {
+      e.valid = !region;
+      e.encoding = c->encoding;
+      e.from = from;
+      e.to = m_seq;
+      memcpy(e.format, c->format, sizeof(e.format));
+      changed_rects(c, whole, e.rects);
+
+      e.data.clear();
+      e.offset.clear();
+      for(size_t i=0; i<e.rects.size(); i++)
+        {
+          e.offset.push_back(e.data.size());
+          switch( c->encoding )
+            {
+            case RFB_ENC_ZRLE:    encode_zrle(c, e.rects[i], e.data); break;
+            case RFB_ENC_HEXTILE: encode_hextile(c, e.rects[i], e.data); break;
+            default:              encode_raw(c, e.rects[i], e.data); break;
+            }
+        }
+      e.offset.push_back(e.data.size());
+      num_encoded++;
+    }
+  else
+    num_reused++;
+
+  c->out.push_back(RFB_FRAMEBUFFER_UPDATE);
+  c->out.push_back(0);
+  put16(c->out, (int) e.rects.size());
+  for(size_t i=0; i<e.rects.size(); i++)
+    {
+      const rect &r = e.rects[i];
+      put16(c->out, r.x);
+      put16(c->out, r.y);
+      put16(c->out, r.w);
+      put16(c->out, r.h);
+      put32(c->out, (uint32_t) c->encoding);
+
+      // ZRLE data goes through the viewer's own zlib stream
+      const uint8_t *data = e.data.data()+e.offset[i];
+      size_t size = e.offset[i+1]-e.offset[i];
+      if( c->encoding!=RFB_ENC_ZRLE )
+        c->out.insert(c->out.end(), data, data+size);
+      else if( !compress(c, data, size) )
+        {
+          drop(c, "zlib error");
+          return;
+        }
+    }
+
+  c->update_requested = c->full_requested = false;
+  c->synced = m_seq;
+  c->updates++;
+  c->rects += e.rects.size();
+  encode_time.add(now_us()-t);
+
+  send_out(c);
+}
+
+
+// the rectangles to send: the whole picture, or the part asked for plus
+// runs of tiles changed since the viewer's last update in each tile row,
+// merged with the same run in the row above
+void RFBServer::changed_rects(client *c, bool whole, std::vector<rect> &rects)
+{
+  rects.clear();
+  if( whole )
+    {
+      rect r = {0, 0, m_width, m_height};
+      rects.push_back(r);
+      return;
+    }
+
+  if( c->full_requested )
+    {
+      rect r = {c->req_x, c->req_y, c->req_w, c->req_h};
+      rects.push_back(r);
+    }
+
+  std::vector<size_t> above, here;
+  for(int ty=0; ty<m_tiles_y && c->synced<m_seq; ty++)
+    {
+      here.clear();
+      for(int tx=0; tx<m_tiles_x; tx++)
+        {
+          if( m_tile_seq[ty*m_tiles_x+tx]<=c->synced ) continue;
+
+          int end = tx;
+          while( end+1<m_tiles_x && m_tile_seq[ty*m_tiles_x+end+1]>c->synced ) end++;
+
+          rect r;
+          r.x = tx*TILE;
+          r.y = ty*TILE;
+          r.w = ((end+1)*TILE<m_width ? (end+1)*TILE : m_width) - r.x;
+          r.h = ((ty+1)*TILE<m_height ? (ty+1)*TILE : m_height) - r.y;
+
+          size_t i;
+          for(i=0; i<above.size(); i++)
+            {
+              rect &a = rects[above[i]];
+              if( a.x==r.x && a.w==r.w && a.y+a.h==r.y )
+                {
+                  a.h += r.h;
+                  here.push_back(above[i]);
+                  break;
+                }
+            }
+          if( i==above.size() )
+            {
+              rects.push_back(r);
+              here.push_back(rects.size()-1);
+            }
+          tx = end;
+        }
+      above.swap(here);
+    }
+}
+
+
+void RFBServer::encode_raw(client *c, const rect &r, std::vector<uint8_t> &out)
+{
+  int bytes = c->bpp/8;
+  size_t pos = out.size();
+  out.resize(pos + r.w*r.h*bytes);
+  uint8_t *o = out.data()+pos;
+
+  for(int y=r.y; y<r.y+r.h; y++)
+    {
+      const uint8_t *p = m_pixels + y*m_width + r.x;
+      for(int x=0; x<r.w; x++, o+=bytes)
+        memcpy(o, c->pix[p[x]], bytes);
+    }
+}
+
+
+void RFBServer::encode_hextile(client *c, const rect &r, std::vector<uint8_t> &out)
+{
+  // background/foreground carried over from tile to tile (-1 = not set)
+  int bg = -1, fg = -1;
+  uint8_t tile[TILE*TILE], buf[1+TILE*TILE*4];
+
+  for(int y=r.y; y<r.y+r.h; y+=TILE)
+    for(int x=r.x; x<r.x+r.w; x+=TILE)
+      {
+        int w = r.x+r.w-x<TILE ? r.x+r.w-x : TILE, h = r.y+r.h-y<TILE ? r.y+r.h-y : TILE;
+        for(int k=0; k<h; k++)
+          memcpy(tile+k*w, m_pixels+(y+k)*m_width+x, w);
+
+        int n = hextile_tile(c, tile, w, h, buf, bg, fg);
+        out.insert(out.end(), buf, buf+n);
+      }
+}
+
+
+// one hextile tile (w*h levels in "p"), returns the number of bytes written to "out"
+int RFBServer::hextile_tile(client *c, const uint8_t *p, int w, int h, uint8_t *out,
+                            int &bg, int &fg)
+{
+  struct subrect
+  {
+    uint8_t v, xy, wh;
+  };
+
+  int bytes = c->bpp/8, n = w*h;
+
+  // background: the most frequent level
+  uint16_t count[256] = {0};
+  uint8_t  levels[TILE*TILE];
+  int tile_bg = p[0], colors = 0;
+  for(int i=0; i<n; i++)
+    if( count[p[i]]++==0 ) levels[colors++] = p[i];
+  for(int i=1; i<colors; i++)
+    if( count[levels[i]]>count[tile_bg] ) tile_bg = levels[i];
+
+  uint8_t *o = out;
+  if( colors==1 )
+    {
+      *o++ = tile_bg!=bg ? HEXTILE_BG : 0;
+      if( tile_bg!=bg )
+        {
+          memcpy(o, c->pix[tile_bg], bytes);
+          o += bytes;
+          bg = tile_bg;
+        }
+      return (int) (o-out);
+    }
+
+  // cover everything else with runs of one level (widest first, then as
+  // many rows down as match), most text glyphs take a handful
+  subrect sub[256];
+  bool covered[TILE*TILE] = {false};
+  int  num = 0, tile_fg = -1, raw_size = 1 + n*bytes, size = 0;
+  bool mono = true;
+  for(int y=0; y<h && size<raw_size && num<255; y++)
+    for(int x=0; x<w; x++)
+      {
+        int v = p[y*w+x];
+        if( v==tile_bg || covered[y*w+x] ) continue;
+
+        int sw = 1, sh = 1;
+        while( x+sw<w && p[y*w+x+sw]==v && !covered[y*w+x+sw] ) sw++;
+        while( y+sh<h )
+          {
+            int k = 0;
+            while( k<sw && p[(y+sh)*w+x+k]==v && !covered[(y+sh)*w+x+k] ) k++;
+            if( k<sw ) break;
+            sh++;
+          }
+        for(int yy=y; yy<y+sh; yy++)
+          memset(covered+yy*w+x, 1, sw);
+
+        if( tile_fg<0 ) tile_fg = v; else if( v!=tile_fg ) mono = false;
+        sub[num].v  = (uint8_t) v;
+        sub[num].xy = (uint8_t) (x<<4 | y);
+        sub[num].wh = (uint8_t) ((sw-1)<<4 | (sh-1));
+        num++;
+
+        size = 2 + (tile_bg!=bg ? bytes : 0) + (mono ? (tile_fg!=fg ? bytes : 0) : 0) + num*(mono ? 2 : 2+bytes);
+        if( num==255 || size>=raw_size ) break;
+        x += sw-1;
+      }
+
+  if( size>=raw_size || num==255 )
+    {
+      *o++ = HEXTILE_RAW;
+      for(int i=0; i<n; i++, o+=bytes)
+        memcpy(o, c->pix[p[i]], bytes);
+
+      // the next tile must specify its colors again
+      bg = fg = -1;
+      return (int) (o-out);
+    }
+
+  uint8_t mask = HEXTILE_SUBRECTS;
+  if( tile_bg!=bg ) mask |= HEXTILE_BG;
+  if( mono && tile_fg!=fg ) mask |= HEXTILE_FG;
+  if( !mono ) mask |= HEXTILE_COLOURED;
+  *o++ = mask;
+  if( mask & HEXTILE_BG )
+    {
+      memcpy(o, c->pix[tile_bg], bytes);
+      o += bytes;
+    }
+  if( mask & HEXTILE_FG )
+    {
+      memcpy(o, c->pix[tile_fg], bytes);
+      o += bytes;
+    }
+  *o++ = (uint8_t) num;
+  for(int i=0; i<num; i++)
+    {
+      if( !mono )
+        {
+          memcpy(o, c->pix[sub[i].v], bytes);
+          o += bytes;
+        }
+      *o++ = sub[i].xy;
+      *o++ = sub[i].wh;
+    }
+
+  bg = tile_bg;
+  fg = mono ? tile_fg : -1;
+  return (int) (o-out);
+}
+
+
+// the uncompressed ZRLE tiles of a rectangle
+void RFBServer::encode_zrle(client *c, const rect &r, std::vector<uint8_t> &out)
+{
+  for(int y=r.y; y<r.y+r.h; y+=ZRLE_TILE)
+    for(int x=r.x; x<r.x+r.w; x+=ZRLE_TILE)
+      {
+        int w = r.x+r.w-x<ZRLE_TILE ? r.x+r.w-x : ZRLE_TILE;
+        int h = r.y+r.h-y<ZRLE_TILE ? r.y+r.h-y : ZRLE_TILE;
+        zrle_tile(c, m_pixels + y*m_width + x, w, h, out);
+      }
+}
+
+
+// append length and compressed data (flushed so the viewer can decode it
+// right away) to the client's output, false on error
+bool RFBServer::compress(client *c, const uint8_t *data, size_t size)
+{
+  // one zlib stream for the whole connection
+  if( !c->zs_init )
+    {
+      memset(&c->zs, 0, sizeof(c->zs));
+      if( deflateInit(&c->zs, Z_BEST_SPEED)!=Z_OK ) return false;
+      c->zs_init = true;
+    }
+
+  size_t pos = c->out.size();
+  c->out.resize(pos + 4 + deflateBound(&c->zs, size) + 16);
+  c->zs.next_in   = (Bytef *) data;
+  c->zs.avail_in  = (uInt) size;
+  c->zs.next_out  = c->out.data()+pos+4;
+  c->zs.avail_out = (uInt) (c->out.size()-pos-4);
+  if( deflate(&c->zs, Z_SYNC_FLUSH)!=Z_OK || c->zs.avail_in!=0 ) return false;
+
+  uint32_t len = (uint32_t) (c->zs.next_out - (c->out.data()+pos+4));
+  c->out.resize(pos+4+len);
+  c->out[pos]   = (uint8_t) (len>>24);
+  c->out[pos+1] = (uint8_t) (len>>16);
+  c->out[pos+2] = (uint8_t) (len>>8);
+  c->out[pos+3] = (uint8_t) len;
+  return true;
+}
+
+
+// one ZRLE tile (at "p" in the picture), appended to "out"
+void RFBServer::zrle_tile(client *c, const uint8_t *p, int w, int h, std::vector<uint8_t> &out)
+{
+  // palette of at most 127 levels
+  int index[256], palette[128], n = 0;
+  memset(index, -1, sizeof(index));
+  for(int y=0; y<h && n<=127; y++)
+    for(int x=0; x<w && n<=127; x++)
+      {
+        int v = p[y*m_width+x];
+        if( index[v]<0 )
+          {
+            if( n<128 ) palette[n] = v;
+            index[v] = n++;
+          }
+      }
+
+  const int cb = c->cpixel, co = c->cpixel_offset;
+  if( n==1 )
+    {
+      // solid
+      out.push_back(1);
+      out.insert(out.end(), c->pix[palette[0]]+co, c->pix[palette[0]]+co+cb);
+    }
+  else if( n<=16 )
+    {
+      // packed palette: 1, 2 or 4 bits per pixel, rows start on a byte
+      out.push_back((uint8_t) n);
+      for(int i=0; i<n; i++)
+        out.insert(out.end(), c->pix[palette[i]]+co, c->pix[palette[i]]+co+cb);
+
+      int bits = n==2 ? 1 : n<=4 ? 2 : 4;
+      for(int y=0; y<h; y++)
+        {
+          const uint8_t *row = p + y*m_width;
+          int byte = 0, used = 0, x = 0;
+#if __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+          if( bits==1 )
+            {
+              // two levels (i.e. text): 8 pixels at a time, bytes equal to
+              // the second level become 1, then one multiply gathers them
+              // into one byte (first pixel in the top bit)
+              const uint64_t ones = 0x0101010101010101ull, low7 = 0x7F7F7F7F7F7F7F7Full;
+              uint64_t second = ones*palette[1];
+              for(; x+8<=w; x+=8)
+                {
+                  uint64_t v;
+                  memcpy(&v, row+x, 8);
+                  v ^= second;
+                  v = ~(((v & low7) + low7) | v) & (ones<<7);
+                  out.push_back((uint8_t) (((v>>7) * 0x8040201008040201ull) >> 56));
+                }
+            }
+#endif
+          for(; x<w; x++)
+            {
+              byte = (byte<<bits) | index[row[x]];
+              used += bits;
+              if( used==8 )
+                {
+                  out.push_back((uint8_t) byte);
+                  byte = used = 0;
+                }
+            }
+          if( used>0 ) out.push_back((uint8_t) (byte<<(8-used)));
+        }
+    }
+  else
+    {
+      // palette RLE for up to 127 levels, plain RLE otherwise
+      bool plain = n>127;
+      if( plain )
+        out.push_back(128);
+      else
+        {
+          out.push_back((uint8_t) (128+n));
+          for(int i=0; i<n; i++)
+            out.insert(out.end(), c->pix[palette[i]]+co, c->pix[palette[i]]+co+cb);
+        }
+
+      int x = 0, y = 0;
+      while( y<h )
+        {
+          int v = p[y*m_width+x], len = 0;
+          while( y<h && p[y*m_width+x]==v )
+            {
+              len++;
+              if( ++x==w ) { x = 0; y++; }
+            }
+
+          if( plain )
+            out.insert(out.end(), c->pix[v]+co, c->pix[v]+co+cb);
+          else
+            out.push_back((uint8_t) (index[v] | (len>1 ? 128 : 0)));
+          if( plain || len>1 )
+            {
+              for(len--; len>=255; len-=255) out.push_back(255);
+              out.push_back((uint8_t) len);
+            }
+        }
+    }
+}
+
+
+void RFBServer::print_stats(FILE *f)
+{
+  fprintf(f, "VNC: %llu updates, %llu tiles changed, %llu encoded, %llu reused, %i viewers\n",
+          (unsigned long long) num_updates, (unsigned long long) num_tiles,
+          (unsigned long long) num_encoded, (unsigned long long) num_reused, (int) m_clients.size());
+  for(size_t i=0; i<m_clients.size(); i++)
+    {
+      client *c = m_clients[i];
+      fprintf(f, "  %-22s %-7s %10llu bytes %8llu updates %8llu rects %6llu keys %8llu deferred\n", c->name,
+              c->encoding==RFB_ENC_ZRLE ? "ZRLE" : c->encoding==RFB_ENC_HEXTILE ? "hextile" : "raw",
+              (unsigned long long) c->bytes, (unsigned long long) c->updates,
+              (unsigned long long) c->rects, (unsigned long long) c->keys,
+              (unsigned long long) c->deferred);
+    }
+  hash_time.print(f);
+  encode_time.print(f);
+}
@@ -0,0 +1,184 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - RFB (VNC) server
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef RFBSERVER_H
+#define RFBSERVER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <zlib.h>
+#include "reactor.h"
+#include "histogram.h"
+
+
+// Serves a picture (one byte per pixel, 0 to max_value like
+// VDM1Framebuffer::pixels) to any number of VNC viewers (RFB protocol
+// 3.3, 3.7 and 3.8, no authentication, so by default only on the local
+// machine).
+// - update() finds what changed by hashing 16x16 pixel tiles and comparing
+//   the hashes with the last update's, changed tiles are stamped with a
+//   sequence number (like the relay does for cells), a viewer remembers
+//   the sequence number it is synchronized to. Hashing costs the same no
+//   matter how many viewers there are, each viewer only needs its own
+//   encoding.
+// - changed tiles are sent as rectangles (runs of tiles in a row, merged
+//   with the same run in the row above), encoded with the first of ZRLE,
+//   hextile and raw that the viewer asks for. Both ZRLE (palette tiles,
+//   1 bit per pixel for two colors, then zlib) and hextile (background,
+//   foreground and runs of foreground pixels) fit two-colored text well.
+//   Viewers in step (same changes, format and encoding) share the
+//   encoding of the last update (a few pixel formats and encodings at a
+//   time), only ZRLE's compression is per viewer.
+// - a viewer gets a new update only after asking for one (as the protocol
+//   wants) and only once it has taken the last one, a slow viewer gets
+//   fewer, larger updates (incremental requests are answered for the
+//   whole picture).
+// - key presses are translated to ASCII (X keysyms, Control held down
+//   gives control characters, Insert = 0x80 like the Windows display)
+//   and passed to the key callback.
+class RFBServer
+{
+ public:
+  typedef void (*key_func)(void *ctx, uint8_t key);
+
+  RFBServer(Reactor *reactor);
+  ~RFBServer();
+
+  // the picture served, must stay valid (set before listening)
+  void set_picture(const uint8_t *pixels, int width, int height, uint8_t max_value,
+                   uint32_t fg = 0x00FF00, uint32_t bg = 0x000000);
+
+  void set_key_callback(key_func f, void *ctx);
+
+  // accept viewers on a TCP port of the given address (NULL = any)
+  // returns the port or -1 on error
+  int listen(const char *addr, int port);
+
+  // the picture changed: find the changed tiles and serve waiting viewers
+  void update();
+
+  int num_clients() const { return (int) m_clients.size(); }
+
+  void print_stats(FILE *f);
+
+  enum { TILE = 16, MAX_CLIENTS = 64, NOTSENT_LOWAT = 16384, NUM_LAST = 4 };
+
+  // statistics
+  uint64_t  num_updates, num_tiles;  // update() calls with changes, changed tiles
+  uint64_t  num_encoded, num_reused; // updates encoded, encoded updates sent to another viewer
+  Histogram hash_time, encode_time;  // microseconds per update() and per encoded update
+
+ private:
+  enum state_t { STATE_VERSION, STATE_SECURITY, STATE_INIT, STATE_NORMAL };
+
+  struct client
+  {
+    RFBServer *server;
+    int        fd;
+    char       name[64];
+    state_t    state;
+    int        minor;
+
+    std::vector<uint8_t> in, out;
+    size_t     out_pos;
+
+    // pixel format: bytes of each level (0-max_value) as the viewer wants them
+    uint8_t    format[16];
+    int        bpp, cpixel, cpixel_offset;
+    bool       big_endian, true_colour;
+    uint16_t   max[3];
+    uint8_t    shift[3];
+    uint8_t    pix[256][4];
+
+    int        encoding;
+    bool       update_requested, full_requested, control;
+    int        req_x, req_y, req_w, req_h;
+    uint32_t   synced;
+
+    z_stream   zs;
+    bool       zs_init;
+
+    uint64_t   bytes, updates, rects, keys, deferred;
+  };
+
+  struct rect
+  {
+    int x, y, w, h;
+  };
+
+  // an encoded update: the rectangles for the changes from sequence
+  // number "from" (0 = everything) to "to" and their data (for ZRLE not
+  // compressed yet)
+  struct encoded
+  {
+    bool     valid;
+    int      encoding;
+    uint8_t  format[16];
+    uint32_t from, to;
+    std::vector<rect>    rects;
+    std::vector<size_t>  offset;  // of each rectangle's data, plus the end
+    std::vector<uint8_t> data;
+  };
+
+  void accept_all();
+  void drop(client *c, const char *reason);
+  bool send_out(client *c);
+  bool receive(client *c);
+  int  handle(client *c, const uint8_t *p, int n);
+  void set_pixel_format(client *c, const uint8_t *pf);
+  void set_encodings(client *c, const uint8_t *list, int n);
+  void key_event(client *c, bool down, uint32_t keysym);
+  void serve(client *c);
+
+  void changed_rects(client *c, bool whole, std::vector<rect> &rects);
+  void encode_raw(client *c, const rect &r, std::vector<uint8_t> &out);
+  void encode_hextile(client *c, const rect &r, std::vector<uint8_t> &out);
+  int  hextile_tile(client *c, const uint8_t *p, int w, int h, uint8_t *out,
+                    int &bg, int &fg);
+  void encode_zrle(client *c, const rect &r, std::vector<uint8_t> &out);
+  bool compress(client *c, const uint8_t *data, size_t size);
+  void zrle_tile(client *c, const uint8_t *p, int w, int h, std::vector<uint8_t> &out);
+
+  static void listen_event(void *ctx, int fd, uint32_t events);
+  static void client_event(void *ctx, int fd, uint32_t events);
+
+  Reactor  *m_reactor;
+  int       m_listen;
+  key_func  m_key_func;
+  void     *m_key_ctx;
+
+  const uint8_t *m_pixels;
+  int       m_width, m_height;
+  uint8_t   m_max_value;
+  uint8_t   m_rgb[256][3];
+
+  // tiles: hash of the pixels and sequence number of the last change
+  int       m_tiles_x, m_tiles_y;
+  std::vector<uint64_t> m_hash;
+  std::vector<uint32_t> m_tile_seq;
+  uint32_t  m_seq;
+
+  std::vector<client *> m_clients;
+  encoded               m_last[NUM_LAST];
+  int                   m_last_next;
+};
+
+
+#endif
@@ -0,0 +1,179 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - finding text on the screen
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <string.h>
+#include "screenmatcher.h"
+#include "vdm1scan.h"
+
+
+ScreenMatcher::ScreenMatcher(const VDM1Core *core)
+{
+  m_core = core;
+  for(int i=0; i<MAX_PATTERNS; i++) m_patterns[i].used = false;
+  memcpy(m_hash, core->row_hash, sizeof(m_hash));
+  memset(m_text, 0, sizeof(m_text));
+  memset(m_vt, 0, sizeof(m_vt));
+  memset(m_found, 0, sizeof(m_found));
+  m_new = 0;
+  m_blanking = core->dip & 0x30;
+  num_checks = num_rows = num_searches = 0;
+  invalidate();
+}
+
+
+ScreenMatcher::~ScreenMatcher()
+{
+  for(int id=0; id<MAX_PATTERNS; id++) remove(id);
+}
+
+
+int ScreenMatcher::add(const char *text, bool regex)
+{
+  int id;
+  for(id=0; id<MAX_PATTERNS && m_patterns[id].used; id++) {}
+  if( id==MAX_PATTERNS ) return -1;
+
+  pattern &p = m_patterns[id];
+  if( regex && regcomp(&p.re, text, REG_EXTENDED | REG_NOSUB)!=0 ) return -1;
+
+  p.used  = true;
+  p.regex = regex;
+  p.text  = text;
+
+  // rows examined so far only need a look for the new pattern
+  for(int m=0; m<VDM1_ROWS; m++)
+    {
+      m_found[m] &= ~(1u << id);
+      if( (m_valid>>m & 1) && match(p, m) ) m_found[m] |= 1u << id;
+    }
+
+  return id;
+}
+
+
+void ScreenMatcher::remove(int id)
+{
+  if( id<0 || id>=MAX_PATTERNS || !m_patterns[id].used ) return;
+  if( m_patterns[id].regex ) regfree(&m_patterns[id].re);
+  m_patterns[id].used = false;
+  for(int m=0; m<VDM1_ROWS; m++) m_found[m] &= ~(1u << id);
+}
+
+
+void ScreenMatcher::mark()
+{
+  check();
+  m_new = 0;
+}
+
+
+void ScreenMatcher::invalidate()
+{
+  m_valid = 0;
+}
+
+
+bool ScreenMatcher::check()
+{
+  num_checks++;
+
+  // where rows end depends on whether CR/VT blanking is on
+  if( (m_core->dip & 0x30)!=m_blanking )
+    {
+      m_blanking = m_core->dip & 0x30;
+      invalidate();
+    }
+
+  bool changed = false;
+  for(int m=0; m<VDM1_ROWS; m++)
+    if( m_core->row_hash[m]!=m_hash[m] || (m_valid>>m & 1)==0 )
+      {
+        // rows converted again without a change (after invalidate()) are not new
+        if( m_core->row_hash[m]!=m_hash[m] ) m_new |= 1u << m;
+        m_hash[m] = m_core->row_hash[m];
+        convert(m);
+
+        uint32_t found = 0;
+        for(int id=0; id<MAX_PATTERNS; id++)
+          if( m_patterns[id].used && match(m_patterns[id], m) )
+            found |= 1u << id;
+
+        m_found[m] = found;
+        m_valid |= 1u << m;
+        changed = true;
+      }
+
+  return changed;
+}
+
+
+int ScreenMatcher::find(int id, bool only_new)
+{
+  check();
+
+  uint8_t ctrl = m_core->ctrl;
+  int firstDisplayed = (ctrl & 0xF0)/16;
+  int firstLine      = ctrl & 0x0F;
+
+  // whole screen blanked
+  if( (m_core->dip & 3)==0 ) return -1;
+
+  for(int r=0; r<VDM1_ROWS; r++)
+    {
+      int m = (r+firstLine) & 0x0F;
+      if( r>=firstDisplayed && (m_found[m]>>id & 1) && (!only_new || (m_new>>m & 1)) )
+        return r;
+
+      // VT blanks the rest of the screen (also from within curtain blanking)
+      if( m_vt[m] ) break;
+    }
+
+  return -1;
+}
+
+
+void ScreenMatcher::convert(int m)
+{
+  const uint8_t *row = m_core->mem + m*VDM1_COLS;
+  int end = m_blanking!=0x30 ? vdm1_scan_row(row, NULL) : VDM1_SCAN_NONE;
+  m_vt[m] = end!=VDM1_SCAN_NONE && (row[end] & 0x7f)==11;
+
+  // same characters as VDM1Core::get_text()
+  char *text = m_text[m];
+  for(int c=0; c<end; c++)
+    {
+      uint8_t ch = row[c] & 0x7f;
+      text[c] = (ch<32 || ch==127) ? ' ' : ch;
+    }
+
+  int n = end;
+  while( n>0 && text[n-1]==' ' ) n--;
+  text[n] = 0;
+  num_rows++;
+}
+
+
+bool ScreenMatcher::match(const pattern &p, int m)
+{
+  num_searches++;
+  if( p.regex )
+    return regexec(&p.re, m_text[m], 0, NULL, 0)==0;
+  else
+    return strstr(m_text[m], p.text.c_str())!=NULL;
+}
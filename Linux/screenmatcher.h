@@ -0,0 +1,107 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - finding text on the screen
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef SCREENMATCHER_H
+#define SCREENMATCHER_H
+
+#include <stdint.h>
+#include <string>
+#include <regex.h>
+#include "vdm1core.h"
+
+
+// Finds text on the screen for scripts waiting for output (see
+// expectscript.h). A pattern is plain text or a regular expression (POSIX
+// extended syntax) and is matched against one row at a time, as the row
+// is displayed: bit 7 (cursor/inverse) cleared, control characters as
+// spaces, nothing after a CR or VT if the DIP switches enable CR/VT
+// blanking, trailing spaces removed (so /^A>$/ is a CP/M prompt with
+// nothing typed after it).
+// - check() only re-examines rows of video memory that were touched since
+//   the last check: it compares the core's row hashes (VDM1Core::row_hash)
+//   with the ones it saw last, converts the rows that differ and runs all
+//   patterns on them. Results are kept per row of video memory, so
+//   scrolling with the first line in ctrl costs nothing.
+// - find() goes through the rows in display order (memory row ctrl & 15 at
+//   the top) and skips blanked ones: curtain blanking (ctrl bits 4-7), rows
+//   after a VT, the whole screen blanked by the DIP switches.
+// - mark() starts over what counts as new: find() can be limited to rows
+//   that changed since then, i.e. output that follows a command while the
+//   old prompt is still on the screen.
+// Not thread-safe, the owner must serialize calls (and changes to the core).
+class ScreenMatcher
+{
+ public:
+  enum { MAX_PATTERNS = 32 };
+
+  ScreenMatcher(const VDM1Core *core);
+  ~ScreenMatcher();
+
+  // add a pattern, returns its id or -1 if the regular expression is
+  // invalid or there are MAX_PATTERNS already
+  int  add(const char *pattern, bool regex);
+  void remove(int id);
+
+  // rows changed from now on are new
+  void mark();
+
+  // forget what was examined, the next check() converts all rows
+  void invalidate();
+
+  // re-examine the rows touched since the last check, returns true if there were any
+  bool check();
+
+  // checks and returns the topmost displayed row (0-15) where pattern
+  // "id" is found, -1 if it is not on the screen; with "only_new" only
+  // rows changed since mark() count
+  int  find(int id, bool only_new = false);
+
+  // text of a row of video memory as matched (valid after check())
+  const char *text(int mem_row) const { return m_text[mem_row]; }
+
+  // statistics
+  uint64_t num_checks, num_rows, num_searches; // check() calls, rows converted, patterns run on a row
+
+ private:
+  struct pattern
+  {
+    bool        used, regex;
+    std::string text;
+    regex_t     re;
+  };
+
+  void convert(int m);
+  bool match(const pattern &p, int m);
+
+  const VDM1Core *m_core;
+  pattern  m_patterns[MAX_PATTERNS];
+
+  // per row of video memory: row hash when last converted, text, ends with VT, patterns found
+  uint64_t m_hash[VDM1_ROWS];
+  char     m_text[VDM1_ROWS][VDM1_COLS+1];
+  bool     m_vt[VDM1_ROWS];
+  uint32_t m_found[VDM1_ROWS];
+
+  // rows converted since invalidate() / changed since mark() (bit per row of video memory)
+  uint32_t m_valid, m_new;
+  uint8_t  m_blanking;
+};
+
+
+#endif
@@ -0,0 +1,383 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - multi-session display server (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "server.h"
+#include "vdm1proto.h"
+
+
+static uint64_t clock_ns(clockid_t clk)
+{
+  struct timespec ts;
+  clock_gettime(clk, &ts);
+  return uint64_t(ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+
+// -----------------------------------------------------------------------------
+// Session
+// -----------------------------------------------------------------------------
+
+
+Session::Session(int i, int f, const char *n, bool skip_greeting) :
+  lag("lag", "us"),
+  closed(false)
+{
+  id = i;
+  fd = f;
+  snprintf(name, sizeof(name), "%s", n);
+  cpu_ns = 0;
+  turns = 0;
+  m_skip_greeting = skip_greeting;
+  m_probe = false;
+
+  core.set_surface(&framebuffer);
+  core.set_write_callback(core_write, this);
+  core.redraw();
+}
+
+
+void Session::core_write(void *ctx, int addr, uint8_t value)
+{
+  Session *s = (Session *) ctx;
+
+  if( s->m_probe && addr==0x3ff )
+    {
+      const uint8_t *m = s->core.mem + 0x3fc;
+      uint32_t stamp = (m[0]&0x3f) | ((m[1]&0x3f)<<6) | ((m[2]&0x3f)<<12) | ((m[3]&0x3f)<<18);
+      uint32_t now   = (uint32_t) (clock_ns(CLOCK_MONOTONIC)/1000);
+      s->lag.add((now-stamp) & 0xffffff);
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// SessionServer
+// -----------------------------------------------------------------------------
+
+
+SessionServer::SessionServer(int threads) :
+  num_steals(0), num_kicks(0), num_turns(0), m_running(false), m_kick_pending(false), m_idle(0)
+{
+  m_num_threads = threads<1 ? 1 : threads;
+  m_workers = new worker[m_num_threads];
+  m_listen = -1;
+  m_probe = false;
+
+  m_epoll = epoll_create1(EPOLL_CLOEXEC);
+  if( m_epoll<0 ) perror("epoll_create1");
+
+  // edge-triggered: each kick wakes exactly one waiting worker
+  m_kick = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.ptr = &m_kick;
+  epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_kick, &ev);
+}
+
+
+SessionServer::~SessionServer()
+{
+  stop();
+
+  for(size_t i=0; i<m_sessions.size(); i++)
+    delete m_sessions[i];
+
+  if( m_listen>=0 ) close(m_listen);
+  close(m_kick);
+  close(m_epoll);
+  delete [] m_workers;
+}
+
+
+void SessionServer::start()
+{
+  m_running = true;
+  for(int i=0; i<m_num_threads; i++)
+    m_workers[i].thread = std::thread(&SessionServer::run_worker, this, i);
+}
+
+
+void SessionServer::stop()
+{
+  if( !m_running ) return;
+
+  // each worker passes the kick on before it exits
+  m_running = false;
+  kick(true);
+  for(int i=0; i<m_num_threads; i++)
+    m_workers[i].thread.join();
+
+  for(size_t i=0; i<m_sessions.size(); i++)
+    if( !m_sessions[i]->closed )
+      close_session(m_sessions[i]);
+}
+
+
+Session *SessionServer::add(int fd, const char *name, bool skip_greeting)
+{
+  Session *s;
+  {
+    std::lock_guard<std::mutex> lock(m_sessions_mutex);
+    s = new Session((int) m_sessions.size(), fd, name, skip_greeting);
+    s->m_probe = m_probe;
+    m_sessions.push_back(s);
+  }
+
+  // ask for the full screen
+  uint8_t c = VDM_CONNECT;
+  if( write(fd, &c, 1)<0 && errno!=EAGAIN )
+    {
+      close_session(s);
+      return s;
+    }
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.ptr = s;
+  if( epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev)<0 )
+    {
+      perror("epoll_ctl");
+      close_session(s);
+    }
+
+  return s;
+}
+
+
+std::vector<Session *> SessionServer::sessions()
+{
+  std::lock_guard<std::mutex> lock(m_sessions_mutex);
+  return m_sessions;
+}
+
+
+int SessionServer::listen(int port)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  int one = 1;
+
+  m_listen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  setsockopt(m_listen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if( m_listen<0 || bind(m_listen, (struct sockaddr *) &addr, sizeof(addr))<0 || ::listen(m_listen, 1024)<0 ||
+      getsockname(m_listen, (struct sockaddr *) &addr, &len)<0 )
+    {
+      fprintf(stderr, "Unable to listen on port %i: %s\n", port, strerror(errno));
+      if( m_listen>=0 ) close(m_listen);
+      m_listen = -1;
+      return -1;
+    }
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.ptr = &m_listen;
+  epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listen, &ev);
+
+  return ntohs(addr.sin_port);
+}
+
+
+void SessionServer::accept_all()
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  int fd;
+
+  while( (fd=accept4(m_listen, (struct sockaddr *) &addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC))>=0 )
+    {
+      char name[64];
+      snprintf(name, sizeof(name), "%s:%i", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+      add(fd, name);
+      len = sizeof(addr);
+    }
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.ptr = &m_listen;
+  epoll_ctl(m_epoll, EPOLL_CTL_MOD, m_listen, &ev);
+}
+
+
+void SessionServer::kick(bool force)
+{
+  // one kick on its way is enough, the woken worker kicks again if
+  // there is still more to do
+  if( m_kick_pending.exchange(true) && !force ) return;
+
+  uint64_t one = 1;
+  num_kicks++;
+  if( write(m_kick, &one, sizeof(one))<0 ) perror("eventfd");
+}
+
+
+void SessionServer::rearm(Session *s)
+{
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.ptr = s;
+  epoll_ctl(m_epoll, EPOLL_CTL_MOD, s->fd, &ev);
+}
+
+
+void SessionServer::close_session(Session *s)
+{
+  epoll_ctl(m_epoll, EPOLL_CTL_DEL, s->fd, NULL);
+  close(s->fd);
+  s->closed = true;
+}
+
+
+// returns true if the session (probably) has more data waiting
+bool SessionServer::process(Session *s, uint8_t *buf)
+{
+  std::lock_guard<std::mutex> lock(s->mutex);
+  uint64_t t = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+  bool more = false;
+
+  ssize_t n = read(s->fd, buf, TURN_BYTES);
+  if( n>0 )
+    {
+      int i = 0;
+      if( s->m_skip_greeting )
+        {
+          // skip the simulator's greeting message, see Source
+          while( i<n && s->m_skip_greeting )
+            if( buf[i++]=='\n' )
+              s->m_skip_greeting = false;
+        }
+
+      s->core.receive(buf+i, (int) n-i);
+      more = n==TURN_BYTES;
+      if( !more ) rearm(s);
+    }
+  else if( n<0 && (errno==EAGAIN || errno==EINTR) )
+    rearm(s);
+  else
+    close_session(s);
+
+  s->turns++;
+  s->cpu_ns += clock_ns(CLOCK_THREAD_CPUTIME_ID)-t;
+  num_turns++;
+  return more;
+}
+
+
+Session *SessionServer::steal(int idx)
+{
+  for(int i=1; i<m_num_threads; i++)
+    {
+      worker &w = m_workers[(idx+i) % m_num_threads];
+      std::lock_guard<std::mutex> lock(w.mutex);
+      if( !w.queue.empty() )
+        {
+          Session *s = w.queue.back();
+          w.queue.pop_back();
+          num_steals++;
+          return s;
+        }
+    }
+
+  return NULL;
+}
+
+
+void SessionServer::run_worker(int idx)
+{
+  worker  &w = m_workers[idx];
+  uint8_t *buf = new uint8_t[TURN_BYTES];
+
+  while( m_running )
+    {
+      Session *s = NULL;
+      size_t   queued = 0;
+
+      {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if( !w.queue.empty() )
+          {
+            s = w.queue.front();
+            w.queue.pop_front();
+            queued = w.queue.size();
+          }
+      }
+
+      if( s==NULL ) s = steal(idx);
+
+      if( s!=NULL )
+        {
+          // still more to do here and someone idle who could help
+          if( queued>0 && m_idle>0 ) kick();
+
+          if( process(s, buf) )
+            {
+              std::lock_guard<std::mutex> lock(w.mutex);
+              w.queue.push_back(s);
+            }
+
+          continue;
+        }
+
+      // nothing to do: wait for ready connections (or a kick)
+      struct epoll_event events[MAX_EVENTS];
+      m_idle++;
+      int n = epoll_wait(m_epoll, events, MAX_EVENTS, -1);
+      m_idle--;
+
+      int added = 0;
+      for(int i=0; i<n; i++)
+        {
+          void *p = events[i].data.ptr;
+          if( p==&m_kick )
+            {
+              uint64_t v;
+              m_kick_pending = false;
+              while( read(m_kick, &v, sizeof(v))==sizeof(v) );
+            }
+          else if( p==&m_listen )
+            accept_all();
+          else
+            {
+              std::lock_guard<std::mutex> lock(w.mutex);
+              w.queue.push_back((Session *) p);
+              added++;
+            }
+        }
+
+      if( added>1 && m_idle>0 ) kick();
+    }
+
+  // pass the stop request on to the next worker
+  kick(true);
+  delete [] buf;
+}
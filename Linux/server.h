@@ -0,0 +1,141 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - multi-session display server (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include "vdm1core.h"
+#include "vdm1framebuffer.h"
+#include "histogram.h"
+
+
+// One VDM-1 display attached to one connection: its own decoder, video
+// memory and rendered picture.
+class Session
+{
+ public:
+  Session(int id, int fd, const char *name, bool skip_greeting);
+
+  int  id, fd;
+  char name[64];
+
+  VDM1Core        core;
+  VDM1Framebuffer framebuffer;
+
+  // held while data is processed, lock it to look at core/framebuffer
+  std::mutex mutex;
+
+  // statistics
+  Histogram lag;          // microseconds, from timestamp probes (see below)
+  uint64_t  cpu_ns;       // thread CPU time spent processing this session
+  uint64_t  turns;        // number of times a worker processed it
+  std::atomic<bool> closed;
+
+ private:
+  friend class SessionServer;
+  static void core_write(void *ctx, int addr, uint8_t value);
+
+  bool m_skip_greeting, m_probe;
+};
+
+
+// Hosts any number of sessions in one process. All connections share one
+// epoll instance (EPOLLONESHOT, so a session is only ever handled by one
+// thread at a time) and are driven by a small pool of worker threads:
+// - a worker takes ready sessions from epoll_wait() into its own queue and
+//   works through it in order
+// - a worker without work steals from the back of another worker's queue,
+//   idle workers are woken up when there is work to steal
+// - each turn reads at most TURN_BYTES, a busy session goes back to the
+//   end of its worker's queue so one fast sender can not starve the others
+//
+// Timestamp probes: if enabled, the last four bytes of video memory
+// (0x3FC-0x3FF) are taken as a CLOCK_MONOTONIC microsecond time stamp each
+// time byte 0x3FF is written, and the time since then is recorded in the
+// session's lag histogram. Each byte holds 6 bits of the stamp (lowest
+// first) plus 0x40 so the probe is printable and never contains CR/VT,
+// which would make every probe redraw the whole screen. Used by
+// vdm1-loadgen, senders must run on the same machine.
+class SessionServer
+{
+ public:
+  enum { TURN_BYTES = 65536, MAX_EVENTS = 8 };
+
+  SessionServer(int threads);
+  ~SessionServer();
+
+  void set_timestamp_probe(bool enable) { m_probe = enable; }
+
+  // start the worker threads
+  void start();
+
+  // stop the worker threads and close all connections
+  void stop();
+
+  // add a connection (non-blocking descriptor, owned by the server from now on)
+  // the Altair is asked to send the full screen right away
+  Session *add(int fd, const char *name, bool skip_greeting = false);
+
+  // accept connections on a TCP port (0 = any free port)
+  // returns the port number or -1 on error
+  int listen(int port);
+
+  // all sessions so far (including closed ones)
+  std::vector<Session *> sessions();
+
+  int num_threads() { return m_num_threads; }
+
+  // statistics
+  std::atomic<uint64_t> num_steals, num_kicks, num_turns;
+
+ private:
+  struct worker
+  {
+    std::mutex          mutex;
+    std::deque<Session *> queue;
+    std::thread         thread;
+  };
+
+  void run_worker(int idx);
+  bool process(Session *s, uint8_t *buf);
+  void rearm(Session *s);
+  void close_session(Session *s);
+  void accept_all();
+  Session *steal(int idx);
+  void kick(bool force = false);
+
+  int  m_num_threads;
+  int  m_epoll, m_kick, m_listen;
+  bool m_probe;
+  std::atomic<bool> m_running, m_kick_pending;
+  std::atomic<int>  m_idle;
+  worker          *m_workers;
+
+  std::mutex             m_sessions_mutex;
+  std::vector<Session *> m_sessions;
+};
+
+
+#endif
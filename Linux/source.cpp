@@ -0,0 +1,646 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - data source for the display (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "source.h"
+#include "connection.h"
+
+
+#define MIN_BACKOFF 0.1
+#define MAX_BACKOFF 5.0
+
+// opens of a pseudo terminal's slave side closer together than this count as one
+#define PTY_SETTLE  0.02
+
+// UDP: how often the sender is reminded that we are still listening
+#define HELLO_INTERVAL 1.0
+
+// TCP: give up on an address that does not answer (the kernel would
+// keep trying for minutes)
+#define CONNECT_TIMEOUT 5.0
+
+
+static int64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+
+Source::Source(Reactor *reactor, const char *spec, int baud) :
+  read_time("read time", "us"),
+  read_bytes("bytes per wakeup", "bytes")
+{
+  m_reactor = reactor;
+  snprintf(m_spec, sizeof(m_spec), "%s", spec);
+  m_pty_slave[0] = 0;
+  m_baud = baud;
+
+  if( strncmp(spec, "/dev/", 5)==0 )
+    m_kind = KIND_SERIAL;
+  else if( strcmp(spec, "pty")==0 )
+    m_kind = KIND_PTY;
+  else if( strncmp(spec, "udp:", 4)==0 )
+    m_kind = KIND_UDP;
+  else
+    m_kind = KIND_TCP;
+
+  m_fd = -1;
+  m_notify_fd = -1;
+  m_pty_slave_fd = -1;
+  m_pty_notify_fd = -1;
+  m_retry_timer = m_reactor->add_timer(retry_timer, this);
+  m_pty_timer = -1;
+  m_hello_timer = -1;
+  m_resolve_fd = -1;
+  m_connect_fd = -1;
+  m_connect_timer = -1;
+  m_connect_error = 0;
+  m_addrs = NULL;
+  m_next_addr = NULL;
+  m_hello_seq = 0;
+  vdm_dgreceiver_init(&datagrams);
+  m_backoff = MIN_BACKOFF;
+  m_reconnect = true;
+  m_skip_greeting = false;
+  m_buf = new uint8_t[READ_SIZE];
+
+  m_data_func = NULL;
+  m_state_func = NULL;
+  m_pty_func = NULL;
+  m_data_ctx = NULL;
+  m_state_ctx = NULL;
+  m_pty_ctx = NULL;
+
+  num_reads = 0;
+  num_bytes = 0;
+  num_connects = 0;
+}
+
+
+Source::~Source()
+{
+  if( m_fd>=0 )
+    {
+      m_reactor->remove(m_fd);
+      close(m_fd);
+    }
+
+  if( m_notify_fd>=0 )
+    {
+      m_reactor->remove(m_notify_fd);
+      close(m_notify_fd);
+    }
+
+  if( m_pty_notify_fd>=0 )
+    {
+      m_reactor->remove(m_pty_notify_fd);
+      close(m_pty_notify_fd);
+    }
+
+  if( m_pty_slave_fd>=0 ) close(m_pty_slave_fd);
+
+  // a name lookup can not be interrupted, wait for it
+  if( m_resolver.joinable() ) m_resolver.join();
+  if( m_addrs!=NULL ) freeaddrinfo(m_addrs);
+
+  if( m_resolve_fd>=0 )
+    {
+      m_reactor->remove(m_resolve_fd);
+      close(m_resolve_fd);
+    }
+
+  if( m_connect_fd>=0 )
+    {
+      m_reactor->remove(m_connect_fd);
+      close(m_connect_fd);
+    }
+
+  if( m_retry_timer>=0 ) m_reactor->remove_timer(m_retry_timer);
+  if( m_connect_timer>=0 ) m_reactor->remove_timer(m_connect_timer);
+  if( m_pty_timer>=0 ) m_reactor->remove_timer(m_pty_timer);
+  if( m_hello_timer>=0 ) m_reactor->remove_timer(m_hello_timer);
+  delete [] m_buf;
+}
+
+
+void Source::set_data_callback(data_func f, void *ctx)
+{
+  m_data_func = f;
+  m_data_ctx = ctx;
+}
+
+
+void Source::set_state_callback(state_func f, void *ctx)
+{
+  m_state_func = f;
+  m_state_ctx = ctx;
+}
+
+
+void Source::set_pty_callback(pty_func f, void *ctx)
+{
+  m_pty_func = f;
+  m_pty_ctx = ctx;
+}
+
+
+void Source::set_reconnect(bool reconnect)
+{
+  m_reconnect = reconnect;
+}
+
+
+void Source::start()
+{
+  if( !connect() ) wait_reconnect();
+}
+
+
+bool Source::connect()
+{
+  if( m_kind==KIND_TCP )
+    {
+      // neither the name lookup nor the connect may hold up the reactor
+      // (and with it the display), resolve_event() takes over from here
+      if( m_resolve_fd<0 )
+        {
+          m_resolve_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+          if( m_resolve_fd<0 ) return false;
+          if( !m_reactor->add(m_resolve_fd, EPOLLIN, resolve_event, this) )
+            {
+              close(m_resolve_fd);
+              m_resolve_fd = -1;
+              return false;
+            }
+
+          m_connect_timer = m_reactor->add_timer(connect_timer, this);
+        }
+
+      m_reactor->set_timer(m_retry_timer, 0);
+      m_resolver = std::thread(resolve_thread, this);
+      return true;
+    }
+
+  bool is_tcp;
+  int fd = open_connection(m_spec, m_baud, &is_tcp, m_pty_slave, sizeof(m_pty_slave), &m_pty_slave_fd);
+  if( fd<0 ) return false;
+
+  if( !m_reactor->add(fd, EPOLLIN, data_event, this) )
+    {
+      close(fd);
+      if( m_pty_slave_fd>=0 )
+        {
+          close(m_pty_slave_fd);
+          m_pty_slave_fd = -1;
+        }
+      return false;
+    }
+
+  attach(fd);
+  return true;
+}
+
+
+void Source::attach(int fd)
+{
+  if( m_notify_fd>=0 )
+    {
+      m_reactor->remove(m_notify_fd);
+      close(m_notify_fd);
+      m_notify_fd = -1;
+    }
+  m_reactor->set_timer(m_retry_timer, 0);
+
+  {
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    m_fd = fd;
+  }
+
+  m_backoff = MIN_BACKOFF;
+  m_skip_greeting = m_kind==KIND_TCP;
+
+  if( m_kind==KIND_PTY )
+    {
+      // the master side never sees the emulator (re)open the slave side,
+      // but inotify does. The pseudo terminal only counts as connected
+      // once that happens.
+      if( m_pty_timer<0 ) m_pty_timer = m_reactor->add_timer(pty_timer, this);
+      m_pty_notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+      if( m_pty_notify_fd>=0 &&
+          (inotify_add_watch(m_pty_notify_fd, m_pty_slave, IN_OPEN)<0 ||
+           !m_reactor->add(m_pty_notify_fd, EPOLLIN, pty_event, this)) )
+        {
+          close(m_pty_notify_fd);
+          m_pty_notify_fd = -1;
+        }
+
+      if( m_pty_func!=NULL ) m_pty_func(m_pty_ctx, m_pty_slave);
+    }
+  else
+    {
+      if( m_kind==KIND_UDP )
+        {
+          // nothing is received until the sender knows about us
+          vdm_dgreceiver_init(&datagrams);
+          m_hello_timer = m_reactor->add_timer(hello_timer, this);
+          m_reactor->set_timer(m_hello_timer, HELLO_INTERVAL, HELLO_INTERVAL);
+          send_datagram(VDM_DG_HELLO, NULL, 0);
+        }
+
+      num_connects++;
+      if( m_state_func!=NULL ) m_state_func(m_state_ctx, true);
+    }
+}
+
+
+void Source::resolve_thread(Source *s)
+{
+  s->m_addrs = resolve_tcp(s->m_spec);
+  uint64_t one = 1;
+  if( ::write(s->m_resolve_fd, &one, sizeof(one))<0 ) perror("eventfd");
+}
+
+
+void Source::resolve_event(void *ctx, int fd, uint32_t events)
+{
+  Source *s = (Source *) ctx;
+  uint64_t n;
+  if( read(fd, &n, sizeof(n))<0 ) return;
+
+  s->m_resolver.join();
+  s->m_next_addr = s->m_addrs;
+  s->m_connect_error = 0;
+  if( s->m_addrs!=NULL )
+    s->next_address();
+  else
+    s->connect_failed();
+}
+
+
+void Source::next_address()
+{
+  // try the addresses in turn, as connect() would block each one gets
+  // its own socket and the reactor reports when it is done
+  while( m_next_addr!=NULL )
+    {
+      int fd = start_tcp(m_next_addr);
+      m_next_addr = m_next_addr->ai_next;
+
+      if( fd<0 )
+        m_connect_error = errno;
+      else if( !m_reactor->add(fd, EPOLLOUT, connect_event, this) )
+        close(fd);
+      else
+        {
+          m_connect_fd = fd;
+          m_reactor->set_timer(m_connect_timer, CONNECT_TIMEOUT);
+          return;
+        }
+    }
+
+  fprintf(stderr, "Unable to connect to %s: %s\n", m_spec, strerror(m_connect_error));
+  freeaddrinfo(m_addrs);
+  m_addrs = NULL;
+  connect_failed();
+}
+
+
+void Source::connect_event(void *ctx, int fd, uint32_t events)
+{
+  ((Source *) ctx)->connect_done(finish_tcp(fd));
+}
+
+
+void Source::connect_timer(void *ctx)
+{
+  ((Source *) ctx)->connect_done(ETIMEDOUT);
+}
+
+
+void Source::connect_done(int err)
+{
+  int fd = m_connect_fd;
+  m_reactor->remove(fd);
+  m_reactor->set_timer(m_connect_timer, 0);
+  m_connect_fd = -1;
+
+  if( err!=0 )
+    {
+      close(fd);
+      m_connect_error = err;
+      next_address();
+      return;
+    }
+
+  freeaddrinfo(m_addrs);
+  m_addrs = NULL;
+
+  // only now is the connection up and counted
+  if( !m_reactor->add(fd, EPOLLIN, data_event, this) )
+    {
+      close(fd);
+      connect_failed();
+      return;
+    }
+
+  attach(fd);
+}
+
+
+void Source::connect_failed()
+{
+  if( m_reconnect )
+    wait_reconnect();
+  else if( m_state_func!=NULL )
+    m_state_func(m_state_ctx, false);
+}
+
+
+void Source::disconnect(const char *reason)
+{
+  fprintf(stderr, "%s: %s\n", m_spec, reason);
+
+  m_reactor->remove(m_fd);
+  {
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    close(m_fd);
+    m_fd = -1;
+  }
+
+  if( m_hello_timer>=0 )
+    {
+      m_reactor->remove_timer(m_hello_timer);
+      m_hello_timer = -1;
+    }
+
+  // a pseudo terminal is not reopened but replaced, the new one gets its
+  // own slave side and watch
+  if( m_pty_slave_fd>=0 )
+    {
+      close(m_pty_slave_fd);
+      m_pty_slave_fd = -1;
+    }
+
+  if( m_pty_notify_fd>=0 )
+    {
+      m_reactor->remove(m_pty_notify_fd);
+      close(m_pty_notify_fd);
+      m_pty_notify_fd = -1;
+    }
+
+  if( m_pty_timer>=0 ) m_reactor->set_timer(m_pty_timer, 0);
+
+  if( m_state_func!=NULL ) m_state_func(m_state_ctx, false);
+  if( m_reconnect ) wait_reconnect();
+}
+
+
+void Source::wait_reconnect()
+{
+  if( m_kind==KIND_SERIAL && m_notify_fd<0 )
+    {
+      // watch the device's directory so we know when it (re)appears
+      // (USB serial adapters come and go with the Altair's power)
+      char dir[256];
+      snprintf(dir, sizeof(dir), "%s", m_spec);
+      char *slash = strrchr(dir, '/');
+      if( slash!=NULL ) *slash = 0;
+
+      m_notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+      if( m_notify_fd>=0 &&
+          (inotify_add_watch(m_notify_fd, dir, IN_CREATE | IN_ATTRIB | IN_MOVED_TO)<0 ||
+           !m_reactor->add(m_notify_fd, EPOLLIN, notify_event, this)) )
+        {
+          close(m_notify_fd);
+          m_notify_fd = -1;
+        }
+
+      // the device may exist but not be usable yet (e.g. permissions
+      // not set up), so still retry now and then
+      m_backoff = MAX_BACKOFF;
+    }
+
+  m_reactor->set_timer(m_retry_timer, m_backoff);
+  m_backoff *= 2;
+  if( m_backoff>MAX_BACKOFF ) m_backoff = MAX_BACKOFF;
+}
+
+
+void Source::retry_timer(void *ctx)
+{
+  Source *s = (Source *) ctx;
+  if( s->m_fd<0 && !s->connecting() && !s->connect() ) s->wait_reconnect();
+}
+
+
+void Source::notify_event(void *ctx, int fd, uint32_t events)
+{
+  Source *s = (Source *) ctx;
+  char buf[4096];
+  bool relevant = false;
+  const char *name = strrchr(s->m_spec, '/')+1;
+
+  ssize_t n;
+  while( (n=read(fd, buf, sizeof(buf)))>0 )
+    for(char *p=buf; p<buf+n; )
+      {
+        struct inotify_event *ev = (struct inotify_event *) p;
+        if( ev->len>0 && strcmp(ev->name, name)==0 ) relevant = true;
+        p += sizeof(struct inotify_event) + ev->len;
+      }
+
+  // udev may still be adjusting the device, so give it a moment
+  if( relevant && s->m_fd<0 )
+    s->m_reactor->set_timer(s->m_retry_timer, MIN_BACKOFF);
+}
+
+
+void Source::pty_event(void *ctx, int fd, uint32_t events)
+{
+  Source *s = (Source *) ctx;
+  char buf[4096];
+  int opens = 0;
+
+  ssize_t n;
+  while( (n=read(fd, buf, sizeof(buf)))>0 )
+    for(char *p=buf; p<buf+n; )
+      {
+        struct inotify_event *ev = (struct inotify_event *) p;
+        if( ev->mask & IN_OPEN ) opens++;
+        p += sizeof(struct inotify_event) + ev->len;
+      }
+
+  // emulators often open the port several times in a row (probing it,
+  // then configuring it, then using it), only the last one matters
+  if( opens>0 ) s->m_reactor->set_timer(s->m_pty_timer, PTY_SETTLE);
+}
+
+
+void Source::pty_timer(void *ctx)
+{
+  Source *s = (Source *) ctx;
+  if( s->m_fd>=0 )
+    {
+      s->num_connects++;
+      if( s->m_state_func!=NULL ) s->m_state_func(s->m_state_ctx, true);
+    }
+}
+
+
+void Source::hello_timer(void *ctx)
+{
+  ((Source *) ctx)->send_datagram(VDM_DG_HELLO, NULL, 0);
+}
+
+
+void Source::data_event(void *ctx, int fd, uint32_t events)
+{
+  Source *s = (Source *) ctx;
+  if( s->m_kind==KIND_UDP )
+    s->on_datagrams();
+  else
+    s->on_data(events);
+}
+
+
+void Source::on_data(uint32_t events)
+{
+  int total = 0;
+
+  for(int reads=0; reads<MAX_READS; reads++)
+    {
+      int64_t t = now_us();
+      ssize_t n = read(m_fd, m_buf, READ_SIZE);
+
+      if( n<0 && errno==EINTR )
+        continue;
+      else if( n<0 && (errno==EAGAIN || errno==EWOULDBLOCK) )
+        break;
+      else if( n<=0 )
+        {
+          if( total>0 ) read_bytes.add(total);
+          disconnect(n==0 ? "connection closed" : strerror(errno));
+          return;
+        }
+
+      int i = 0;
+      if( m_skip_greeting )
+        {
+          // when connecting, the simulator sends a greeting message saying
+          // "[connected as nth client on port 8800]", skip everything up
+          // to and including the newline
+          while( i<n && m_skip_greeting )
+            if( m_buf[i++]=='\n' )
+              m_skip_greeting = false;
+        }
+
+      if( i<n && m_data_func!=NULL ) m_data_func(m_data_ctx, m_buf+i, (int) n-i);
+
+      read_time.add(now_us()-t);
+      num_reads++;
+      num_bytes += n;
+      total += n;
+
+      // a short read means the kernel buffer is empty, save the extra read() call
+      if( n<READ_SIZE ) break;
+    }
+
+  if( total>0 )
+    read_bytes.add(total);
+  else if( events & (EPOLLHUP | EPOLLERR) )
+    disconnect("connection lost");
+}
+
+
+void Source::on_datagrams()
+{
+  int total = 0;
+
+  while( true )
+    {
+      int64_t t = now_us();
+      ssize_t n = recv(m_fd, m_buf, READ_SIZE, 0);
+
+      if( n<0 && (errno==EINTR || errno==ECONNREFUSED) )
+        {
+          // ECONNREFUSED: an earlier datagram found nobody listening,
+          // the sender may still show up
+          continue;
+        }
+      else if( n<0 )
+        break;
+
+      bool resync;
+      int  i = vdm_dgreceiver_accept(&datagrams, m_buf, (int) n, &resync);
+      if( resync ) send_datagram(VDM_DG_RESYNC, NULL, 0);
+      if( i>0 && i<n && m_data_func!=NULL ) m_data_func(m_data_ctx, m_buf+i, (int) n-i);
+
+      read_time.add(now_us()-t);
+      num_reads++;
+      num_bytes += n;
+      total += n;
+    }
+
+  if( total>0 ) read_bytes.add(total);
+}
+
+
+bool Source::send_datagram(uint8_t type, const uint8_t *data, int size)
+{
+  uint8_t dg[VDM_DG_MAX];
+  std::lock_guard<std::mutex> lock(m_write_mutex);
+  if( m_fd<0 ) return false;
+
+  do
+    {
+      int n = size > VDM_DG_MAX-VDM_DG_HEADER ? VDM_DG_MAX-VDM_DG_HEADER : size;
+      vdm_dg_header(dg, type, m_hello_seq++);
+      if( n>0 ) memcpy(dg+VDM_DG_HEADER, data, n);
+
+      // nobody listening (yet) is not an error, the hello timer tries again
+      if( send(m_fd, dg, VDM_DG_HEADER+n, 0)<0 && errno!=ECONNREFUSED && errno!=EAGAIN )
+        return false;
+
+      data += n;
+      size -= n;
+    }
+  while( size>0 );
+
+  return true;
+}
+
+
+bool Source::write(const uint8_t *data, int size)
+{
+  if( m_kind==KIND_UDP )
+    return send_datagram(VDM_DG_HELLO, data, size);
+
+  std::lock_guard<std::mutex> lock(m_write_mutex);
+  return m_fd>=0 && write_all(m_fd, data, size);
+}
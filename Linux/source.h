@@ -0,0 +1,143 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - data source for the display (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdint.h>
+#include <mutex>
+#include <thread>
+#include "reactor.h"
+#include "histogram.h"
+#include "vdm1proto.h"
+
+
+// The connection to the Altair simulator (serial port, pseudo terminal or
+// TCP, see open_connection()), read through a Reactor:
+// - each wakeup reads everything available in large chunks and passes
+//   it straight on to the data callback
+// - when the connection is lost it is re-established without polling:
+//   serial ports are re-opened when the device (re)appears (inotify),
+//   TCP connections are retried with exponential backoff, the name
+//   lookup runs in a thread and the connect completes in the reactor
+// - a pseudo terminal stays open for the whole time, each time a program
+//   opens its slave side counts as a new connection (inotify). Should it
+//   fail anyway, a new one (with a new name) replaces it.
+// - a UDP "connection" (datagrams from vdm1-relay, see VDM_DG_* in
+//   vdm1proto.h) is always up: the sender is greeted periodically, late
+//   datagrams are dropped and a keyframe is requested after a loss
+// - per-read processing time and bytes per wakeup are recorded
+
+
+class Source
+{
+ public:
+  typedef void (*data_func)(void *ctx, const uint8_t *data, int size);
+  typedef void (*state_func)(void *ctx, bool connected);
+  typedef void (*pty_func)(void *ctx, const char *slave);
+
+  // a wakeup reads at most MAX_READS times READ_SIZE bytes, so a sender
+  // that keeps the buffer full can't hold up timers (blink, frame pacer)
+  enum { READ_SIZE = 65536, MAX_READS = 4 };
+
+  Source(Reactor *reactor, const char *spec, int baud);
+  ~Source();
+
+  void set_data_callback(data_func f, void *ctx);
+  void set_state_callback(state_func f, void *ctx);
+
+  // called with the slave's name each time a pseudo terminal is created
+  void set_pty_callback(pty_func f, void *ctx);
+
+  // reconnect automatically (default) or stay disconnected
+  void set_reconnect(bool reconnect);
+
+  // open the connection (or start waiting for it if it can not be opened now)
+  // a TCP connection is only set up while the reactor runs, so a caller
+  // that accepts it itself must keep the reactor going meanwhile (see
+  // connecting())
+  void start();
+
+  bool connected() { return m_fd>=0; }
+
+  // a TCP connection is being set up, the state callback reports the
+  // outcome (only a failure if reconnecting is off, see set_reconnect())
+  bool connecting() { return m_resolver.joinable() || m_connect_fd>=0; }
+
+  // name of the pseudo terminal's slave side (empty if not a PTY)
+  const char *pty_slave() { return m_pty_slave; }
+
+  // write data to the connection (any thread), returns false if not connected
+  bool write(const uint8_t *data, int size);
+
+  // UDP: sequence number check and loss statistics
+  vdm_dgreceiver_t datagrams;
+
+  // statistics
+  Histogram read_time;    // microseconds from read() until the data was processed
+  Histogram read_bytes;   // bytes read per wakeup
+  uint64_t  num_reads, num_bytes, num_connects;
+
+ private:
+  enum { KIND_SERIAL, KIND_PTY, KIND_TCP, KIND_UDP };
+
+  bool connect();
+  void attach(int fd);
+  void next_address();
+  void connect_done(int err);
+  void connect_failed();
+  void disconnect(const char *reason);
+  void wait_reconnect();
+  void on_data(uint32_t events);
+  void on_datagrams();
+  bool send_datagram(uint8_t type, const uint8_t *data, int size);
+
+  static void data_event(void *ctx, int fd, uint32_t events);
+  static void notify_event(void *ctx, int fd, uint32_t events);
+  static void pty_event(void *ctx, int fd, uint32_t events);
+  static void pty_timer(void *ctx);
+  static void resolve_thread(Source *s);
+  static void resolve_event(void *ctx, int fd, uint32_t events);
+  static void connect_event(void *ctx, int fd, uint32_t events);
+  static void connect_timer(void *ctx);
+  static void retry_timer(void *ctx);
+  static void hello_timer(void *ctx);
+
+  Reactor    *m_reactor;
+  char        m_spec[256], m_pty_slave[64];
+  int         m_kind, m_baud;
+  int         m_fd, m_notify_fd, m_retry_timer, m_hello_timer;
+  int         m_pty_slave_fd, m_pty_notify_fd, m_pty_timer;
+  int         m_resolve_fd, m_connect_fd, m_connect_timer, m_connect_error;
+  std::thread m_resolver;
+  struct addrinfo *m_addrs, *m_next_addr;
+  uint32_t    m_hello_seq;
+  double      m_backoff;
+  bool        m_reconnect, m_skip_greeting;
+  std::mutex  m_write_mutex;
+  uint8_t    *m_buf;
+
+  data_func   m_data_func;
+  state_func  m_state_func;
+  pty_func    m_pty_func;
+  void       *m_data_ctx, *m_state_ctx, *m_pty_ctx;
+};
+
+
+#endif
@@ -0,0 +1,166 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - CRT post-processing benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Time per frame of the CRT post-processing (vdm1crt.h) at fullscreen
+// 1080p and 4K (fractional scales), for
+// - idle:   nothing changes (after the first frames)
+// - typing: one character per frame, like an editor or a terminal session
+// - rows:   4 complete rows change every 8th frame (fading out in between)
+// - full:   the whole screen changes every frame (e.g. a Trek-80 chart),
+//           which is what computing every pixel every frame would cost
+// each without a time budget and with a 4ms budget (a quarter of a 60Hz
+// frame). With the budget the quality drops as soon as a frame runs out of
+// time, "cells" is the number of character cells computed per frame.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+#include "vdm1core.h"
+#include "vdm1framebuffer.h"
+#include "vdm1crt.h"
+
+
+static int frames = 240;
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+enum { CASE_IDLE, CASE_TYPING, CASE_ROWS, CASE_FULL, NUM_CASES };
+static const char *case_names[NUM_CASES] = {"idle", "typing", "rows", "full"};
+
+
+// the change of the given case for frame "n"
+static void update(VDM1Core &core, int c, int n, uint32_t &seed)
+{
+  switch( c )
+    {
+    case CASE_IDLE:
+      break;
+
+    case CASE_TYPING:
+      core.write_byte(n%1024, 32 + rand_r(&seed)%95);
+      core.write_byte((n+1)%1024, 0x80+' ');
+      break;
+
+    case CASE_ROWS:
+      if( (n%8)==0 )
+        {
+          int row = rand_r(&seed)%13;
+          for(int i=0; i<4*64; i++) core.write_byte(row*64+i, 32 + rand_r(&seed)%95);
+        }
+      break;
+
+    case CASE_FULL:
+      {
+        uint8_t mem[1024];
+        for(int i=0; i<1024; i++) mem[i] = 32 + rand_r(&seed)%95;
+        core.write_frame(mem);
+        break;
+      }
+    }
+
+  core.present();
+}
+
+
+static void run(const char *name, double scale, int c, int budget_us, const char *ppm)
+{
+  VDM1Framebuffer framebuffer(scale);
+  VDM1Core core;
+  core.set_surface(&framebuffer);
+  core.set_dip(2+4+32);  // show all characters, no cursor blinking
+  core.set_paced(true);
+
+  // start with a full screen of text
+  uint32_t seed = 1;
+  uint8_t mem[1024];
+  for(int i=0; i<1024; i++) mem[i] = 32 + rand_r(&seed)%95;
+  core.write_frame(mem);
+  core.present();
+
+  VDM1CRT crt(&framebuffer);
+  crt.set_budget(budget_us);
+  for(int i=0; i<30; i++) crt.process();
+  memset(&crt.stats, 0, sizeof(crt.stats));
+
+  std::vector<double> times;
+  for(int n=0; n<frames; n++)
+    {
+      update(core, c, n, seed);
+      double start = now_sec();
+      crt.process();
+      times.push_back((now_sec()-start)*1e3);
+    }
+
+  if( ppm!=NULL ) crt.write_ppm(ppm);
+
+  double sum = 0;
+  for(size_t i=0; i<times.size(); i++) sum += times[i];
+  std::sort(times.begin(), times.end());
+
+  printf("%-6s %4ix%-4i %-7s %4s %8.3f %8.3f %8.3f %7.0f %6.1f%% %4i\n",
+         name, framebuffer.width, framebuffer.height, case_names[c],
+         budget_us>0 ? "4ms" : "-", sum/frames, times[frames*99/100], times[frames-1],
+         double(crt.stats.cells)/frames, 100.0*crt.stats.over_budget/frames, crt.quality);
+  fflush(stdout);
+}
+
+
+int main(int argc, char **argv)
+{
+  static const struct { const char *name; int w, h; } screens[] = {{"1080p", 1920, 1080}, {"4K", 3840, 2160}};
+  const char *ppm = NULL;
+  int opt;
+
+  while( (opt=getopt(argc, argv, "n:s:"))!=-1 )
+    switch( opt )
+      {
+      case 'n': frames = atoi(optarg); break;
+      case 's': ppm = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-n frames per test] [-s file (PPM of the 1080p typing case)]\n", argv[0]);
+        return 1;
+      }
+
+  if( frames<1 ) frames = 1;
+  printf("screen picture    case  budget  mean ms   p99 ms   max ms   cells   over quality\n");
+  for(size_t i=0; i<sizeof(screens)/sizeof(screens[0]); i++)
+    {
+      double sx = double(screens[i].w)/VDM1_HPIX, sy = double(screens[i].h)/VDM1_VPIX;
+      double scale = sx<sy ? sx : sy;
+      for(int c=0; c<NUM_CASES; c++)
+        for(int b=0; b<2; b++)
+          run(screens[i].name, scale, c, b ? 4000 : 0,
+              (i==0 && c==CASE_TYPING && b==0) ? ppm : NULL);
+    }
+
+  return 0;
+}
@@ -0,0 +1,303 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - embedding API benchmark (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Compares how many video memory writes per second a software Altair can
+// make through the embedding API (vdm1embed.h) with the serialized path
+// (VDM_MEMBYTE commands parsed by VDM1Core::receive(), directly and
+// through a TCP connection like the simulator's):
+// 1. vdm1_write() with 0, 1 and 4 reader threads continuously updating
+//    their views (rendering every change)
+// 2. vdm1_write_range() with whole 64-character lines
+// 3. encoding + VDM1Core::receive() with a framebuffer, in one thread
+// 4. encoding, sending over TCP loopback, Source + VDM1Core::receive()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "vdm1proto.h"
+#include "vdm1core.h"
+#include "vdm1framebuffer.h"
+#include "vdm1embed.h"
+#include "reactor.h"
+#include "source.h"
+#include "connection.h"
+
+
+static double duration = 2;
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+// printable characters all over the screen
+static inline int addr_of(uint32_t i)  { return (i*7) & 1023; }
+static inline uint8_t value_of(uint32_t i) { return 32 + i%95; }
+
+
+static int membyte(uint8_t *p, int addr, uint8_t value)
+{
+  p[0] = VDM_MEMBYTE | ((addr>>8) & 7);
+  p[1] = addr & 255;
+  p[2] = value;
+  return 3;
+}
+
+
+static void report(const char *name, uint64_t writes, double elapsed, const char *extra = "")
+{
+  printf("%-34s %12.0f writes/s %8.1f ns/write%s\n", name, writes/elapsed, elapsed*1e9/writes, extra);
+  fflush(stdout);
+}
+
+
+// -----------------------------------------------------------------------------
+// embedding API
+// -----------------------------------------------------------------------------
+
+
+static void reader_thread(vdm1_display_t *d, std::atomic<bool> *running, uint64_t *updates)
+{
+  vdm1_view_t *v = vdm1_view_create(d, 1);
+  while( *running )
+    if( vdm1_view_update(v) ) (*updates)++;
+  vdm1_view_destroy(v);
+}
+
+
+static void bench_direct(int readers)
+{
+  vdm1_display_t *d = vdm1_create();
+  std::atomic<bool> running(true);
+  std::vector<std::thread> threads;
+  std::vector<uint64_t>    updates(readers, 0);
+
+  for(int i=0; i<readers; i++)
+    threads.push_back(std::thread(reader_thread, d, &running, &updates[i]));
+
+  uint64_t n = 0;
+  double start = now_sec(), elapsed;
+  do
+    {
+      for(int i=0; i<100000; i++, n++)
+        vdm1_write(d, addr_of(n), value_of(n));
+    }
+  while( (elapsed=now_sec()-start)<duration );
+
+  running = false;
+  for(int i=0; i<readers; i++) threads[i].join();
+
+  uint64_t total = 0;
+  for(int i=0; i<readers; i++) total += updates[i];
+
+  char name[64], extra[64] = "";
+  snprintf(name, sizeof(name), "vdm1_write, %i readers", readers);
+  if( readers>0 ) snprintf(extra, sizeof(extra), "   %.0f view updates/s per reader", total/elapsed/readers);
+  report(name, n, elapsed, extra);
+
+  // the last state must be visible to a new reader
+  uint8_t mem[1024];
+  vdm1_read(d, mem, NULL, NULL);
+  for(int i=0; i<1024; i++)
+    if( mem[addr_of(n-1-i)]!=value_of(n-1-i) )
+      {
+        printf("  MISMATCH at %i\n", addr_of(n-1-i));
+        break;
+      }
+
+  vdm1_destroy(d);
+}
+
+
+static void bench_range()
+{
+  vdm1_display_t *d = vdm1_create();
+  uint8_t line[64];
+  for(int i=0; i<64; i++) line[i] = value_of(i);
+
+  uint64_t n = 0;
+  double start = now_sec(), elapsed;
+  do
+    {
+      for(int i=0; i<100000; i++, n++)
+        vdm1_write_range(d, (n%16)*64, line, 64);
+    }
+  while( (elapsed=now_sec()-start)<duration );
+
+  report("vdm1_write_range, 64 bytes", n*64, elapsed);
+  vdm1_destroy(d);
+}
+
+
+// -----------------------------------------------------------------------------
+// serialized path
+// -----------------------------------------------------------------------------
+
+
+static void bench_decode()
+{
+  VDM1Core        core;
+  VDM1Framebuffer framebuffer;
+  core.set_surface(&framebuffer);
+
+  // the way the data arrives from a fast link: larger chunks
+  uint8_t buf[3*1000];
+  uint64_t n = 0;
+  double start = now_sec(), elapsed;
+  do
+    {
+      for(int j=0; j<100; j++)
+        {
+          int len = 0;
+          for(int i=0; i<1000; i++, n++)
+            len += membyte(buf+len, addr_of(n), value_of(n));
+          core.receive(buf, len);
+        }
+    }
+  while( (elapsed=now_sec()-start)<duration );
+
+  report("VDM_MEMBYTE + receive()", n, elapsed);
+}
+
+
+static Reactor               reactor;
+static VDM1Core              tcp_core;
+static std::atomic<uint64_t> tcp_received(0);
+
+
+static void tcp_data(void *ctx, const uint8_t *data, int size)
+{
+  tcp_core.receive(data, size);
+  tcp_received = tcp_core.stats.membyte;
+}
+
+
+static void tcp_sender(int fd, std::atomic<bool> *running, std::atomic<uint64_t> *sent)
+{
+  uint8_t buf[3*1000];
+  const char *greeting = "[connected as 1st client]\r\n";
+  write_all(fd, (const uint8_t *) greeting, (int) strlen(greeting));
+
+  uint64_t n = 0;
+  while( *running )
+    {
+      int len = 0;
+      for(int i=0; i<1000; i++, n++)
+        len += membyte(buf+len, addr_of(n), value_of(n));
+      if( !write_all(fd, buf, len) ) break;
+    }
+
+  *sent = n;
+}
+
+
+static void stop_timer(void *ctx)
+{
+  reactor.stop();
+}
+
+
+static void bench_tcp()
+{
+  VDM1Framebuffer framebuffer;
+  tcp_core.set_surface(&framebuffer);
+
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int lfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  bind(lfd, (struct sockaddr *) &addr, sizeof(addr));
+  listen(lfd, 1);
+  getsockname(lfd, (struct sockaddr *) &addr, &len);
+
+  char spec[64];
+  snprintf(spec, sizeof(spec), "127.0.0.1:%i", ntohs(addr.sin_port));
+  Source source(&reactor, spec, 0);
+  source.set_data_callback(tcp_data, NULL);
+  source.set_reconnect(false);
+  source.start();
+
+  // the connect completes in the reactor, accept() only once it has
+  while( source.connecting() && reactor.run_once(100) ) {}
+  if( !source.connected() ) exit(1);
+  int fd = accept(lfd, NULL, NULL);
+
+  std::atomic<bool> running(true);
+  std::atomic<uint64_t> sent(UINT64_MAX);
+  std::thread sender(tcp_sender, fd, &running, &sent);
+
+  // run until everything sent in "duration" has been processed
+  double start = now_sec();
+  int timer = reactor.add_timer(stop_timer, NULL);
+  reactor.set_timer(timer, duration);
+  reactor.run();
+  running = false;
+  while( tcp_received<sent && reactor.run_once(100) ) {}
+  sender.join();
+  double elapsed = now_sec()-start;
+
+  report("VDM_MEMBYTE over TCP + receive()", tcp_received, elapsed);
+  reactor.remove_timer(timer);
+  close(fd);
+  close(lfd);
+}
+
+
+int main(int argc, char **argv)
+{
+  int opt;
+  while( (opt=getopt(argc, argv, "d:"))!=-1 )
+    switch( opt )
+      {
+      case 'd': duration = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-d seconds per test]\n", argv[0]);
+        return 1;
+      }
+
+  signal(SIGPIPE, SIG_IGN);
+  bench_direct(0);
+  bench_direct(1);
+  bench_direct(4);
+  bench_range();
+  bench_decode();
+  bench_tcp();
+
+  // for comparison: a serial line at the VDM-1 default rate
+  printf("%-34s %12.0f writes/s\n", "VDM_MEMBYTE at 1050000 baud", 1050000/10.0/3);
+  return 0;
+}
@@ -0,0 +1,575 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - automation script test
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Tests the screen matcher (screenmatcher.h) and automation scripts
+// (expectscript.h):
+// 1. the matcher against blanking (CR/VT, curtain, DIP switches),
+//    scrolling with ctrl and rows changed since mark()
+// 2. scripts driving a stand-in for an Altair running CP/M: it answers
+//    typed commands (DIR, TYPE BIG, SLOW, anything else with "?") like the
+//    simulator would, as protocol data, scrolling with the first line in
+//    ctrl. After each piece of data the matcher's rows are compared with
+//    VDM1Core::get_text().
+// 3. what the matcher costs per video memory write while text scrolls by,
+//    checking after each write or after each 64 writes, against converting
+//    and searching all rows each time
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "vdm1proto.h"
+#include "vdm1core.h"
+#include "screenmatcher.h"
+#include "reactor.h"
+#include "expectscript.h"
+
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+  printf("  %-60s %s\n", what, ok ? "ok" : "FAILED");
+  fflush(stdout);
+  if( !ok ) failures++;
+}
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+static void put_text(VDM1Core &core, int row, int col, const char *text)
+{
+  for(int i=0; text[i]!=0; i++) core.write_byte(row*64+col+i, text[i]);
+}
+
+
+// -----------------------------------------------------------------------------
+// matcher
+// -----------------------------------------------------------------------------
+
+
+static void test_matcher()
+{
+  printf("matcher:\n");
+
+  VDM1Core core;
+  uint8_t blank[1024];
+  memset(blank, ' ', sizeof(blank));
+  core.write_frame(blank);
+  uint8_t dip = core.dip;
+
+  ScreenMatcher m(&core);
+  put_text(core, 3, 0, "HELLO\rA>");
+  int prompt = m.add("A>", false);
+  check(m.find(prompt)==-1, "text after a CR is blanked");
+  core.set_dip(dip | 0x30);
+  check(m.find(prompt)==3, "...unless CR/VT blanking is off");
+  core.set_dip(dip);
+
+  int foo = m.add("F[O0]+$", true);
+  put_text(core, 7, 60, "FOO");
+  check(m.find(foo)==7, "regular expression");
+  put_text(core, 5, 0, "X\013");
+  check(m.find(foo)==-1, "rows after a VT are blanked");
+  core.write_byte(5*64+1, ' ');
+  check(m.find(foo)==7, "...until the VT is gone");
+
+  core.set_ctrl(0x80);
+  check(m.find(foo)==-1, "curtain blanking");
+  core.set_ctrl(0x0c);
+  check(m.find(foo)==11, "scrolled: memory row 7 is displayed in row 11");
+  core.set_ctrl(0);
+
+  m.mark();
+  check(m.find(foo, true)==-1, "not new after mark()");
+  put_text(core, 7, 10, "Z");
+  check(m.find(foo, true)==7, "new once its row changed");
+  uint64_t rows = m.num_rows;
+  m.find(foo);
+  check(m.num_rows==rows, "unchanged rows are not converted again");
+  core.write_byte(7*64+10, 0x80 | 'Z');
+  check(m.find(foo)==7 && m.num_rows==rows+1, "cursor (bit 7) is ignored");
+
+  core.set_dip(dip & ~3);
+  check(m.find(foo)==-1, "whole screen blanked");
+  core.set_dip(dip);
+
+  check(m.add("(", true)==-1, "invalid regular expression");
+  m.remove(prompt);
+  check(m.find(prompt)==-1, "removed pattern");
+}
+
+
+// -----------------------------------------------------------------------------
+// stand-in for an Altair running CP/M
+// -----------------------------------------------------------------------------
+
+
+class StandIn
+{
+ public:
+  StandIn(Reactor *reactor, VDM1Core *core);
+  ~StandIn();
+
+  void boot();
+  void key(uint8_t k);
+
+  ExpectScript *script;
+  double        slow_done;
+  int           mismatches;
+
+ private:
+  void put(uint8_t ch);
+  void print(const char *text);
+  void newline();
+  void cursor(bool on);
+  void membyte(int addr, uint8_t value);
+  void flush();
+  void command();
+
+  static void key_timer(void *ctx);
+  static void boot_timer(void *ctx);
+  static void slow_timer(void *ctx);
+
+  Reactor  *m_reactor;
+  VDM1Core *m_core;
+  int       m_key_timer, m_boot_timer, m_slow_timer;
+  std::deque<uint8_t>  m_keys;
+  std::string          m_line;
+  std::vector<uint8_t> m_out;
+  uint8_t   m_cells[1024];
+  int       m_row, m_col, m_first;
+};
+
+
+StandIn::StandIn(Reactor *reactor, VDM1Core *core)
+{
+  m_reactor = reactor;
+  m_core    = core;
+  m_key_timer  = reactor->add_timer(key_timer, this);
+  m_boot_timer = reactor->add_timer(boot_timer, this);
+  m_slow_timer = reactor->add_timer(slow_timer, this);
+  script     = NULL;
+  slow_done  = 0;
+  mismatches = 0;
+  m_row = m_col = m_first = 0;
+}
+
+
+StandIn::~StandIn()
+{
+  m_reactor->remove_timer(m_key_timer);
+  m_reactor->remove_timer(m_boot_timer);
+  m_reactor->remove_timer(m_slow_timer);
+}
+
+
+void StandIn::boot()
+{
+  // clear the screen now, the banner comes a little later
+  memset(m_cells, ' ', sizeof(m_cells));
+  m_out.push_back(VDM_FULLFRAME);
+  m_out.insert(m_out.end(), m_cells, m_cells+1024);
+  m_out.push_back(VDM_CTRL);
+  m_out.push_back(0);
+  flush();
+  m_reactor->set_timer(m_boot_timer, 0.05);
+}
+
+
+void StandIn::key(uint8_t k)
+{
+  // the Altair takes a moment to get to it
+  m_keys.push_back(k);
+  m_reactor->set_timer(m_key_timer, 0.002);
+}
+
+
+void StandIn::membyte(int addr, uint8_t value)
+{
+  m_cells[addr] = value;
+  m_out.push_back(VDM_MEMBYTE | (addr>>8));
+  m_out.push_back(addr & 0xff);
+  m_out.push_back(value);
+}
+
+
+void StandIn::cursor(bool on)
+{
+  int a = ((m_row+m_first) & 15)*64 + m_col;
+  membyte(a, on ? (m_cells[a] | 0x80) : (m_cells[a] & 0x7f));
+}
+
+
+void StandIn::put(uint8_t ch)
+{
+  membyte(((m_row+m_first) & 15)*64 + m_col, ch);
+  if( ++m_col==64 ) newline();
+}
+
+
+void StandIn::newline()
+{
+  m_col = 0;
+  if( m_row<15 )
+    m_row++;
+  else
+    {
+      // scroll: the top row becomes the new bottom row
+      for(int c=0; c<64; c++) membyte(m_first*64+c, ' ');
+      m_first = (m_first+1) & 15;
+      m_out.push_back(VDM_CTRL);
+      m_out.push_back(m_first);
+    }
+}
+
+
+void StandIn::print(const char *text)
+{
+  cursor(false);
+  for(int i=0; text[i]!=0; i++)
+    if( text[i]=='\n' )
+      newline();
+    else
+      put(text[i]);
+  cursor(true);
+}
+
+
+void StandIn::flush()
+{
+  // arrives in pieces, like from a serial port
+  for(size_t i=0; i<m_out.size(); i+=256)
+    {
+      int n = m_out.size()-i < 256 ? (int) (m_out.size()-i) : 256;
+      m_core->receive(m_out.data()+i, n);
+      if( script!=NULL )
+        {
+          script->poll();
+
+          // the matcher's rows must be the screen's
+          char text[16*65+1];
+          m_core->get_text(text, "\n");
+          script->matcher.check();
+          for(int r=0; r<16; r++)
+            {
+              std::string line(text+r*65, 64);
+              line.erase(line.find_last_not_of(' ')+1);
+              if( line!=script->matcher.text((r+m_core->ctrl) & 15) ) mismatches++;
+            }
+        }
+    }
+
+  m_out.clear();
+}
+
+
+void StandIn::command()
+{
+  print("\n");
+  if( m_line=="DIR" )
+    {
+      print("A: ASM      COM : DDT      COM : DUMP     COM : ED       COM\n"
+            "A: LOAD     COM : PIP      COM : STAT     COM : SUBMIT   COM\n"
+            "A: XSUB     COM : MBASIC   COM : DUMP     ASM : BIOS     ASM\n");
+    }
+  else if( m_line=="TYPE BIG" )
+    {
+      // scrolls all the way around more than twice
+      char buf[32];
+      for(int i=1; i<=40; i++)
+        {
+          snprintf(buf, sizeof(buf), "LINE %04i\n", i);
+          print(buf);
+        }
+    }
+  else if( m_line=="SLOW" )
+    {
+      // the prompt only comes back after a while
+      m_line.clear();
+      m_reactor->set_timer(m_slow_timer, 0.3);
+      return;
+    }
+  else if( !m_line.empty() )
+    {
+      print(m_line.c_str());
+      print("?\n");
+    }
+
+  print("A>");
+  m_line.clear();
+}
+
+
+void StandIn::key_timer(void *ctx)
+{
+  StandIn *s = (StandIn *) ctx;
+  while( !s->m_keys.empty() )
+    {
+      uint8_t k = s->m_keys.front();
+      s->m_keys.pop_front();
+      if( k=='\r' )
+        s->command();
+      else if( k>=32 && k<127 )
+        {
+          char echo[2] = { (char) toupper(k), 0 };
+          s->m_line += echo[0];
+          s->print(echo);
+        }
+    }
+
+  s->flush();
+}
+
+
+void StandIn::boot_timer(void *ctx)
+{
+  StandIn *s = (StandIn *) ctx;
+  s->print("64K CP/M VERS 2.2\nA>");
+  s->flush();
+}
+
+
+void StandIn::slow_timer(void *ctx)
+{
+  StandIn *s = (StandIn *) ctx;
+  s->print("DONE\nA>");
+  s->slow_done = now_sec();
+  s->flush();
+}
+
+
+// -----------------------------------------------------------------------------
+// scripts
+// -----------------------------------------------------------------------------
+
+
+struct run_result
+{
+  bool   parsed, ok;
+  double elapsed, done, slow_done;
+  int    mismatches;
+};
+
+
+static Reactor *run_reactor;
+
+static void script_send(void *ctx, const uint8_t *data, int size)
+{
+  for(int i=0; i<size; i++) ((StandIn *) ctx)->key(data[i]);
+}
+
+
+static void script_done(void *ctx, bool ok)
+{
+  *(double *) ctx = now_sec();
+  run_reactor->stop();
+}
+
+
+static void stop_timer(void *ctx)
+{
+  run_reactor->stop();
+}
+
+
+static run_result run(const char *text)
+{
+  Reactor  reactor;
+  VDM1Core core;
+  StandIn  standin(&reactor, &core);
+  ExpectScript script(&reactor, &core);
+  run_result res;
+
+  run_reactor = &reactor;
+  res.done = 0;
+  res.parsed = script.parse(text, "test");
+  if( res.parsed )
+    {
+      standin.script = &script;
+      script.set_send_callback(script_send, &standin);
+      script.set_done_callback(script_done, &res.done);
+      reactor.set_timer(reactor.add_timer(stop_timer, NULL), 10);
+
+      double start = now_sec();
+      standin.boot();
+      script.start();
+      reactor.run();
+      res.elapsed = now_sec()-start;
+    }
+
+  res.ok = script.succeeded();
+  res.slow_done  = standin.slow_done;
+  res.mismatches = standin.mismatches;
+  return res;
+}
+
+
+static void test_scripts()
+{
+  printf("scripts against the CP/M stand-in:\n");
+
+  run_result r = run("# a session\n"
+                     "timeout 2\n"
+                     "wait /^A>$/\n"
+                     "send \"dir\\r\"\n"
+                     "expect \"STAT     COM\"\n"
+                     "expect /^A>$/\n"
+                     "send \"TYPE BIG\\r\"\n"
+                     "expect \"LINE 0040\"\n"
+                     "  expect /^A>$/  \n"
+                     "\n"
+                     "send \"XYZ\\r\"\n"
+                     "expect /^XYZ\\?$/\n"
+                     "sleep 0.05\n"
+                     "send \"SLOW\\x0d\"\n"
+                     "expect /^A>$/\n");
+  check(r.parsed && r.ok, "session succeeds");
+  check(r.slow_done>0 && r.done>=r.slow_done, "expect waits for the new prompt, not the old one");
+  check(r.mismatches==0, "matcher rows equal get_text() after each piece of data");
+
+  r = run("timeout 2\n"
+          "wait /^A>$/\n"
+          "send \"SLOW\\r\"\n"
+          "wait /^A>$/\n");
+  check(r.parsed && r.ok && (r.slow_done==0 || r.done<r.slow_done), "wait is satisfied by the old prompt");
+
+  printf("  (expected error:)\n");
+  fflush(stdout);
+  fflush(stdout);
+  r = run("timeout 0.2\n"
+          "wait /^A>$/\n"
+          "send \"XYZ\\r\"\n"
+          "expect \"NOT THERE\"\n");
+  check(r.parsed && !r.ok && r.elapsed>=0.2 && r.elapsed<1, "timeout fails the script");
+
+  printf("  (expected errors:)\n");
+  fflush(stdout);
+  fflush(stdout);
+  r = run("bogus\n"
+          "wait \"unterminated\n"
+          "wait /(/\n"
+          "send \"\\q\"\n"
+          "sleep x\n"
+          "wait \"\"\n"
+          "send \"A\" extra\n");
+  check(!r.parsed, "syntax errors");
+}
+
+
+// -----------------------------------------------------------------------------
+// cost per write
+// -----------------------------------------------------------------------------
+
+
+// text scrolling by as fast as it is written, the way the stand-in does it
+static void write_text(VDM1Core &core, uint64_t n, int &row, int &col, int &first)
+{
+  static const char text[] = "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG 0123456789 ";
+  uint8_t ch = text[n % (sizeof(text)-1)];
+  core.write_byte(((row+first) & 15)*64 + col, ch);
+  if( ++col==48 )
+    {
+      col = 0;
+      if( row<15 )
+        row++;
+      else
+        {
+          for(int c=0; c<64; c++) core.write_byte(first*64+c, ' ');
+          first = (first+1) & 15;
+          core.set_ctrl(first);
+        }
+    }
+}
+
+
+static double bench(int every, bool rescan, double seconds)
+{
+  VDM1Core core;
+  ScreenMatcher m(&core);
+  m.add("A>", false);
+  m.add("ERROR", false);
+  m.add("^A>$", true);
+  m.add("LINE [0-9]+ OF", true);
+
+  int row = 0, col = 0, first = 0;
+  uint64_t n = 0;
+  double start = now_sec(), elapsed;
+  do
+    {
+      for(int i=0; i<65536; i++, n++)
+        {
+          write_text(core, n, row, col, first);
+          if( every>0 && (n % every)==0 )
+            {
+              if( rescan ) m.invalidate();
+              m.find(0);
+            }
+        }
+    }
+  while( (elapsed=now_sec()-start)<seconds );
+
+  return elapsed*1e9/n;
+}
+
+
+static void bench_matcher()
+{
+  printf("\nmatcher cost while text scrolls by (4 patterns, 2 of them regular expressions):\n");
+
+  double base = bench(0, false, 0.5);
+  printf("  %-44s %8.1f ns/write\n", "writes alone", base);
+
+  static const struct { const char *name; int every; bool rescan; } modes[] =
+    {
+      { "check after each write",                   1, false },
+      { "check after each 64 writes",              64, false },
+      { "convert all rows after each 64 writes",   64, true  },
+    };
+
+  for(size_t i=0; i<sizeof(modes)/sizeof(modes[0]); i++)
+    {
+      double t = bench(modes[i].every, modes[i].rescan, 0.5);
+      printf("  %-44s %8.1f ns/write (+%.1f)\n", modes[i].name, t, t-base);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+  test_matcher();
+  test_scripts();
+  printf("%s\n", failures==0 ? "all tests passed" : "TESTS FAILED");
+  if( failures>0 ) return 1;
+
+  bench_matcher();
+  return 0;
+}
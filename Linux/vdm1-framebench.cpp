@@ -0,0 +1,293 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - frame sync benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Shows what VDM_ENDFRAME buys for sprite-style game traffic: a screen
+// of "invaders", a ship, shots and a score that are erased and redrawn with
+// one VDM_MEMBYTE per character each frame, received in chunks of random
+// size (as reads from a serial line or socket return them). Compares
+// 1. drawing each write as it arrives (what a display without frame sync does)
+// 2. drawing once per received chunk (guessing frame boundaries)
+// 3. drawing on VDM_ENDFRAME (sender marks the end of each frame)
+// and counts presents (begin_update/end_update batches) and intermediate
+// presents, i.e. those whose picture doesn't match any complete frame.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <unordered_set>
+#include <vector>
+
+#include "vdm1proto.h"
+#include "vdm1core.h"
+#include "vdm1framebuffer.h"
+
+
+static int num_frames = 2000, max_chunk = 64, baud = 1050000;
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+// Remembers what is shown in each cell (to recognize complete frames)
+// and passes all drawing on to another surface (if any).
+class GridSurface : public VDM1Surface
+{
+ public:
+  GridSurface(VDM1Surface *next, const std::unordered_set<uint64_t> *frames)
+  {
+    m_next = next;
+    m_frames = frames;
+    memset(cells, ' ', sizeof(cells));
+    presents = intermediate = 0;
+  }
+
+  virtual void begin_update()
+  {
+    if( m_next!=NULL ) m_next->begin_update();
+  }
+
+  virtual void end_update()
+  {
+    if( m_next!=NULL ) m_next->end_update();
+    presents++;
+    if( m_frames!=NULL && m_frames->count(hash())==0 ) intermediate++;
+  }
+
+  virtual void draw_char(int row, int col, uint8_t ch, bool inverse)
+  {
+    cells[row*64+col] = ch | (inverse ? 0x80 : 0);
+    if( m_next!=NULL ) m_next->draw_char(row, col, ch, inverse);
+  }
+
+  virtual void fill(int row, int col, int h, int w, bool inverse)
+  {
+    for(int r=row; r<row+h; r++)
+      memset(cells+r*64+col, ' ' | (inverse ? 0x80 : 0), w);
+    if( m_next!=NULL ) m_next->fill(row, col, h, w, inverse);
+  }
+
+  uint64_t hash() const
+  {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for(int i=0; i<1024; i++) h = (h ^ cells[i]) * 1099511628211ULL;
+    return h;
+  }
+
+  uint8_t  cells[1024];
+  uint64_t presents, intermediate;
+
+ private:
+  VDM1Surface *m_next;
+  const std::unordered_set<uint64_t> *m_frames;
+};
+
+
+// -----------------------------------------------------------------------------
+// game traffic
+// -----------------------------------------------------------------------------
+
+
+struct sprite_t
+{
+  int row, col;
+  const char *shape;
+};
+
+
+static void membyte(std::vector<uint8_t> &out, int row, int col, uint8_t value)
+{
+  int addr = row*64+col;
+  out.push_back(VDM_MEMBYTE | ((addr>>8) & 7));
+  out.push_back(addr & 255);
+  out.push_back(value);
+}
+
+
+static void draw_sprite(std::vector<uint8_t> &out, const sprite_t &s, bool erase)
+{
+  for(int i=0; s.shape[i]!=0; i++)
+    membyte(out, s.row, s.col+i, erase ? ' ' : s.shape[i]);
+}
+
+
+// returns the commands for each frame (without VDM_ENDFRAME)
+static std::vector< std::vector<uint8_t> > make_game(int n)
+{
+  std::vector< std::vector<uint8_t> > frames;
+  std::vector<sprite_t> sprites;
+  int dir = 1, score = 0;
+
+  // two rows of six invaders, a ship and three shots
+  for(int r=0; r<2; r++)
+    for(int c=0; c<6; c++)
+      sprites.push_back({3+2*r, 4+6*c, r==0 ? "<W>" : "/O\\"});
+  sprites.push_back({15, 30, "^"});
+  for(int i=0; i<3; i++)
+    sprites.push_back({14-4*i, 10+20*i, "|"});
+
+  for(int f=0; f<n; f++)
+    {
+      std::vector<uint8_t> out;
+
+      // move everything: the formation bounces between the screen edges,
+      // the ship follows it, shots fly upwards
+      if( sprites[5].col+3+dir>63 || sprites[0].col+dir<0 ) dir = -dir;
+      for(size_t i=0; i<sprites.size(); i++)
+        {
+          sprite_t next = sprites[i];
+          if( i<12 )
+            next.col += dir;
+          else if( i==12 )
+            next.col = sprites[0].col+15;
+          else if( --next.row<2 )
+            { next.row = 14; next.col = (next.col+17)%64; }
+
+          draw_sprite(out, sprites[i], true);
+          draw_sprite(out, next, false);
+          sprites[i] = next;
+        }
+
+      // score in the top left corner
+      char buf[16];
+      snprintf(buf, sizeof(buf), "%05i", score += 10);
+      for(int i=0; i<5; i++) membyte(out, 0, i, buf[i]);
+
+      frames.push_back(out);
+    }
+
+  return frames;
+}
+
+
+// -----------------------------------------------------------------------------
+// benchmark
+// -----------------------------------------------------------------------------
+
+
+enum { MODE_WRITE, MODE_CHUNK, MODE_ENDFRAME };
+
+
+static void run(int mode, const std::vector< std::vector<uint8_t> > &frames,
+                const std::unordered_set<uint64_t> &boundaries, const VDM1Framebuffer &reference)
+{
+  static const char *names[] = {"present per write", "present per chunk", "present on VDM_ENDFRAME"};
+
+  // a sender using VDM_ENDFRAME starts with one to switch on frame sync
+  std::vector<uint8_t> stream;
+  if( mode==MODE_ENDFRAME ) stream.push_back(VDM_ENDFRAME);
+  for(size_t f=0; f<frames.size(); f++)
+    {
+      stream.insert(stream.end(), frames[f].begin(), frames[f].end());
+      if( mode==MODE_ENDFRAME ) stream.push_back(VDM_ENDFRAME);
+    }
+
+  VDM1Framebuffer framebuffer;
+  GridSurface surface(&framebuffer, &boundaries);
+  VDM1Core core;
+  core.set_surface(&surface);
+  core.redraw();
+  if( mode==MODE_CHUNK ) core.set_frame_sync(true);
+  uint64_t presents = surface.presents, intermediate = surface.intermediate;
+
+  // same chunk sizes for all modes
+  srand(1);
+  double start = now_sec();
+  for(size_t i=0; i<stream.size(); )
+    {
+      int n = 1 + rand()%max_chunk;
+      if( n>(int) (stream.size()-i) ) n = (int) (stream.size()-i);
+      core.receive(stream.data()+i, n);
+      if( mode==MODE_CHUNK ) core.present();
+      i += n;
+    }
+  double elapsed = now_sec()-start;
+
+  presents = surface.presents-presents;
+  intermediate = surface.intermediate-intermediate;
+
+  // bytes per frame limit the frame rate on a serial line (10 bits per byte)
+  double fps = baud/10.0/((double) stream.size()/frames.size());
+
+  printf("%-24s %8.1f presents/frame %9.0f presents/s at %4.0f frames/s %6.1f%% intermediate %7.2f us/frame%s\n",
+         names[mode], (double) presents/frames.size(), presents*fps/frames.size(), fps,
+         presents>0 ? 100.0*intermediate/presents : 0.0, elapsed*1e6/frames.size(),
+         memcmp(framebuffer.pixels, reference.pixels, reference.width*reference.height)==0 ? "" : "   MISMATCH");
+  fflush(stdout);
+}
+
+
+static void usage(const char *prg)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -f frames     number of game frames (default %i)\n"
+          "  -c bytes      maximum size of a received chunk (default %i)\n"
+          "  -b baud       serial line speed for the presents/s column (default %i)\n",
+          prg, num_frames, max_chunk, baud);
+  exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+  int opt;
+  while( (opt=getopt(argc, argv, "f:c:b:"))!=-1 )
+    switch( opt )
+      {
+      case 'f': num_frames = atoi(optarg); break;
+      case 'c': max_chunk = atoi(optarg); break;
+      case 'b': baud = atoi(optarg); break;
+      default:  usage(argv[0]);
+      }
+
+  if( optind!=argc || num_frames<1 || max_chunk<1 || baud<1 ) usage(argv[0]);
+
+  // the picture after each complete frame
+  std::vector< std::vector<uint8_t> > frames = make_game(num_frames);
+  std::unordered_set<uint64_t> boundaries;
+  VDM1Framebuffer reference;
+  GridSurface surface(&reference, NULL);
+  VDM1Core core;
+  core.set_surface(&surface);
+  core.redraw();
+  boundaries.insert(surface.hash());
+  size_t writes = 0;
+  for(size_t f=0; f<frames.size(); f++)
+    {
+      core.receive(frames[f].data(), (int) frames[f].size());
+      boundaries.insert(surface.hash());
+      writes += frames[f].size()/3;
+    }
+
+  printf("%i frames, %.1f writes/frame, chunks of 1-%i bytes\n",
+         num_frames, (double) writes/num_frames, max_chunk);
+  run(MODE_WRITE, frames, boundaries, reference);
+  run(MODE_CHUNK, frames, boundaries, reference);
+  run(MODE_ENDFRAME, frames, boundaries, reference);
+  return 0;
+}
@@ -0,0 +1,276 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - video state fingerprint test
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Checks the incrementally kept fingerprint (Common/vdm1hash.h) against
+// one computed from scratch after each of -n random changes, made
+// - to a VDM1Core: writes, full frames, control register and DIP switch
+//   changes, directly and as protocol data split at random points
+// - through the embedding API (vdm1embed.h): writes, ranges (also
+//   wrapping around the end of video memory), ctrl and dip
+// then measures what a poller pays to find out whether the screen changed:
+// reading the fingerprint against copying and hashing the whole state.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+
+#include "vdm1core.h"
+#include "vdm1proto.h"
+#include "vdm1embed.h"
+#include "vdm1hash.h"
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+static bool same(uint64_t hash, const uint64_t *rows, const uint8_t *mem, uint8_t ctrl, uint8_t dip,
+                 const char *what, int n)
+{
+  uint64_t r[16];
+  uint64_t h = vdm1_hash_state(mem, ctrl, dip, r);
+  if( h==hash && memcmp(r, rows, sizeof(r))==0 ) return true;
+
+  printf("%s: fingerprint differs after change %i: %016llx, from scratch %016llx\n", what, n,
+         (unsigned long long) hash, (unsigned long long) h);
+  return false;
+}
+
+
+// a random value, mostly text, sometimes cursor or control characters
+static uint8_t random_value(uint32_t &seed)
+{
+  uint32_t r = rand_r(&seed);
+  return (r%4)!=0 ? 32 + (r>>4)%95 : (uint8_t) (r>>4);
+}
+
+
+static bool test_core(int changes)
+{
+  VDM1Core core;
+  uint32_t seed = 1;
+  std::vector<uint8_t> data;
+
+  if( !same(core.hash, core.row_hash, core.mem, core.ctrl, core.dip, "core", 0) ) return false;
+  for(int n=1; n<=changes; n++)
+    {
+      switch( rand_r(&seed)%8 )
+        {
+        case 0: case 1: case 2:
+          core.write_byte(rand_r(&seed), random_value(seed));
+          break;
+
+        case 3:
+          {
+            // a new screen, or the same one with a few changes
+            uint8_t mem[1024];
+            memcpy(mem, core.mem, sizeof(mem));
+            if( rand_r(&seed)%2 )
+              for(int i=0; i<1024; i++) mem[i] = random_value(seed);
+            else
+              for(int i=rand_r(&seed)%5; i>0; i--) mem[rand_r(&seed)%1024] = random_value(seed);
+            core.write_frame(mem);
+            break;
+          }
+
+        case 4:
+          core.set_ctrl((uint8_t) rand_r(&seed));
+          break;
+
+        case 5:
+          core.set_dip((uint8_t) rand_r(&seed));
+          break;
+
+        case 6:
+          core.toggle_blink();
+          break;
+
+        case 7:
+          {
+            // protocol data for a few changes, received in random pieces
+            data.clear();
+            for(int i=rand_r(&seed)%8; i>=0; i--)
+              switch( rand_r(&seed)%10 )
+                {
+                case 0:
+                  data.push_back(VDM_FULLFRAME);
+                  for(int a=0; a<1024; a++) data.push_back(random_value(seed));
+                  break;
+
+                case 1:
+                  data.push_back(VDM_CTRL);
+                  data.push_back((uint8_t) rand_r(&seed));
+                  break;
+
+                case 2:
+                  data.push_back(VDM_DIP);
+                  data.push_back((uint8_t) rand_r(&seed));
+                  break;
+
+                default:
+                  {
+                    int a = rand_r(&seed)%1024;
+                    data.push_back(VDM_MEMBYTE | (a>>8));
+                    data.push_back(a & 0xff);
+                    data.push_back(random_value(seed));
+                    break;
+                  }
+                }
+
+            for(size_t i=0; i<data.size(); )
+              {
+                int k = 1 + rand_r(&seed)%300;
+                if( k>(int) (data.size()-i) ) k = (int) (data.size()-i);
+                core.receive(data.data()+i, k);
+                i += k;
+
+                // also in the middle of a full frame
+                if( !same(core.hash, core.row_hash, core.mem, core.ctrl, core.dip, "core (received)", n) )
+                  return false;
+              }
+            break;
+          }
+        }
+
+      if( !same(core.hash, core.row_hash, core.mem, core.ctrl, core.dip, "core", n) ) return false;
+    }
+
+  return true;
+}
+
+
+static bool test_embed(int changes)
+{
+  vdm1_display_t *d = vdm1_create();
+  uint32_t seed = 2;
+  uint8_t mem[1024], ctrl, dip, data[1024];
+  uint64_t rows[16];
+  bool ok = true;
+
+  for(int n=0; n<=changes && ok; n++)
+    {
+      if( n>0 )
+        switch( rand_r(&seed)%5 )
+          {
+          case 0: case 1:
+            vdm1_write(d, rand_r(&seed)%1024, random_value(seed));
+            break;
+
+          case 2:
+            {
+              int len = rand_r(&seed)%1025;
+              for(int i=0; i<len; i++) data[i] = random_value(seed);
+              vdm1_write_range(d, rand_r(&seed)%1024, data, len);
+              break;
+            }
+
+          case 3:
+            vdm1_set_ctrl(d, (uint8_t) rand_r(&seed));
+            break;
+
+          case 4:
+            vdm1_set_dip(d, (uint8_t) rand_r(&seed));
+            break;
+          }
+
+      uint64_t h = vdm1_hash(d, rows);
+      vdm1_read(d, mem, &ctrl, &dip);
+      ok = same(h, rows, mem, ctrl, dip, "embedded", n);
+    }
+
+  vdm1_destroy(d);
+  return ok;
+}
+
+
+static void bench_poll(double seconds)
+{
+  vdm1_display_t *d = vdm1_create();
+  uint8_t mem[1024], ctrl, dip;
+  uint64_t sum = 0;
+  int n;
+  double start, elapsed;
+
+  printf("\nfinding out whether the screen changed (ns per poll):\n");
+
+  n = 0;
+  start = now_sec();
+  do { sum += vdm1_hash(d, NULL); n++; } while( (elapsed=now_sec()-start)<seconds );
+  printf("  fingerprint              %8.1f\n", elapsed*1e9/n);
+
+  n = 0;
+  start = now_sec();
+  do { sum += vdm1_hash(d, (uint64_t *) mem); n++; } while( (elapsed=now_sec()-start)<seconds );
+  printf("  fingerprint + row hashes %8.1f\n", elapsed*1e9/n);
+
+  n = 0;
+  start = now_sec();
+  do { vdm1_read(d, mem, &ctrl, &dip); sum += mem[n & 1023]; n++; } while( (elapsed=now_sec()-start)<seconds );
+  printf("  copy of the state        %8.1f\n", elapsed*1e9/n);
+
+  n = 0;
+  start = now_sec();
+  do
+    {
+      vdm1_read(d, mem, &ctrl, &dip);
+      sum += vdm1_hash_state(mem, ctrl, dip, NULL);
+      n++;
+    }
+  while( (elapsed=now_sec()-start)<seconds );
+  printf("  copy and hash from scratch %6.1f\n", elapsed*1e9/n);
+
+  // the writer's share: one write with the fingerprint kept up to date
+  n = 0;
+  start = now_sec();
+  do { vdm1_write(d, n & 1023, (uint8_t) n); n++; } while( (elapsed=now_sec()-start)<seconds );
+  printf("  (vdm1_write              %8.1f)\n", elapsed*1e9/n);
+
+  if( sum==1 ) printf(" ");
+  vdm1_destroy(d);
+}
+
+
+int main(int argc, char **argv)
+{
+  int changes = 200000, opt;
+
+  while( (opt=getopt(argc, argv, "n:"))!=-1 )
+    switch( opt )
+      {
+      case 'n': changes = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-n changes]\n", argv[0]);
+        return 1;
+      }
+
+  bool ok = test_core(changes) && test_embed(changes);
+  printf("%i random changes: fingerprints %s\n", changes, ok ? "match" : "DIFFER");
+  if( !ok ) return 1;
+
+  bench_poll(0.5);
+  return 0;
+}
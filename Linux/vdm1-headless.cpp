@@ -0,0 +1,677 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - headless display for Linux
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Runs the VDM-1 display without any display server: the video state is
+// kept in memory and can be saved as screenshot (PNG/PPM picture or text)
+// on request (SIGUSR1), periodically and when exiting, or recorded as
+// video. Useful for automated tests of Altair software and for
+// remote/embedded setups.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#include "vdm1proto.h"
+#include "vdm1core.h"
+#include "vdm1framebuffer.h"
+#include "vdm1crt.h"
+#include "sendqueue.h"
+#include "reactor.h"
+#include "source.h"
+#include "vdm1shm.h"
+#include "pacer.h"
+#include "recorder.h"
+#include "rfbserver.h"
+#include "expectscript.h"
+#include "vdm1metrics.h"
+
+
+static Reactor         reactor;
+static VDM1Core        core;
+static VDM1Framebuffer framebuffer;
+static SendQueue      *send_queue = NULL;
+static Source         *source = NULL;
+static FramePacer     *pacer = NULL;
+static VDM1CRT        *crt = NULL;
+static uint32_t        crt_changes = 0;
+static Recorder        recorder;
+static uint32_t        record_changes = 0;
+static RFBServer      *rfb = NULL;
+static uint32_t        rfb_changes = 0;
+static ExpectScript   *script = NULL;
+static VDM1Metrics    *metrics = NULL;
+static vdm1shm_writer_t shm;
+static bool            shm_enabled = false;
+static const char     *shm_name = NULL;
+static uint64_t        shm_bytes = 0;
+static uint32_t        shm_changes = 0;
+
+static const char *screenshot_file = NULL, *upload_file = NULL, *pty_link = NULL, *record_file = NULL;
+static const char *metrics_file = NULL;
+static bool   quiet = false, exit_when_sent = false, exit_on_close = false;
+static double start_time;
+static struct termios stdin_termios;
+static bool   stdin_raw = false;
+static int    exit_status = 0;
+
+
+static void usage(const char *prg)
+{
+  fprintf(stderr,
+          "usage: %s [options] connection\n"
+          "connection:\n"
+          "  /dev/...      serial port\n"
+          "  pty           create a pseudo terminal for a software Altair emulator\n"
+          "                (the name of its slave side is printed)\n"
+          "  udp:host[:port] datagrams from vdm1-relay -U (default port 8801)\n"
+          "  host[:port]   TCP connection to the simulator (default port 8800)\n"
+          "options:\n"
+          "  -b baud       serial baud rate (default 1050000)\n"
+          "  -s file       screenshot file (.txt = text, .png = PNG, otherwise PPM picture),\n"
+          "                written on SIGUSR1 and when exiting\n"
+          "  -S seconds    additionally write the screenshot periodically\n"
+          "  -z scale      screenshot scale factor (default 1, may be fractional)\n"
+          "  -j threads    threads drawing large updates (default 1)\n"
+          "  -r hz         draw at most hz times per second (default: each change as it arrives)\n"
+          "  -C us         CRT look (scanlines, phosphor persistence, bloom) for screenshots\n"
+          "                and -m, computed -r hz (default 60) times per second taking at most\n"
+          "                us microseconds each time (0 = unlimited)\n"
+          "  -R file       record the screen as video (.gif or .y4m) at -r hz (default 30)\n"
+          "                frames per second\n"
+          "  -t seconds    exit after the given time\n"
+          "  -l path       publish the pseudo terminal as symbolic link \"path\"\n"
+          "  -o            exit when the connection is lost (default: reconnect)\n"
+          "  -k            forward standard input as key presses\n"
+          "  -f file       send file as key presses\n"
+          "  -d char,line  delay (ms) after each character/line sent with -f\n"
+          "  -e            wait for the echo of characters sent with -f\n"
+          "  -x            exit when the file given with -f has been sent\n"
+          "  -m name       publish the screen in POSIX shared memory \"name\" (see vdm1shm.h)\n"
+          "  -V [addr:]port serve the screen to VNC viewers, checked -r hz (default 30)\n"
+          "                times per second (default address 127.0.0.1)\n"
+          "  -M file       write live metrics (Prometheus text format) to a file every second\n"
+          "  -a file       run an automation script (waits for text on the screen and\n"
+          "                types, see expectscript.h), exit when it ends (status 1 if it failed)\n"
+          "  -q            do not print statistics\n",
+          prg);
+  exit(1);
+}
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+static void restore_stdin()
+{
+  if( stdin_raw ) tcsetattr(0, TCSANOW, &stdin_termios);
+}
+
+
+static bool write_screenshot(const char *fname)
+{
+  // write to a temporary file first so readers never see a partial file
+  char tmp[1024];
+  bool ok;
+  snprintf(tmp, sizeof(tmp), "%s.tmp", fname);
+
+  size_t len = strlen(fname);
+  if( len>4 && strcmp(fname+len-4, ".txt")==0 )
+    {
+      char buf[16*65+1];
+      FILE *f = fopen(tmp, "w");
+      int n = core.get_text(buf, "\n");
+      ok = f!=NULL && fwrite(buf, 1, n, f)==(size_t) n;
+      if( f!=NULL && fclose(f)!=0 ) ok = false;
+    }
+  else if( len>4 && strcmp(fname+len-4, ".png")==0 )
+    ok = crt!=NULL ? write_png(tmp, crt->pixels, crt->width, crt->height, 255) :
+      write_png(tmp, framebuffer.pixels, framebuffer.width, framebuffer.height, framebuffer.max_value);
+  else if( crt!=NULL )
+    ok = crt->write_ppm(tmp);
+  else
+    ok = framebuffer.write_ppm(tmp);
+
+  if( !ok || rename(tmp, fname)<0 )
+    {
+      fprintf(stderr, "Unable to write %s: %s\n", fname, strerror(errno));
+      unlink(tmp);
+      return false;
+    }
+
+  return true;
+}
+
+
+static void print_stats()
+{
+  if( quiet ) return;
+
+  double elapsed = now_sec()-start_time;
+  fprintf(stderr,
+          "%.1fs: received %llu bytes (%.0f bytes/s): %llu membyte, %llu fullframe, %llu ctrl, %llu dip, %llu endframe, %llu unknown\n"
+          "       drawn %llu characters, %llu full redraws, %llu presents, screen hash %016llx\n",
+          elapsed, (unsigned long long) core.stats.bytes,
+          elapsed>0 ? core.stats.bytes/elapsed : 0.0,
+          (unsigned long long) core.stats.membyte, (unsigned long long) core.stats.fullframe,
+          (unsigned long long) core.stats.ctrl, (unsigned long long) core.stats.dip,
+          (unsigned long long) core.stats.endframe, (unsigned long long) core.stats.unknown,
+          (unsigned long long) core.stats.chars_drawn, (unsigned long long) core.stats.frame_redraws,
+          (unsigned long long) core.stats.presents, (unsigned long long) core.hash);
+
+  fprintf(stderr, "       %llu reads in %llu wakeups, %llu connects\n",
+          (unsigned long long) source->num_reads, (unsigned long long) reactor.num_wakeups,
+          (unsigned long long) source->num_connects);
+
+  fprintf(stderr, "       sent %llu keys in %llu writes (%llu bytes), %llu dropped, %i pending\n",
+          (unsigned long long) send_queue->num_keys, (unsigned long long) send_queue->num_writes,
+          (unsigned long long) send_queue->num_bytes, (unsigned long long) send_queue->num_dropped,
+          send_queue->bulk_pending());
+
+  if( source->datagrams.started )
+    fprintf(stderr, "       datagrams: %u lost, %u late, %u invalid\n",
+            source->datagrams.num_lost, source->datagrams.num_late, source->datagrams.num_bad);
+
+  source->read_time.print(stderr);
+  source->read_bytes.print(stderr);
+  if( pacer!=NULL ) pacer->print_stats(stderr);
+  if( crt!=NULL )
+    fprintf(stderr, "       CRT: %llu frames (%llu computed), %llu cells, %llu over budget, quality %i (%llu changes)\n",
+            (unsigned long long) crt->stats.frames, (unsigned long long) crt->stats.busy_frames,
+            (unsigned long long) crt->stats.cells, (unsigned long long) crt->stats.over_budget,
+            crt->quality, (unsigned long long) crt->stats.quality_changes);
+  if( record_file!=NULL ) recorder.print_stats(stderr);
+  if( rfb!=NULL ) rfb->print_stats(stderr);
+  if( script!=NULL ) script->print_stats(stderr);
+}
+
+
+static void core_write(void *ctx, int addr, uint8_t value)
+{
+  send_queue->observe_write(addr, value);
+}
+
+
+static void send_queue_write(void *ctx, const uint8_t *data, int size)
+{
+  // data for a lost connection is dropped
+  source->write(data, size);
+}
+
+
+static bool send_file(const char *fname)
+{
+  FILE *f = fopen(fname, "rb");
+  if( f==NULL )
+    {
+      fprintf(stderr, "Unable to open %s: %s\n", fname, strerror(errno));
+      return false;
+    }
+
+  uint8_t buf[4096];
+  size_t n;
+  bool ok = true;
+  while( ok && (n=fread(buf, 1, sizeof(buf), f))>0 )
+    ok = send_queue->send_bulk(buf, (int) n);
+  fclose(f);
+
+  if( !ok ) fprintf(stderr, "%s is too large\n", fname);
+  return ok;
+}
+
+
+static void publish()
+{
+  // only if something was received or drawn since the last time
+  // (and not in the middle of a frame in frame sync mode)
+  uint32_t changes = crt!=NULL ? crt_changes : framebuffer.changes;
+  if( shm_enabled && !core.frame_pending() &&
+      (core.stats.bytes!=shm_bytes || changes!=shm_changes) )
+    {
+      vdm1shm_publish(&shm, core.mem, core.ctrl, core.dip, core.blink_on,
+                      changes!=shm_changes ? (crt!=NULL ? crt->pixels : framebuffer.pixels) : NULL);
+      shm_bytes = core.stats.bytes;
+      shm_changes = changes;
+    }
+}
+
+
+static void source_data(void *ctx, const uint8_t *data, int size)
+{
+  core.receive(data, size);
+  if( pacer!=NULL )
+    pacer->data_received();
+  else
+    publish();
+  if( script!=NULL ) script->poll();
+}
+
+
+static void source_state(void *ctx, bool connected)
+{
+  if( connected )
+    {
+      if( !quiet && source->num_connects>1 ) fprintf(stderr, "Reconnected\n");
+      core.reset_decoder();
+      send_queue->send_connect();
+
+      // upload the file once the first connection is up
+      if( upload_file!=NULL && source->num_connects==1 && !send_file(upload_file) )
+        reactor.stop();
+    }
+  else if( exit_on_close )
+    {
+      // a TCP connection that could not be set up at all is an error
+      if( source->num_connects==0 ) exit_status = 1;
+      reactor.stop();
+    }
+}
+
+
+static void source_pty(void *ctx, const char *slave)
+{
+  // the slave's name changes each time, a link gives the emulator a fixed name
+  if( pty_link!=NULL )
+    {
+      unlink(pty_link);
+      if( symlink(slave, pty_link)<0 )
+        fprintf(stderr, "Unable to create %s: %s\n", pty_link, strerror(errno));
+    }
+
+  printf("%s\n", slave);
+  fflush(stdout);
+}
+
+
+static void signal_event(void *ctx, int fd, uint32_t events)
+{
+  struct signalfd_siginfo si;
+
+  while( read(fd, &si, sizeof(si))==sizeof(si) )
+    {
+      if( si.ssi_signo==SIGUSR1 )
+        {
+          if( screenshot_file!=NULL ) write_screenshot(screenshot_file);
+          print_stats();
+        }
+      else
+        reactor.stop();
+    }
+}
+
+
+static void stdin_event(void *ctx, int fd, uint32_t events)
+{
+  uint8_t buf[256];
+  ssize_t n = read(0, buf, sizeof(buf));
+
+  if( n<=0 )
+    reactor.remove(0);
+  else
+    for(ssize_t i=0; i<n; i++)
+      send_queue->send_key(buf[i]=='\n' ? 13 : buf[i]);
+}
+
+
+static void blink_timer(void *ctx)
+{
+  core.toggle_blink();
+  publish();
+}
+
+
+static void pacer_present(void *ctx)
+{
+  publish();
+}
+
+
+static void crt_timer(void *ctx)
+{
+  if( crt->process() )
+    {
+      crt_changes++;
+      publish();
+    }
+}
+
+
+static void record()
+{
+  // only pictures that changed (and not in the middle of a frame in frame sync mode)
+  uint32_t changes = crt!=NULL ? crt_changes : framebuffer.changes;
+  if( changes!=record_changes && !core.frame_pending() )
+    {
+      recorder.add_frame(crt!=NULL ? crt->pixels : framebuffer.pixels);
+      record_changes = changes;
+    }
+}
+
+
+static void record_timer(void *ctx)
+{
+  record();
+}
+
+
+static void rfb_timer(void *ctx)
+{
+  // same rules as for recording
+  uint32_t changes = crt!=NULL ? crt_changes : framebuffer.changes;
+  if( changes!=rfb_changes && !core.frame_pending() )
+    {
+      rfb->update();
+      rfb_changes = changes;
+    }
+}
+
+
+static void rfb_key(void *ctx, uint8_t key)
+{
+  send_queue->send_key(key);
+}
+
+
+static void script_send(void *ctx, const uint8_t *data, int size)
+{
+  // paced like a file sent with -f
+  if( !send_queue->send_bulk(data, size) ) fprintf(stderr, "Script sends too much at once\n");
+}
+
+
+static void script_done(void *ctx, bool ok)
+{
+  if( !ok ) exit_status = 1;
+  reactor.stop();
+}
+
+
+static void frame_timer(void *ctx)
+{
+  // changes pending for a whole period: the sender stopped sending VDM_ENDFRAME
+  static uint64_t presents = 0;
+  if( core.frame_pending() && core.stats.presents==presents )
+    {
+      core.set_frame_sync(false);
+      publish();
+    }
+
+  presents = core.stats.presents;
+}
+
+
+static void screenshot_timer(void *ctx)
+{
+  write_screenshot(screenshot_file);
+}
+
+
+static void metrics_timer(void *ctx)
+{
+  // only the first failure is reported, the file is retried every second
+  static bool failed = false;
+  if( metrics->write_file(metrics_file) )
+    failed = false;
+  else if( !failed )
+    {
+      fprintf(stderr, "Unable to write %s: %s\n", metrics_file, strerror(errno));
+      failed = true;
+    }
+}
+
+
+static void exit_timer(void *ctx)
+{
+  reactor.stop();
+}
+
+
+static void sent_timer(void *ctx)
+{
+  if( exit_when_sent && send_queue->bulk_pending()==0 ) reactor.stop();
+}
+
+
+int main(int argc, char **argv)
+{
+  int    baud = 1050000, threads = 1, opt;
+  int    delay_char = 0, delay_line = 0;
+  int    crt_budget = -1;
+  double screenshot_interval = 0, timeout = 0, rate = 0, scale = 1;
+  bool   keys = false, echo = false;
+  const char *vnc = NULL, *script_file = NULL;
+
+  while( (opt=getopt(argc, argv, "b:s:S:z:j:r:C:R:t:l:okf:d:exm:V:M:a:q"))!=-1 )
+    switch( opt )
+      {
+      case 'b': baud = atoi(optarg); break;
+      case 's': screenshot_file = optarg; break;
+      case 'S': screenshot_interval = atof(optarg); break;
+      case 'z': scale = atof(optarg); break;
+      case 'j': threads = atoi(optarg); break;
+      case 'r': rate = atof(optarg); break;
+      case 'C': crt_budget = atoi(optarg); break;
+      case 'R': record_file = optarg; break;
+      case 't': timeout = atof(optarg); break;
+      case 'l': pty_link = optarg; break;
+      case 'o': exit_on_close = true; break;
+      case 'k': keys = true; break;
+      case 'f': upload_file = optarg; break;
+      case 'd': if( sscanf(optarg, "%i,%i", &delay_char, &delay_line)<1 ) usage(argv[0]); break;
+      case 'e': echo = true; break;
+      case 'x': exit_when_sent = true; break;
+      case 'm': shm_name = optarg; break;
+      case 'V': vnc = optarg; break;
+      case 'M': metrics_file = optarg; break;
+      case 'a': script_file = optarg; break;
+      case 'q': quiet = true; break;
+      default:  usage(argv[0]);
+      }
+
+  if( optind!=argc-1 ) usage(argv[0]);
+  Recorder::format_t record_format;
+  if( record_file!=NULL && !Recorder::format_of(record_file, &record_format) ) usage(argv[0]);
+
+  // signals are handled in the event loop
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  sigaddset(&sigs, SIGUSR1);
+  sigprocmask(SIG_BLOCK, &sigs, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  int sfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+  reactor.add(sfd, EPOLLIN, signal_event, NULL);
+
+  framebuffer.set_scale(scale);
+  framebuffer.set_threads(threads);
+  core.set_surface(&framebuffer);
+  core.set_write_callback(core_write, NULL);
+  core.redraw();
+  if( crt_budget>=0 )
+    {
+      crt = new VDM1CRT(&framebuffer);
+      crt->set_budget(crt_budget);
+      crt->process();
+    }
+  if( record_file!=NULL )
+    {
+      bool ok;
+      if( crt!=NULL )
+        ok = recorder.start(record_file, record_format, crt->width, crt->height, 255, rate>0 ? rate : 30);
+      else
+        ok = recorder.start(record_file, record_format, framebuffer.width, framebuffer.height,
+                            framebuffer.max_value, rate>0 ? rate : 30);
+      if( !ok )
+        {
+          fprintf(stderr, "Unable to create %s: %s\n", record_file, strerror(errno));
+          return 1;
+        }
+
+      record_changes = (crt!=NULL ? crt_changes : framebuffer.changes)-1;
+      record();
+    }
+  if( shm_name!=NULL )
+    {
+      if( !vdm1shm_create(&shm, shm_name, framebuffer.width, framebuffer.height) ) return 1;
+      shm_enabled = true;
+      shm_changes = framebuffer.changes-1;
+      publish();
+    }
+
+  send_queue = new SendQueue(send_queue_write, NULL);
+  send_queue->set_pacing(delay_char, delay_line);
+  send_queue->set_echo_pacing(echo);
+
+  if( vnc!=NULL )
+    {
+      // local viewers only unless an address is given (there is no authentication)
+      char host[256] = "127.0.0.1";
+      const char *port = strrchr(vnc, ':');
+      if( port!=NULL )
+        snprintf(host, sizeof(host), "%.*s", (int) (port-vnc), vnc);
+      port = port!=NULL ? port+1 : vnc;
+
+      rfb = new RFBServer(&reactor);
+      if( crt!=NULL )
+        rfb->set_picture(crt->pixels, crt->width, crt->height, 255);
+      else
+        rfb->set_picture(framebuffer.pixels, framebuffer.width, framebuffer.height, framebuffer.max_value);
+      rfb->set_key_callback(rfb_key, NULL);
+      if( rfb->listen(host[0]!=0 ? host : NULL, atoi(port))<0 ) return 1;
+
+      rfb_changes = (crt!=NULL ? crt_changes : framebuffer.changes)-1;
+      rfb_timer(NULL);
+      double period = 1/(rate>0 ? rate : 30);
+      reactor.set_timer(reactor.add_timer(rfb_timer, NULL), period, period);
+    }
+
+  if( script_file!=NULL )
+    {
+      script = new ExpectScript(&reactor, &core);
+      if( !script->load(script_file) ) return 1;
+      script->set_send_callback(script_send, NULL);
+      script->set_done_callback(script_done, NULL);
+    }
+
+  source = new Source(&reactor, argv[optind], baud);
+  source->set_data_callback(source_data, NULL);
+  source->set_state_callback(source_state, NULL);
+  source->set_pty_callback(source_pty, NULL);
+  source->set_reconnect(!exit_on_close);
+  start_time = now_sec();
+  source->start();
+  if( !source->connected() && !source->connecting() && exit_on_close ) return 1;
+
+  if( keys )
+    {
+      if( isatty(0) && tcgetattr(0, &stdin_termios)==0 )
+        {
+          // pass on each key as it is typed, Ctrl-C still exits
+          struct termios tio = stdin_termios;
+          tio.c_lflag &= ~(ICANON | ECHO);
+          tio.c_iflag &= ~ICRNL;
+          tio.c_cc[VMIN] = 1;
+          tio.c_cc[VTIME] = 0;
+          stdin_raw = tcsetattr(0, TCSANOW, &tio)==0;
+          atexit(restore_stdin);
+        }
+
+      reactor.add(0, EPOLLIN, stdin_event, NULL);
+    }
+
+  reactor.set_timer(reactor.add_timer(blink_timer, NULL), 0.5, 0.5);
+  if( rate>0 )
+    {
+      // the pacer draws everything, including the blinking cursor
+      pacer = new FramePacer(&reactor, &core);
+      pacer->set_present_callback(pacer_present, NULL);
+      pacer->start(rate);
+    }
+  else
+    reactor.set_timer(reactor.add_timer(frame_timer, NULL), 0.025, 0.025);
+  if( crt!=NULL )
+    {
+      double period = 1/(rate>0 ? rate : 60);
+      reactor.set_timer(reactor.add_timer(crt_timer, NULL), period, period);
+    }
+  if( record_file!=NULL )
+    {
+      double period = 1/(rate>0 ? rate : 30);
+      reactor.set_timer(reactor.add_timer(record_timer, NULL), period, period);
+    }
+  if( screenshot_file!=NULL && screenshot_interval>0 )
+    reactor.set_timer(reactor.add_timer(screenshot_timer, NULL), screenshot_interval, screenshot_interval);
+  if( timeout>0 )
+    reactor.set_timer(reactor.add_timer(exit_timer, NULL), timeout);
+  if( exit_when_sent )
+    reactor.set_timer(reactor.add_timer(sent_timer, NULL), 0.05, 0.05);
+  if( metrics_file!=NULL )
+    {
+      // without the pacer the data is drawn while it is processed
+      metrics = new VDM1Metrics(&core);
+      metrics->set_send_queue(send_queue);
+      metrics->set_connects(&source->num_connects);
+      metrics->set_latency(pacer!=NULL ? &pacer->latency : &source->read_time);
+      metrics->add_histogram("vdm1_read_bytes", "Bytes read per wakeup", &source->read_bytes);
+      if( pacer!=NULL )
+        metrics->add_histogram("vdm1_frame_time_us", "Microseconds spent drawing one present", &pacer->frame_time);
+      metrics_timer(NULL);
+      reactor.set_timer(reactor.add_timer(metrics_timer, NULL), 1, 1);
+    }
+  if( script!=NULL )
+    script->start();
+
+  reactor.run();
+
+  // show what arrived since the last tick
+  if( pacer!=NULL ) pacer->vsync();
+  if( crt!=NULL && crt->process() ) crt_changes++;
+  if( record_file!=NULL )
+    {
+      record();
+      if( !recorder.stop() ) fprintf(stderr, "Unable to write %s\n", record_file);
+    }
+  if( screenshot_file!=NULL ) write_screenshot(screenshot_file);
+  if( metrics!=NULL ) metrics_timer(NULL);
+  print_stats();
+
+  if( shm_enabled ) vdm1shm_destroy(&shm);
+  delete metrics;
+  delete script;
+  delete rfb;
+  delete pacer;
+  delete crt;
+  delete send_queue;
+  delete source;
+  if( pty_link!=NULL ) unlink(pty_link);
+  return exit_status;
+}
@@ -0,0 +1,175 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - key encoder/decoder test
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Round trip of the keys sent to the Altair (Common/vdm1proto.h): -n
+// random streams, each made of key sequences of 0-999 random keys
+// (vdm_encode_keys() with VDM_KEYS blocks on or off, chosen per sequence)
+// with VDM_CONNECT in between, fed to vdm_keydecoder_feed() in random
+// reads of 1-40 bytes. The decoded keys and connects must come out as
+// they went in. Then the bytes on the wire with and without VDM_KEYS
+// blocks for the files given on the command line (default: programs/ENT
+// and programs/HEX).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <vector>
+
+#include "vdm1proto.h"
+
+
+// what the decoder passed on: keys, and -1 for each VDM_CONNECT
+static void decoded_keys(void *ctx, const uint8_t *keys, int n)
+{
+  std::vector<int> *out = (std::vector<int> *) ctx;
+  for(int i=0; i<n; i++) out->push_back(keys[i]);
+}
+
+
+static void decoded_connect(void *ctx)
+{
+  ((std::vector<int> *) ctx)->push_back(-1);
+}
+
+
+static bool round_trip(int streams)
+{
+  uint32_t seed = 1;
+  uint64_t keys_total = 0, blocks_bytes = 0, plain_bytes = 0;
+
+  for(int s=0; s<streams; s++)
+    {
+      std::vector<int> expected, decoded;
+      std::vector<uint8_t> wire;
+
+      int parts = 1 + rand_r(&seed)%8;
+      for(int p=0; p<parts; p++)
+        {
+          if( rand_r(&seed)%3==0 )
+            {
+              wire.push_back(VDM_CONNECT);
+              expected.push_back(-1);
+            }
+
+          int n = rand_r(&seed)%1000;
+          bool blocks = rand_r(&seed)%2;
+          std::vector<uint8_t> keys(n), buf(VDM_KEYS_ENCODED_SIZE(n) + 1);
+          for(int i=0; i<n; i++) { keys[i] = (uint8_t) rand_r(&seed); expected.push_back(keys[i]); }
+
+          // the encoder must stay within the promised size
+          buf[VDM_KEYS_ENCODED_SIZE(n)] = 0xa5;
+          int size = vdm_encode_keys(buf.data(), keys.data(), n, blocks);
+          if( size>VDM_KEYS_ENCODED_SIZE(n) || buf[VDM_KEYS_ENCODED_SIZE(n)]!=0xa5 )
+            {
+              printf("stream %i: %i keys encoded into %i bytes\n", s, n, size);
+              return false;
+            }
+          wire.insert(wire.end(), buf.begin(), buf.begin()+size);
+          keys_total += n;
+          (blocks ? blocks_bytes : plain_bytes) += size;
+        }
+
+      vdm_keydecoder_t d;
+      vdm_keydecoder_init(&d, decoded_keys, decoded_connect, &decoded);
+      for(size_t i=0; i<wire.size(); )
+        {
+          int n = 1 + rand_r(&seed)%40;
+          if( n>(int) (wire.size()-i) ) n = (int) (wire.size()-i);
+          vdm_keydecoder_feed(&d, wire.data()+i, n);
+          i += n;
+        }
+
+      if( decoded!=expected )
+        {
+          size_t i = 0;
+          while( i<decoded.size() && i<expected.size() && decoded[i]==expected[i] ) i++;
+          printf("stream %i: %zu items decoded, %zu expected, first difference at %zu\n",
+                 s, decoded.size(), expected.size(), i);
+          return false;
+        }
+    }
+
+  printf("%i random streams (%llu keys, %llu bytes with blocks, %llu without) decoded correctly\n",
+         streams, (unsigned long long) keys_total, (unsigned long long) blocks_bytes,
+         (unsigned long long) plain_bytes);
+  return true;
+}
+
+
+static bool bytes_on_wire(const char *fname, uint64_t *total)
+{
+  FILE *f = fopen(fname, "rb");
+  if( f==NULL )
+    {
+      printf("Unable to open %s: %s\n", fname, strerror(errno));
+      return false;
+    }
+
+  std::vector<uint8_t> keys;
+  int c;
+  while( (c=fgetc(f))!=EOF ) keys.push_back((uint8_t) c);
+  fclose(f);
+
+  int n = (int) keys.size();
+  std::vector<uint8_t> buf(VDM_KEYS_ENCODED_SIZE(n));
+  int plain = vdm_encode_keys(buf.data(), keys.data(), n, false);
+  int blocks = vdm_encode_keys(buf.data(), keys.data(), n, true);
+  printf("%-32s %7i %9i %9i\n", fname, n, plain, blocks);
+  total[0] += n;
+  total[1] += plain;
+  total[2] += blocks;
+  return true;
+}
+
+
+int main(int argc, char **argv)
+{
+  static const char *files[] = {
+    "../programs/ENT/checkers.ent", "../programs/ENT/chess.ent", "../programs/ENT/pattern.ent",
+    "../programs/ENT/raiders.ent", "../programs/ENT/target.ent", "../programs/ENT/trk80.ent",
+    "../programs/HEX/checkers.hex", "../programs/HEX/chess.hex", "../programs/HEX/pattern.hex",
+    "../programs/HEX/raiders.hex", "../programs/HEX/target.hex", "../programs/HEX/trk80.hex",
+    "../programs/HEX/vdmcuter.hex", NULL };
+  int streams = 20000, opt;
+
+  while( (opt=getopt(argc, argv, "n:"))!=-1 )
+    switch( opt )
+      {
+      case 'n': streams = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-n streams] [file ...]\n", argv[0]);
+        return 1;
+      }
+
+  if( !round_trip(streams) ) return 1;
+
+  uint64_t total[3] = {0, 0, 0};
+  printf("\n%-32s %7s %9s %9s\n", "file", "keys", "VDM_KEY", "VDM_KEYS");
+  if( optind<argc )
+    for(int i=optind; i<argc; i++) bytes_on_wire(argv[i], total);
+  else
+    for(int i=0; files[i]!=NULL; i++) bytes_on_wire(files[i], total);
+  if( total[1]>0 )
+    printf("%-32s %7llu %9llu %9llu (%+.1f%%)\n", "total", (unsigned long long) total[0],
+           (unsigned long long) total[1], (unsigned long long) total[2], (total[2]*100.0/total[1])-100);
+  return 0;
+}
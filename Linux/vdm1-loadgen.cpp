@@ -0,0 +1,253 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - load generator for the display server (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Simulates many Altairs sending screen updates to a SessionServer at
+// once. Each synthetic sender is a TCP connection writing VDM_MEMBYTE
+// commands at a fixed rate, every millisecond ending with a time stamp
+// probe (see server.h). By default the server runs in this process so the
+// per-session lag and CPU time can be reported directly, with -c the load
+// goes to a separate vdm1-server (run that with -T to see the lag).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include "vdm1proto.h"
+#include "server.h"
+#include "connection.h"
+
+
+static std::atomic<bool>     running(true);
+static std::atomic<uint64_t> sent_bytes(0), stalls(0);
+
+
+static uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+
+static int membyte(uint8_t *p, int addr, uint8_t value)
+{
+  p[0] = VDM_MEMBYTE | ((addr>>8) & 7);
+  p[1] = addr & 255;
+  p[2] = value;
+  return 3;
+}
+
+
+// one thread driving a share of the connections, one chunk per
+// connection and millisecond
+static void sender(std::vector<int> fds, int rate)
+{
+  int chunk = rate/1000;
+  chunk -= chunk%3;
+  if( chunk<12 ) chunk = 12;
+
+  std::vector<uint8_t> buf(chunk);
+  std::vector<int>     pos(fds.size(), 0);
+  uint64_t next = now_ns();
+
+  while( running )
+    {
+      next += 1000000;
+      struct timespec ts;
+      ts.tv_sec  = next/1000000000;
+      ts.tv_nsec = next%1000000000;
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+      for(size_t i=0; i<fds.size(); i++)
+        {
+          // text scrolling through the screen (rows 0-14), then the time stamp
+          int n = 0;
+          while( n<chunk-12 )
+            {
+              n += membyte(buf.data()+n, pos[i] % 960, 32 + (pos[i]/7)%95);
+              pos[i]++;
+            }
+
+          uint32_t stamp = (uint32_t) (now_ns()/1000);
+          for(int b=0; b<4; b++)
+            n += membyte(buf.data()+n, 0x3fc+b, 0x40 | ((stamp >> (6*b)) & 0x3f));
+
+          ssize_t r = send(fds[i], buf.data(), n, MSG_DONTWAIT | MSG_NOSIGNAL);
+          if( r>0 ) sent_bytes += r;
+
+          // the receiver can not keep up, skip the rest of this chunk
+          // (at worst a partially sent command garbles one character)
+          if( r<n ) stalls++;
+
+          // discard VDM_CONNECT requests
+          uint8_t dummy[64];
+          while( recv(fds[i], dummy, sizeof(dummy), MSG_DONTWAIT)>0 );
+        }
+    }
+}
+
+
+static double process_cpu_ms()
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return (ru.ru_utime.tv_sec+ru.ru_stime.tv_sec)*1e3 + (ru.ru_utime.tv_usec+ru.ru_stime.tv_usec)/1e3;
+}
+
+
+static void usage(const char *prg)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -n sessions   number of synthetic senders (default 100)\n"
+          "  -r rate       bytes per second per sender (default 105000 = 1050000 baud)\n"
+          "  -d seconds    duration (default 5)\n"
+          "  -j threads    server worker threads (default: number of CPUs)\n"
+          "  -S threads    sender threads (default 2)\n"
+          "  -c host:port  send to a separate vdm1-server instead\n"
+          "  -v            print one line per session\n",
+          prg);
+  exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+  int    opt, num = 100, rate = 105000, send_threads = 2;
+  int    threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  double duration = 5;
+  bool   verbose = false;
+  const char *target = NULL;
+
+  while( (opt=getopt(argc, argv, "n:r:d:j:S:c:v"))!=-1 )
+    switch( opt )
+      {
+      case 'n': num = atoi(optarg); break;
+      case 'r': rate = atoi(optarg); break;
+      case 'd': duration = atof(optarg); break;
+      case 'j': threads = atoi(optarg); break;
+      case 'S': send_threads = atoi(optarg); break;
+      case 'c': target = optarg; break;
+      case 'v': verbose = true; break;
+      default:  usage(argv[0]);
+      }
+
+  if( num<1 || send_threads<1 ) usage(argv[0]);
+
+  SessionServer *server = NULL;
+  char spec[256];
+  if( target!=NULL )
+    snprintf(spec, sizeof(spec), "%s", target);
+  else
+    {
+      server = new SessionServer(threads);
+      server->set_timestamp_probe(true);
+      int port = server->listen(0);
+      if( port<0 ) return 1;
+      snprintf(spec, sizeof(spec), "127.0.0.1:%i", port);
+      server->start();
+    }
+
+  // connect all senders
+  std::vector<std::vector<int> > fds(send_threads);
+  for(int i=0; i<num; i++)
+    {
+      bool is_tcp;
+      int fd = open_connection(spec, 0, &is_tcp, NULL, 0, NULL);
+      if( fd<0 ) return 1;
+      fds[i % send_threads].push_back(fd);
+    }
+
+  // wait until the server has seen all connections
+  while( server!=NULL && (int) server->sessions().size()<num ) usleep(1000);
+
+  double   cpu0 = process_cpu_ms();
+  uint64_t t0 = now_ns();
+  std::vector<std::thread> senders;
+  for(int i=0; i<send_threads; i++)
+    senders.push_back(std::thread(sender, fds[i], rate));
+
+  usleep((useconds_t) (duration*1e6));
+  running = false;
+  for(int i=0; i<send_threads; i++)
+    senders[i].join();
+
+  // give the server a moment to process what is still in flight
+  usleep(200000);
+  double elapsed = (now_ns()-t0)/1e9;
+
+  printf("%i senders at %i bytes/s for %.1fs: sent %.1f MB (%.2f MB/s), %llu stalls\n",
+         num, rate, elapsed, sent_bytes/1e6, sent_bytes/1e6/elapsed, (unsigned long long) stalls);
+
+  if( server!=NULL )
+    {
+      server->stop();
+      double cpu = process_cpu_ms()-cpu0;
+
+      std::vector<Session *> sessions = server->sessions();
+      std::vector<uint64_t>  p99s, cpus;
+      Histogram lag("lag (all sessions)", "us");
+      uint64_t  bytes = 0, session_cpu = 0;
+
+      if( verbose )
+        printf("%-24s %12s %10s %10s %10s %8s\n", "session", "bytes", "cpu ms", "lag p50", "lag p99", "lag max");
+
+      for(size_t i=0; i<sessions.size(); i++)
+        {
+          Session *s = sessions[i];
+          if( verbose )
+            printf("%-24s %12llu %10.2f %10llu %10llu %8llu\n", s->name,
+                   (unsigned long long) s->core.stats.bytes, s->cpu_ns/1e6,
+                   (unsigned long long) s->lag.percentile(0.5), (unsigned long long) s->lag.percentile(0.99),
+                   (unsigned long long) s->lag.max);
+
+          p99s.push_back(s->lag.percentile(0.99));
+          cpus.push_back(s->cpu_ns);
+          lag.merge(s->lag);
+          bytes += s->core.stats.bytes;
+          session_cpu += s->cpu_ns;
+        }
+
+      std::sort(p99s.begin(), p99s.end());
+      std::sort(cpus.begin(), cpus.end());
+      printf("received %.1f MB in %llu turns (%llu steals) on %i threads\n",
+             bytes/1e6, (unsigned long long) server->num_turns, (unsigned long long) server->num_steals,
+             server->num_threads());
+      printf("per-session lag p99: median <=%llu us, worst <=%llu us\n",
+             (unsigned long long) p99s[p99s.size()/2], (unsigned long long) p99s.back());
+      printf("per-session CPU: mean %.2f ms, max %.2f ms (%.1f us per second of traffic)\n",
+             session_cpu/1e6/sessions.size(), cpus.back()/1e6, session_cpu/1e3/sessions.size()/elapsed);
+      printf("process CPU (server and senders): %.1f ms = %.1f%% of one CPU\n", cpu, cpu/elapsed/10);
+      lag.print(stdout);
+      delete server;
+    }
+
+  return 0;
+}
@@ -0,0 +1,495 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - TCP vs. datagram staleness under loss (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Compares how stale the screen gets on a lossy link when watching a
+// vdm1-relay over TCP and over datagrams (UDP). Everything runs in this
+// process over loopback:
+//
+//   generator -> VDM1Core -> Relay --TCP--> shim --TCP--> Source -> VDM1Core
+//                                  --UDP--> shim --UDP--> Source -> VDM1Core
+//
+// The generator writes random characters plus a time stamp probe (see
+// server.h) every millisecond. The receiving side samples its probe every
+// few milliseconds, the age of the shown stamp is the staleness.
+//
+// The shim adds a one-way delay and drops packets. For UDP it simply
+// drops datagrams (both directions). Loopback TCP can not lose segments
+// (and netem is not always available), so the TCP shim models what the
+// kernel would do: the stream is cut into segments, a lost segment
+// arrives after the recovery time (fast retransmit one RTT after the
+// third segment sent after it, otherwise the retransmission timeout,
+// doubled for each lost retransmission) and holds up everything after it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <numeric>
+#include <atomic>
+#include <deque>
+#include <random>
+#include <thread>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "vdm1proto.h"
+#include "vdm1core.h"
+#include "reactor.h"
+#include "source.h"
+#include "relay.h"
+#include "connection.h"
+
+
+#define SEGMENT_SIZE 1448
+
+
+static double delay_ms = 2, rto_ms = 200, duration = 10, warmup = 1;
+static int    writes_per_sec = 2000;
+
+
+static int64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+
+// -----------------------------------------------------------------------------
+// sending side
+// -----------------------------------------------------------------------------
+
+
+struct sender_t
+{
+  Reactor      reactor;
+  VDM1Core     core;
+  Relay       *relay;
+  std::mt19937 rnd;
+};
+
+
+static void sender_write(void *ctx, int addr, uint8_t value)
+{
+  ((sender_t *) ctx)->relay->changed(addr);
+}
+
+
+static void generator_timer(void *ctx)
+{
+  sender_t *s = (sender_t *) ctx;
+
+  for(int i=0; i<writes_per_sec/1000; i++)
+    s->core.write_byte(s->rnd() % 0x3fc, 32 + s->rnd() % 95);
+
+  uint32_t stamp = (uint32_t) now_us();
+  for(int b=0; b<4; b++)
+    s->core.write_byte(0x3fc+b, 0x40 | ((stamp >> (6*b)) & 0x3f));
+}
+
+
+// -----------------------------------------------------------------------------
+// loss shim
+// -----------------------------------------------------------------------------
+
+
+struct packet
+{
+  int64_t due;
+  std::vector<uint8_t> data;
+  int     after;   // TCP: segments sent after this lost one (-1 = not lost)
+};
+
+
+struct shim_t
+{
+  std::atomic<bool> running;
+  double       loss;
+  std::mt19937 rnd;
+
+  int udp_front, udp_back, tcp_listen, tcp_viewer, tcp_relay;
+  int relay_tcp_port;
+  struct sockaddr_in viewer_addr;
+  bool have_viewer;
+
+  std::deque<packet> to_viewer, to_relay, tcp_queue;
+  uint64_t dropped, segments, lost_segments;
+
+  bool lose() { return std::uniform_real_distribution<double>(0, 1)(rnd) < loss; }
+};
+
+
+static int local_socket(int type, int port)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  int fd = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+  getsockname(fd, (struct sockaddr *) &addr, &len);
+  return fd;
+}
+
+
+static int local_port(int fd)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  getsockname(fd, (struct sockaddr *) &addr, &len);
+  return ntohs(addr.sin_port);
+}
+
+
+static void shim_tcp_data(shim_t *s, const uint8_t *data, int size)
+{
+  int64_t now = now_us();
+
+  for(int i=0; i<size; i+=SEGMENT_SIZE)
+    {
+      packet p;
+      int n = size-i < SEGMENT_SIZE ? size-i : SEGMENT_SIZE;
+      p.data.assign(data+i, data+i+n);
+      p.due = now + delay_ms*1000;
+      p.after = -1;
+
+      // earlier lost segments: the third one after them triggers a fast retransmit
+      for(size_t j=0; j<s->tcp_queue.size(); j++)
+        {
+          packet &q = s->tcp_queue[j];
+          if( q.after>=0 && ++q.after==3 )
+            q.due = std::min(q.due, now + int64_t(3*delay_ms*1000));
+        }
+
+      if( s->lose() )
+        {
+          // retransmission timeout, doubled each time the retransmission is lost too
+          double rto = rto_ms;
+          p.due += rto*1000;
+          while( s->lose() ) p.due += (rto *= 2)*1000;
+          p.after = 0;
+          s->lost_segments++;
+        }
+
+      s->segments++;
+      s->tcp_queue.push_back(p);
+    }
+}
+
+
+static void shim_thread(shim_t *s)
+{
+  uint8_t buf[65536];
+
+  while( s->running )
+    {
+      struct pollfd p[5];
+      int n = 0;
+      p[n++] = {s->udp_front, POLLIN, 0};
+      p[n++] = {s->udp_back, POLLIN, 0};
+      p[n++] = {s->tcp_listen, POLLIN, 0};
+      if( s->tcp_viewer>=0 )
+        {
+          p[n++] = {s->tcp_viewer, POLLIN, 0};
+          p[n++] = {s->tcp_relay, POLLIN, 0};
+        }
+
+      // wake up for the next packet due (TCP segments leave in order)
+      int64_t now = now_us(), next = now+10000;
+      if( !s->to_viewer.empty() ) next = std::min(next, s->to_viewer.front().due);
+      if( !s->to_relay.empty() )  next = std::min(next, s->to_relay.front().due);
+      if( !s->tcp_queue.empty() ) next = std::min(next, s->tcp_queue.front().due);
+      struct timespec ts = {0, 0};
+      if( next>now ) { ts.tv_sec = (next-now)/1000000; ts.tv_nsec = ((next-now)%1000000)*1000; }
+      ppoll(p, n, &ts, NULL);
+
+      // datagrams from the viewer (hello, resync) and from the relay
+      struct sockaddr_in from;
+      socklen_t len = sizeof(from);
+      ssize_t r;
+      while( (r=recvfrom(s->udp_front, buf, sizeof(buf), 0, (struct sockaddr *) &from, &len))>0 )
+        {
+          s->viewer_addr = from;
+          s->have_viewer = true;
+          if( s->lose() ) { s->dropped++; continue; }
+          s->to_relay.push_back({now_us() + int64_t(delay_ms*1000), std::vector<uint8_t>(buf, buf+r), -1});
+        }
+
+      while( (r=recv(s->udp_back, buf, sizeof(buf), 0))>0 )
+        {
+          if( s->lose() ) { s->dropped++; continue; }
+          s->to_viewer.push_back({now_us() + int64_t(delay_ms*1000), std::vector<uint8_t>(buf, buf+r), -1});
+        }
+
+      // one TCP viewer, connected through to the relay
+      int fd = accept4(s->tcp_listen, NULL, NULL, SOCK_CLOEXEC);
+      if( fd>=0 )
+        {
+          s->tcp_viewer = fd;
+          s->tcp_relay = open_tcp("127.0.0.1", s->relay_tcp_port);
+          fcntl(s->tcp_viewer, F_SETFL, fcntl(s->tcp_viewer, F_GETFL) | O_NONBLOCK);
+        }
+
+      if( s->tcp_viewer>=0 )
+        {
+          // VDM_CONNECT from the viewer (not subject to loss, it is sent only once)
+          while( (r=recv(s->tcp_viewer, buf, sizeof(buf), 0))>0 )
+            write_all(s->tcp_relay, buf, (int) r);
+
+          while( (r=recv(s->tcp_relay, buf, sizeof(buf), 0))>0 )
+            shim_tcp_data(s, buf, (int) r);
+        }
+
+      now = now_us();
+      while( !s->to_relay.empty() && s->to_relay.front().due<=now )
+        {
+          send(s->udp_back, s->to_relay.front().data.data(), s->to_relay.front().data.size(), 0);
+          s->to_relay.pop_front();
+        }
+
+      while( !s->to_viewer.empty() && s->to_viewer.front().due<=now )
+        {
+          if( s->have_viewer )
+            sendto(s->udp_front, s->to_viewer.front().data.data(), s->to_viewer.front().data.size(), 0,
+                   (struct sockaddr *) &s->viewer_addr, sizeof(s->viewer_addr));
+          s->to_viewer.pop_front();
+        }
+
+      // in order: a segment still waiting for its retransmission holds up the rest
+      while( !s->tcp_queue.empty() && s->tcp_queue.front().due<=now )
+        {
+          write_all(s->tcp_viewer, s->tcp_queue.front().data.data(), (int) s->tcp_queue.front().data.size());
+          s->tcp_queue.pop_front();
+        }
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// receiving side
+// -----------------------------------------------------------------------------
+
+
+struct receiver_t
+{
+  Source  *source;
+  VDM1Core core;
+  std::vector<uint32_t> staleness;
+};
+
+
+static Reactor    reactor;
+static receiver_t receivers[2];
+static int64_t    start_time;
+
+
+static void receiver_data(void *ctx, const uint8_t *data, int size)
+{
+  ((receiver_t *) ctx)->core.receive(data, size);
+}
+
+
+static void receiver_state(void *ctx, bool connected)
+{
+  receiver_t *r = (receiver_t *) ctx;
+  uint8_t b = VDM_CONNECT;
+  if( connected )
+    {
+      r->core.reset_decoder();
+      r->source->write(&b, 1);
+    }
+}
+
+
+static void sample_timer(void *ctx)
+{
+  int64_t now = now_us();
+  if( now-start_time < warmup*1e6 ) return;
+
+  for(int i=0; i<2; i++)
+    {
+      const uint8_t *m = receivers[i].core.mem + 0x3fc;
+      if( (m[3] & 0xc0)!=0x40 ) continue;
+
+      uint32_t stamp = (m[0]&0x3f) | ((m[1]&0x3f)<<6) | ((m[2]&0x3f)<<12) | ((m[3]&0x3f)<<18);
+      receivers[i].staleness.push_back(((uint32_t) now - stamp) & 0xffffff);
+    }
+}
+
+
+static void exit_timer(void *ctx)
+{
+  reactor.stop();
+}
+
+
+static double percentile(std::vector<uint32_t> &v, double p)
+{
+  if( v.empty() ) return 0;
+  size_t i = (size_t) (p*(v.size()-1));
+  std::nth_element(v.begin(), v.begin()+i, v.end());
+  return v[i]/1000.0;
+}
+
+
+static void run(double loss)
+{
+  // sending side in its own thread
+  sender_t *sender = new sender_t;
+  sender->rnd.seed(1);
+  sender->relay = new Relay(&sender->reactor, &sender->core);
+  int tcp_port = sender->relay->listen(0);
+  int udp_port = sender->relay->listen_udp(0);
+  sender->core.set_write_callback(sender_write, sender);
+  sender->reactor.set_timer(sender->reactor.add_timer(generator_timer, sender), 0.001, 0.001);
+  std::thread sender_thread(&Reactor::run, &sender->reactor);
+
+  // shim in between
+  shim_t *shim = new shim_t;
+  shim->running = true;
+  shim->loss = loss;
+  shim->rnd.seed(2);
+  shim->relay_tcp_port = tcp_port;
+  shim->udp_front = local_socket(SOCK_DGRAM, 0);
+  shim->udp_back = local_socket(SOCK_DGRAM, 0);
+  shim->tcp_listen = local_socket(SOCK_STREAM, 0);
+  shim->tcp_viewer = shim->tcp_relay = -1;
+  shim->have_viewer = false;
+  shim->dropped = shim->segments = shim->lost_segments = 0;
+  listen(shim->tcp_listen, 1);
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(udp_port);
+  connect(shim->udp_back, (struct sockaddr *) &addr, sizeof(addr));
+  std::thread shim_thr(shim_thread, shim);
+
+  // receiving side in this thread
+  char spec[2][64];
+  snprintf(spec[0], sizeof(spec[0]), "127.0.0.1:%i", local_port(shim->tcp_listen));
+  snprintf(spec[1], sizeof(spec[1]), "udp:127.0.0.1:%i", local_port(shim->udp_front));
+  for(int i=0; i<2; i++)
+    {
+      receivers[i].staleness.clear();
+      receivers[i].core = VDM1Core();
+      receivers[i].source = new Source(&reactor, spec[i], 0);
+      receivers[i].source->set_data_callback(receiver_data, &receivers[i]);
+      receivers[i].source->set_state_callback(receiver_state, &receivers[i]);
+      receivers[i].source->start();
+    }
+
+  int sample = reactor.add_timer(sample_timer, NULL);
+  int stop = reactor.add_timer(exit_timer, NULL);
+  reactor.set_timer(sample, 0.005, 0.005);
+  reactor.set_timer(stop, duration+warmup);
+  start_time = now_us();
+  reactor.run();
+  reactor.remove_timer(sample);
+  reactor.remove_timer(stop);
+
+  for(int i=0; i<2; i++)
+    {
+      receiver_t *r = &receivers[i];
+      printf("%4.0f%%  %-4s %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f",
+             loss*100, i==0 ? "tcp" : "udp",
+             percentile(r->staleness, 0.5), percentile(r->staleness, 0.9),
+             percentile(r->staleness, 0.99), percentile(r->staleness, 0.999),
+             percentile(r->staleness, 1.0),
+             r->staleness.empty() ? 0.0 : std::accumulate(r->staleness.begin(), r->staleness.end(), 0.0)/r->staleness.size()/1000);
+      if( i==0 )
+        printf("   %llu of %llu segments lost\n",
+               (unsigned long long) shim->lost_segments, (unsigned long long) shim->segments);
+      else
+        printf("   %llu datagrams dropped, %u lost / %u late at receiver\n",
+               (unsigned long long) shim->dropped, r->source->datagrams.num_lost, r->source->datagrams.num_late);
+      fflush(stdout);
+      delete r->source;
+    }
+
+  shim->running = false;
+  shim_thr.join();
+  close(shim->udp_front);
+  close(shim->udp_back);
+  close(shim->tcp_listen);
+  if( shim->tcp_viewer>=0 ) { close(shim->tcp_viewer); close(shim->tcp_relay); }
+  delete shim;
+
+  sender->reactor.stop();
+  sender_thread.join();
+  delete sender->relay;
+  delete sender;
+}
+
+
+static void usage(const char *prg)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -l list       loss rates in percent (default 0,1,5,10)\n"
+          "  -d seconds    duration per loss rate (default 10)\n"
+          "  -D ms         one-way delay (default 2)\n"
+          "  -R ms         TCP retransmission timeout (default 200, Linux minimum)\n"
+          "  -w writes     random writes per second besides the probes (default 2000)\n",
+          prg);
+  exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+  const char *losses = "0,1,5,10";
+  int opt;
+
+  while( (opt=getopt(argc, argv, "l:d:D:R:w:"))!=-1 )
+    switch( opt )
+      {
+      case 'l': losses = optarg; break;
+      case 'd': duration = atof(optarg); break;
+      case 'D': delay_ms = atof(optarg); break;
+      case 'R': rto_ms = atof(optarg); break;
+      case 'w': writes_per_sec = atoi(optarg); break;
+      default:  usage(argv[0]);
+      }
+
+  signal(SIGPIPE, SIG_IGN);
+  printf("staleness in ms (%.0fs per loss rate, %.1f ms one-way delay, %.0f ms RTO)\n", duration, delay_ms, rto_ms);
+  printf("loss  link      p50      p90      p99    p99.9      max     mean\n");
+
+  char buf[256];
+  snprintf(buf, sizeof(buf), "%s", losses);
+  for(char *p=strtok(buf, ","); p!=NULL; p=strtok(NULL, ","))
+    run(atof(p)/100);
+
+  return 0;
+}
@@ -0,0 +1,197 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - metrics overhead benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// What the live metrics (Common/vdm1metrics.h) cost a display host:
+// - ingest: VDM1Core::receive() of a stream of MEMBYTE commands (text
+//   written at random places) in reads of 64 bytes, plain and with each
+//   read timed and added to a histogram the way Source does (read_time,
+//   the latency without a pacer), with the drawing counted only and into
+//   a framebuffer; the runs alternate, best of several
+// - reporting: text(), summary() and write_file(), which a host calls
+//   once per second, as a fraction of that second
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "vdm1core.h"
+#include "vdm1proto.h"
+#include "vdm1framebuffer.h"
+#include "vdm1metrics.h"
+#include "sendqueue.h"
+
+
+#define STREAM_SIZE (3*65536)
+#define READ_SIZE   64
+
+static double seconds = 0.3;
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+static uint64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+
+// counts what the core draws
+class NullSurface : public VDM1Surface
+{
+ public:
+  NullSurface() { cells = 0; }
+  virtual void draw_char(int row, int col, uint8_t ch, bool inverse) { cells++; }
+  virtual void fill(int row, int col, int h, int w, bool inverse) { cells += h*w; }
+  uint64_t cells;
+};
+
+
+static void send_none(void *ctx, const uint8_t *data, int size)
+{
+}
+
+
+// MB/s received
+static double bench_receive(VDM1Core *core, const uint8_t *stream, Histogram *h)
+{
+  uint64_t n = 0;
+  double start = now_sec(), elapsed;
+
+  do
+    {
+      for(int i=0; i<STREAM_SIZE; i+=READ_SIZE)
+        if( h!=NULL )
+          {
+            uint64_t t = now_us();
+            core->receive(stream+i, READ_SIZE);
+            h->add(now_us()-t);
+          }
+        else
+          core->receive(stream+i, READ_SIZE);
+      n += STREAM_SIZE;
+    }
+  while( (elapsed=now_sec()-start)<seconds );
+
+  return n/elapsed/1e6;
+}
+
+
+static void run_receive(const char *name, VDM1Core *core, const uint8_t *stream)
+{
+  Histogram h("read_time", "us");
+  double plain = 0, timed = 0;
+
+  // alternating, so both see the same frequency scaling and noise
+  for(int i=0; i<5; i++)
+    {
+      double p = bench_receive(core, stream, NULL), t = bench_receive(core, stream, &h);
+      if( p>plain ) plain = p;
+      if( t>timed ) timed = t;
+    }
+
+  printf("%-12s %8.1f MB/s plain %8.1f MB/s timed  (%+.1f%%)\n", name, plain, timed, (timed/plain-1)*100);
+}
+
+
+static VDM1Metrics *metrics;
+static const char  *fname = "/tmp/vdm1-metricsbench.prom";
+
+static void call_text()       { metrics->text(); }
+static void call_summary()    { metrics->summary(now_sec()); }
+static void call_write_file() { metrics->write_file(fname); }
+
+
+// microseconds per call
+static double bench_call(void (*f)())
+{
+  int n = 0;
+  double start = now_sec(), elapsed;
+  do { f(); n++; } while( (elapsed=now_sec()-start)<seconds );
+  return elapsed*1e6/n;
+}
+
+
+int main(int argc, char **argv)
+{
+  int opt;
+
+  while( (opt=getopt(argc, argv, "d:f:"))!=-1 )
+    switch( opt )
+      {
+      case 'd': seconds = atof(optarg); break;
+      case 'f': fname = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-d seconds per run] [-f metrics file]\n", argv[0]);
+        return 1;
+      }
+
+  // printable characters at random places
+  static uint8_t stream[STREAM_SIZE];
+  uint32_t seed = 1;
+  for(int i=0; i<STREAM_SIZE; i+=3)
+    {
+      int addr = rand_r(&seed) & 1023;
+      stream[i]   = VDM_MEMBYTE | (addr>>8);
+      stream[i+1] = addr & 255;
+      stream[i+2] = 32 + rand_r(&seed)%95;
+    }
+
+  // STREAM_SIZE and READ_SIZE keep commands whole across the stream's end,
+  // not across reads (as from a serial port)
+  NullSurface surface;
+  VDM1Core core;
+  core.set_surface(&surface);
+  run_receive("count only", &core, stream);
+
+  VDM1Framebuffer framebuffer;
+  VDM1Core fbcore;
+  fbcore.set_surface(&framebuffer);
+  run_receive("framebuffer", &fbcore, stream);
+
+  // a host's metrics, with all parts
+  SendQueue queue(send_none, NULL);
+  Histogram latency("latency", "us"), read_bytes("read_bytes", "bytes");
+  uint64_t connects = 1;
+  for(int i=0; i<10000; i++) { latency.add(rand_r(&seed)%20000); read_bytes.add(rand_r(&seed)%2000); }
+  metrics = new VDM1Metrics(&fbcore);
+  metrics->set_send_queue(&queue);
+  metrics->set_connects(&connects);
+  metrics->set_latency(&latency);
+  metrics->add_histogram("vdm1_read_bytes", "Bytes read per wakeup", &read_bytes);
+
+  double t_text = bench_call(call_text), t_summary = bench_call(call_summary);
+  double t_file = bench_call(call_write_file);
+  printf("\nonce per second: text() %.1f us, summary() %.1f us, write_file() %.1f us (%.4f%% of the time)\n",
+         t_text, t_summary, t_file, (t_file+t_summary)/1e4);
+  printf("%s: %zu bytes\n", fname, metrics->text().size());
+  unlink(fname);
+  delete metrics;
+  return 0;
+}
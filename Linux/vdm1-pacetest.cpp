@@ -0,0 +1,280 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - frame pacer test
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Runs the headless display (reactor, Source, core, framebuffer) connected
+// to a synthetic traffic source over TCP loopback, drawing each change as
+// it arrives and with the frame pacer (pacer.h), under
+// - heavy traffic: VDM_MEMBYTE commands as fast as the display takes them
+// - light traffic: a few characters every 0-50ms (someone typing)
+// and checks that the pacer presents at most once per tick, misses no
+// deadlines under light traffic and ends up with the same picture.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <atomic>
+#include <thread>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "vdm1proto.h"
+#include "vdm1core.h"
+#include "vdm1framebuffer.h"
+#include "reactor.h"
+#include "source.h"
+#include "pacer.h"
+#include "histogram.h"
+
+
+static double duration = 2, rate = 60;
+
+
+static int64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+
+static int membyte(uint8_t *p, int addr, uint8_t value)
+{
+  p[0] = VDM_MEMBYTE | ((addr>>8) & 7);
+  p[1] = addr & 255;
+  p[2] = value;
+  return 3;
+}
+
+
+// -----------------------------------------------------------------------------
+// traffic source
+// -----------------------------------------------------------------------------
+
+
+static bool write_all(int fd, const uint8_t *p, int n)
+{
+  while( n>0 )
+    {
+      ssize_t w = write(fd, p, n);
+      if( w<0 && errno==EINTR ) continue;
+      if( w<=0 ) return false;
+      p += w;
+      n -= (int) w;
+    }
+
+  return true;
+}
+
+
+// sends traffic until "running" is cleared, then stores the number of bytes sent in "sent"
+static void source_thread(int fd, bool heavy, std::atomic<bool> *running, std::atomic<uint64_t> *sent)
+{
+  uint8_t  buf[300];
+  uint32_t i = 0, seed = 1;
+  uint64_t total = 0;
+
+  // like the simulator
+  write_all(fd, (const uint8_t *) "[connected]\r\n", 13);
+
+  while( *running )
+    {
+      int n = 0;
+      if( heavy )
+        {
+          // 100 printable characters all over the screen
+          for(int j=0; j<100; j++, i++)
+            n += membyte(buf+n, (i*7) & 1023, 32 + i%95);
+        }
+      else
+        {
+          // 1-5 characters typed on the bottom line
+          int k = 1 + rand_r(&seed)%5;
+          for(int j=0; j<k; j++, i++)
+            n += membyte(buf+n, 15*64 + i%64, 'a' + i%26);
+        }
+
+      if( !write_all(fd, buf, n) ) break;
+      total += n;
+      if( !heavy ) usleep(rand_r(&seed)%50000);
+    }
+
+  *sent = total;
+}
+
+
+// -----------------------------------------------------------------------------
+// display
+// -----------------------------------------------------------------------------
+
+
+static VDM1Core   *core = NULL;
+static FramePacer *pacer = NULL;
+static Histogram   latency("update-to-present latency", "us");
+static uint64_t    received = 0;
+
+
+static void source_data(void *ctx, const uint8_t *data, int size)
+{
+  int64_t t = now_us();
+  core->receive(data, size);
+  received += size;
+
+  if( pacer!=NULL )
+    pacer->data_received(t);
+  else
+    latency.add(now_us()-t);
+}
+
+
+static void stop_timer(void *ctx)
+{
+  ((Reactor *) ctx)->stop();
+}
+
+
+static bool run(bool heavy, bool paced)
+{
+  // the display connects to the traffic source like to the simulator
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int lfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if( lfd<0 || bind(lfd, (struct sockaddr *) &addr, sizeof(addr))<0 || listen(lfd, 1)<0 )
+    { perror("listen"); exit(1); }
+  getsockname(lfd, (struct sockaddr *) &addr, &len);
+
+  Reactor reactor;
+  VDM1Core c;
+  VDM1Framebuffer framebuffer;
+  FramePacer p(&reactor, &c);
+  core = &c;
+  pacer = paced ? &p : NULL;
+  latency.reset();
+  received = 0;
+
+  c.set_surface(&framebuffer);
+  c.redraw();
+  if( paced ) p.start(rate);
+
+  char spec[64];
+  snprintf(spec, sizeof(spec), "127.0.0.1:%i", ntohs(addr.sin_port));
+  Source source(&reactor, spec, 0);
+  source.set_data_callback(source_data, NULL);
+  source.set_reconnect(false);
+  source.start();
+
+  // the connect completes in the reactor, accept() only once it has
+  while( source.connecting() && reactor.run_once(100) ) {}
+  if( !source.connected() ) exit(1);
+  int fd = accept(lfd, NULL, NULL);
+
+  std::atomic<bool> running(true);
+  std::atomic<uint64_t> sent(UINT64_MAX);
+  std::thread sender(source_thread, fd, heavy, &running, &sent);
+
+  int timer = reactor.add_timer(stop_timer, &reactor);
+  reactor.set_timer(timer, duration);
+  uint64_t presents = c.stats.presents, chars = c.stats.chars_drawn;
+  int64_t start = now_us();
+  reactor.run();
+  double elapsed = (now_us()-start)/1e6;
+  presents = c.stats.presents-presents;
+  chars = c.stats.chars_drawn-chars;
+
+  // stop the source, then take everything it sent (minus the greeting)
+  running = false;
+  while( received+13<sent && reactor.run_once(100) ) {}
+  sender.join();
+  if( paced ) p.vsync();
+  reactor.remove_timer(timer);
+  close(fd);
+  close(lfd);
+
+  printf("%s traffic, %s: %.0f KB/s, %.0f presents/s, %.0f chars drawn/s\n",
+         heavy ? "heavy" : "light", paced ? "paced" : "unpaced",
+         received/elapsed/1024, presents/elapsed, chars/elapsed);
+
+  bool ok = true;
+  if( paced )
+    {
+      p.print_stats(stdout);
+      if( p.num_presents>p.num_ticks )
+        { printf("FAIL: more presents than ticks\n"); ok = false; }
+      if( !heavy && p.num_missed>0 )
+        { printf("FAIL: missed deadlines under light traffic\n"); ok = false; }
+    }
+  else
+    latency.print(stdout);
+
+  // the picture must be the same as drawing the final state from scratch
+  VDM1Core ref;
+  VDM1Framebuffer ref_fb;
+  ref.set_surface(&ref_fb);
+  ref.write_frame(c.mem);
+  if( memcmp(ref_fb.pixels, framebuffer.pixels, framebuffer.width*framebuffer.height)!=0 )
+    { printf("FAIL: picture differs from the video memory\n"); ok = false; }
+
+  printf("\n");
+  fflush(stdout);
+  return ok;
+}
+
+
+static void usage(const char *prg)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -r hz         pacer rate (default %.0f)\n"
+          "  -t seconds    duration of each run (default %.0f)\n",
+          prg, rate, duration);
+  exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+  int opt;
+  while( (opt=getopt(argc, argv, "r:t:"))!=-1 )
+    switch( opt )
+      {
+      case 'r': rate = atof(optarg); break;
+      case 't': duration = atof(optarg); break;
+      default:  usage(argv[0]);
+      }
+
+  if( optind!=argc || rate<=0 || duration<=0 ) usage(argv[0]);
+
+  signal(SIGPIPE, SIG_IGN);
+  bool ok = true;
+  ok &= run(true,  false);
+  ok &= run(true,  true);
+  ok &= run(false, false);
+  ok &= run(false, true);
+
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
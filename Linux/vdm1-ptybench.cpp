@@ -0,0 +1,250 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - pseudo terminal throughput and latency test (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Measures how fast and with how much delay the display takes in data
+// through its pseudo terminal endpoint. A thread plays the software Altair:
+// it opens the slave side like an emulator would and writes VDM_MEMBYTE
+// commands, the main thread runs the same Source/VDM1Core/framebuffer
+// pipeline as vdm1-headless. Three phases:
+// 1. the slave is opened several times back-to-back, the display must
+//    answer with VDM_CONNECT (once per burst of opens)
+// 2. data is written as fast as possible (throughput)
+// 3. data is written at the rate of a serial line (latency from write()
+//    until the command has been drawn)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <termios.h>
+#include <atomic>
+#include <thread>
+
+#include "vdm1proto.h"
+#include "vdm1core.h"
+#include "vdm1framebuffer.h"
+#include "sendqueue.h"
+#include "histogram.h"
+#include "reactor.h"
+#include "source.h"
+
+
+static Reactor         reactor;
+static VDM1Core        core;
+static VDM1Framebuffer framebuffer;
+static Source         *source = NULL;
+static SendQueue      *send_queue = NULL;
+
+static std::atomic<int64_t> *sent_at = NULL;
+static std::atomic<int>      phase(0);
+static std::atomic<uint64_t> drawn(0), measured(0);
+static uint64_t              phase_start = 0;
+static Histogram             latency("latency", "us");
+
+
+static int64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+
+static void send_queue_write(void *ctx, const uint8_t *data, int size)
+{
+  source->write(data, size);
+}
+
+
+static void source_state(void *ctx, bool connected)
+{
+  if( connected )
+    {
+      core.reset_decoder();
+      send_queue->send_connect();
+    }
+}
+
+
+static void source_data(void *ctx, const uint8_t *data, int size)
+{
+  core.receive(data, size);
+  drawn = core.stats.membyte;
+
+  // all commands up to here have been drawn now
+  if( phase==3 )
+    {
+      int64_t t = now_us();
+      uint64_t m = measured;
+      for(; m<core.stats.membyte-phase_start; m++)
+        latency.add(t-sent_at[m].load(std::memory_order_acquire));
+      measured = m;
+    }
+}
+
+
+static int encode(uint8_t *buf, uint32_t i)
+{
+  int a = i & 0x3ff;
+  buf[0] = VDM_MEMBYTE | (a>>8);
+  buf[1] = a & 255;
+  buf[2] = 32 + i%95;
+  return 3;
+}
+
+
+static void write_all_blocking(int fd, const uint8_t *data, int size)
+{
+  while( size>0 )
+    {
+      ssize_t n = write(fd, data, size);
+      if( n>0 ) { data += n; size -= n; }
+    }
+}
+
+
+// count the VDM_CONNECT requests arriving within "ms" milliseconds
+static int count_connects(int fd, int ms)
+{
+  int n = 0;
+  struct pollfd p = {fd, POLLIN, 0};
+  while( poll(&p, 1, ms)>0 )
+    {
+      uint8_t buf[64];
+      ssize_t r = read(fd, buf, sizeof(buf));
+      for(ssize_t i=0; i<r; i++)
+        if( buf[i]==VDM_CONNECT ) n++;
+    }
+
+  return n;
+}
+
+
+static void emulator(const char *slave, int opens, uint32_t bulk_packets, uint32_t paced_packets, int rate)
+{
+  // phase 1: back-to-back opens (an emulator probing the port)
+  int fd = -1;
+  for(int i=0; i<opens; i++)
+    {
+      if( fd>=0 ) close(fd);
+      fd = open(slave, O_RDWR | O_NOCTTY);
+    }
+
+  // TCSANOW: TCSAFLUSH would discard the VDM_CONNECT already waiting
+  struct termios tio;
+  tcgetattr(fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(fd, TCSANOW, &tio);
+
+  int n = count_connects(fd, 200);
+  printf("%i back-to-back opens: %i VDM_CONNECT received\n", opens, n);
+
+  // phase 2: throughput
+  uint8_t *buf = new uint8_t[bulk_packets*3];
+  for(uint32_t i=0; i<bulk_packets; i++) encode(buf+i*3, i);
+
+  phase_start = drawn;
+  phase = 2;
+  int64_t t = now_us();
+  write_all_blocking(fd, buf, bulk_packets*3);
+  while( drawn-phase_start<bulk_packets ) usleep(100);
+  t = now_us()-t;
+  printf("throughput: %u bytes in %.3fs = %.2f MB/s (%u commands)\n",
+         bulk_packets*3, t/1e6, bulk_packets*3/(double) t, bulk_packets);
+  delete [] buf;
+
+  // phase 3: paced writes of one command each, "rate" bytes per second
+  usleep(100000);
+  phase_start = drawn;
+  measured = 0;
+  phase = 3;
+  int64_t interval = 3*1000000000LL/rate, next;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  next = int64_t(ts.tv_sec)*1000000000 + ts.tv_nsec;
+  for(uint32_t i=0; i<paced_packets; i++)
+    {
+      uint8_t p[3];
+      encode(p, i);
+      next += interval;
+      ts.tv_sec  = next/1000000000;
+      ts.tv_nsec = next%1000000000;
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+      sent_at[i].store(now_us(), std::memory_order_release);
+      write_all_blocking(fd, p, 3);
+    }
+
+  while( measured<paced_packets ) usleep(1000);
+  phase = 0;
+  close(fd);
+  reactor.stop();
+}
+
+
+int main(int argc, char **argv)
+{
+  int opt, opens = 5, rate = 105000;
+  uint32_t bulk = 1000000, paced = 20000;
+
+  while( (opt=getopt(argc, argv, "n:p:r:o:"))!=-1 )
+    switch( opt )
+      {
+      case 'n': bulk  = atoi(optarg); break;
+      case 'p': paced = atoi(optarg); break;
+      case 'r': rate  = atoi(optarg); break;
+      case 'o': opens = atoi(optarg); break;
+      default:
+        fprintf(stderr,
+                "usage: %s [-n commands] [-p commands] [-r rate] [-o opens]\n"
+                "  -n  commands written as fast as possible (default 1000000)\n"
+                "  -p  commands written at a fixed rate (default 20000)\n"
+                "  -r  rate in bytes/second for -p (default 105000 = 1050000 baud)\n"
+                "  -o  number of back-to-back opens of the slave side (default 5)\n",
+                argv[0]);
+        return 1;
+      }
+
+  core.set_surface(&framebuffer);
+  send_queue = new SendQueue(send_queue_write, NULL);
+  source = new Source(&reactor, "pty", 0);
+  source->set_data_callback(source_data, NULL);
+  source->set_state_callback(source_state, NULL);
+  source->set_reconnect(false);
+  source->start();
+  if( !source->connected() ) return 1;
+
+  sent_at = new std::atomic<int64_t>[paced];
+  std::thread t(emulator, source->pty_slave(), opens, bulk, paced, rate);
+  reactor.run();
+  t.join();
+
+  printf("paced at %i bytes/s: ", rate);
+  latency.print(stdout);
+  printf("reads: %llu in %llu wakeups, ", (unsigned long long) source->num_reads, (unsigned long long) reactor.num_wakeups);
+  source->read_bytes.print(stdout);
+
+  delete send_queue;
+  delete source;
+  delete [] sent_at;
+  return 0;
+}
@@ -0,0 +1,173 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - recording benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Encode throughput of the recorder (recorder.h) for an hour (-d minutes)
+// of a simulated session, recorded at 30 frames per second:
+// - the cursor blinks at 2 Hz all the time
+// - 20s of typing (6 characters per second) each minute
+// - a 40 line listing scrolling by (10 lines per second) each minute
+// - 30s of a Trek-80 style game every 5 minutes: a new chart every 2s
+//   and a few moving sprites in between
+// Pictures are passed in as fast as the encoder takes them (time stamps
+// are simulated), as GIF and Y4M at scale 1 and at a fractional scale.
+// The files go to /dev/null unless a directory is given with -o.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "vdm1core.h"
+#include "vdm1framebuffer.h"
+#include "recorder.h"
+
+
+#define FPS 30
+
+static double minutes = 60;
+static const char *out_dir = NULL;
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+// the traffic of frame n
+static void session(VDM1Core &core, int64_t n, uint32_t &seed)
+{
+  int64_t s = n/FPS, f = n%FPS;
+  int sec = (int) (s%60);
+
+  if( f==0 || f==FPS/2 ) core.toggle_blink();
+
+  if( (s%300)<30 )
+    {
+      // game: a new chart every 2s, sprites move every frame
+      if( f==0 && (s%2)==0 )
+        {
+          uint8_t mem[1024];
+          for(int i=0; i<1024; i++) mem[i] = (rand_r(&seed)%8)==0 ? '*' : (i%64)<48 ? '.' : ' ';
+          core.write_frame(mem);
+        }
+      else
+        for(int i=0; i<4; i++)
+          core.write_byte(rand_r(&seed)%1024, "<>^vKE"[rand_r(&seed)%6]);
+    }
+  else if( sec<20 )
+    {
+      // typing: cursor moves along with the characters
+      if( (f%5)==0 )
+        {
+          static int pos = 0;
+          core.write_byte(pos, 32 + rand_r(&seed)%95);
+          pos = (pos+1)%1024;
+          core.write_byte(pos, 0x80+' ');
+        }
+    }
+  else if( sec>=30 && sec<34 && (f%3)==0 )
+    {
+      // listing: scroll up one line and fill the bottom one
+      uint8_t ctrl = (core.ctrl+1) & 15;
+      int line = ((ctrl+15) & 15)*64;
+      for(int i=0; i<64; i++) core.write_byte(line+i, i<40 ? 32 + rand_r(&seed)%95 : ' ');
+      core.set_ctrl(ctrl);
+    }
+
+  core.present();
+}
+
+
+static void run(Recorder::format_t format, double scale)
+{
+  VDM1Framebuffer framebuffer(scale);
+  VDM1Core core;
+  core.set_surface(&framebuffer);
+  core.set_dip(2+8+32);  // blinking cursor, all characters shown
+  core.set_paced(true);
+  core.redraw();
+
+  char fname[1024];
+  if( out_dir!=NULL )
+    snprintf(fname, sizeof(fname), "%s/recbench-%.2f.%s", out_dir, scale, format==Recorder::FORMAT_GIF ? "gif" : "y4m");
+  else
+    snprintf(fname, sizeof(fname), "/dev/null");
+
+  Recorder recorder;
+  if( !recorder.start(fname, format, framebuffer.width, framebuffer.height, framebuffer.max_value, FPS) )
+    {
+      perror(fname);
+      exit(1);
+    }
+
+  // time stamps from 1s on (0 means now)
+  int64_t frames = (int64_t) (minutes*60*FPS);
+  uint32_t seed = 1, changes = framebuffer.changes-1;
+  double start = now_sec();
+  for(int64_t n=0; n<frames; n++)
+    {
+      session(core, n, seed);
+      if( framebuffer.changes!=changes )
+        {
+          recorder.add_frame(framebuffer.pixels, 1000000 + n*1000000/FPS, true);
+          changes = framebuffer.changes;
+        }
+    }
+  recorder.stop(1000000 + frames*1000000/FPS);
+  double elapsed = now_sec()-start;
+
+  printf("%-4s %5.2f  %4ix%-4i %9llu %9llu %10.1f %8.1f %7.0fx %8.0f %8llu\n",
+         format==Recorder::FORMAT_GIF ? "GIF" : "Y4M", scale, framebuffer.width, framebuffer.height,
+         (unsigned long long) recorder.num_frames, (unsigned long long) recorder.num_written,
+         recorder.num_bytes/1e6, elapsed, minutes*60/elapsed, recorder.encode_time.mean(),
+         (unsigned long long) recorder.encode_time.percentile(0.99));
+  fflush(stdout);
+}
+
+
+int main(int argc, char **argv)
+{
+  int opt;
+
+  while( (opt=getopt(argc, argv, "d:o:"))!=-1 )
+    switch( opt )
+      {
+      case 'd': minutes = atof(optarg); break;
+      case 'o': out_dir = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-d minutes] [-o directory for the files]\n", argv[0]);
+        return 1;
+      }
+
+  printf("%.0f minutes at %i fps\n", minutes, FPS);
+  printf("     scale  picture    pictures    frames   MB written  seconds realtime  enc us  p99 us\n");
+  static const double scales[] = {1, 2.6};
+  for(size_t i=0; i<sizeof(scales)/sizeof(scales[0]); i++)
+    {
+      run(Recorder::FORMAT_GIF, scales[i]);
+      run(Recorder::FORMAT_Y4M, scales[i]);
+    }
+
+  return 0;
+}
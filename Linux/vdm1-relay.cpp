@@ -0,0 +1,206 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - fan-out relay for remote viewers (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Connects to one Altair simulator (or serial port / pseudo terminal) and
+// lets any number of VDM-1 displays watch it over TCP (see Relay), e.g.
+//   vdm1-relay -L 8801 simhost:8800
+//   vdm1-headless -s screen.txt relayhost:8801
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#include "vdm1proto.h"
+#include "vdm1core.h"
+#include "reactor.h"
+#include "source.h"
+#include "relay.h"
+
+
+static Reactor   reactor;
+static VDM1Core  core;
+static Source   *source = NULL;
+static Relay    *relay = NULL;
+static bool      quiet = false;
+
+
+static void usage(const char *prg)
+{
+  fprintf(stderr,
+          "usage: %s [options] connection\n"
+          "connection:\n"
+          "  /dev/...      serial port\n"
+          "  pty           create a pseudo terminal (its name is printed)\n"
+          "  host[:port]   TCP connection to the simulator (default port 8800)\n"
+          "options:\n"
+          "  -L port       accept viewers on a TCP port (default 8801)\n"
+          "  -U port       accept datagram viewers (udp:host:port) on a UDP port\n"
+          "  -K ms         keyframe interval for datagram viewers (default 500)\n"
+          "  -B bytes      limit each viewer to the given bytes/second\n"
+          "  -i ms         update interval (default 20)\n"
+          "  -b baud       serial baud rate (default 1050000)\n"
+          "  -t seconds    exit after the given time\n"
+          "  -q            do not print statistics\n",
+          prg);
+  exit(1);
+}
+
+
+static void print_stats()
+{
+  if( quiet ) return;
+
+  fprintf(stderr, "received %llu bytes: %llu membyte, %llu fullframe, %llu ctrl, %llu dip, %llu unknown, %llu connects\n",
+          (unsigned long long) core.stats.bytes,
+          (unsigned long long) core.stats.membyte, (unsigned long long) core.stats.fullframe,
+          (unsigned long long) core.stats.ctrl, (unsigned long long) core.stats.dip,
+          (unsigned long long) core.stats.unknown, (unsigned long long) source->num_connects);
+  source->read_time.print(stderr);
+  relay->print_stats(stderr);
+}
+
+
+static void core_write(void *ctx, int addr, uint8_t value)
+{
+  relay->changed(addr);
+}
+
+
+static void core_frame(void *ctx)
+{
+  relay->frame_changed();
+}
+
+
+static void core_state(void *ctx)
+{
+  relay->state_changed();
+}
+
+
+static void source_data(void *ctx, const uint8_t *data, int size)
+{
+  core.receive(data, size);
+}
+
+
+static void source_state(void *ctx, bool connected)
+{
+  if( connected )
+    {
+      // the simulator sends the whole screen after VDM_CONNECT
+      uint8_t b = VDM_CONNECT;
+      core.reset_decoder();
+      source->write(&b, 1);
+    }
+}
+
+
+static void signal_event(void *ctx, int fd, uint32_t events)
+{
+  struct signalfd_siginfo si;
+
+  while( read(fd, &si, sizeof(si))==sizeof(si) )
+    {
+      if( si.ssi_signo==SIGUSR1 )
+        print_stats();
+      else
+        reactor.stop();
+    }
+}
+
+
+static void exit_timer(void *ctx)
+{
+  reactor.stop();
+}
+
+
+int main(int argc, char **argv)
+{
+  int    baud = 1050000, port = 8801, udp_port = -1, rate = 0, opt;
+  double interval = 20, key_interval = 500, timeout = 0;
+
+  while( (opt=getopt(argc, argv, "L:U:K:B:i:b:t:q"))!=-1 )
+    switch( opt )
+      {
+      case 'L': port = atoi(optarg); break;
+      case 'U': udp_port = atoi(optarg); break;
+      case 'K': key_interval = atof(optarg); break;
+      case 'B': rate = atoi(optarg); break;
+      case 'i': interval = atof(optarg); break;
+      case 'b': baud = atoi(optarg); break;
+      case 't': timeout = atof(optarg); break;
+      case 'q': quiet = true; break;
+      default:  usage(argv[0]);
+      }
+
+  if( optind!=argc-1 ) usage(argv[0]);
+
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  sigaddset(&sigs, SIGUSR1);
+  sigprocmask(SIG_BLOCK, &sigs, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  int sfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+  reactor.add(sfd, EPOLLIN, signal_event, NULL);
+
+  relay = new Relay(&reactor, &core);
+  relay->set_rate(rate);
+  relay->set_interval(interval/1000);
+  relay->set_keyframe_interval(key_interval/1000);
+  if( (port=relay->listen(port))<0 ) return 1;
+  if( !quiet ) fprintf(stderr, "Accepting viewers on port %i\n", port);
+  if( udp_port>=0 )
+    {
+      if( (udp_port=relay->listen_udp(udp_port))<0 ) return 1;
+      if( !quiet ) fprintf(stderr, "Accepting datagram viewers on UDP port %i\n", udp_port);
+    }
+
+  core.set_write_callback(core_write, NULL);
+  core.set_frame_callback(core_frame, NULL);
+  core.set_state_callback(core_state, NULL);
+
+  source = new Source(&reactor, argv[optind], baud);
+  source->set_data_callback(source_data, NULL);
+  source->set_state_callback(source_state, NULL);
+  source->start();
+  if( source->pty_slave()[0]!=0 )
+    {
+      printf("%s\n", source->pty_slave());
+      fflush(stdout);
+    }
+
+  if( timeout>0 )
+    reactor.set_timer(reactor.add_timer(exit_timer, NULL), timeout);
+
+  reactor.run();
+  print_stats();
+
+  delete relay;
+  delete source;
+  return 0;
+}
@@ -0,0 +1,158 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - renderer benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Render time of the framebuffer (vdm1framebuffer.h) against the number of
+// drawing threads at scales 1-8 (scale 8 is about what a 4K fullscreen
+// window needs), for
+// - full:    redrawing the whole screen (e.g. a Trek-80 chart, VDM_FULLFRAME)
+// - rows:    4 complete rows changed (256 cells)
+// - partial: 64 cells changed all over the screen
+// Partial updates go through a paced core, i.e. they are drawn in one batch
+// like the frame pacer does. The picture is checked against one thread.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <thread>
+#include <vector>
+
+#include "vdm1core.h"
+#include "vdm1framebuffer.h"
+
+
+static double duration = 0.3;
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+enum { CASE_FULL, CASE_ROWS, CASE_PARTIAL, NUM_CASES };
+
+
+// one change of the given case
+static void update(VDM1Core &core, int c, uint32_t &seed)
+{
+  switch( c )
+    {
+    case CASE_FULL:
+      {
+        uint8_t mem[1024];
+        for(int i=0; i<1024; i++) mem[i] = 32 + rand_r(&seed)%95;
+        core.write_frame(mem);
+        core.present();
+        break;
+      }
+
+    case CASE_ROWS:
+      {
+        int row = rand_r(&seed)%13;
+        for(int i=0; i<4*64; i++) core.write_byte(row*64+i, 32 + rand_r(&seed)%95);
+        core.present();
+        break;
+      }
+
+    case CASE_PARTIAL:
+      for(int i=0; i<64; i++) core.write_byte(rand_r(&seed)%1024, 32 + rand_r(&seed)%95);
+      core.present();
+      break;
+    }
+}
+
+
+// milliseconds per update, "pixels" gets the final picture
+static double run(int scale, int threads, int c, std::vector<uint8_t> &pixels)
+{
+  VDM1Framebuffer framebuffer(scale);
+  framebuffer.set_threads(threads);
+  VDM1Core core;
+  core.set_surface(&framebuffer);
+  core.set_dip(2+4+32);  // show all characters, no cursor blinking
+  core.set_paced(true);
+
+  uint32_t seed = 1;
+  int n = 0;
+  double start = now_sec(), elapsed;
+  do
+    {
+      update(core, c, seed);
+      n++;
+    }
+  while( (elapsed=now_sec()-start)<duration );
+
+  // same sequence of changes for the picture check
+  VDM1Core check;
+  VDM1Framebuffer check_fb(scale);
+  check_fb.set_threads(threads);
+  check.set_surface(&check_fb);
+  check.set_dip(2+4+32);
+  check.set_paced(true);
+  seed = 1;
+  for(int i=0; i<20; i++) update(check, c, seed);
+  pixels.assign(check_fb.pixels, check_fb.pixels+check_fb.width*check_fb.height);
+
+  return elapsed*1e3/n;
+}
+
+
+int main(int argc, char **argv)
+{
+  static const char *names[] = {"full", "rows", "partial"};
+  int max_threads = (int) std::thread::hardware_concurrency(), opt;
+  if( max_threads<4 ) max_threads = 4;
+
+  while( (opt=getopt(argc, argv, "t:d:"))!=-1 )
+    switch( opt )
+      {
+      case 't': max_threads = atoi(optarg); break;
+      case 'd': duration = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-t max threads] [-d seconds per test]\n", argv[0]);
+        return 1;
+      }
+
+  printf("%u CPUs, milliseconds per update\n", std::thread::hardware_concurrency());
+  printf("case    scale  resolution");
+  for(int t=1; t<=max_threads; t*=2) printf("  %2i thr", t);
+  printf("\n");
+
+  bool ok = true;
+  for(int c=0; c<NUM_CASES; c++)
+    for(int scale=1; scale<=8; scale++)
+      {
+        std::vector<uint8_t> ref, pixels;
+        printf("%-7s %5i %5ix%-5i", names[c], scale, VDM1_HPIX*scale, VDM1_VPIX*scale);
+        for(int t=1; t<=max_threads; t*=2)
+          {
+            printf(" %7.3f", run(scale, t, c, t==1 ? ref : pixels));
+            fflush(stdout);
+            if( t>1 && pixels!=ref ) { printf(" MISMATCH"); ok = false; }
+          }
+        printf("\n");
+      }
+
+  return ok ? 0 : 1;
+}
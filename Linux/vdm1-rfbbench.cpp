@@ -0,0 +1,658 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - RFB server benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// CPU time of the RFB server (rfbserver.h) per connected viewer for
+// continuous screen updates at 30 frames per second (-d seconds per run):
+// - text:    typing (6 characters per second) and a listing scrolling by
+//            (the whole picture moves) every few seconds
+// - sprites: 12 sprites erased and drawn again one cell further each frame
+// - full:    a new random screen each frame (the worst case)
+// with 1 and 8 (-n) viewers for each encoding (-l and -e pick one). The viewers are local
+// stand-ins in threads of their own: they decode every update (ZRLE,
+// hextile or raw; every other one in 16 bit big endian RGB565 instead of
+// the default 32 bit format) and keep asking for more like a real viewer
+// does. At the end each viewer's picture is checked against the screen.
+// CPU time is the server's share of the main thread (without the time
+// spent making the frames), "MB/s" is what each viewer received.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <zlib.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "vdm1core.h"
+#include "vdm1framebuffer.h"
+#include "reactor.h"
+#include "rfbserver.h"
+
+
+#define FPS 30
+
+static double seconds = 3, scale = 1;
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+static double thread_cpu_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+// -----------------------------------------------------------------------------
+// viewer stand-in
+// -----------------------------------------------------------------------------
+
+
+class Viewer
+{
+ public:
+  Viewer(int port, int encoding, bool rgb565);
+  ~Viewer();
+
+  // the picture as 0xRRGGBB of the levels of a green on black screen
+  bool check(const uint8_t *pixels, int width, int height, uint8_t max_value);
+
+  std::atomic<uint64_t> bytes, updates;
+  std::atomic<bool>     failed, busy;   // busy: in the middle of an update
+  char                  error[128];
+
+ private:
+  void run();
+  bool readn(void *buf, size_t n);
+  bool read_pixel(uint32_t &v, bool cpixel);
+  bool decode_raw(int x, int y, int w, int h);
+  bool decode_hextile(int x, int y, int w, int h);
+  bool decode_zrle(int x, int y, int w, int h);
+  bool zbyte(uint8_t &b);
+  bool zpixel(uint32_t &v);
+  void fail(const char *msg);
+
+  int  m_fd, m_encoding, m_width, m_height;
+  bool m_rgb565;
+  std::vector<uint32_t> m_pic;   // pixel values as received
+  std::mutex  m_mutex;
+  std::thread m_thread;
+  std::atomic<bool> m_stop;
+
+  z_stream m_zs;
+  std::vector<uint8_t> m_z;
+  size_t   m_zpos;
+
+  uint8_t  m_buf[65536];
+  size_t   m_buf_pos, m_buf_len;
+};
+
+
+Viewer::Viewer(int port, int encoding, bool rgb565) : bytes(0), updates(0), failed(false), busy(false)
+{
+  m_buf_pos = m_buf_len = 0;
+  m_encoding = encoding;
+  m_rgb565 = rgb565;
+  m_width = m_height = 0;
+  m_stop = false;
+  error[0] = 0;
+  memset(&m_zs, 0, sizeof(m_zs));
+  inflateInit(&m_zs);
+  m_zpos = 0;
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  m_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if( connect(m_fd, (struct sockaddr *) &addr, sizeof(addr))<0 )
+    {
+      perror("connect");
+      exit(1);
+    }
+  int one = 1;
+  setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  m_thread = std::thread(&Viewer::run, this);
+}
+
+
+Viewer::~Viewer()
+{
+  m_stop = true;
+  shutdown(m_fd, SHUT_RDWR);
+  m_thread.join();
+  close(m_fd);
+  inflateEnd(&m_zs);
+}
+
+
+void Viewer::fail(const char *msg)
+{
+  if( !m_stop && !failed )
+    {
+      snprintf(error, sizeof(error), "%s", msg);
+      failed = true;
+    }
+}
+
+
+bool Viewer::readn(void *buf, size_t n)
+{
+  uint8_t *p = (uint8_t *) buf;
+  while( n>0 )
+    {
+      if( m_buf_pos==m_buf_len )
+        {
+          ssize_t r = recv(m_fd, m_buf, sizeof(m_buf), 0);
+          if( r<=0 )
+            {
+              fail("connection closed");
+              return false;
+            }
+          m_buf_pos = 0;
+          m_buf_len = r;
+          bytes += r;
+        }
+
+      size_t k = m_buf_len-m_buf_pos<n ? m_buf_len-m_buf_pos : n;
+      memcpy(p, m_buf+m_buf_pos, k);
+      m_buf_pos += k;
+      p += k;
+      n -= k;
+    }
+  return true;
+}
+
+
+static int get16(const uint8_t *p) { return (p[0]<<8) | p[1]; }
+static uint32_t get32(const uint8_t *p) { return (uint32_t(p[0])<<24) | (p[1]<<16) | (p[2]<<8) | p[3]; }
+
+
+bool Viewer::read_pixel(uint32_t &v, bool cpixel)
+{
+  uint8_t b[4];
+  if( m_rgb565 )
+    {
+      if( !readn(b, 2) ) return false;
+      v = (b[0]<<8) | b[1];
+    }
+  else
+    {
+      // 32 bit little endian, a CPIXEL is the lower three bytes
+      if( !readn(b, cpixel ? 3 : 4) ) return false;
+      v = b[0] | (b[1]<<8) | (b[2]<<16) | (cpixel ? 0 : b[3]<<24);
+    }
+  return true;
+}
+
+
+void Viewer::run()
+{
+  uint8_t buf[64];
+
+  // version, security type None, shared, ServerInit
+  if( !readn(buf, 12) || memcmp(buf, "RFB 003.008\n", 12)!=0 ) return fail("bad version");
+  send(m_fd, "RFB 003.008\n", 12, MSG_NOSIGNAL);
+  if( !readn(buf, 2) || buf[0]!=1 || buf[1]!=1 ) return fail("bad security types");
+  buf[0] = 1;
+  send(m_fd, buf, 1, MSG_NOSIGNAL);
+  if( !readn(buf, 4) || get32(buf)!=0 ) return fail("security failed");
+  send(m_fd, buf, 1, MSG_NOSIGNAL);
+  if( !readn(buf, 24) ) return;
+  m_width = get16(buf);
+  m_height = get16(buf+2);
+  uint32_t name_len = get32(buf+20);
+  std::vector<uint8_t> name(name_len);
+  if( name_len>0 && !readn(name.data(), name_len) ) return;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pic.assign(m_width*m_height, 0xdeadbeef);
+  }
+
+  if( m_rgb565 )
+    {
+      static const uint8_t msg[20] = {0, 0, 0, 0, 16, 16, 1, 1, 0, 31, 0, 63, 0, 31, 11, 5, 0, 0, 0, 0};
+      send(m_fd, msg, sizeof(msg), MSG_NOSIGNAL);
+    }
+  uint8_t enc[8] = {2, 0, 0, 1, 0, 0, 0, (uint8_t) m_encoding};
+  send(m_fd, enc, sizeof(enc), MSG_NOSIGNAL);
+
+  uint8_t req[10] = {3, 0, 0, 0, 0, 0, (uint8_t) (m_width>>8), (uint8_t) m_width,
+                     (uint8_t) (m_height>>8), (uint8_t) m_height};
+  send(m_fd, req, sizeof(req), MSG_NOSIGNAL);
+
+  while( !m_stop )
+    {
+      if( !readn(buf, 4) ) return;
+      if( buf[0]!=0 ) return fail("unexpected message");
+
+      int n = get16(buf+2);
+      busy = true;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      for(int i=0; i<n; i++)
+        {
+          if( !readn(buf, 12) ) return;
+          int x = get16(buf), y = get16(buf+2), w = get16(buf+4), h = get16(buf+6);
+          int e = (int) get32(buf+8);
+          if( e!=m_encoding || x+w>m_width || y+h>m_height ) return fail("bad rectangle");
+          bool ok = e==16 ? decode_zrle(x, y, w, h) : e==5 ? decode_hextile(x, y, w, h) : decode_raw(x, y, w, h);
+          if( !ok ) return;
+        }
+      updates++;
+      busy = false;
+
+      // incremental from now on
+      req[1] = 1;
+      send(m_fd, req, sizeof(req), MSG_NOSIGNAL);
+    }
+}
+
+
+bool Viewer::decode_raw(int x, int y, int w, int h)
+{
+  for(int r=y; r<y+h; r++)
+    for(int c=x; c<x+w; c++)
+      if( !read_pixel(m_pic[r*m_width+c], false) ) return false;
+  return true;
+}
+
+
+bool Viewer::decode_hextile(int x, int y, int w, int h)
+{
+  uint32_t bg = 0, fg = 0;
+  for(int ty=y; ty<y+h; ty+=16)
+    for(int tx=x; tx<x+w; tx+=16)
+      {
+        int tw = x+w-tx<16 ? x+w-tx : 16, th = y+h-ty<16 ? y+h-ty : 16;
+        uint8_t mask;
+        if( !readn(&mask, 1) ) return false;
+        if( mask & 1 )
+          {
+            if( !decode_raw(tx, ty, tw, th) ) return false;
+            continue;
+          }
+        if( (mask & 2) && !read_pixel(bg, false) ) return false;
+        if( (mask & 4) && !read_pixel(fg, false) ) return false;
+        for(int r=ty; r<ty+th; r++)
+          for(int c=tx; c<tx+tw; c++) m_pic[r*m_width+c] = bg;
+        if( mask & 8 )
+          {
+            uint8_t n;
+            if( !readn(&n, 1) ) return false;
+            for(int i=0; i<n; i++)
+              {
+                uint32_t color = fg;
+                uint8_t sr[2];
+                if( (mask & 16) && !read_pixel(color, false) ) return false;
+                if( !readn(sr, 2) ) return false;
+                int sx = sr[0]>>4, sy = sr[0] & 15, sw = (sr[1]>>4)+1, sh = (sr[1] & 15)+1;
+                if( sx+sw>tw || sy+sh>th ) { fail("bad subrectangle"); return false; }
+                for(int r=0; r<sh; r++)
+                  for(int c=0; c<sw; c++) m_pic[(ty+sy+r)*m_width+tx+sx+c] = color;
+              }
+          }
+      }
+  return true;
+}
+
+
+bool Viewer::zbyte(uint8_t &b)
+{
+  if( m_zpos>=m_z.size() ) { fail("ZRLE data too short"); return false; }
+  b = m_z[m_zpos++];
+  return true;
+}
+
+
+bool Viewer::zpixel(uint32_t &v)
+{
+  uint8_t b[3];
+  int n = m_rgb565 ? 2 : 3;
+  for(int i=0; i<n; i++)
+    if( !zbyte(b[i]) ) return false;
+  v = m_rgb565 ? (b[0]<<8) | b[1] : b[0] | (b[1]<<8) | (b[2]<<16);
+  return true;
+}
+
+
+bool Viewer::decode_zrle(int x, int y, int w, int h)
+{
+  uint8_t lb[4];
+  if( !readn(lb, 4) ) return false;
+  std::vector<uint8_t> data(get32(lb));
+  if( !readn(data.data(), data.size()) ) return false;
+
+  // inflate all of it (the server flushes after each rectangle)
+  m_z.clear();
+  m_zpos = 0;
+  m_zs.next_in = data.data();
+  m_zs.avail_in = (uInt) data.size();
+  uint8_t out[65536];
+  do
+    {
+      m_zs.next_out = out;
+      m_zs.avail_out = sizeof(out);
+      int r = inflate(&m_zs, Z_SYNC_FLUSH);
+      if( r!=Z_OK && r!=Z_BUF_ERROR ) { fail("inflate error"); return false; }
+      m_z.insert(m_z.end(), out, out+(sizeof(out)-m_zs.avail_out));
+    }
+  while( m_zs.avail_in>0 || m_zs.avail_out==0 );
+
+  for(int ty=y; ty<y+h; ty+=64)
+    for(int tx=x; tx<x+w; tx+=64)
+      {
+        int tw = x+w-tx<64 ? x+w-tx : 64, th = y+h-ty<64 ? y+h-ty : 64;
+        uint8_t sub;
+        uint32_t palette[128];
+        if( !zbyte(sub) ) return false;
+
+        if( sub==0 )
+          {
+            for(int r=ty; r<ty+th; r++)
+              for(int c=tx; c<tx+tw; c++)
+                if( !zpixel(m_pic[r*m_width+c]) ) return false;
+          }
+        else if( sub<=16 )
+          {
+            for(int i=0; i<sub; i++)
+              if( !zpixel(palette[i]) ) return false;
+            int bits = sub==1 ? 0 : sub==2 ? 1 : sub<=4 ? 2 : 4;
+            for(int r=ty; r<ty+th; r++)
+              {
+                uint8_t byte = 0;
+                int left = 0;
+                for(int c=tx; c<tx+tw; c++)
+                  {
+                    int idx = 0;
+                    if( bits>0 )
+                      {
+                        if( left==0 ) { if( !zbyte(byte) ) return false; left = 8; }
+                        left -= bits;
+                        idx = (byte>>left) & ((1<<bits)-1);
+                      }
+                    if( idx>=sub ) { fail("bad palette index"); return false; }
+                    m_pic[r*m_width+c] = palette[idx];
+                  }
+              }
+          }
+        else if( sub>=128 )
+          {
+            int n = sub-128;
+            for(int i=0; i<n; i++)
+              if( !zpixel(palette[i]) ) return false;
+            int pos = 0, total = tw*th;
+            while( pos<total )
+              {
+                uint32_t v;
+                uint8_t b;
+                bool run = true;
+                if( n==0 )
+                  {
+                    if( !zpixel(v) ) return false;
+                  }
+                else
+                  {
+                    if( !zbyte(b) ) return false;
+                    if( (b & 127)>=n ) { fail("bad palette index"); return false; }
+                    v = palette[b & 127];
+                    run = (b & 128)!=0;
+                  }
+                int len = 1;
+                if( run )
+                  do { if( !zbyte(b) ) return false; len += b; } while( b==255 );
+                if( pos+len>total ) { fail("run too long"); return false; }
+                for(int i=0; i<len; i++, pos++)
+                  m_pic[(ty+pos/tw)*m_width+tx+pos%tw] = v;
+              }
+          }
+        else
+          {
+            fail("unsupported ZRLE subencoding");
+            return false;
+          }
+      }
+
+  if( m_zpos!=m_z.size() ) { fail("ZRLE data left over"); return false; }
+  return true;
+}
+
+
+bool Viewer::check(const uint8_t *pixels, int width, int height, uint8_t max_value)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if( width!=m_width || height!=m_height ) return false;
+
+  for(int i=0; i<width*height; i++)
+    {
+      // green on black, like the server's default colors
+      int g = 255*pixels[i]/max_value;
+      uint32_t want = m_rgb565 ? uint32_t((g*63+127)/255) << 5 : uint32_t(g) << 8;
+      if( m_pic[i]!=want ) return false;
+    }
+  return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// runs
+// -----------------------------------------------------------------------------
+
+
+enum { LOAD_TEXT, LOAD_SPRITES, LOAD_FULL, NUM_LOADS };
+
+
+// the changes of frame n
+static void frame(VDM1Core &core, int load, int64_t n, uint32_t &seed)
+{
+  int f = (int) (n%FPS);
+  if( f==0 || f==FPS/2 ) core.toggle_blink();
+
+  switch( load )
+    {
+    case LOAD_TEXT:
+      {
+        static int pos = 0;
+        if( (n/FPS)%4==3 && (f%3)==0 )
+          {
+            // listing: scroll up one line and fill the bottom one
+            uint8_t ctrl = (core.ctrl+1) & 15;
+            int line = ((ctrl+15) & 15)*64;
+            for(int i=0; i<64; i++) core.write_byte(line+i, i<40 ? 32 + rand_r(&seed)%95 : ' ');
+            core.set_ctrl(ctrl);
+          }
+        else if( (f%5)==0 )
+          {
+            core.write_byte(pos, 32 + rand_r(&seed)%95);
+            pos = (pos+1)%1024;
+            core.write_byte(pos, 0x80+' ');
+          }
+        break;
+      }
+
+    case LOAD_SPRITES:
+      {
+        static const char *sprite = "/O\\";
+        int x0 = (int) (n%40), x1 = (int) ((n+1)%40);
+        if( x0>=20 ) x0 = 39-x0;
+        if( x1>=20 ) x1 = 39-x1;
+        for(int i=0; i<12; i++)
+          {
+            int a = (2 + 2*(i/4))*64 + x0 + 10*(i%4);
+            for(int k=0; k<3; k++) core.write_byte(a+k, ' ');
+            a = (2 + 2*(i/4))*64 + x1 + 10*(i%4);
+            for(int k=0; k<3; k++) core.write_byte(a+k, sprite[k]);
+          }
+        break;
+      }
+
+    case LOAD_FULL:
+      {
+        uint8_t mem[1024];
+        for(int i=0; i<1024; i++) mem[i] = 32 + rand_r(&seed)%95;
+        core.write_frame(mem);
+        break;
+      }
+    }
+
+  core.present();
+}
+
+
+static bool run(int load, int encoding, int num_viewers)
+{
+  static const char *loads[] = {"text", "sprites", "full"};
+
+  Reactor reactor;
+  VDM1Framebuffer framebuffer(scale);
+  VDM1Core core;
+  core.set_surface(&framebuffer);
+  core.set_dip(2+8+32);  // blinking cursor, all characters shown
+  core.set_paced(true);
+  core.redraw();
+  core.present();
+
+  RFBServer server(&reactor);
+  server.set_picture(framebuffer.pixels, framebuffer.width, framebuffer.height, framebuffer.max_value);
+  int port = server.listen("127.0.0.1", 0);
+  if( port<0 ) exit(1);
+
+  std::vector<Viewer *> viewers;
+  for(int i=0; i<num_viewers; i++)
+    viewers.push_back(new Viewer(port, encoding, (i%2)==1));
+  double t0 = now_sec();
+  while( server.num_clients()<num_viewers && now_sec()-t0<2 ) reactor.run_once(10);
+
+  // frames in real time, the reactor serves the viewers in between
+  uint32_t seed = 1, changes = framebuffer.changes;
+  double cpu0 = thread_cpu_sec(), frame_cpu = 0, start = now_sec(), next = start;
+  uint64_t bytes0 = 0;
+  for(size_t i=0; i<viewers.size(); i++) bytes0 += viewers[i]->bytes;
+  int64_t n = 0;
+  while( now_sec()-start<seconds )
+    {
+      double now = now_sec();
+      if( now>=next )
+        {
+          double c = thread_cpu_sec();
+          frame(core, load, n++, seed);
+          frame_cpu += thread_cpu_sec()-c;
+          if( framebuffer.changes!=changes )
+            {
+              server.update();
+              changes = framebuffer.changes;
+            }
+          next += 1.0/FPS;
+        }
+      else
+        reactor.run_once((int) ((next-now)*1000)+1);
+    }
+  double elapsed = now_sec()-start, cpu = thread_cpu_sec()-cpu0-frame_cpu;
+  uint64_t bytes = 0, updates = 0;
+  for(size_t i=0; i<viewers.size(); i++)
+    {
+      bytes += viewers[i]->bytes;
+      updates += viewers[i]->updates;
+    }
+  bytes -= bytes0;
+
+  // let the viewers catch up (until none of them got anything for a while), then compare
+  t0 = now_sec();
+  double idle = now_sec();
+  while( now_sec()-idle<0.2 && now_sec()-t0<30 )
+    {
+      reactor.run_once(10);
+      for(size_t i=0; i<viewers.size(); i++)
+        if( viewers[i]->busy ) idle = now_sec();
+    }
+  bool ok = true;
+  for(size_t i=0; i<viewers.size(); i++)
+    if( viewers[i]->failed || !viewers[i]->check(framebuffer.pixels, framebuffer.width, framebuffer.height,
+                                                 framebuffer.max_value) )
+      {
+        printf("  viewer %i: %s\n", (int) i, viewers[i]->failed ? viewers[i]->error : "picture differs");
+        ok = false;
+      }
+
+  printf("%-8s %-8s %3i %8.2f %9.2f %9.3f %8.0f %8.0f  %s\n", loads[load],
+         encoding==16 ? "ZRLE" : encoding==5 ? "hextile" : "raw", num_viewers,
+         cpu/elapsed*100, cpu/elapsed*100/num_viewers, bytes/elapsed/1e6/num_viewers,
+         updates/elapsed/num_viewers, server.encode_time.mean(), ok ? "ok" : "FAILED");
+  fflush(stdout);
+
+  for(size_t i=0; i<viewers.size(); i++) delete viewers[i];
+  return ok;
+}
+
+
+int main(int argc, char **argv)
+{
+  static const char *load_names[] = {"text", "sprites", "full"};
+  static const char *encoding_names[] = {"zrle", "hextile", "raw"};
+  static const int encodings[] = {16, 5, 0};
+  int max_viewers = 8, only_load = -1, only_encoding = -1, opt;
+
+  while( (opt=getopt(argc, argv, "d:z:n:l:e:"))!=-1 )
+    switch( opt )
+      {
+      case 'd': seconds = atof(optarg); break;
+      case 'z': scale = atof(optarg); break;
+      case 'n': max_viewers = atoi(optarg); break;
+      case 'l':
+        for(int i=0; i<NUM_LOADS; i++) if( strcmp(optarg, load_names[i])==0 ) only_load = i;
+        break;
+      case 'e':
+        for(int i=0; i<3; i++) if( strcmp(optarg, encoding_names[i])==0 ) only_encoding = i;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-d seconds per run] [-z scale] [-n viewers] [-l text|sprites|full]\n"
+                "       [-e zrle|hextile|raw]\n", argv[0]);
+        return 1;
+      }
+
+  VDM1Framebuffer fb(scale);
+  printf("%ix%i pixels, %i fps, %.0fs per run\n", fb.width, fb.height, FPS, seconds);
+  printf("load     encoding  n   CPU %%  %%/viewer MB/s/vwr upd/s/vwr  enc us\n");
+  bool ok = true;
+  for(int load=0; load<NUM_LOADS; load++)
+    for(int e=0; e<3; e++)
+      {
+        if( (only_load>=0 && load!=only_load) || (only_encoding>=0 && e!=only_encoding) ) continue;
+        if( !run(load, encodings[e], 1) ) ok = false;
+        if( max_viewers>1 && !run(load, encodings[e], max_viewers) ) ok = false;
+      }
+
+  return ok ? 0 : 1;
+}
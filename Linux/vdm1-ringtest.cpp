@@ -0,0 +1,259 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - ring buffer stress test and benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Stress test and throughput benchmark for the single-producer/single-
+// consumer ring buffer (Common/ringbuffer.h) with a real producer and
+// consumer thread. Each side uses one of the three ways in and out:
+// - byte:  ringbuffer_enqueue()/ringbuffer_dequeue()
+// - bulk:  ringbuffer_write()/ringbuffer_read() with random lengths
+// - span:  ringbuffer_write_span()/commit() and read_span()/consume()
+// The producer writes a position-dependent byte pattern (only what fits,
+// nothing is dropped) and the consumer checks every byte it gets, for all
+// nine combinations with a keyboard-sized (64 byte) and a receive-sized
+// (4096 byte) buffer. The overflow and high-watermark accounting is then
+// checked on its own. The MB/s printed for each combination is the
+// benchmark (the 4096 byte buffer with bulk/span is the receive path).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <thread>
+#include <atomic>
+
+#include "ringbuffer.h"
+
+
+enum { MODE_BYTE, MODE_BULK, MODE_SPAN };
+static const char *mode_names[] = {"byte", "bulk", "span"};
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+// the byte at stream position i
+static inline uint8_t pattern(uint64_t i)
+{
+  return (uint8_t) (i ^ (i>>8) ^ ((i>>16)*31));
+}
+
+
+static inline uint32_t next_random(uint32_t *state)
+{
+  uint32_t x = *state;
+  x ^= x<<13;
+  x ^= x>>17;
+  x ^= x<<5;
+  return *state = x;
+}
+
+
+// now and then lets the other side run in between even on a single CPU,
+// where it would otherwise only run when this side finds nothing to do
+static inline void maybe_yield(uint32_t *rnd)
+{
+  if( (next_random(rnd)&255)==0 ) std::this_thread::yield();
+}
+
+
+static void producer(ringbuffer_t *rb, int mode, uint64_t total, std::atomic<bool> *done)
+{
+  uint8_t buf[256], *p;
+  uint32_t rnd = 1, n;
+  uint64_t pos = 0;
+
+  while( pos<total )
+    {
+      maybe_yield(&rnd);
+      switch( mode )
+        {
+        case MODE_BYTE:
+          // full is expected here, only bytes really dropped are overflows
+          if( ringbuffer_full(rb) )
+            std::this_thread::yield();
+          else if( ringbuffer_enqueue(rb, pattern(pos)) )
+            pos++;
+          break;
+
+        case MODE_BULK:
+          n = 1 + next_random(&rnd)%sizeof(buf);
+          if( n>ringbuffer_available_for_write(rb) ) n = ringbuffer_available_for_write(rb);
+          if( n>total-pos ) n = (uint32_t) (total-pos);
+          if( n==0 ) { std::this_thread::yield(); break; }
+          for(uint32_t i=0; i<n; i++) buf[i] = pattern(pos+i);
+          pos += ringbuffer_write(rb, buf, n);
+          break;
+
+        case MODE_SPAN:
+          n = ringbuffer_write_span(rb, &p);
+          if( n>1 + next_random(&rnd)%sizeof(buf) ) n = 1 + rnd%sizeof(buf);
+          if( n>total-pos ) n = (uint32_t) (total-pos);
+          if( n==0 ) { std::this_thread::yield(); break; }
+          for(uint32_t i=0; i<n; i++) p[i] = pattern(pos+i);
+          ringbuffer_commit(rb, n);
+          pos += n;
+          break;
+        }
+    }
+
+  *done = true;
+}
+
+
+// returns the position of the first wrong byte, "total" if all are right
+static uint64_t consumer(ringbuffer_t *rb, int mode, uint64_t total)
+{
+  uint8_t buf[256], b;
+  const uint8_t *p;
+  uint32_t rnd = 2, n;
+  uint64_t pos = 0;
+
+  while( pos<total )
+    {
+      maybe_yield(&rnd);
+      switch( mode )
+        {
+        case MODE_BYTE:
+          if( !ringbuffer_dequeue(rb, &b) )
+            std::this_thread::yield();
+          else if( b!=pattern(pos) )
+            return pos;
+          else
+            pos++;
+          break;
+
+        case MODE_BULK:
+          n = ringbuffer_read(rb, buf, 1 + next_random(&rnd)%sizeof(buf));
+          if( n==0 ) std::this_thread::yield();
+          for(uint32_t i=0; i<n; i++)
+            if( buf[i]!=pattern(pos+i) ) return pos+i;
+          pos += n;
+          break;
+
+        case MODE_SPAN:
+          n = ringbuffer_read_span(rb, &p);
+          if( n>1 + next_random(&rnd)%sizeof(buf) ) n = 1 + rnd%sizeof(buf);
+          if( n==0 ) std::this_thread::yield();
+          for(uint32_t i=0; i<n; i++)
+            if( p[i]!=pattern(pos+i) ) return pos+i;
+          ringbuffer_consume(rb, n);
+          pos += n;
+          break;
+        }
+    }
+
+  return pos;
+}
+
+
+static bool stress(uint32_t size, int pmode, int cmode, uint64_t total)
+{
+  uint8_t *data = (uint8_t *) malloc(size);
+  ringbuffer_t rb;
+  ringbuffer_init(&rb, data, size);
+
+  // the counters wrap around early on, at an index in the middle of the buffer
+  rb.head = rb.tail = 0xffffffffu - 1000000 - size/3;
+
+  double start = now_sec();
+  std::atomic<bool> done(false);
+  std::thread p(producer, &rb, pmode, total, &done);
+  uint64_t pos = consumer(&rb, cmode, total);
+
+  // after a wrong byte the producer still needs room to finish
+  while( pos<total && !done ) ringbuffer_clear(&rb);
+  p.join();
+  double elapsed = now_sec()-start;
+
+  bool ok = pos==total && ringbuffer_empty(&rb) && rb.overflows==0 && rb.high_watermark<=size;
+  printf("%5u  %-4s %-4s %8.1f MB/s  high watermark %4u  %s", size, mode_names[pmode], mode_names[cmode],
+         total/elapsed/1e6, rb.high_watermark, ok ? "ok\n" : "FAILED");
+  fflush(stdout);
+  if( !ok )
+    {
+      if( pos<total )
+        printf(" (wrong byte at %llu)\n", (unsigned long long) pos);
+      else
+        printf(" (%u bytes left, %u overflows)\n", ringbuffer_available_for_read(&rb), rb.overflows);
+    }
+
+  free(data);
+  return ok;
+}
+
+
+// what a producer that cannot wait (an interrupt handler) sees when the
+// consumer falls behind
+static bool check_overflow()
+{
+  uint8_t data[64], buf[100];
+  ringbuffer_t rb;
+  bool ok = true;
+
+  ringbuffer_init(&rb, data, sizeof(data));
+  for(int i=0; i<70; i++) ringbuffer_enqueue(&rb, (uint8_t) i);
+  ok = ok && rb.overflows==6 && rb.high_watermark==64 && ringbuffer_full(&rb);
+
+  // the bytes that fit are kept in order, the rest is dropped
+  ok = ok && ringbuffer_read(&rb, buf, 10)==10 && buf[0]==0 && buf[9]==9;
+  for(int i=0; i<20; i++) buf[i] = (uint8_t) (100+i);
+  ok = ok && ringbuffer_write(&rb, buf, 20)==10 && rb.overflows==16;
+  ok = ok && ringbuffer_read(&rb, buf, sizeof(buf))==64 && buf[0]==10 && buf[53]==63 && buf[54]==100 && buf[63]==109;
+  ok = ok && ringbuffer_empty(&rb) && rb.high_watermark==64;
+
+  // a span never reaches past the end of the buffer
+  uint8_t *p;
+  ok = ok && ringbuffer_write_span(&rb, &p)==64-(74 & 63) && p==data+(74 & 63);
+
+  printf("overflow accounting: %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+
+int main(int argc, char **argv)
+{
+  uint64_t total = 20000000;
+  int opt;
+
+  while( (opt=getopt(argc, argv, "n:"))!=-1 )
+    switch( opt )
+      {
+      case 'n': total = strtoull(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "usage: %s [-n bytes per run]\n", argv[0]);
+        return 1;
+      }
+
+  bool ok = check_overflow();
+  printf("\n size  in   out       throughput\n");
+  static const uint32_t sizes[] = {64, 4096};
+  for(int s=0; s<2; s++)
+    for(int pmode=0; pmode<3; pmode++)
+      for(int cmode=0; cmode<3; cmode++)
+        if( !stress(sizes[s], pmode, cmode, total) ) ok = false;
+
+  return ok ? 0 : 1;
+}
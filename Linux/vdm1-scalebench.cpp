@@ -0,0 +1,148 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - fractional scaling benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Fullscreen on common monitors: the picture size with the largest integer
+// scale that fits compared with the largest fractional one, and for the
+// fractional scale the time to build the glyph cache (VDM1Framebuffer::
+// set_scale()), the time per full and partial (64 cells) update with the
+// cache, and the time per full update if every character was resampled
+// while drawing (no cache). The integer scale's update times are given
+// for comparison.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "vdm1core.h"
+#include "vdm1charset.h"
+#include "vdm1framebuffer.h"
+
+
+static double duration = 0.3;
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+// milliseconds per full (cells = 1024) or partial update
+static double update_time(double scale, int cells)
+{
+  VDM1Framebuffer framebuffer(scale);
+  VDM1Core core;
+  core.set_surface(&framebuffer);
+  core.set_dip(2+4+32);  // show all characters, no cursor blinking
+  core.set_paced(true);
+
+  uint32_t seed = 1;
+  int n = 0;
+  double start = now_sec(), elapsed;
+  do
+    {
+      for(int i=0; i<cells; i++)
+        core.write_byte(cells==1024 ? i : rand_r(&seed)%1024, 32 + rand_r(&seed)%95);
+      core.present();
+      n++;
+    }
+  while( (elapsed=now_sec()-start)<duration );
+
+  return elapsed*1e3/n;
+}
+
+
+// milliseconds to build the glyph cache
+static double cache_time(double scale)
+{
+  VDM1Framebuffer framebuffer;
+  int n = 0;
+  double start = now_sec(), elapsed;
+  do
+    {
+      framebuffer.set_scale(scale);
+      n++;
+    }
+  while( (elapsed=now_sec()-start)<duration );
+
+  return elapsed*1e3/n;
+}
+
+
+// milliseconds per full update, resampling each character while drawing
+static double uncached_time(double scale)
+{
+  VDM1Framebuffer framebuffer(scale);
+  uint32_t seed = 1;
+  int n = 0;
+  double start = now_sec(), elapsed;
+  do
+    {
+      for(int r=0; r<VDM1_ROWS; r++)
+        for(int c=0; c<VDM1_COLS; c++)
+          vdm1_render_glyph(32 + rand_r(&seed)%95, framebuffer.cell_w, framebuffer.cell_h, 255,
+                            framebuffer.pixels + r*framebuffer.cell_h*framebuffer.width + c*framebuffer.cell_w,
+                            framebuffer.width);
+      n++;
+    }
+  while( (elapsed=now_sec()-start)<duration );
+
+  return elapsed*1e3/n;
+}
+
+
+int main(int argc, char **argv)
+{
+  static const int monitors[][2] = {{1366, 768}, {1440, 900}, {1920, 1080}, {1920, 1200},
+                                    {2560, 1440}, {3440, 1440}, {3840, 2160}, {5120, 2880}};
+  int opt;
+
+  while( (opt=getopt(argc, argv, "d:"))!=-1 )
+    switch( opt )
+      {
+      case 'd': duration = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-d seconds per test]\n", argv[0]);
+        return 1;
+      }
+
+  printf("                      integer scale                fractional scale\n");
+  printf("monitor    scale  picture    used  full ms   scale  picture    used  cache ms  full ms  part ms  uncached ms\n");
+  for(size_t i=0; i<sizeof(monitors)/sizeof(monitors[0]); i++)
+    {
+      int w = monitors[i][0], h = monitors[i][1];
+      double sx = double(w)/VDM1_HPIX, sy = double(h)/VDM1_VPIX;
+      double fscale = sx<sy ? sx : sy;
+      int    iscale = (int) fscale;
+
+      VDM1Framebuffer ifb(iscale), ffb(fscale);
+      printf("%4ix%-4i %4i   %4ix%-4i %3.0f%% %7.2f   %5.2f  %4ix%-4i %3.0f%% %8.2f %8.2f %8.3f %10.2f\n",
+             w, h, iscale, ifb.width, ifb.height, 100.0*ifb.width*ifb.height/(w*h), update_time(iscale, 1024),
+             fscale, ffb.width, ffb.height, 100.0*ffb.width*ffb.height/(w*h),
+             cache_time(fscale), update_time(fscale, 1024), update_time(fscale, 64), uncached_time(fscale));
+      fflush(stdout);
+    }
+
+  return 0;
+}
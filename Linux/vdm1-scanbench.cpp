@@ -0,0 +1,191 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - video memory scanning benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Row scanning (Common/vdm1scan.h): the implementation compiled in
+// against the portable one and a plain loop over each character, in
+// nanoseconds per 64 character row, for
+// - text:   printable characters only (the whole row has to be looked at)
+// - cr:     a line of text ended by a CR somewhere in the first half
+// - cursor: text with a cursor character
+// with and without collecting the cursor characters. All of them are
+// first checked against the plain loop with random rows. Then the core's
+// uses: a full redraw with CR/VT blanking and the blinking cursor
+// (which only redraws cursor characters).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "vdm1core.h"
+#include "vdm1scan.h"
+
+
+typedef int (*scan_func)(const uint8_t *row, uint64_t *cursor);
+
+#define NUM_ROWS 1024
+
+static double seconds = 0.5;
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+// counts what the core draws
+class NullSurface : public VDM1Surface
+{
+ public:
+  NullSurface() { cells = 0; }
+  virtual void draw_char(int row, int col, uint8_t ch, bool inverse) { cells++; }
+  virtual void fill(int row, int col, int h, int w, bool inverse) { cells += h*w; }
+  uint64_t cells;
+};
+
+
+static bool check(scan_func f, const char *name)
+{
+  uint8_t row[64];
+  uint32_t seed = 1;
+
+  for(int n=0; n<1000000; n++)
+    {
+      // few CR/VT and cursor characters in some rows, many in others
+      int odds = 1 + n%50;
+      for(int c=0; c<64; c++)
+        {
+          uint32_t r = rand_r(&seed);
+          row[c] = (r%odds)!=0 ? 32 + (r>>8)%95 : (r>>8)%4==0 ? 11 : (r>>8)%4==1 ? 13 : (r>>8) & 0xff;
+          if( ((r>>16)%odds)==0 ) row[c] |= 0x80;
+        }
+
+      uint64_t m1, m2;
+      int p1 = vdm1_scan_row_scalar(row, &m1), p2 = f(row, &m2), p3 = f(row, NULL);
+      if( p1!=p2 || p1!=p3 || m1!=m2 )
+        {
+          printf("%s: mismatch for row %i: %i/%i/%i %016llx/%016llx\n", name, n, p1, p2, p3,
+                 (unsigned long long) m1, (unsigned long long) m2);
+          return false;
+        }
+    }
+
+  return true;
+}
+
+
+static double bench(scan_func f, uint8_t rows[][64], bool cursor)
+{
+  uint64_t m = 0, sum = 0, n = 0;
+  double start = now_sec(), elapsed;
+
+  do
+    {
+      for(int i=0; i<NUM_ROWS; i++)
+        {
+          sum += f(rows[i], cursor ? &m : NULL);
+          sum += m;
+        }
+      n += NUM_ROWS;
+    }
+  while( (elapsed=now_sec()-start)<seconds );
+
+  // keep the results alive
+  if( sum==1 ) printf(" ");
+  return elapsed*1e9/n;
+}
+
+
+static void make_rows(uint8_t rows[][64], int kind)
+{
+  uint32_t seed = 2;
+  for(int i=0; i<NUM_ROWS; i++)
+    {
+      for(int c=0; c<64; c++) rows[i][c] = 32 + rand_r(&seed)%95;
+      if( kind==1 ) rows[i][rand_r(&seed)%32] = 13;
+      if( kind==2 ) rows[i][rand_r(&seed)%64] |= 0x80;
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+  static uint8_t rows[NUM_ROWS][64];
+  static const char *kinds[] = {"text", "cr", "cursor"};
+  static const scan_func funcs[] = {vdm1_scan_row_scalar, vdm1_scan_row_portable, vdm1_scan_row};
+  const char *names[] = {"scalar", "portable", vdm1_scan_impl()};
+  int opt;
+
+  while( (opt=getopt(argc, argv, "d:"))!=-1 )
+    switch( opt )
+      {
+      case 'd': seconds = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-d seconds per run]\n", argv[0]);
+        return 1;
+      }
+
+  for(int i=1; i<3; i++)
+    if( !check(funcs[i], names[i]) ) return 1;
+
+  printf("ns per row  first CR/VT           with cursor mask\n");
+  printf("row        ");
+  for(int k=0; k<2; k++)
+    for(int i=0; i<3; i++) printf(" %8s", names[i]);
+  printf("\n");
+  for(int kind=0; kind<3; kind++)
+    {
+      make_rows(rows, kind);
+      printf("%-10s ", kinds[kind]);
+      for(int k=0; k<2; k++)
+        for(int i=0; i<3; i++) printf(" %8.2f", bench(funcs[i], rows, k==1));
+      printf("\n");
+    }
+
+  // a BASIC listing: lines of 20-40 characters ended by CR, a blinking cursor
+  NullSurface surface;
+  VDM1Core core;
+  uint32_t seed = 3;
+  for(int r=0; r<16; r++)
+    {
+      int len = 20 + rand_r(&seed)%21;
+      for(int c=0; c<len; c++) core.write_byte(r*64+c, 32 + rand_r(&seed)%95);
+      core.write_byte(r*64+len, 13);
+    }
+  core.write_byte(15*64, 0x80+' ');
+  core.set_dip(2+8+16);  // blinking cursor, CR/VT blanking
+  core.set_surface(&surface);
+
+  int n = 0;
+  double start = now_sec(), elapsed;
+  do { core.redraw(); n++; } while( (elapsed=now_sec()-start)<seconds );
+  printf("\nredraw: %.2f us (%.0f cells)\n", elapsed*1e6/n, (double) surface.cells/n);
+
+  surface.cells = 0;
+  n = 0;
+  start = now_sec();
+  do { core.toggle_blink(); n++; } while( (elapsed=now_sec()-start)<seconds );
+  printf("blink:  %.2f us (%.0f cells)\n", elapsed*1e6/n, (double) surface.cells/n);
+  return 0;
+}
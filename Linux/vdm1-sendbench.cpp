@@ -0,0 +1,210 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - send queue benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Measures the send queue (Common/sendqueue.h) writing key presses into a
+// pseudo terminal, with a thread on the slave side reading them like the
+// Altair would. For an upload (a file from programs/ENT or -f file):
+// - keys sent as one write() of a VDM_KEY packet per key (before the
+//   send queue)
+// - the same keys queued with send_bulk(), as VDM_KEY packets and as
+//   VDM_KEYS blocks
+// - typed keys, each queued with send_key() as it comes
+// - bulk keys paced with a 1 ms character delay (-d), against the
+//   target rate
+// printing keys/s, bytes on the wire and write() calls per key.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <termios.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "vdm1proto.h"
+#include "sendqueue.h"
+
+
+static int master_fd = -1, slave_fd = -1;
+static std::atomic<uint64_t> written(0), syscalls(0), received(0);
+static std::atomic<bool>     running(true);
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+static bool open_pty()
+{
+  master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if( master_fd<0 || grantpt(master_fd)!=0 || unlockpt(master_fd)!=0 ) return false;
+  slave_fd = open(ptsname(master_fd), O_RDWR | O_NOCTTY);
+  if( slave_fd<0 ) return false;
+
+  // no line discipline in either direction: every byte arrives as sent
+  struct termios tio;
+  tcgetattr(slave_fd, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(slave_fd, TCSANOW, &tio);
+  return true;
+}
+
+
+// the send queue's output (also the old way, called once per key)
+static void pty_write(void *ctx, const uint8_t *data, int size)
+{
+  while( size>0 )
+    {
+      ssize_t n = write(master_fd, data, size);
+      syscalls++;
+      if( n<0 && errno==EINTR ) continue;
+      if( n<=0 ) return;
+      data += n;
+      size -= (int) n;
+      written += n;
+    }
+}
+
+
+// the Altair side
+static void reader_thread()
+{
+  uint8_t buf[4096];
+  while( running )
+    {
+      ssize_t n = read(slave_fd, buf, sizeof(buf));
+      if( n>0 ) received += n;
+    }
+}
+
+
+static void wait_received()
+{
+  while( received<written ) usleep(100);
+}
+
+
+static void print_result(const char *name, int keys, double elapsed, uint64_t bytes, uint64_t calls)
+{
+  printf("%-22s %6i keys %8.3f s %12.0f keys/s %7llu bytes %7llu writes %8.4f syscalls/key\n",
+         name, keys, elapsed, keys/elapsed, (unsigned long long) bytes, (unsigned long long) calls,
+         (double) calls/keys);
+}
+
+
+static void bench_direct(const std::vector<uint8_t> &keys)
+{
+  uint64_t w = written, s = syscalls;
+  double start = now_sec();
+  for(size_t i=0; i<keys.size(); i++)
+    {
+      uint8_t packet[2] = { VDM_KEY, keys[i] };
+      pty_write(NULL, packet, 2);
+    }
+  wait_received();
+  print_result("write() per key", (int) keys.size(), now_sec()-start, written-w, syscalls-s);
+}
+
+
+static void bench_queue(const char *name, const std::vector<uint8_t> &keys, bool typed, bool blocks, int char_delay)
+{
+  SendQueue *queue = new SendQueue(pty_write, NULL);
+  queue->set_key_blocks(blocks);
+  queue->set_pacing(char_delay, 0);
+
+  uint64_t w = written, s = syscalls;
+  double start = now_sec();
+  if( typed )
+    {
+      // the interactive queue holds MAX_INTERACTIVE keys, a fast typist
+      // never gets there
+      for(size_t i=0; i<keys.size(); i++)
+        while( !queue->send_key(keys[i]) ) usleep(10);
+    }
+  else
+    queue->send_bulk(keys.data(), (int) keys.size());
+
+  // all keys encoded: deleting the queue waits for the last write
+  while( queue->bulk_pending()>0 || queue->interactive_pending()>0 || queue->num_keys<keys.size() )
+    usleep(50);
+  delete queue;
+  wait_received();
+  print_result(name, (int) keys.size(), now_sec()-start, written-w, syscalls-s);
+}
+
+
+int main(int argc, char **argv)
+{
+  const char *fname = "../programs/ENT/checkers.ent";
+  int paced_keys = 1000, opt;
+
+  while( (opt=getopt(argc, argv, "f:n:"))!=-1 )
+    switch( opt )
+      {
+      case 'f': fname = optarg; break;
+      case 'n': paced_keys = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-f file to upload] [-n keys for the paced run]\n", argv[0]);
+        return 1;
+      }
+
+  FILE *f = fopen(fname, "rb");
+  if( f==NULL )
+    {
+      fprintf(stderr, "Unable to open %s: %s\n", fname, strerror(errno));
+      return 1;
+    }
+  std::vector<uint8_t> keys;
+  int c;
+  while( (c=fgetc(f))!=EOF ) keys.push_back((uint8_t) c);
+  fclose(f);
+
+  if( !open_pty() )
+    {
+      fprintf(stderr, "Unable to create a pseudo terminal: %s\n", strerror(errno));
+      return 1;
+    }
+  std::thread reader(reader_thread);
+
+  printf("%s:\n", fname);
+  bench_direct(keys);
+  bench_queue("send_bulk()", keys, false, false, 0);
+  bench_queue("send_bulk(), VDM_KEYS", keys, false, true, 0);
+  bench_queue("send_key()", keys, true, false, 0);
+
+  std::vector<uint8_t> paced(keys.begin(), keys.begin() + (paced_keys<(int) keys.size() ? paced_keys : keys.size()));
+  bench_queue("1 ms character delay", paced, false, false, 1);
+  printf("(target for the paced run: 1000 keys/s)\n");
+
+  // the reader is blocked in read(): closing the master side ends it
+  running = false;
+  close(master_fd);
+  reader.join();
+  close(slave_fd);
+  return 0;
+}
@@ -0,0 +1,232 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - multi-session display server (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Serves many VDM-1 displays from one process, e.g. for a rack of Altair
+// simulators. Each connection is a separate display (see SessionServer).
+// The screens can be saved on SIGUSR1 and when exiting.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <vector>
+
+#include "server.h"
+#include "reactor.h"
+#include "connection.h"
+
+
+static Reactor        reactor;
+static SessionServer *server = NULL;
+static const char    *screenshot_dir = NULL;
+static bool           quiet = false;
+
+
+static void usage(const char *prg)
+{
+  fprintf(stderr,
+          "usage: %s [options] [connection...]\n"
+          "connection:\n"
+          "  /dev/...      serial port\n"
+          "  pty           create a pseudo terminal (its name is printed)\n"
+          "  host[:port]   TCP connection to a simulator (default port 8800)\n"
+          "options:\n"
+          "  -L port       accept connections from simulators on a TCP port\n"
+          "  -j threads    number of worker threads (default: number of CPUs)\n"
+          "  -b baud       serial baud rate (default 1050000)\n"
+          "  -s dir        save all screens as dir/NAME.txt and dir/NAME.ppm\n"
+          "                on SIGUSR1 and when exiting\n"
+          "  -t seconds    exit after the given time\n"
+          "  -T            record lag from timestamp probes (see vdm1-loadgen)\n"
+          "  -q            do not print statistics\n",
+          prg);
+  exit(1);
+}
+
+
+static void save_screens()
+{
+  std::vector<Session *> sessions = server->sessions();
+  for(size_t i=0; i<sessions.size(); i++)
+    {
+      Session *s = sessions[i];
+      char fname[1024], buf[16*65+1];
+
+      // connection names may contain slashes (/dev/...)
+      char name[64];
+      snprintf(name, sizeof(name), "%s", s->name);
+      for(char *p=name; *p; p++) if( *p=='/' ) *p = '_';
+
+      std::lock_guard<std::mutex> lock(s->mutex);
+      snprintf(fname, sizeof(fname), "%s/%s.ppm", screenshot_dir, name);
+      if( !s->framebuffer.write_ppm(fname) )
+        fprintf(stderr, "Unable to write %s: %s\n", fname, strerror(errno));
+
+      snprintf(fname, sizeof(fname), "%s/%s.txt", screenshot_dir, name);
+      FILE *f = fopen(fname, "w");
+      if( f!=NULL )
+        {
+          fwrite(buf, 1, s->core.get_text(buf, "\n"), f);
+          fclose(f);
+        }
+    }
+}
+
+
+static void print_stats()
+{
+  if( quiet ) return;
+
+  std::vector<Session *> sessions = server->sessions();
+  Histogram lag("lag (all sessions)", "us");
+  uint64_t cpu = 0, bytes = 0;
+
+  fprintf(stderr, "%-24s %12s %10s %10s %10s %8s %16s\n", "session", "bytes", "cpu ms", "lag p50", "lag p99", "lag max",
+          "screen hash");
+  for(size_t i=0; i<sessions.size(); i++)
+    {
+      Session *s = sessions[i];
+      std::lock_guard<std::mutex> lock(s->mutex);
+      fprintf(stderr, "%-24s %12llu %10.1f %10llu %10llu %8llu %016llx%s\n", s->name,
+              (unsigned long long) s->core.stats.bytes, s->cpu_ns/1e6,
+              (unsigned long long) s->lag.percentile(0.5), (unsigned long long) s->lag.percentile(0.99),
+              (unsigned long long) s->lag.max, (unsigned long long) s->core.hash, s->closed ? " (closed)" : "");
+      lag.merge(s->lag);
+      cpu += s->cpu_ns;
+      bytes += s->core.stats.bytes;
+    }
+
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  fprintf(stderr, "%i sessions, %llu bytes, %.1f ms CPU in sessions (%.1f ms per session), %.1f ms process CPU\n",
+          (int) sessions.size(), (unsigned long long) bytes, cpu/1e6,
+          sessions.size()>0 ? cpu/1e6/sessions.size() : 0.0,
+          (ru.ru_utime.tv_sec+ru.ru_stime.tv_sec)*1e3 + (ru.ru_utime.tv_usec+ru.ru_stime.tv_usec)/1e3);
+  fprintf(stderr, "%i threads, %llu turns, %llu steals, %llu kicks\n", server->num_threads(),
+          (unsigned long long) server->num_turns, (unsigned long long) server->num_steals,
+          (unsigned long long) server->num_kicks);
+  if( lag.count>0 ) lag.print(stderr);
+}
+
+
+static void signal_event(void *ctx, int fd, uint32_t events)
+{
+  struct signalfd_siginfo si;
+
+  while( read(fd, &si, sizeof(si))==sizeof(si) )
+    {
+      if( si.ssi_signo==SIGUSR1 )
+        {
+          if( screenshot_dir!=NULL ) save_screens();
+          print_stats();
+        }
+      else
+        reactor.stop();
+    }
+}
+
+
+static void exit_timer(void *ctx)
+{
+  reactor.stop();
+}
+
+
+int main(int argc, char **argv)
+{
+  int    opt, port = -1, baud = 1050000;
+  int    threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  double timeout = 0;
+  bool   probe = false;
+
+  while( (opt=getopt(argc, argv, "L:j:b:s:t:Tq"))!=-1 )
+    switch( opt )
+      {
+      case 'L': port = atoi(optarg); break;
+      case 'j': threads = atoi(optarg); break;
+      case 'b': baud = atoi(optarg); break;
+      case 's': screenshot_dir = optarg; break;
+      case 't': timeout = atof(optarg); break;
+      case 'T': probe = true; break;
+      case 'q': quiet = true; break;
+      default:  usage(argv[0]);
+      }
+
+  if( optind>=argc && port<0 ) usage(argv[0]);
+  if( screenshot_dir!=NULL ) mkdir(screenshot_dir, 0777);
+
+  // signals are handled in the main thread's event loop, the
+  // worker threads inherit the blocked signal mask
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  sigaddset(&sigs, SIGUSR1);
+  sigprocmask(SIG_BLOCK, &sigs, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  int sfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+  reactor.add(sfd, EPOLLIN, signal_event, NULL);
+
+  server = new SessionServer(threads);
+  server->set_timestamp_probe(probe);
+
+  // the server does not reconnect, a lost connection stays closed
+  std::vector<int> pty_slave_fds;
+  for(int i=optind; i<argc; i++)
+    {
+      char pty_slave[64];
+      bool is_tcp;
+      int pty_slave_fd = -1;
+      int fd = open_connection(argv[i], baud, &is_tcp, pty_slave, sizeof(pty_slave), &pty_slave_fd);
+      if( fd<0 ) return 1;
+      if( pty_slave_fd>=0 ) pty_slave_fds.push_back(pty_slave_fd);
+
+      const char *name = argv[i];
+      if( strcmp(argv[i], "pty")==0 )
+        {
+          printf("%s\n", pty_slave);
+          name = pty_slave;
+        }
+
+      server->add(fd, name, is_tcp);
+    }
+  fflush(stdout);
+
+  if( port>=0 && server->listen(port)<0 )
+    return 1;
+
+  if( timeout>0 )
+    reactor.set_timer(reactor.add_timer(exit_timer, NULL), timeout);
+
+  server->start();
+  reactor.run();
+  server->stop();
+
+  if( screenshot_dir!=NULL ) save_screens();
+  print_stats();
+  delete server;
+  for(size_t i=0; i<pty_slave_fds.size(); i++) close(pty_slave_fds[i]);
+  return 0;
+}
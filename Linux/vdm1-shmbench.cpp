@@ -0,0 +1,181 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - shared-memory export benchmark (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Many reader processes reading the shared memory export (vdm1shm.h)
+// while one writer publishes as fast as it can (or at a given rate).
+// Each published state is uniform (all bytes of video memory and of the
+// picture derived from the generation), so a reader can tell if a copy
+// was torn. Reports reads per second, sequence lock retries and torn
+// copies (which must be 0) for mem-only and picture reads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "vdm1core.h"
+#include "vdm1shm.h"
+
+
+#define SHM_NAME "/vdm1-shmbench"
+
+struct reader_stats
+{
+  uint64_t reads, retries, torn, generations;
+};
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+static void reader(bool pixels, double duration, reader_stats *st)
+{
+  vdm1shm_reader_t r;
+  if( !vdm1shm_open(&r, SHM_NAME) ) exit(1);
+
+  uint8_t  mem[1024], ctrl;
+  uint8_t *pic = (uint8_t *) malloc((size_t) r.hdr->width*r.hdr->height);
+  uint32_t last = 0;
+  double   end = now_sec()+duration;
+
+  while( now_sec()<end )
+    for(int i=0; i<100; i++)
+      {
+        uint32_t g;
+        bool ok;
+        if( pixels )
+          {
+            g = vdm1shm_read_pixels(&r, pic);
+            size_t n = (size_t) r.hdr->width*r.hdr->height;
+            ok = pic[0]==(uint8_t) g && pic[n/2]==(uint8_t) g && pic[n-1]==(uint8_t) g;
+          }
+        else
+          {
+            g = vdm1shm_read(&r, mem, &ctrl, NULL);
+            ok = ctrl==(uint8_t) g && mem[0]==(uint8_t) g && mem[1023]==(uint8_t) g;
+            for(int a=1; a<1023 && ok; a+=61) ok = mem[a]==(uint8_t) g;
+          }
+
+        if( !ok ) st->torn++;
+        if( g!=last ) st->generations++;
+        last = g;
+        st->reads++;
+      }
+
+  st->retries = r.retries;
+  free(pic);
+  vdm1shm_close(&r);
+  exit(0);
+}
+
+
+static void run(int readers, bool pixels, double duration, double rate)
+{
+  vdm1shm_writer_t w;
+  if( !vdm1shm_create(&w, SHM_NAME, VDM1_HPIX, VDM1_VPIX) ) exit(1);
+
+  reader_stats *st = (reader_stats *) mmap(NULL, readers*sizeof(reader_stats), PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  memset(st, 0, readers*sizeof(reader_stats));
+
+  uint8_t  mem[1024];
+  uint8_t *pic = (uint8_t *) malloc(VDM1_HPIX*VDM1_VPIX);
+  uint32_t g = 0;
+
+  // generation 1 before the readers start
+  memset(mem, 1, sizeof(mem));
+  memset(pic, 1, VDM1_HPIX*VDM1_VPIX);
+  vdm1shm_publish(&w, mem, 1, 0, false, pic);
+  g = 1;
+
+  for(int i=0; i<readers; i++)
+    if( fork()==0 ) reader(pixels, duration, &st[i]);
+
+  double start = now_sec(), next = start, elapsed;
+  while( (elapsed=now_sec()-start)<duration )
+    {
+      if( rate>0 )
+        {
+          next += 1/rate;
+          double d = next-now_sec();
+          if( d>0 ) usleep((useconds_t) (d*1e6));
+        }
+
+      g++;
+      memset(mem, (uint8_t) g, sizeof(mem));
+      if( pixels ) memset(pic, (uint8_t) g, VDM1_HPIX*VDM1_VPIX);
+      vdm1shm_publish(&w, mem, (uint8_t) g, 0, false, pixels ? pic : NULL);
+    }
+
+  for(int i=0; i<readers; i++) wait(NULL);
+
+  reader_stats total;
+  memset(&total, 0, sizeof(total));
+  for(int i=0; i<readers; i++)
+    {
+      total.reads += st[i].reads;
+      total.retries += st[i].retries;
+      total.torn += st[i].torn;
+      total.generations += st[i].generations;
+    }
+
+  printf("%3i readers, %-6s %9.0f publishes/s  %11.0f reads/s (%10.0f per reader)  %5.1f%% retries  %llu torn  %.0f%% of generations seen\n",
+         readers, pixels ? "pixels" : "mem", (g-1)/elapsed, total.reads/elapsed, total.reads/elapsed/readers,
+         total.reads>0 ? 100.0*total.retries/total.reads : 0.0, (unsigned long long) total.torn,
+         g>1 ? 100.0*total.generations/readers/(g-1) : 0.0);
+  fflush(stdout);
+
+  munmap(st, readers*sizeof(reader_stats));
+  free(pic);
+  vdm1shm_destroy(&w);
+}
+
+
+int main(int argc, char **argv)
+{
+  double duration = 2, rate = 0;
+  int opt;
+
+  while( (opt=getopt(argc, argv, "d:r:"))!=-1 )
+    switch( opt )
+      {
+      case 'd': duration = atof(optarg); break;
+      case 'r': rate = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-d seconds per test] [-r publishes per second (default: as fast as possible)]\n", argv[0]);
+        return 1;
+      }
+
+  int counts[] = {1, 4, 16};
+  for(int p=0; p<2; p++)
+    for(int i=0; i<3; i++)
+      run(counts[i], p==1, duration, rate);
+
+  return 0;
+}
@@ -0,0 +1,333 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - text terminal display for Linux
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Shows the VDM-1 screen in the text terminal it runs in (e.g. over SSH),
+// drawn at a fixed rate with only what changed since the last frame sent
+// (see Common/vdm1terminal.h).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#include "vdm1core.h"
+#include "vdm1terminal.h"
+#include "sendqueue.h"
+#include "reactor.h"
+#include "source.h"
+#include "pacer.h"
+#include "vdm1metrics.h"
+
+
+static Reactor       reactor;
+static VDM1Core      core;
+static VDM1Terminal *terminal = NULL;
+static SendQueue    *send_queue = NULL;
+static Source       *source = NULL;
+static FramePacer   *pacer = NULL;
+static VDM1Metrics  *metrics = NULL;
+
+static const char *connection, *metrics_file = NULL;
+static bool   keys = false, exit_on_close = false, show_stats = false;
+static struct termios stdin_termios;
+static bool   stdin_raw = false;
+
+
+static void usage(const char *prg)
+{
+  fprintf(stderr,
+          "usage: %s [options] connection\n"
+          "connection:\n"
+          "  /dev/...      serial port\n"
+          "  pty           create a pseudo terminal for a software Altair emulator\n"
+          "  udp:host[:port] datagrams from vdm1-relay -U (default port 8801)\n"
+          "  host[:port]   TCP connection to the simulator (default port 8800)\n"
+          "options:\n"
+          "  -b baud       serial baud rate (default 1050000)\n"
+          "  -r hz         frames per second sent to the terminal (default 30, 0 = each change)\n"
+          "  -a            ASCII only (control characters as '.')\n"
+          "  -k            forward key presses\n"
+          "  -o            exit when the connection is lost (default: reconnect)\n"
+          "  -t seconds    exit after the given time\n"
+          "  -M file       write live metrics (Prometheus text format) to a file every second\n"
+          "  -O            show live statistics in the status line\n"
+          "  -q            do not print statistics when exiting\n",
+          prg);
+  exit(1);
+}
+
+
+static void restore_stdin()
+{
+  if( stdin_raw ) tcsetattr(0, TCSANOW, &stdin_termios);
+}
+
+
+static void terminal_write(void *ctx, const char *data, int size)
+{
+  while( size>0 )
+    {
+      ssize_t n = write(1, data, size);
+      if( n<0 && errno==EINTR ) continue;
+      if( n<=0 ) { reactor.stop(); return; }
+      data += n;
+      size -= (int) n;
+    }
+}
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+static void show_status()
+{
+  char buf[512];
+  int n;
+  if( source->pty_slave()[0]!=0 )
+    n = snprintf(buf, sizeof(buf), "VDM-1 on %s%s", source->pty_slave(), keys ? ", keys forwarded" : "");
+  else
+    n = snprintf(buf, sizeof(buf), "VDM-1 %s %s%s", source->connected() ? "connected to" : "waiting for",
+                 connection, keys ? ", keys forwarded" : "");
+
+  if( show_stats && n>0 && n<(int) sizeof(buf) )
+    {
+      // cut at the terminal's width, a wrapped status line would not be cleared
+      snprintf(buf+n, sizeof(buf)-n, " - %s", metrics->summary(now_sec()));
+      struct winsize ws;
+      if( ioctl(1, TIOCGWINSZ, &ws)==0 && ws.ws_col>0 && ws.ws_col<sizeof(buf) )
+        buf[ws.ws_col-1] = 0;
+    }
+  terminal->status(buf);
+}
+
+
+static void core_write(void *ctx, int addr, uint8_t value)
+{
+  send_queue->observe_write(addr, value);
+}
+
+
+static void send_queue_write(void *ctx, const uint8_t *data, int size)
+{
+  source->write(data, size);
+}
+
+
+static void source_data(void *ctx, const uint8_t *data, int size)
+{
+  core.receive(data, size);
+  if( pacer!=NULL ) pacer->data_received();
+}
+
+
+static void source_state(void *ctx, bool connected)
+{
+  if( connected )
+    {
+      core.reset_decoder();
+      send_queue->send_connect();
+    }
+  else if( exit_on_close )
+    reactor.stop();
+
+  show_status();
+}
+
+
+static void signal_event(void *ctx, int fd, uint32_t events)
+{
+  struct signalfd_siginfo si;
+
+  while( read(fd, &si, sizeof(si))==sizeof(si) )
+    {
+      if( si.ssi_signo==SIGWINCH )
+        {
+          // the terminal may have rearranged or cleared what it shows
+          terminal->reset();
+          show_status();
+        }
+      else
+        reactor.stop();
+    }
+}
+
+
+static void stdin_event(void *ctx, int fd, uint32_t events)
+{
+  uint8_t buf[256];
+  ssize_t n = read(0, buf, sizeof(buf));
+
+  if( n<=0 )
+    reactor.remove(0);
+  else
+    for(ssize_t i=0; i<n; i++)
+      send_queue->send_key(buf[i]=='\n' ? 13 : buf[i]);
+}
+
+
+static void blink_timer(void *ctx)
+{
+  core.toggle_blink();
+}
+
+
+static void metrics_timer(void *ctx)
+{
+  static bool failed = false;
+  if( metrics_file!=NULL )
+    {
+      if( metrics->write_file(metrics_file) )
+        failed = false;
+      else if( !failed )
+        {
+          terminal->status((std::string("Unable to write ") + metrics_file + ": " + strerror(errno)).c_str());
+          failed = true;
+        }
+    }
+  if( show_stats ) show_status();
+}
+
+
+static void exit_timer(void *ctx)
+{
+  reactor.stop();
+}
+
+
+int main(int argc, char **argv)
+{
+  int    baud = 1050000, opt;
+  double rate = 30, timeout = 0;
+  bool   ascii = false, quiet = false;
+
+  while( (opt=getopt(argc, argv, "b:r:akot:M:Oq"))!=-1 )
+    switch( opt )
+      {
+      case 'b': baud = atoi(optarg); break;
+      case 'r': rate = atof(optarg); break;
+      case 'a': ascii = true; break;
+      case 'k': keys = true; break;
+      case 'o': exit_on_close = true; break;
+      case 't': timeout = atof(optarg); break;
+      case 'M': metrics_file = optarg; break;
+      case 'O': show_stats = true; break;
+      case 'q': quiet = true; break;
+      default:  usage(argv[0]);
+      }
+
+  if( optind!=argc-1 ) usage(argv[0]);
+  connection = argv[optind];
+
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  sigaddset(&sigs, SIGHUP);
+  sigaddset(&sigs, SIGWINCH);
+  sigprocmask(SIG_BLOCK, &sigs, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  int sfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+  reactor.add(sfd, EPOLLIN, signal_event, NULL);
+
+  // no echo of typed keys (they would end up on the screen), Ctrl-C still exits
+  if( isatty(0) && tcgetattr(0, &stdin_termios)==0 )
+    {
+      struct termios tio = stdin_termios;
+      tio.c_lflag &= ~(ICANON | ECHO);
+      tio.c_iflag &= ~ICRNL;
+      tio.c_cc[VMIN] = 1;
+      tio.c_cc[VTIME] = 0;
+      stdin_raw = tcsetattr(0, TCSANOW, &tio)==0;
+      atexit(restore_stdin);
+    }
+  if( keys ) reactor.add(0, EPOLLIN, stdin_event, NULL);
+
+  terminal = new VDM1Terminal(terminal_write, NULL);
+  terminal->set_ascii(ascii);
+  terminal->reset();
+  core.set_surface(terminal);
+  core.set_write_callback(core_write, NULL);
+  core.redraw();
+
+  send_queue = new SendQueue(send_queue_write, NULL);
+  source = new Source(&reactor, connection, baud);
+  metrics = new VDM1Metrics(&core);
+  metrics->set_send_queue(send_queue);
+  metrics->set_connects(&source->num_connects);
+  source->set_data_callback(source_data, NULL);
+  source->set_state_callback(source_state, NULL);
+  source->set_reconnect(!exit_on_close);
+  source->start();
+  show_status();
+  if( !source->connected() && !source->connecting() && exit_on_close )
+    {
+      terminal->finish();
+      return 1;
+    }
+
+  reactor.set_timer(reactor.add_timer(blink_timer, NULL), 0.5, 0.5);
+  if( rate>0 )
+    {
+      pacer = new FramePacer(&reactor, &core);
+      pacer->start(rate);
+    }
+  if( timeout>0 )
+    reactor.set_timer(reactor.add_timer(exit_timer, NULL), timeout);
+  if( metrics_file!=NULL || show_stats )
+    {
+      metrics->set_latency(pacer!=NULL ? &pacer->latency : &source->read_time);
+      metrics->add_counter("vdm1_terminal_bytes_total", "Bytes sent to the terminal", &terminal->num_bytes);
+      metrics_timer(NULL);
+      reactor.set_timer(reactor.add_timer(metrics_timer, NULL), 1, 1);
+    }
+
+  reactor.run();
+  if( metrics_file!=NULL ) metrics->write_file(metrics_file);
+
+  if( pacer!=NULL ) pacer->vsync();
+  terminal->finish();
+  restore_stdin();
+  if( !quiet )
+    fprintf(stderr, "\nreceived %llu bytes, sent %llu bytes to the terminal in %llu frames (%llu cells)\n",
+            (unsigned long long) core.stats.bytes, (unsigned long long) terminal->num_bytes,
+            (unsigned long long) terminal->num_flushes, (unsigned long long) terminal->num_cells);
+
+  // a TCP connection that could not be set up at all is an error
+  int status = exit_on_close && source->num_connects==0 ? 1 : 0;
+
+  delete metrics;
+  delete pacer;
+  delete source;
+  delete send_queue;
+  delete terminal;
+  return status;
+}
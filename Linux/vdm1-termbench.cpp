@@ -0,0 +1,327 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - terminal output benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Bytes sent to a text terminal (vdm1terminal.h) per second for a minute
+// (-d seconds) of simulated sessions, shown at 30 frames per second (-r):
+// - basic:   typing a BASIC program (6 characters per second, the cursor
+//            moving along), then a 40 line listing scrolling by
+// - raiders: an invaders style game, 12 sprites erased and drawn again
+//            one cell further every frame, a few shots
+// - trek:    a Trek-80 style game, a new chart (VDM_FULLFRAME) every 2s
+//            and a few moving ships in between
+// The sessions are protocol data as sent by the simulator (so the
+// decoder's DIP and CR/VT rules apply), compared against the protocol
+// data rate and against redrawing all 16 lines on each changed frame.
+// With -f a captured session (raw protocol data, e.g. saved by "nc host
+// 8800 >file") is replayed instead, at the rate of the -b baud rate.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+
+#include "vdm1proto.h"
+#include "vdm1core.h"
+#include "vdm1terminal.h"
+
+
+static double seconds = 60, fps = 30;
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+// counts the terminal output
+static void count_write(void *ctx, const char *data, int size)
+{
+}
+
+
+// redraws all lines of each changed frame: home, then 16 lines of 64
+// characters each followed by CR/LF, attributes switched where needed
+class FullRedraw : public VDM1Surface
+{
+ public:
+  FullRedraw() : num_bytes(0), m_changed(false) { memset(m_cells, ' ', sizeof(m_cells)); }
+
+  virtual void end_update()
+  {
+    if( !m_changed ) return;
+    m_changed = false;
+
+    bool inverse = false;
+    num_bytes += 3;
+    for(int i=0; i<VDM1_ROWS*VDM1_COLS; i++)
+      {
+        if( ((m_cells[i] & 0x80)!=0)!=inverse ) { inverse = !inverse; num_bytes += inverse ? 4 : 3; }
+        uint8_t ch = m_cells[i] & 0x7f;
+        num_bytes += (ch>=32 && ch<127) ? 1 : 3;
+        if( (i%VDM1_COLS)==VDM1_COLS-1 ) num_bytes += 2;
+      }
+  }
+
+  virtual void draw_char(int row, int col, uint8_t ch, bool inverse)
+  {
+    m_cells[row*VDM1_COLS+col] = (ch & 0x7f) | (inverse ? 0x80 : 0);
+    m_changed = true;
+  }
+
+  virtual void fill(int row, int col, int h, int w, bool inverse)
+  {
+    for(int r=row; r<row+h; r++)
+      memset(m_cells+r*VDM1_COLS+col, ' ' | (inverse ? 0x80 : 0), w);
+    m_changed = true;
+  }
+
+  uint64_t num_bytes;
+
+ private:
+  uint8_t m_cells[VDM1_ROWS*VDM1_COLS];
+  bool    m_changed;
+};
+
+
+// both surfaces behind one core
+class Both : public VDM1Surface
+{
+ public:
+  Both(VDM1Surface *a, VDM1Surface *b) : m_a(a), m_b(b) {}
+  virtual void begin_update() { m_a->begin_update(); m_b->begin_update(); }
+  virtual void end_update() { m_a->end_update(); m_b->end_update(); }
+  virtual void draw_char(int row, int col, uint8_t ch, bool inverse)
+  { m_a->draw_char(row, col, ch, inverse); m_b->draw_char(row, col, ch, inverse); }
+  virtual void fill(int row, int col, int h, int w, bool inverse)
+  { m_a->fill(row, col, h, w, inverse); m_b->fill(row, col, h, w, inverse); }
+
+ private:
+  VDM1Surface *m_a, *m_b;
+};
+
+
+// -----------------------------------------------------------------------------
+// sessions
+// -----------------------------------------------------------------------------
+
+
+enum { SESSION_BASIC, SESSION_RAIDERS, SESSION_TREK, NUM_SESSIONS };
+
+
+static void membyte(std::vector<uint8_t> &out, int addr, uint8_t value)
+{
+  out.push_back(VDM_MEMBYTE | ((addr>>8) & 7));
+  out.push_back(addr & 255);
+  out.push_back(value);
+}
+
+
+static void ctrl(std::vector<uint8_t> &out, uint8_t value)
+{
+  out.push_back(VDM_CTRL);
+  out.push_back(value);
+}
+
+
+// the protocol data of frame n
+static void session(int s, int64_t n, uint32_t &seed, std::vector<uint8_t> &out)
+{
+  int f = (int) (n % (int64_t) fps);
+  double t = n/fps;
+
+  switch( s )
+    {
+    case SESSION_BASIC:
+      {
+        // 30s typing, 10s listing (scrolling with the start row register)
+        static int pos, scroll;
+        if( n==0 ) { pos = 0; scroll = 0; ctrl(out, 0); }
+        double p = t - 40*(int) (t/40);
+        if( p<30 )
+          {
+            if( (f%5)==0 )
+              {
+                int a = (scroll*64 + pos) & 1023;
+                membyte(out, a, (pos%64)==63 ? '\r' : 32 + rand_r(&seed)%95);
+                pos = (pos+1) % 1024;
+                membyte(out, (scroll*64 + pos) & 1023, 0x80 | ' ');
+              }
+          }
+        else if( (f%3)==0 )
+          {
+            scroll = (scroll+1) & 15;
+            int line = ((scroll+15) & 15)*64;
+            int len = 20 + rand_r(&seed)%30;
+            for(int i=0; i<len; i++) membyte(out, line+i, 32 + rand_r(&seed)%95);
+            membyte(out, line+len, '\r');
+            ctrl(out, scroll);
+          }
+        break;
+      }
+
+    case SESSION_RAIDERS:
+      {
+        // a block of 12 sprites moving left and right, erased and drawn again
+        static const char *sprite = "/O\\";
+        int x0 = (int) (n%40), x1 = (int) ((n+1)%40);
+        if( x0>=20 ) x0 = 39-x0;
+        if( x1>=20 ) x1 = 39-x1;
+        if( n==0 )
+          for(int a=0; a<1024; a++) membyte(out, a, a>=15*64 ? '-' : ' ');
+        for(int i=0; i<12; i++)
+          {
+            int a = (2 + 2*(i/4))*64 + x0 + 10*(i%4);
+            for(int k=0; k<3; k++) membyte(out, a+k, ' ');
+            a = (2 + 2*(i/4))*64 + x1 + 10*(i%4);
+            for(int k=0; k<3; k++) membyte(out, a+k, sprite[k]);
+          }
+        // a shot going up
+        int y = 13 - (int) (n%12);
+        int sx = 5 + (int) ((n/12)*7 % 50);
+        if( y<13 ) membyte(out, (y+1)*64+sx, ' ');
+        if( y>0 ) membyte(out, y*64+sx, '|');
+        break;
+      }
+
+    case SESSION_TREK:
+      {
+        // a new chart every 2s, ships moving a few times per second
+        if( n%(int64_t) (2*fps)==0 )
+          {
+            out.push_back(VDM_FULLFRAME);
+            for(int i=0; i<1024; i++)
+              out.push_back((i%64)>=48 ? ' ' : (rand_r(&seed)%8)==0 ? '*' : '.');
+          }
+        else if( (f%8)==0 )
+          for(int i=0; i<3; i++)
+            {
+              int a = (rand_r(&seed)%16)*64 + rand_r(&seed)%48;
+              membyte(out, a, '.');
+              membyte(out, (a+1) & 1023, "<>KE"[rand_r(&seed)%4]);
+            }
+        break;
+      }
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// runs
+// -----------------------------------------------------------------------------
+
+
+static void run(const char *name, int s, const std::vector<uint8_t> *capture, int baud, bool ascii)
+{
+  VDM1Terminal terminal(count_write, NULL);
+  terminal.set_ascii(ascii);
+  FullRedraw full;
+  Both both(&terminal, &full);
+
+  VDM1Core core;
+  core.set_surface(&both);
+  core.set_dip(2+8+32);  // blinking cursor, all characters shown
+  core.set_paced(true);
+  terminal.reset();
+  core.redraw();
+  core.present();
+  uint64_t start_bytes = terminal.num_bytes, start_full = full.num_bytes;
+
+  int64_t frames = (int64_t) (seconds*fps);
+  double bytes_per_frame = baud/10.0/fps, sent = 0;
+  uint64_t proto = 0;
+  uint32_t seed = 1;
+  std::vector<uint8_t> out;
+  double start = now_sec();
+  for(int64_t n=0; n<frames; n++)
+    {
+      out.clear();
+      if( capture!=NULL )
+        {
+          size_t from = (size_t) sent, to = (size_t) (sent += bytes_per_frame);
+          if( from>=capture->size() ) { frames = n; break; }
+          if( to>capture->size() ) to = capture->size();
+          out.assign(capture->begin()+from, capture->begin()+to);
+        }
+      else
+        session(s, n, seed, out);
+
+      if( !out.empty() ) core.receive(out.data(), (int) out.size());
+      proto += out.size();
+      if( (n%(int64_t) fps)==0 || (n%(int64_t) fps)==(int64_t) fps/2 ) core.toggle_blink();
+      core.present();
+    }
+  double elapsed = now_sec()-start, secs = frames/fps;
+
+  uint64_t bytes = terminal.num_bytes-start_bytes, fbytes = full.num_bytes-start_full;
+  printf("%-8s %6.0f %10.0f %10.0f %6.1f%% %10.0f %6.1f%% %8llu %7.2f\n",
+         name, secs, proto/secs, bytes/secs, proto>0 ? 100.0*bytes/proto : 0.0,
+         fbytes/secs, fbytes>0 ? 100.0*bytes/fbytes : 0.0,
+         (unsigned long long) terminal.num_flushes, elapsed*1e6/(frames>0 ? frames : 1));
+  fflush(stdout);
+}
+
+
+int main(int argc, char **argv)
+{
+  const char *fname = NULL;
+  int baud = 1050000, opt;
+  bool ascii = false;
+
+  while( (opt=getopt(argc, argv, "d:r:f:b:a"))!=-1 )
+    switch( opt )
+      {
+      case 'd': seconds = atof(optarg); break;
+      case 'r': fps = atof(optarg); break;
+      case 'f': fname = optarg; break;
+      case 'b': baud = atoi(optarg); break;
+      case 'a': ascii = true; break;
+      default:
+        fprintf(stderr, "usage: %s [-d seconds] [-r fps] [-a] [-f captured session [-b baud]]\n", argv[0]);
+        return 1;
+      }
+  if( fps<1 ) fps = 1;
+
+  printf("%.0f frames per second%s, bytes per second\n", fps, ascii ? ", ASCII" : "");
+  printf("session   secs   protocol   terminal  /proto full redraw  /full   frames us/frame\n");
+  if( fname!=NULL )
+    {
+      FILE *f = fopen(fname, "rb");
+      if( f==NULL ) { perror(fname); return 1; }
+      std::vector<uint8_t> capture;
+      uint8_t buf[65536];
+      size_t n;
+      while( (n=fread(buf, 1, sizeof(buf), f))>0 ) capture.insert(capture.end(), buf, buf+n);
+      fclose(f);
+      seconds = 1e9;
+      run("capture", 0, &capture, baud, ascii);
+    }
+  else
+    {
+      static const char *names[] = {"basic", "raiders", "trek"};
+      for(int s=0; s<NUM_SESSIONS; s++) run(names[s], s, NULL, baud, ascii);
+    }
+
+  return 0;
+}
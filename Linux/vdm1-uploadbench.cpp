@@ -0,0 +1,260 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - upload pacing benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Upload times of programs/ENT files (or the files given) with fixed
+// delays against echo pacing (Common/echopacer.h), with a scripted stand-in
+// for CUTER on the Altair side:
+// - the send queue writes into a socketpair, the stand-in decodes the
+//   keys into an input buffer of -b characters (default 16); characters
+//   arriving while it is full are dropped, like a UART overflow
+// - each character takes it -e microseconds (default 300) and is then
+//   echoed into video memory followed by the cursor, a line end takes -L
+//   microseconds (default 3000) and puts the cursor on the next row
+// - video memory writes are passed to SendQueue::observe_write() as the
+//   display's receive path would
+// Fixed mode uses -c ms per character and -l ms per line (default 1/0,
+// the fastest lossless setting with the defaults), echo pacing no delays.
+// Runs in real time: all six ENT files take about three minutes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "vdm1proto.h"
+#include "sendqueue.h"
+
+
+static int    input_size = 16, char_us = 300, line_us = 3000;
+static int    char_delay = 1, line_delay = 0;
+
+
+static int64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+
+static void sleep_until(int64_t t)
+{
+  struct timespec ts;
+  ts.tv_sec  = t/1000000;
+  ts.tv_nsec = (t%1000000)*1000;
+  while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)==EINTR );
+}
+
+
+// the monitor: input buffer, screen position and counters
+struct StandIn
+{
+  int                   fd;
+  SendQueue            *queue;
+  std::deque<uint8_t>   input;
+  int                   row, col;
+  uint8_t               prev;
+  uint32_t              expected;
+  std::atomic<uint32_t> processed, dropped;
+  std::atomic<bool>     running;
+};
+
+
+static void standin_keys(void *ctx, const uint8_t *keys, int n)
+{
+  StandIn *s = (StandIn *) ctx;
+  for(int i=0; i<n; i++)
+    if( (int) s->input.size()<input_size )
+      s->input.push_back(keys[i]);
+    else
+      s->dropped++;
+}
+
+
+static void screen_write(StandIn *s, int row, int col, uint8_t value)
+{
+  s->queue->observe_write(row*64+col, value);
+}
+
+
+static void standin_thread(StandIn *s)
+{
+  vdm_keydecoder_t d;
+  vdm_keydecoder_init(&d, standin_keys, NULL, s);
+  screen_write(s, s->row, s->col, 0x80|' ');
+
+  while( s->running )
+    {
+      // everything that arrived meanwhile goes into the input buffer (or is lost)
+      uint8_t buf[4096];
+      ssize_t n;
+      while( (n=read(s->fd, buf, sizeof(buf)))>0 ) vdm_keydecoder_feed(&d, buf, (int) n);
+
+      if( s->input.empty() )
+        {
+          struct pollfd p = { s->fd, POLLIN, 0 };
+          poll(&p, 1, 1);
+          continue;
+        }
+
+      uint8_t c = s->input.front();
+      s->input.pop_front();
+      bool line_end = c==13 || (c==10 && s->prev!=13);
+      sleep_until(now_us() + (line_end ? line_us : char_us));
+
+      if( line_end )
+        {
+          // next row, cleared, then the cursor: ready for the next line
+          screen_write(s, s->row, s->col, ' ');
+          s->row = (s->row+1) % 16;
+          s->col = 0;
+          for(int i=1; i<64; i++) screen_write(s, s->row, i, ' ');
+          screen_write(s, s->row, 0, 0x80|' ');
+        }
+      else if( c>=32 && c<127 )
+        {
+          screen_write(s, s->row, s->col, c);
+          if( s->col<63 ) s->col++;
+          screen_write(s, s->row, s->col, 0x80|' ');
+        }
+
+      s->prev = c;
+      s->processed++;
+    }
+}
+
+
+static void queue_write(void *ctx, const uint8_t *data, int size)
+{
+  int fd = *(int *) ctx;
+  while( size>0 )
+    {
+      ssize_t n = write(fd, data, size);
+      if( n<0 && errno==EINTR ) continue;
+      if( n<=0 ) return;
+      data += n;
+      size -= (int) n;
+    }
+}
+
+
+// seconds until the stand-in has taken in all characters (processed or dropped)
+static double upload(const std::vector<uint8_t> &data, bool echo, uint32_t *dropped)
+{
+  int fds[2];
+  if( socketpair(AF_UNIX, SOCK_STREAM, 0, fds)!=0 ) return -1;
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+  StandIn s;
+  s.fd = fds[1];
+  s.row = s.col = 0;
+  s.prev = 0;
+  s.expected = (uint32_t) data.size();
+  s.processed = 0;
+  s.dropped = 0;
+  s.running = true;
+
+  SendQueue *queue = new SendQueue(queue_write, &fds[0]);
+  s.queue = queue;
+  if( echo )
+    {
+      queue->set_pacing(0, 0);
+      queue->set_echo_pacing(true);
+    }
+  else
+    queue->set_pacing(char_delay, line_delay);
+
+  std::thread t(standin_thread, &s);
+  int64_t start = now_us();
+  queue->send_bulk(data.data(), (int) data.size());
+  while( s.processed+s.dropped<s.expected ) usleep(1000);
+  double elapsed = (now_us()-start)/1e6;
+
+  s.running = false;
+  t.join();
+  delete queue;
+  close(fds[0]);
+  close(fds[1]);
+  *dropped = s.dropped;
+  return elapsed;
+}
+
+
+int main(int argc, char **argv)
+{
+  static const char *files[] = {
+    "../programs/ENT/checkers.ent", "../programs/ENT/chess.ent", "../programs/ENT/pattern.ent",
+    "../programs/ENT/raiders.ent", "../programs/ENT/target.ent", "../programs/ENT/trk80.ent", NULL };
+  int opt;
+
+  while( (opt=getopt(argc, argv, "b:e:L:c:l:"))!=-1 )
+    switch( opt )
+      {
+      case 'b': input_size = atoi(optarg); break;
+      case 'e': char_us = atoi(optarg); break;
+      case 'L': line_us = atoi(optarg); break;
+      case 'c': char_delay = atoi(optarg); break;
+      case 'l': line_delay = atoi(optarg); break;
+      default:
+        fprintf(stderr,
+                "usage: %s [-b input buffer] [-e us per character] [-L us per line]\n"
+                "          [-c fixed ms per character] [-l fixed ms per line] [file ...]\n", argv[0]);
+        return 1;
+      }
+
+  std::vector<const char *> names;
+  if( optind<argc )
+    for(int i=optind; i<argc; i++) names.push_back(argv[i]);
+  else
+    for(int i=0; files[i]!=NULL; i++) names.push_back(files[i]);
+
+  printf("input buffer %i, %i us per character, %i us per line\n", input_size, char_us, line_us);
+  printf("%-30s %8s %9s %8s %9s\n", "", "fixed", "dropped", "echo", "dropped");
+  for(size_t f=0; f<names.size(); f++)
+    {
+      FILE *fp = fopen(names[f], "rb");
+      if( fp==NULL )
+        {
+          printf("Unable to open %s: %s\n", names[f], strerror(errno));
+          continue;
+        }
+      std::vector<uint8_t> data;
+      int c;
+      while( (c=fgetc(fp))!=EOF ) data.push_back((uint8_t) c);
+      fclose(fp);
+
+      uint32_t d_fixed, d_echo;
+      double t_fixed = upload(data, false, &d_fixed);
+      double t_echo  = upload(data, true, &d_echo);
+      printf("%-30s %7.1fs %9u %7.1fs %9u\n", names[f], t_fixed, d_fixed, t_echo, d_echo);
+      fflush(stdout);
+    }
+
+  return 0;
+}
@@ -0,0 +1,325 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - X11 display for Linux
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Shows the VDM-1 screen in an X11 window, presented through MIT-SHM
+// shared memory images at a fixed rate (see x11display.h). Keys typed in
+// the window are sent to the simulator.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#include "vdm1core.h"
+#include "vdm1framebuffer.h"
+#include "sendqueue.h"
+#include "reactor.h"
+#include "source.h"
+#include "pacer.h"
+#include "x11display.h"
+#include "vdm1metrics.h"
+
+
+static Reactor         reactor;
+static VDM1Core        core;
+static VDM1Framebuffer framebuffer;
+static X11Display     *display = NULL;
+static SendQueue      *send_queue = NULL;
+static Source         *source = NULL;
+static FramePacer     *pacer = NULL;
+static VDM1Metrics    *metrics = NULL;
+
+static const char *connection;
+static const char *metrics_file = NULL;
+static bool   exit_on_close = false, show_stats = false;
+
+
+static void usage(const char *prg)
+{
+  fprintf(stderr,
+          "usage: %s [options] connection\n"
+          "connection:\n"
+          "  /dev/...      serial port\n"
+          "  pty           create a pseudo terminal for a software Altair emulator\n"
+          "  udp:host[:port] datagrams from vdm1-relay -U (default port 8801)\n"
+          "  host[:port]   TCP connection to the simulator (default port 8800)\n"
+          "options:\n"
+          "  -b baud       serial baud rate (default 1050000)\n"
+          "  -D display    X display (default $DISPLAY)\n"
+          "  -z scale      initial scale factor (default 1, may be fractional)\n"
+          "  -j threads    threads drawing large updates (default 1)\n"
+          "  -r hz         frames per second (default 60, 0 = each change as it arrives)\n"
+          "  -n            no MIT-SHM (always XPutImage)\n"
+          "  -o            exit when the connection is lost (default: reconnect)\n"
+          "  -t seconds    exit after the given time\n"
+          "  -M file       write live metrics (Prometheus text format) to a file every second\n"
+          "  -O            show live statistics in the window title\n"
+          "  -q            do not print statistics when exiting\n",
+          prg);
+  exit(1);
+}
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+static void set_title()
+{
+  char buf[512];
+  int n;
+  if( source->pty_slave()[0]!=0 )
+    n = snprintf(buf, sizeof(buf), "VDM-1 Display (%s)", source->pty_slave());
+  else
+    n = snprintf(buf, sizeof(buf), "VDM-1 Display (%s, %sconnected)", connection, source->connected() ? "" : "not ");
+  if( show_stats && n>0 && n<(int) sizeof(buf) )
+    snprintf(buf+n, sizeof(buf)-n, " - %s", metrics->summary(now_sec()));
+  display->set_title(buf);
+}
+
+
+static void present()
+{
+  display->present();
+
+  // Xlib may have read events while waiting for replies
+  display->events();
+  if( display->closed ) reactor.stop();
+}
+
+
+static void core_write(void *ctx, int addr, uint8_t value)
+{
+  send_queue->observe_write(addr, value);
+}
+
+
+static void send_queue_write(void *ctx, const uint8_t *data, int size)
+{
+  source->write(data, size);
+}
+
+
+static void source_data(void *ctx, const uint8_t *data, int size)
+{
+  core.receive(data, size);
+  if( pacer!=NULL )
+    pacer->data_received();
+  else
+    present();
+}
+
+
+static void source_state(void *ctx, bool connected)
+{
+  if( connected )
+    {
+      core.reset_decoder();
+      send_queue->send_connect();
+    }
+  else if( exit_on_close )
+    reactor.stop();
+
+  set_title();
+}
+
+
+static void pacer_present(void *ctx)
+{
+  present();
+}
+
+
+static void display_key(void *ctx, uint8_t key)
+{
+  send_queue->send_key(key);
+}
+
+
+static void display_resize(void *ctx)
+{
+  // the framebuffer has a new scale
+  core.redraw();
+}
+
+
+static void display_event(void *ctx, int fd, uint32_t events)
+{
+  display->events();
+  if( display->closed ) reactor.stop();
+
+  // cells held back while the server was reading the image, or a redraw after resizing
+  display->present();
+}
+
+
+static void signal_event(void *ctx, int fd, uint32_t events)
+{
+  struct signalfd_siginfo si;
+  while( read(fd, &si, sizeof(si))==sizeof(si) ) reactor.stop();
+}
+
+
+static void blink_timer(void *ctx)
+{
+  core.toggle_blink();
+  if( pacer==NULL ) present();
+}
+
+
+static void metrics_timer(void *ctx)
+{
+  static bool failed = false;
+  if( metrics_file!=NULL )
+    {
+      if( metrics->write_file(metrics_file) )
+        failed = false;
+      else if( !failed )
+        {
+          fprintf(stderr, "Unable to write %s: %s\n", metrics_file, strerror(errno));
+          failed = true;
+        }
+    }
+  if( show_stats ) set_title();
+}
+
+
+static void exit_timer(void *ctx)
+{
+  reactor.stop();
+}
+
+
+int main(int argc, char **argv)
+{
+  int    baud = 1050000, threads = 1, opt;
+  double rate = 60, timeout = 0, scale = 1;
+  bool   shm = true, quiet = false;
+  const char *display_name = NULL;
+
+  while( (opt=getopt(argc, argv, "b:D:z:j:r:not:M:Oq"))!=-1 )
+    switch( opt )
+      {
+      case 'b': baud = atoi(optarg); break;
+      case 'D': display_name = optarg; break;
+      case 'z': scale = atof(optarg); break;
+      case 'j': threads = atoi(optarg); break;
+      case 'r': rate = atof(optarg); break;
+      case 'n': shm = false; break;
+      case 'o': exit_on_close = true; break;
+      case 't': timeout = atof(optarg); break;
+      case 'M': metrics_file = optarg; break;
+      case 'O': show_stats = true; break;
+      case 'q': quiet = true; break;
+      default:  usage(argv[0]);
+      }
+
+  if( optind!=argc-1 ) usage(argv[0]);
+  connection = argv[optind];
+
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  sigaddset(&sigs, SIGHUP);
+  sigprocmask(SIG_BLOCK, &sigs, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  int sfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+  reactor.add(sfd, EPOLLIN, signal_event, NULL);
+
+  framebuffer.set_scale(scale);
+  framebuffer.set_threads(threads);
+  core.set_surface(&framebuffer);
+  core.set_write_callback(core_write, NULL);
+  core.redraw();
+
+  display = new X11Display(&framebuffer);
+  display->set_shm(shm);
+  display->set_key_callback(display_key, NULL);
+  display->set_resize_callback(display_resize, NULL);
+  if( !display->open(display_name, "VDM-1 Display") ) return 1;
+  reactor.add(display->fd(), EPOLLIN, display_event, NULL);
+
+  send_queue = new SendQueue(send_queue_write, NULL);
+  source = new Source(&reactor, connection, baud);
+  metrics = new VDM1Metrics(&core);
+  metrics->set_send_queue(send_queue);
+  metrics->set_connects(&source->num_connects);
+  source->set_data_callback(source_data, NULL);
+  source->set_state_callback(source_state, NULL);
+  source->set_reconnect(!exit_on_close);
+  source->start();
+  set_title();
+  if( !source->connected() && !source->connecting() && exit_on_close ) return 1;
+  if( source->pty_slave()[0]!=0 )
+    {
+      printf("%s\n", source->pty_slave());
+      fflush(stdout);
+    }
+
+  reactor.set_timer(reactor.add_timer(blink_timer, NULL), 0.5, 0.5);
+  if( rate>0 )
+    {
+      pacer = new FramePacer(&reactor, &core);
+      pacer->set_present_callback(pacer_present, NULL);
+      pacer->start(rate);
+    }
+  if( timeout>0 )
+    reactor.set_timer(reactor.add_timer(exit_timer, NULL), timeout);
+  if( metrics_file!=NULL || show_stats )
+    {
+      // with "-r 0" each change is presented as it is read, so the read time is the latency
+      metrics->set_latency(pacer!=NULL ? &pacer->latency : &source->read_time);
+      metrics->add_histogram("vdm1_present_time_us", "Microseconds per present to the X server", &display->present_time);
+      metrics->add_counter("vdm1_present_pixels_total", "Pixels sent to the X server", &display->num_pixels);
+      metrics_timer(NULL);
+      reactor.set_timer(reactor.add_timer(metrics_timer, NULL), 1, 1);
+    }
+
+  present();
+  reactor.run();
+  if( metrics_file!=NULL ) metrics->write_file(metrics_file);
+
+  if( !quiet )
+    {
+      fprintf(stderr, "received %llu bytes\n", (unsigned long long) core.stats.bytes);
+      display->print_stats(stderr);
+      if( pacer!=NULL ) pacer->print_stats(stderr);
+    }
+
+  // a TCP connection that could not be set up at all is an error
+  int status = exit_on_close && source->num_connects==0 ? 1 : 0;
+
+  delete metrics;
+  delete pacer;
+  delete source;
+  delete send_queue;
+  delete display;
+  return status;
+}
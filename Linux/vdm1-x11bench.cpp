@@ -0,0 +1,189 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - X11 present benchmark
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+// Present throughput of the X11 display (x11display.h): frames are made
+// and presented as fast as the X server takes them (each present waits
+// for the server with XSync), -d seconds per run, for
+// - text:    typing and a listing scrolling by every few seconds
+// - sprites: 12 sprites erased and drawn again one cell further each frame
+// - full:    a new random screen each frame (the worst case)
+// through MIT-SHM and XPutImage, at scale 1 and 2 (-z picks one).
+// Needs an X server, e.g. xvfb-run -s "-screen 0 1280x1024x24" vdm1-x11bench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "vdm1core.h"
+#include "vdm1framebuffer.h"
+#include "x11display.h"
+
+
+static double seconds = 3;
+static const char *display_name = NULL;
+
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+enum { LOAD_TEXT, LOAD_SPRITES, LOAD_FULL, NUM_LOADS };
+
+
+// the changes of frame n (30 frames per "second" of simulated time)
+static void frame(VDM1Core &core, int load, int64_t n, uint32_t &seed)
+{
+  int f = (int) (n%30);
+  if( f==0 || f==15 ) core.toggle_blink();
+
+  switch( load )
+    {
+    case LOAD_TEXT:
+      {
+        static int pos = 0;
+        if( (n/30)%4==3 && (f%3)==0 )
+          {
+            uint8_t ctrl = (core.ctrl+1) & 15;
+            int line = ((ctrl+15) & 15)*64;
+            for(int i=0; i<64; i++) core.write_byte(line+i, i<40 ? 32 + rand_r(&seed)%95 : ' ');
+            core.set_ctrl(ctrl);
+          }
+        else if( (f%5)==0 )
+          {
+            core.write_byte(pos, 32 + rand_r(&seed)%95);
+            pos = (pos+1)%1024;
+            core.write_byte(pos, 0x80+' ');
+          }
+        break;
+      }
+
+    case LOAD_SPRITES:
+      {
+        static const char *sprite = "/O\\";
+        int x0 = (int) (n%40), x1 = (int) ((n+1)%40);
+        if( x0>=20 ) x0 = 39-x0;
+        if( x1>=20 ) x1 = 39-x1;
+        for(int i=0; i<12; i++)
+          {
+            int a = (2 + 2*(i/4))*64 + x0 + 10*(i%4);
+            for(int k=0; k<3; k++) core.write_byte(a+k, ' ');
+            a = (2 + 2*(i/4))*64 + x1 + 10*(i%4);
+            for(int k=0; k<3; k++) core.write_byte(a+k, sprite[k]);
+          }
+        break;
+      }
+
+    case LOAD_FULL:
+      {
+        uint8_t mem[1024];
+        for(int i=0; i<1024; i++) mem[i] = 32 + rand_r(&seed)%95;
+        core.write_frame(mem);
+        break;
+      }
+    }
+
+  core.present();
+}
+
+
+static bool run(int load, bool shm, double scale)
+{
+  static const char *loads[] = {"text", "sprites", "full"};
+
+  VDM1Framebuffer framebuffer(scale);
+  VDM1Core core;
+  core.set_surface(&framebuffer);
+  core.set_dip(2+8+32);  // blinking cursor, all characters shown
+  core.set_paced(true);
+  core.redraw();
+  core.present();
+
+  X11Display display(&framebuffer);
+  display.set_shm(shm);
+  if( !display.open(display_name, "vdm1-x11bench") ) return false;
+  if( shm && !display.shm() ) return true;
+
+  // until the window is shown at its size
+  double t0 = now_sec();
+  while( now_sec()-t0<0.5 )
+    {
+      display.sync();
+      display.present();
+      usleep(10000);
+    }
+  display.present_time.reset();
+  uint64_t presents0 = display.num_presents, pixels0 = display.num_pixels;
+
+  uint32_t seed = 1;
+  int64_t n = 0;
+  double start = now_sec();
+  while( now_sec()-start<seconds )
+    {
+      frame(core, load, n++, seed);
+      display.present();
+      display.sync();
+    }
+  double elapsed = now_sec()-start;
+
+  uint64_t presents = display.num_presents-presents0;
+  printf("%-8s %-9s %5.2f  %4ix%-4i %8.0f %9.1f %8.0f %8llu\n", loads[load], shm ? "MIT-SHM" : "XPutImage",
+         scale, framebuffer.width, framebuffer.height, presents/elapsed,
+         (display.num_pixels-pixels0)/elapsed/1e6, display.present_time.mean(),
+         (unsigned long long) display.present_time.percentile(0.99));
+  fflush(stdout);
+  return true;
+}
+
+
+int main(int argc, char **argv)
+{
+  double only_scale = 0;
+  int opt;
+
+  while( (opt=getopt(argc, argv, "d:D:z:"))!=-1 )
+    switch( opt )
+      {
+      case 'd': seconds = atof(optarg); break;
+      case 'D': display_name = optarg; break;
+      case 'z': only_scale = atof(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-d seconds per run] [-D display] [-z scale]\n", argv[0]);
+        return 1;
+      }
+
+  printf("%.0fs per run, each present waits for the X server\n", seconds);
+  printf("load     present   scale  picture   frames/s  Mpix/s  pres us   p99 us\n");
+  static const double scales[] = {1, 2};
+  for(size_t s=0; s<sizeof(scales)/sizeof(scales[0]); s++)
+    {
+      if( only_scale>0 && scales[s]!=only_scale ) continue;
+      for(int load=0; load<NUM_LOADS; load++)
+        for(int shm=1; shm>=0; shm--)
+          if( !run(load, shm==1, scales[s]) ) return 1;
+    }
+
+  return 0;
+}
@@ -0,0 +1,232 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - shared-memory export of the video state (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "vdm1shm.h"
+
+
+#define LOAD_ACQUIRE(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define LOAD_RELAXED(p)     __atomic_load_n((p), __ATOMIC_RELAXED)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define STORE_RELAXED(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+
+
+// -----------------------------------------------------------------------------
+// writer
+// -----------------------------------------------------------------------------
+
+
+bool vdm1shm_create(vdm1shm_writer_t *w, const char *name, int width, int height)
+{
+  // picture starts on its own cache line
+  size_t pixels_offset = (sizeof(vdm1shm_header_t)+63) & ~(size_t) 63;
+
+  snprintf(w->name, sizeof(w->name), "%s", name);
+  w->size = pixels_offset + (size_t) width*height;
+  w->hdr  = NULL;
+
+  shm_unlink(name);
+  w->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if( w->fd<0 || ftruncate(w->fd, w->size)<0 ||
+      (w->hdr=(vdm1shm_header_t *) mmap(NULL, w->size, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0))==MAP_FAILED )
+    {
+      fprintf(stderr, "Unable to create shared memory %s: %s\n", name, strerror(errno));
+      if( w->fd>=0 ) { close(w->fd); shm_unlink(name); }
+      w->fd  = -1;
+      w->hdr = NULL;
+      return false;
+    }
+
+  // (the segment is all zeros, i.e. seq is even and generation 0)
+  w->hdr->version = VDM1SHM_VERSION;
+  w->hdr->width = width;
+  w->hdr->height = height;
+  w->hdr->pixels_offset = (uint32_t) pixels_offset;
+  STORE_RELEASE(&w->hdr->magic, VDM1SHM_MAGIC);
+  return true;
+}
+
+
+void vdm1shm_publish(vdm1shm_writer_t *w, const uint8_t *mem, uint8_t ctrl, uint8_t dip,
+                     bool blink_on, const uint8_t *pixels)
+{
+  vdm1shm_header_t *h = w->hdr;
+  struct timespec ts;
+  uint32_t seq;
+
+  if( h==NULL ) return;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  seq = LOAD_RELAXED(&h->seq);
+  STORE_RELAXED(&h->seq, seq+1);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  memcpy(h->mem, mem, sizeof(h->mem));
+  h->ctrl = ctrl;
+  h->dip = dip;
+  h->blink_on = blink_on;
+  h->time_ns = (uint64_t) ts.tv_sec*1000000000 + ts.tv_nsec;
+  if( pixels!=NULL && h->width>0 )
+    memcpy((uint8_t *) h + h->pixels_offset, pixels, (size_t) h->width*h->height);
+  STORE_RELAXED(&h->generation, h->generation+1);
+
+  STORE_RELEASE(&h->seq, seq+2);
+}
+
+
+void vdm1shm_destroy(vdm1shm_writer_t *w)
+{
+  if( w->hdr!=NULL )
+    {
+      munmap(w->hdr, w->size);
+      close(w->fd);
+      shm_unlink(w->name);
+      w->hdr = NULL;
+      w->fd = -1;
+    }
+}
+
+
+// -----------------------------------------------------------------------------
+// reader
+// -----------------------------------------------------------------------------
+
+
+bool vdm1shm_open(vdm1shm_reader_t *r, const char *name)
+{
+  struct stat st;
+
+  r->hdr = NULL;
+  r->retries = 0;
+  r->fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+  if( r->fd<0 || fstat(r->fd, &st)<0 || (size_t) st.st_size<sizeof(vdm1shm_header_t) ||
+      (r->hdr=(const vdm1shm_header_t *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, r->fd, 0))==MAP_FAILED )
+    {
+      fprintf(stderr, "Unable to open shared memory %s: %s\n", name, r->fd<0 ? strerror(errno) : "invalid segment");
+      if( r->fd>=0 ) close(r->fd);
+      r->fd  = -1;
+      r->hdr = NULL;
+      return false;
+    }
+
+  r->size = st.st_size;
+  if( LOAD_ACQUIRE(&r->hdr->magic)!=VDM1SHM_MAGIC || r->hdr->version!=VDM1SHM_VERSION ||
+      r->hdr->pixels_offset + (size_t) r->hdr->width*r->hdr->height > r->size )
+    {
+      fprintf(stderr, "Shared memory %s is not a VDM-1 display (version %i)\n", name, VDM1SHM_VERSION);
+      vdm1shm_close(r);
+      return false;
+    }
+
+  return true;
+}
+
+
+void vdm1shm_close(vdm1shm_reader_t *r)
+{
+  if( r->hdr!=NULL )
+    {
+      munmap((void *) r->hdr, r->size);
+      close(r->fd);
+      r->hdr = NULL;
+      r->fd = -1;
+    }
+}
+
+
+uint32_t vdm1shm_generation(vdm1shm_reader_t *r)
+{
+  return LOAD_ACQUIRE(&r->hdr->generation);
+}
+
+
+// waits for an even sequence number (writer not busy) and returns it
+static inline uint32_t read_begin(vdm1shm_reader_t *r)
+{
+  uint32_t seq;
+  int spins = 0;
+
+  // publishing takes microseconds, but if the writer was preempted in the
+  // middle (or shares the CPU with us) spinning only delays it further
+  while( (seq=LOAD_ACQUIRE(&r->hdr->seq)) & 1 )
+    if( ++spins>=100 )
+      {
+        sched_yield();
+        spins = 0;
+      }
+
+  return seq;
+}
+
+
+// returns true if the data copied since read_begin() is consistent
+static inline bool read_end(vdm1shm_reader_t *r, uint32_t seq)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if( LOAD_RELAXED(&r->hdr->seq)==seq ) return true;
+  r->retries++;
+  return false;
+}
+
+
+uint32_t vdm1shm_read(vdm1shm_reader_t *r, uint8_t *mem, uint8_t *ctrl, uint8_t *dip)
+{
+  const vdm1shm_header_t *h = r->hdr;
+  uint32_t seq, generation;
+  uint8_t  c, d;
+
+  do
+    {
+      seq = read_begin(r);
+      memcpy(mem, h->mem, sizeof(h->mem));
+      c = h->ctrl;
+      d = h->dip;
+      generation = h->generation;
+    }
+  while( !read_end(r, seq) );
+
+  if( ctrl!=NULL ) *ctrl = c;
+  if( dip!=NULL )  *dip  = d;
+  return generation;
+}
+
+
+uint32_t vdm1shm_read_pixels(vdm1shm_reader_t *r, uint8_t *pixels)
+{
+  const vdm1shm_header_t *h = r->hdr;
+  uint32_t seq, generation;
+
+  do
+    {
+      seq = read_begin(r);
+      memcpy(pixels, (const uint8_t *) h + h->pixels_offset, (size_t) h->width*h->height);
+      generation = h->generation;
+    }
+  while( !read_end(r, seq) );
+
+  return generation;
+}
@@ -0,0 +1,110 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - shared-memory export of the video state (Linux)
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef VDM1SHM_H
+#define VDM1SHM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// The display publishes its state in a POSIX shared memory segment
+// (shm_open name, e.g. "/vdm1") so any number of local processes can
+// watch the screen without copying it through pipes or the clipboard.
+//
+// The segment starts with a vdm1shm_header_t, followed by the rendered
+// picture (one byte per pixel, 0 = background, 1 = foreground, or 0-255
+// if the display was started with a fractional scale or the CRT look)
+// if the display renders one. Everything is protected by a sequence lock: "seq"
+// is odd while the writer changes the segment, a reader copies what it
+// needs and starts over if "seq" changed in the meantime. Readers never
+// make system calls and never hold up the writer.
+
+#define VDM1SHM_MAGIC   0x314d4456  // "VDM1"
+#define VDM1SHM_VERSION 1
+
+typedef struct
+{
+  uint32_t magic, version;
+  uint32_t seq;            // sequence lock, odd while being written
+  uint32_t generation;     // number of published changes
+  uint64_t time_ns;        // CLOCK_MONOTONIC time of the last change
+  uint8_t  ctrl, dip;      // see VDM1Core
+  uint8_t  blink_on;       // cursor characters currently shown inverted (if blinking)
+  uint8_t  reserved;
+  uint32_t width, height;  // size of the picture in pixels (0 if none)
+  uint32_t pixels_offset;  // offset of the picture from the start of the segment
+  uint8_t  mem[1024];      // video memory
+} vdm1shm_header_t;
+
+
+// writer side (the display)
+typedef struct
+{
+  char              name[64];
+  int               fd;
+  size_t            size;
+  vdm1shm_header_t *hdr;
+} vdm1shm_writer_t;
+
+// creates (or replaces) the segment, width/height 0 = no picture
+bool vdm1shm_create(vdm1shm_writer_t *w, const char *name, int width, int height);
+
+// publishes a new state, "pixels" may be NULL if the picture did not change
+void vdm1shm_publish(vdm1shm_writer_t *w, const uint8_t *mem, uint8_t ctrl, uint8_t dip,
+                     bool blink_on, const uint8_t *pixels);
+
+// unmaps and removes the segment
+void vdm1shm_destroy(vdm1shm_writer_t *w);
+
+
+// reader side
+typedef struct
+{
+  int                     fd;
+  size_t                  size;
+  const vdm1shm_header_t *hdr;
+  uint64_t                retries;  // copies repeated because the writer was busy
+} vdm1shm_reader_t;
+
+bool vdm1shm_open(vdm1shm_reader_t *r, const char *name);
+void vdm1shm_close(vdm1shm_reader_t *r);
+
+// current generation, cheap enough to poll
+uint32_t vdm1shm_generation(vdm1shm_reader_t *r);
+
+// consistent copy of video memory (1024 bytes), control register and DIP
+// switches (ctrl/dip may be NULL), returns the generation of the copy
+uint32_t vdm1shm_read(vdm1shm_reader_t *r, uint8_t *mem, uint8_t *ctrl, uint8_t *dip);
+
+// consistent copy of the picture (width*height bytes, see the header),
+// returns the generation of the copy
+uint32_t vdm1shm_read_pixels(vdm1shm_reader_t *r, uint8_t *pixels);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,554 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - X11 window with MIT-SHM presentation
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/keysym.h>
+#include <X11/Xatom.h>
+#include <vector>
+#include "x11display.h"
+
+
+static int64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+
+// XShmAttach fails asynchronously (e.g. BadAccess for a remote display)
+static bool x_error = false;
+static int x_error_handler(Display *dpy, XErrorEvent *ev)
+{
+  x_error = true;
+  return 0;
+}
+
+
+// an 8 bit color component as pixel value for the given mask
+static uint32_t component(uint32_t value, unsigned long mask)
+{
+  if( mask==0 ) return 0;
+  int shift = __builtin_ctzl(mask), bits = __builtin_popcountl(mask);
+  return (uint32_t) (((unsigned long) (value >> (8-bits)) << shift) & mask);
+}
+
+
+X11Display::X11Display(VDM1Framebuffer *fb) :
+  present_time("X11 present time", "us")
+{
+  m_fb = fb;
+  m_dpy = NULL;
+  m_win = 0;
+  m_gc = 0;
+  m_visual = NULL;
+  m_depth = 0;
+  m_image = NULL;
+  m_shm = m_shm_wanted = true;
+  m_shm_pending = 0;
+  m_shm_completion = -1;
+  m_width = m_height = m_left = m_top = 0;
+  m_fg = 0x00FF00;
+  m_bg = 0x000000;
+  m_levels = -1;
+  m_last_click = 0;
+  m_key_func = NULL;
+  m_key_ctx = NULL;
+  m_resize_func = NULL;
+  m_resize_ctx = NULL;
+  closed = false;
+  num_presents = num_deferred = num_rects = num_pixels = 0;
+}
+
+
+X11Display::~X11Display()
+{
+  if( m_dpy==NULL ) return;
+  destroy_image();
+  if( m_gc!=0 ) XFreeGC(m_dpy, m_gc);
+  if( m_win!=0 ) XDestroyWindow(m_dpy, m_win);
+  XCloseDisplay(m_dpy);
+}
+
+
+void X11Display::set_shm(bool shm)
+{
+  m_shm_wanted = shm;
+}
+
+
+void X11Display::set_colors(uint32_t fg, uint32_t bg)
+{
+  m_fg = fg;
+  m_bg = bg;
+  m_levels = -1;
+}
+
+
+void X11Display::set_key_callback(key_func f, void *ctx)
+{
+  m_key_func = f;
+  m_key_ctx = ctx;
+}
+
+
+void X11Display::set_resize_callback(resize_func f, void *ctx)
+{
+  m_resize_func = f;
+  m_resize_ctx = ctx;
+}
+
+
+bool X11Display::open(const char *display, const char *title)
+{
+  m_dpy = XOpenDisplay(display);
+  if( m_dpy==NULL )
+    {
+      fprintf(stderr, "Unable to open display %s\n", XDisplayName(display));
+      return false;
+    }
+
+  int screen = DefaultScreen(m_dpy);
+  XVisualInfo vi;
+  if( !XMatchVisualInfo(m_dpy, screen, 24, TrueColor, &vi) &&
+      !XMatchVisualInfo(m_dpy, screen, 16, TrueColor, &vi) )
+    {
+      fprintf(stderr, "Display %s has no 16 or 24 bit TrueColor visual\n", XDisplayName(display));
+      return false;
+    }
+  m_visual = vi.visual;
+  m_depth = vi.depth;
+
+  // no background: the whole window is always drawn from the image
+  XSetWindowAttributes attr;
+  Window root = RootWindow(m_dpy, screen);
+  attr.colormap = XCreateColormap(m_dpy, root, m_visual, AllocNone);
+  attr.background_pixmap = None;
+  attr.border_pixel = 0;
+  attr.event_mask = ExposureMask | KeyPressMask | ButtonPressMask | StructureNotifyMask;
+  m_win = XCreateWindow(m_dpy, root, 0, 0, m_fb->width, m_fb->height, 0, m_depth, InputOutput, m_visual,
+                        CWColormap | CWBackPixmap | CWBorderPixel | CWEventMask, &attr);
+  m_gc = XCreateGC(m_dpy, m_win, 0, NULL);
+
+  XSizeHints hints;
+  hints.flags = PMinSize;
+  hints.min_width = VDM1_HPIX;
+  hints.min_height = VDM1_VPIX;
+  XSetWMNormalHints(m_dpy, m_win, &hints);
+  m_wm_delete = XInternAtom(m_dpy, "WM_DELETE_WINDOW", False);
+  m_wm_state = XInternAtom(m_dpy, "_NET_WM_STATE", False);
+  m_wm_fullscreen = XInternAtom(m_dpy, "_NET_WM_STATE_FULLSCREEN", False);
+  XSetWMProtocols(m_dpy, m_win, &m_wm_delete, 1);
+  set_title(title);
+
+  m_shm = m_shm_wanted && XShmQueryExtension(m_dpy);
+  if( m_shm ) m_shm_completion = XShmGetEventBase(m_dpy) + ShmCompletion;
+  if( !create_image(m_fb->width, m_fb->height) ) return false;
+
+  XMapWindow(m_dpy, m_win);
+  XFlush(m_dpy);
+  return true;
+}
+
+
+void X11Display::set_title(const char *title)
+{
+  XStoreName(m_dpy, m_win, title);
+  XFlush(m_dpy);
+}
+
+
+int X11Display::fd() const
+{
+  return ConnectionNumber(m_dpy);
+}
+
+
+void X11Display::toggle_fullscreen()
+{
+  // ask the window manager (_NET_WM_STATE_TOGGLE)
+  XEvent ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.xclient.type = ClientMessage;
+  ev.xclient.window = m_win;
+  ev.xclient.message_type = m_wm_state;
+  ev.xclient.format = 32;
+  ev.xclient.data.l[0] = 2;
+  ev.xclient.data.l[1] = m_wm_fullscreen;
+  ev.xclient.data.l[3] = 1;
+  XSendEvent(m_dpy, DefaultRootWindow(m_dpy), False, SubstructureRedirectMask | SubstructureNotifyMask, &ev);
+  XFlush(m_dpy);
+}
+
+
+// -----------------------------------------------------------------------------
+// image
+// -----------------------------------------------------------------------------
+
+
+bool X11Display::create_image(int width, int height)
+{
+  if( m_shm )
+    {
+      m_image = XShmCreateImage(m_dpy, m_visual, m_depth, ZPixmap, NULL, &m_shminfo, width, height);
+      m_shminfo.shmid = -1;
+      m_shminfo.shmaddr = (char *) -1;
+      if( m_image!=NULL )
+        m_shminfo.shmid = shmget(IPC_PRIVATE, m_image->bytes_per_line*height, IPC_CREAT | 0600);
+      if( m_shminfo.shmid>=0 )
+        m_shminfo.shmaddr = (char *) shmat(m_shminfo.shmid, NULL, 0);
+
+      if( m_shminfo.shmaddr!=(char *) -1 )
+        {
+          m_image->data = m_shminfo.shmaddr;
+          m_shminfo.readOnly = True;
+
+          x_error = false;
+          XErrorHandler old = XSetErrorHandler(x_error_handler);
+          XShmAttach(m_dpy, &m_shminfo);
+          XSync(m_dpy, False);
+          XSetErrorHandler(old);
+        }
+
+      // gone as soon as both sides have detached
+      if( m_shminfo.shmid>=0 ) shmctl(m_shminfo.shmid, IPC_RMID, NULL);
+
+      if( m_shminfo.shmaddr==(char *) -1 || x_error )
+        {
+          fprintf(stderr, "MIT-SHM not usable, using XPutImage\n");
+          if( m_shminfo.shmaddr!=(char *) -1 ) shmdt(m_shminfo.shmaddr);
+          if( m_image!=NULL ) { m_image->data = NULL; XDestroyImage(m_image); }
+          m_image = NULL;
+          m_shm = false;
+        }
+    }
+
+  if( !m_shm )
+    {
+      m_image = XCreateImage(m_dpy, m_visual, m_depth, ZPixmap, 0, NULL, width, height, 32, 0);
+      if( m_image!=NULL ) m_image->data = (char *) malloc(m_image->bytes_per_line*height);
+    }
+
+  if( m_image==NULL || m_image->data==NULL )
+    {
+      fprintf(stderr, "Unable to create a %ix%i image\n", width, height);
+      return false;
+    }
+  if( m_image->bits_per_pixel!=16 && m_image->bits_per_pixel!=32 )
+    {
+      fprintf(stderr, "Unsupported image format (%i bits per pixel)\n", m_image->bits_per_pixel);
+      destroy_image();
+      return false;
+    }
+
+  m_width = width;
+  m_height = height;
+  m_left = (width-m_fb->width)/2;
+  m_top = (height-m_fb->height)/2;
+  clear_image();
+  memset(m_fb->dirty, 1, sizeof(m_fb->dirty));
+  return true;
+}
+
+
+void X11Display::destroy_image()
+{
+  if( m_image==NULL ) return;
+
+  if( m_shm )
+    {
+      // the server is done with it after XSync, completions still queued
+      // for it are ignored in events()
+      XShmDetach(m_dpy, &m_shminfo);
+      XSync(m_dpy, False);
+      m_shm_pending = 0;
+      m_image->data = NULL;
+      XDestroyImage(m_image);
+      shmdt(m_shminfo.shmaddr);
+    }
+  else
+    XDestroyImage(m_image);
+
+  m_image = NULL;
+}
+
+
+void X11Display::set_levels()
+{
+  // levels in between blend background and foreground
+  int max = m_fb->max_value;
+  for(int v=0; v<256; v++)
+    {
+      uint32_t p = 0;
+      for(int i=0; i<3; i++)
+        {
+          int b = (m_bg >> (16-8*i)) & 255, f = (m_fg >> (16-8*i)) & 255;
+          int c = v<=max ? b + (f-b)*v/max : f;
+          p |= component(c, i==0 ? m_visual->red_mask : i==1 ? m_visual->green_mask : m_visual->blue_mask);
+        }
+      m_pixel[v] = p;
+    }
+
+  m_levels = max;
+}
+
+
+void X11Display::clear_image()
+{
+  if( m_levels!=m_fb->max_value ) set_levels();
+  for(int y=0; y<m_height; y++)
+    for(int x=0; x<m_width; x++)
+      XPutPixel(m_image, x, y, m_pixel[0]);
+}
+
+
+// framebuffer pixels of the rectangle to the image
+void X11Display::convert(int x, int y, int w, int h)
+{
+  for(int r=y; r<y+h; r++)
+    {
+      const uint8_t *src = m_fb->pixels + r*m_fb->width + x;
+      char *dst = m_image->data + (m_top+r)*m_image->bytes_per_line;
+      if( m_image->bits_per_pixel==32 )
+        {
+          uint32_t *d = (uint32_t *) dst + m_left + x;
+          for(int i=0; i<w; i++) d[i] = m_pixel[src[i]];
+        }
+      else
+        {
+          uint16_t *d = (uint16_t *) dst + m_left + x;
+          for(int i=0; i<w; i++) d[i] = (uint16_t) m_pixel[src[i]];
+        }
+    }
+}
+
+
+// image rectangle (window coordinates) to the window
+void X11Display::put(int x, int y, int w, int h)
+{
+  if( m_shm )
+    {
+      XShmPutImage(m_dpy, m_win, m_gc, m_image, x, y, x, y, w, h, True);
+      m_shm_pending++;
+    }
+  else
+    XPutImage(m_dpy, m_win, m_gc, m_image, x, y, x, y, w, h);
+
+  num_rects++;
+  num_pixels += w*h;
+}
+
+
+// -----------------------------------------------------------------------------
+// presenting
+// -----------------------------------------------------------------------------
+
+
+void X11Display::present()
+{
+  if( m_image==NULL ) return;
+
+  // the server may still be reading the image
+  if( m_shm_pending>0 )
+    {
+      events();
+      if( m_shm_pending>0 )
+        {
+          num_deferred++;
+          return;
+        }
+    }
+
+  int64_t t = now_us();
+  if( m_levels!=m_fb->max_value ) set_levels();
+
+  // runs of dirty cells in each row, merged with the same run in the row above
+  struct run { int row, col, rows, cols; };
+  std::vector<run> runs;
+  size_t above = 0;
+  for(int r=0; r<VDM1_ROWS; r++)
+    {
+      size_t start = runs.size();
+      uint8_t *d = m_fb->dirty + r*VDM1_COLS;
+      for(int c=0; c<VDM1_COLS; c++)
+        if( d[c] )
+          {
+            int n = 1;
+            while( c+n<VDM1_COLS && d[c+n] ) n++;
+
+            size_t i;
+            for(i=above; i<start; i++)
+              if( runs[i].col==c && runs[i].cols==n && runs[i].row+runs[i].rows==r ) break;
+            if( i<start )
+              {
+                // moves down to this row
+                run m = runs[i];
+                m.rows++;
+                runs.erase(runs.begin()+i);
+                runs.push_back(m);
+                start--;
+              }
+            else
+              {
+                run m = {r, c, 1, n};
+                runs.push_back(m);
+              }
+
+            memset(d+c, 0, n);
+            c += n-1;
+          }
+      above = start;
+    }
+
+  if( runs.empty() ) return;
+
+  for(size_t i=0; i<runs.size(); i++)
+    {
+      int x = runs[i].col*m_fb->cell_w, y = runs[i].row*m_fb->cell_h;
+      int w = runs[i].cols*m_fb->cell_w, h = runs[i].rows*m_fb->cell_h;
+      convert(x, y, w, h);
+      put(m_left+x, m_top+y, w, h);
+    }
+
+  XFlush(m_dpy);
+  num_presents++;
+  present_time.add(now_us()-t);
+}
+
+
+void X11Display::sync()
+{
+  XSync(m_dpy, False);
+  events();
+}
+
+
+// -----------------------------------------------------------------------------
+// events
+// -----------------------------------------------------------------------------
+
+
+void X11Display::events()
+{
+  while( XPending(m_dpy)>0 )
+    {
+      XEvent ev;
+      XNextEvent(m_dpy, &ev);
+      if( ev.type==m_shm_completion )
+        {
+          if( m_image!=NULL && ((XShmCompletionEvent *) &ev)->shmseg==m_shminfo.shmseg && m_shm_pending>0 )
+            m_shm_pending--;
+          continue;
+        }
+
+      switch( ev.type )
+        {
+        case Expose:
+          if( m_image!=NULL ) put(ev.xexpose.x, ev.xexpose.y, ev.xexpose.width, ev.xexpose.height);
+          if( ev.xexpose.count==0 ) XFlush(m_dpy);
+          break;
+
+        case ConfigureNotify:
+          resize(ev.xconfigure.width, ev.xconfigure.height);
+          break;
+
+        case KeyPress:
+          key(&ev.xkey);
+          break;
+
+        case ButtonPress:
+          button(&ev.xbutton);
+          break;
+
+        case ClientMessage:
+          if( (Atom) ev.xclient.data.l[0]==m_wm_delete ) closed = true;
+          break;
+        }
+    }
+}
+
+
+void X11Display::resize(int width, int height)
+{
+  if( width==m_width && height==m_height ) return;
+
+  // the largest scale that fits (the framebuffer rounds cells down to whole pixels)
+  double sx = (double) width/VDM1_HPIX, sy = (double) height/VDM1_VPIX;
+  double scale = sx<sy ? sx : sy;
+  if( scale<1 ) scale = 1;
+  bool rescale = (int) (VDM1_CHAR_W*scale+1e-6)!=m_fb->cell_w || (int) (VDM1_CHAR_H*scale+1e-6)!=m_fb->cell_h;
+  if( rescale ) m_fb->set_scale(scale);
+
+  destroy_image();
+  if( !create_image(width, height) )
+    {
+      closed = true;
+      return;
+    }
+
+  // the whole window is exposed now, the picture follows with the next present
+  if( rescale && m_resize_func!=NULL ) m_resize_func(m_resize_ctx);
+}
+
+
+void X11Display::key(XKeyEvent *ev)
+{
+  char buf[8];
+  KeySym sym;
+  int n = XLookupString(ev, buf, sizeof(buf), &sym, NULL);
+
+  if( (ev->state & ControlMask) && (ev->state & Mod1Mask) && (sym==XK_f || sym==XK_F) )
+    toggle_fullscreen();
+  else if( m_key_func==NULL )
+    return;
+  else if( sym==XK_Insert || sym==XK_KP_Insert )
+    m_key_func(m_key_ctx, 0x80);
+  else if( sym==XK_Delete || sym==XK_KP_Delete )
+    m_key_func(m_key_ctx, 0x7f);
+  else if( n==1 )
+    m_key_func(m_key_ctx, (uint8_t) buf[0]);
+}
+
+
+void X11Display::button(XButtonEvent *ev)
+{
+  if( ev->button!=Button1 ) return;
+
+  // double click
+  if( m_last_click!=0 && ev->time-m_last_click<400 )
+    {
+      toggle_fullscreen();
+      m_last_click = 0;
+    }
+  else
+    m_last_click = ev->time;
+}
+
+
+void X11Display::print_stats(FILE *f)
+{
+  fprintf(f, "X11: %s, %llu presents (%llu deferred), %llu rectangles, %.1f Mpixels\n",
+          m_shm ? "MIT-SHM" : "XPutImage", (unsigned long long) num_presents,
+          (unsigned long long) num_deferred, (unsigned long long) num_rects, num_pixels/1e6);
+  present_time.print(f);
+}
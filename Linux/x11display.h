@@ -0,0 +1,130 @@
+// -----------------------------------------------------------------------------
+// Processor Technology VDM-1 emulation - X11 window with MIT-SHM presentation
+// Copyright (C) 2018 David Hansel
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// -----------------------------------------------------------------------------
+
+#ifndef X11DISPLAY_H
+#define X11DISPLAY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include "vdm1framebuffer.h"
+#include "histogram.h"
+
+
+// Shows a VDM1Framebuffer in an X11 window.
+// - the window's picture is an XImage in shared memory (MIT-SHM), so the
+//   X server reads it directly instead of getting it through the socket.
+//   Without MIT-SHM (e.g. a remote display) it falls back to XPutImage.
+// - present() only converts and sends the cells drawn since the last
+//   present (the framebuffer's dirty flags): runs of dirty cells in a row,
+//   merged with the same run in the row above. While the X server has not
+//   finished reading the last shared image (XShmCompletionEvent) nothing
+//   is changed in it, the cells stay dirty for the next present.
+// - the picture is scaled to fit the window (like the Windows display),
+//   the resize callback then has to redraw the framebuffer.
+// - keys are passed to the key callback like the Windows display's
+//   WM_CHAR/WM_KEYDOWN: the character typed, Insert = 0x80, Delete = 0x7f.
+//   Ctrl+Alt+F and a double click toggle full screen (as in Windows).
+class X11Display
+{
+ public:
+  typedef void (*key_func)(void *ctx, uint8_t key);
+  typedef void (*resize_func)(void *ctx);
+
+  X11Display(VDM1Framebuffer *fb);
+  ~X11Display();
+
+  // open a window on the display (NULL = $DISPLAY), false on error
+  bool open(const char *display, const char *title);
+
+  // use shared memory if the server can (default true), before open()
+  void set_shm(bool shm);
+  bool shm() const { return m_shm; }
+
+  // colors of background and foreground (0xRRGGBB), before open()
+  void set_colors(uint32_t fg, uint32_t bg);
+
+  void set_key_callback(key_func f, void *ctx);
+  void set_resize_callback(resize_func f, void *ctx);
+
+  void set_title(const char *title);
+  void toggle_fullscreen();
+
+  // the X connection's socket, call events() when it is readable
+  int  fd() const;
+  void events();
+
+  // show the cells drawn since the last present()
+  void present();
+
+  // wait until the X server has shown everything
+  void sync();
+
+  // the window was closed
+  bool closed;
+
+  void print_stats(FILE *f);
+
+  // statistics
+  uint64_t  num_presents, num_deferred; // presents, presents put off by an unfinished one
+  uint64_t  num_rects, num_pixels;      // rectangles and pixels sent
+  Histogram present_time;               // microseconds per present()
+
+ private:
+  bool create_image(int width, int height);
+  void destroy_image();
+  void clear_image();
+  void put(int x, int y, int w, int h);
+  void convert(int x, int y, int w, int h);
+  void resize(int width, int height);
+  void set_levels();
+  void key(XKeyEvent *ev);
+  void button(XButtonEvent *ev);
+
+  VDM1Framebuffer *m_fb;
+  Display   *m_dpy;
+  Window     m_win;
+  GC         m_gc;
+  Visual    *m_visual;
+  int        m_depth;
+  Atom       m_wm_delete, m_wm_state, m_wm_fullscreen;
+  int        m_shm_completion;
+
+  XImage         *m_image;
+  XShmSegmentInfo m_shminfo;
+  bool            m_shm, m_shm_wanted;
+  int             m_shm_pending;    // XShmPutImage calls not completed yet
+
+  int        m_width, m_height;     // of the window (and image)
+  int        m_left, m_top;         // of the picture in the window
+  uint32_t   m_fg, m_bg;
+  uint32_t   m_pixel[256];          // pixel values for the framebuffer's levels
+  int        m_levels;              // max_value m_pixel was computed for
+  Time       m_last_click;
+
+  key_func    m_key_func;
+  void       *m_key_ctx;
+  resize_func m_resize_func;
+  void       *m_resize_ctx;
+};
+
+
+#endif
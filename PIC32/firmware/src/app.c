@@ -21,6 +21,8 @@
 #include "app.h"
 #include "vdm1.h"
 #include "keyboard.h"
+#include "ringbuffer.h"
+#include "vdm1proto.h"
 #include "peripheral/tmr/plib_tmr.h"
 #include "peripheral/osc/plib_osc.h"
 #include "peripheral/ports/plib_ports.h"
@@ -50,15 +52,13 @@
 
 
 
-// vdm1 commands received from the Altair simulator
-#define VDM_MEMBYTE   0x10
-#define VDM_FULLFRAME 0x20
-#define VDM_CTRL      0x30
-#define VDM_DIP       0x40
+// Set to 1 to send keys that were typed while the previous transfer was
+// still going as one VDM_KEYS block. Requires an Altair Simulator firmware
+// that understands VDM_KEYS.
+#define USE_KEY_BLOCKS 0
 
-// vdm1 commands sent to the Altair simulator
-#define VDM_CONNECT   0x10
-#define VDM_KEY       0x30
+// maximum number of keys sent in one transfer
+#define MAX_KEYS 16
 
 // receiver states
 #define ST_IDLE      0
@@ -68,6 +68,10 @@
 #define ST_DIP       4
 #define ST_FULLFRAME 5
 
+// frame sync: if changes have been held back for this long (microseconds)
+// then the sender stopped sending VDM_ENDFRAME
+#define FRAME_TIMEOUT 50000
+
 
 uint32_t micros()
 {
@@ -75,6 +79,18 @@ uint32_t micros()
 }
 
 
+static int get_keys(uint8_t *keys, int max)
+{
+  int n = 0;
+  uint16_t key;
+
+  while( n<max && (key=keyboard_get_key())<0x100 )
+    keys[n++] = key;
+
+  return n;
+}
+
+
 void delayMicros(uint32_t t)
 {
   uint32_t start = micros();
@@ -110,6 +126,48 @@ void blink(bool activity)
 // -----------------------------------------------------------------------------
 
 
+// Frame sync: after a VDM_ENDFRAME command all changes go to a copy of
+// the video state which is copied to the real one on the next VDM_ENDFRAME.
+// Copying 1k takes a few microseconds so the video interrupt shows either
+// the old or the new frame on (almost) every row, never a half-drawn sprite.
+static bool     frame_sync = false, frame_pending = false;
+static uint32_t frame_start;
+static uint8_t  frame_memory[16*64], frame_ctrl, frame_dip;
+
+
+static void frame_present()
+{
+  if( frame_pending )
+    {
+      memcpy(vdm1_memory, frame_memory, sizeof(frame_memory));
+      vdm1_ctrl = frame_ctrl;
+      if( frame_dip!=vdm1_get_dip() ) vdm1_set_dip(frame_dip);
+      frame_pending = false;
+    }
+}
+
+
+static void frame_changed()
+{
+  if( !frame_pending )
+    {
+      frame_pending = true;
+      frame_start = micros();
+    }
+}
+
+
+static void frame_tasks()
+{
+  // leave frame sync mode if the sender stopped sending VDM_ENDFRAME
+  if( frame_pending && micros()-frame_start > FRAME_TIMEOUT )
+    {
+      frame_present();
+      frame_sync = false;
+    }
+}
+
+
 void vdm1_receive(uint8_t data)
 {
   static int state = ST_IDLE, addr, cnt;
@@ -139,6 +197,19 @@ void vdm1_receive(uint8_t data)
             addr  = 0;
             cnt   = 1024;
             break;
+
+          case VDM_ENDFRAME:
+            if( frame_sync )
+              frame_present();
+            else
+              {
+                // from now on changes are held back until VDM_ENDFRAME
+                memcpy(frame_memory, vdm1_memory, sizeof(frame_memory));
+                frame_ctrl = vdm1_ctrl;
+                frame_dip  = vdm1_get_dip();
+                frame_sync = true;
+              }
+            break;
           }
         break;
       }
@@ -149,22 +220,34 @@ void vdm1_receive(uint8_t data)
       break;
 
     case ST_MEMBYTE2:
-      vdm1_memory[addr] = data;
+      if( frame_sync )
+        { frame_memory[addr & 0x3ff] = data; frame_changed(); }
+      else
+        vdm1_memory[addr] = data;
       state = ST_IDLE;
       break;
 
     case ST_CTRL:
-      vdm1_ctrl = data;
+      if( frame_sync )
+        { frame_ctrl = data; frame_changed(); }
+      else
+        vdm1_ctrl = data;
       state = ST_IDLE;
       break;
 
     case ST_DIP:
-      vdm1_set_dip(data);
+      if( frame_sync )
+        { frame_dip = data; frame_changed(); }
+      else
+        vdm1_set_dip(data);
       state = ST_IDLE;
       break;
 
     case ST_FULLFRAME:
-      vdm1_memory[addr++] = data;
+      if( frame_sync )
+        { frame_memory[addr++] = data; frame_changed(); }
+      else
+        vdm1_memory[addr++] = data;
       if( --cnt==0 ) state = ST_IDLE; 
       break;
     }
@@ -176,34 +259,16 @@ void vdm1_receive(uint8_t data)
 // -----------------------------------------------------------------------------
 
 
+// Data received via serial (UART interrupt) or USB (CDC read-complete event)
+// is placed in the ring buffer and processed in the main loop (APP_Tasks).
+// The ring buffer supports only one producer: the serial interrupt only
+// stores data while USB is not connected (see _IntHandlerUSARTReceive).
 #define RINGBUFFER_SIZE 0x01000 // must be a power of 2
-volatile uint32_t ringbuffer_start = 0, ringbuffer_end = 0;
-uint8_t  ringbuffer[RINGBUFFER_SIZE];
-
-#define ringbuffer_full()                (((ringbuffer_end+1)&(RINGBUFFER_SIZE-1)) == ringbuffer_start)
-#define ringbuffer_empty()                 (ringbuffer_start==ringbuffer_end)
-#define ringbuffer_available_for_read()  (((ringbuffer_end+RINGBUFFER_SIZE)-ringbuffer_start)&(RINGBUFFER_SIZE-1))
-#define ringbuffer_available_for_write() (((ringbuffer_start+RINGBUFFER_SIZE)-ringbuffer_end-1)&(RINGBUFFER_SIZE-1))
-
+static uint8_t      ringbuffer_data[RINGBUFFER_SIZE];
+static ringbuffer_t ringbuffer;
 
-inline void ringbuffer_enqueue(uint8_t b)
-{
-  // There's really not much we can do if we receive a byte of data
-  // when the ring buffer is full. Overwriting the beginning of the buffer
-  // is about as bad as dropping the newly received byte. So we save
-  // the time to check whether the buffer is full and just overwrite.
-  ringbuffer[ringbuffer_end] = b;
-  ringbuffer_end = (ringbuffer_end+1) & 0x0fff;
-}
-
-inline uint8_t ringbuffer_dequeue()
-{
-  if( !ringbuffer_empty() )
-    {
-      vdm1_receive(ringbuffer[ringbuffer_start]);
-      ringbuffer_start = (ringbuffer_start+1) & 0x0fff;
-    }
-}
+// maximum number of received bytes processed per call to APP_Tasks
+#define RINGBUFFER_CHUNK 32
 
 
 // -----------------------------------------------------------------------------
@@ -419,13 +484,15 @@ void print_string(char *s)
 #define USB_INBUF_SIZE 512 // must be a multiple of 16
 static USB_HOST_CDC_OBJ    usbCdcObject     = NULL;
 static USB_HOST_CDC_HANDLE usbCdcHostHandle = USB_HOST_CDC_HANDLE_INVALID;
-static uint8_t usbInData[USB_INBUF_SIZE], usb_keydata[2];
+static uint8_t usbInData[USB_INBUF_SIZE], usb_keydata[VDM_KEYS_ENCODED_SIZE(MAX_KEYS)];
+static uint8_t *usbInPtr = usbInData; // destination of the current read request
 volatile bool usbBusy = false, usbSendConnect = false;
 
 
 void usbScheduleTransfer()
 {
-  uint16_t key = K_NONE;
+  uint8_t keys[MAX_KEYS];
+  int n;
 
   if( usbBusy )
     {
@@ -440,12 +507,11 @@ void usbScheduleTransfer()
       usbBusy = true;
       usbSendConnect = false;
     }
-  else if( (key=keyboard_get_key()) < 0x100 )
+  else if( (n=get_keys(keys, MAX_KEYS)) > 0 )
     {
       blink(true);
-      usb_keydata[0] = VDM_KEY;
-      usb_keydata[1] = key;
-      USB_HOST_CDC_Write(usbCdcHostHandle, NULL, usb_keydata, 2);
+      n = vdm_encode_keys(usb_keydata, keys, n, USE_KEY_BLOCKS);
+      USB_HOST_CDC_Write(usbCdcHostHandle, NULL, usb_keydata, n);
       usbBusy = true;
     }
   else
@@ -453,11 +519,23 @@ void usbScheduleTransfer()
       // If there is space available in the ringbuffer then ask the client
       // to send more data. If there is no space then do not start another
       // request until we have processed some data and enough space is available
-      // to store at least one full 64-byte packet of USB traffic
-      size_t avail = ringbuffer_available_for_write() & ~0x3F;
+      // to store at least one full 64-byte packet of USB traffic.
+      // If possible, read directly into the ring buffer. Only if the contiguous
+      // space at the end of the ring buffer is too small for a full packet
+      // go through usbInData.
+      uint8_t *p;
+      size_t avail = ringbuffer_write_span(&ringbuffer, &p) & ~0x3F;
+      if( avail>0 )
+        usbInPtr = p;
+      else
+        {
+          avail = ringbuffer_available_for_write(&ringbuffer) & ~0x3F;
+          usbInPtr = usbInData;
+        }
+
       if( avail>0 ) 
         {
-          USB_HOST_CDC_Read(usbCdcHostHandle, NULL, usbInData, min(avail, USB_INBUF_SIZE));
+          USB_HOST_CDC_Read(usbCdcHostHandle, NULL, usbInPtr, min(avail, USB_INBUF_SIZE));
           usbBusy = true;
         }
     }
@@ -485,20 +563,13 @@ USB_HOST_CDC_EVENT_RESPONSE USBHostCDCEventHandler(USB_HOST_CDC_HANDLE cdcHandle
         if( readCompleteEventData->result == USB_HOST_CDC_RESULT_SUCCESS )
           {
             // received data from the client => put it in the ringbuffer so it can
-            // be processed when we get to it
+            // be processed when we get to it (if we read directly into the
+            // ringbuffer then the data just needs to be published)
             size_t len = readCompleteEventData->length;
-            if( ringbuffer_end+len < RINGBUFFER_SIZE )
-              {
-                memcpy(ringbuffer+ringbuffer_end, usbInData, len);
-                ringbuffer_end += len;
-              }
+            if( usbInPtr==usbInData )
+              ringbuffer_write(&ringbuffer, usbInData, len);
             else
-              {
-                size_t len2 = RINGBUFFER_SIZE-ringbuffer_end;
-                memcpy(ringbuffer+ringbuffer_end, usbInData, len2);
-                memcpy(ringbuffer, usbInData+len2, len-len2);
-                ringbuffer_end = len-len2;
-              }
+              ringbuffer_commit(&ringbuffer, len);
           }
 
         // transfer is finished => schedule the next transfer
@@ -552,6 +623,7 @@ bool usbTasks()
               USB_HOST_CDC_ACM_LineCodingSet(usbCdcHostHandle, NULL, &coding);
 
               // request data
+              usbInPtr = usbInData;
               USB_HOST_CDC_Read(usbCdcHostHandle, NULL, usbInData, USB_INBUF_SIZE);
             }
         }
@@ -577,15 +649,21 @@ bool serialConnected = false;
 
 void __ISR(_UART_2_VECTOR, ipl3AUTO) _IntHandlerUSARTReceive(void)
 {
+  uint8_t data = PLIB_USART_ReceiverByteReceive(USART_ID_2);
   serialConnected = true;
-  ringbuffer_enqueue(PLIB_USART_ReceiverByteReceive(USART_ID_2));
+
+  // USB takes precedence, the USB event handler is the only producer
+  // for the ring buffer while USB is connected
+  if( usbCdcHostHandle==USB_HOST_CDC_HANDLE_INVALID )
+    ringbuffer_enqueue(&ringbuffer, data);
   PLIB_INT_SourceFlagClear(INT_ID_0, INT_SOURCE_USART_2_RECEIVE);
 }
 
 
 void serialTasks()
 {
-  uint16_t key;
+  uint8_t keys[MAX_KEYS], buf[VDM_KEYS_ENCODED_SIZE(MAX_KEYS)];
+  int i, n;
 
   if( !serialConnected )
   {
@@ -596,10 +674,14 @@ void serialTasks()
         prevSend = micros();
       }
   }
-  else if( (key=keyboard_get_key())<0x100 ) 
+  else if( (n=get_keys(keys, MAX_KEYS))>0 ) 
   {
-    PLIB_USART_TransmitterByteSend(USART_ID_2, VDM_KEY);
-    PLIB_USART_TransmitterByteSend(USART_ID_2, key);
+    n = vdm_encode_keys(buf, keys, n, USE_KEY_BLOCKS);
+    for(i=0; i<n; i++)
+      {
+        while( PLIB_USART_TransmitterBufferIsFull(USART_ID_2) );
+        PLIB_USART_TransmitterByteSend(USART_ID_2, buf[i]);
+      }
     blink(true);
   }
 }
@@ -659,6 +741,9 @@ void APP_Initialize ( void )
   PLIB_TMR_Counter32BitClear(TMR_ID_4);
   PLIB_TMR_Start(TMR_ID_4);
 
+  // set up receive buffer
+  ringbuffer_init(&ringbuffer, ringbuffer_data, RINGBUFFER_SIZE);
+
   // set up USB
   USB_HOST_CDC_AttachEventHandlerSet(USBHostCDCAttachEventListener, (uintptr_t) 0);
   PLIB_USB_StopInIdleDisable(USB_ID_1);
@@ -712,10 +797,13 @@ void APP_Tasks ( void )
 {
   blink(false);
 
-  // process received data (most commands have 3 bytes so process 3 at once)
-  ringbuffer_dequeue();
-  ringbuffer_dequeue();
-  ringbuffer_dequeue();
+  // process received data in place (up to RINGBUFFER_CHUNK bytes at once)
+  const uint8_t *p;
+  uint32_t i, n = ringbuffer_read_span(&ringbuffer, &p);
+  if( n>RINGBUFFER_CHUNK ) n = RINGBUFFER_CHUNK;
+  for(i=0; i<n; i++) vdm1_receive(p[i]);
+  ringbuffer_consume(&ringbuffer, n);
+  frame_tasks();
 
   // check for new USB connection and manage existing USB connection
   if( !usbTasks() ) 
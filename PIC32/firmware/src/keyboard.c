@@ -27,6 +27,7 @@
 #include "peripheral/int/plib_int.h"
 
 #include "keyboard.h"
+#include "ringbuffer.h"
 
 
 // keyboard receiver state
@@ -109,41 +110,21 @@ const uint16_t scancodes_shift[136] =
   K_NONE,  K_NONE,  K_NONE,  K_F7,    K_NONE,  K_NONE,  K_NONE,  K_NONE}; // 0x80-0x87
 
 
-volatile uint32_t keyboard_buffer_start = 0, keyboard_buffer_end = 0;
-volatile uint8_t  keyboard_buffer[0x40];
+// buffer for bytes received from the keyboard: filled by the change
+// notification interrupt, emptied by the main loop (keyboard_get_key)
+#define KEYBOARD_BUFFER_SIZE 0x40 // must be a power of 2
+static uint8_t      keyboard_buffer_data[KEYBOARD_BUFFER_SIZE];
+static ringbuffer_t keyboard_buffer = {0, 0, KEYBOARD_BUFFER_SIZE, keyboard_buffer_data, 0, 0};
 
-#define keyboard_buffer_full()     (((keyboard_buffer_end+1)&0x0fff) == keyboard_buffer_start)
-#define keyboard_buffer_empty()      (keyboard_buffer_start==keyboard_buffer_end)
-#define keyboard_bufferr_available() ((keyboard_buffer_start-keyboard_buffer_end-1)&0x03f)
+#define keyboard_buffer_empty()      ringbuffer_empty(&keyboard_buffer)
+#define keyboard_buffer_clear()      ringbuffer_clear(&keyboard_buffer)
+#define keyboard_buffer_enqueue(b)   ringbuffer_enqueue(&keyboard_buffer, b)
 
 
-inline void keyboard_buffer_clear()
-{
-  keyboard_buffer_start = 0;
-  keyboard_buffer_end = 0;
-}
-
-
-inline void keyboard_buffer_enqueue(uint8_t b)
-{
-  // There's really not much we can do if we receive a byte of data
-  // when the buffer is full. Overwriting the beginning of the buffer
-  // is about as bad as dropping the newly received byte. So we save
-  // the time to check whether the buffer is full and just overwrite.
-  keyboard_buffer[keyboard_buffer_end] = b;
-  keyboard_buffer_end = (keyboard_buffer_end+1) & 0x3f;
-}
-
 inline uint8_t keyboard_buffer_dequeue()
 {
   uint8_t res = 0;   
- 
-  if( !keyboard_buffer_empty() )
-    {
-      res = keyboard_buffer[keyboard_buffer_start];
-      keyboard_buffer_start = (keyboard_buffer_start+1) & 0x3f;
-    }
-  
+  ringbuffer_dequeue(&keyboard_buffer, &res);
   return res;
 }
 
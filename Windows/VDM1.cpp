@@ -26,45 +26,26 @@
 #include <wingdi.h>
 #include <setupapi.h>
 #include <Shlwapi.h>
+#include <stdio.h>
 
-#define REG_FOLDER    L"Software\\VDM1Display"
-
-#define HPIX 576
-#define VPIX 416
-
-#define VDM_MEMBYTE   0x10
-#define VDM_FULLFRAME 0x20
-#define VDM_CTRL      0x30
-#define VDM_DIP       0x40
-
-#define VDM_CONNECT   0x10
-#define VDM_KEY       0x30
-
-
-// DIP switches (SW1-6 = bit 0-5):
-// bit 0-1: off/off: all blank
-//          off/on : normal video
-//          on /off: inverse video
-//          on /on : illegal
-// bit 2-3: off/off: cursor characters (bit 7 on) shown regular
-//          off/on : cursor characters blink at 2 Hz
-//          on /off: cursor characters shown inverted
-//          on /on : illegal
-// bit 4-5: off/off: all characters blanked (cursor characters shown as blocks)
-//          off/on : control characters (0-31) blanked, CR/VT blanking enabled
-//          on /off: all characters shown, CR/VT blanking enabled
-//          on /on : all characters shown, CR/VT blanking disabled
-byte dip = 2+4+16;
+#include "vdm1proto.h"
+#include "sendqueue.h"
+#include "vdm1core.h"
+#include "vdm1charset.h"
+#include "vdm1metrics.h"
 
+#define REG_FOLDER    L"Software\\VDM1Display"
+#define FRAME_TIMER   1
+#define STATS_TIMER   2
 
-// 4 upper bits define the first line shown, all lines above this are blanked
-// 4 lower bits define the top line on the screen. e.g. if 3 then the order
-//              of lines displayed on the screen is 3-15, 0, 1, 2
-byte ctrl = 0, ctrl_prev = 0;
-
+// video state, protocol decoder and screen logic (shared with other platforms)
+VDM1Core core;
 
-// video memory
-byte mem[1024];
+// statistics shown in the window title (View/Statistics)
+VDM1Metrics *metrics = NULL;
+Histogram receive_time("receive", "us");
+uint64_t num_connects = 0;
+bool show_stats = false;
 
 int    g_com_port = -1;
 int    g_com_baud = 1050000;
@@ -73,14 +54,19 @@ HANDLE serial_conn = INVALID_HANDLE_VALUE;
 wchar_t *peer = NULL;
 SOCKET server_socket = INVALID_SOCKET;
 
+// serializes drawing and all use of the core: the serial thread feeds it
+// while the UI thread draws, blinks and times out frame sync (a Windows
+// mutex may be taken again by the thread holding it)
 HANDLE draw_mutex = INVALID_HANDLE_VALUE;
 
-int colCR[16], colVT, rowVT;
-int scaling = 1, border_left = 10, border_top = 10;
+// character cell size in window pixels (VDM1_CHAR_W x VDM1_CHAR_H scaled
+// by any factor, see calc_pixel_scaling())
+int cell_w = VDM1_CHAR_W, cell_h = VDM1_CHAR_H, border_left = 10, border_top = 10;
 COLORREF bgColor, fgColor;
 HBRUSH bgBrush, fgBrush;
 
-bool blinkOn = false, goSend;
+SendQueue *send_queue = NULL;
+bool echo_pacing = false, key_blocks = false;
 int delay_char = 0, delay_line = 0, delay_times[13] = {0, 1, 2, 5, 10, 20, 30, 40, 50, 75, 100, 200, 500};
 
 HDC memDC;
@@ -90,6 +76,7 @@ HBITMAP charsNormal[128], charsInverse[128];
 enum
   {
     ID_SOCKET = WM_USER,
+    ID_TITLE,
     ID_COPY,
     ID_PASTE,
     ID_FULLSCREEN,
@@ -130,169 +117,47 @@ enum
     ID_DELAY_LINE_100,
     ID_DELAY_LINE_200,
     ID_DELAY_LINE_500,
+    ID_ECHO_PACING,
+    ID_KEY_BLOCKS,
     ID_COLOR_FG,
     ID_COLOR_BG,
+    ID_STATS,
     ID_PORT_NONE, // must be before ID_PORT
     ID_PORT,      // must be last
   };
 
 
-// MCM6475 ROM character set
-const char charset_7bit[128][12] = 
- {{0x7f,0x41,0x41,0x41,0x41,0x41,0x41,0x41,0x7f,0x00,0x00,0x00},
-  {0x7f,0x40,0x40,0x40,0x40,0x40,0x40,0x40,0x40,0x00,0x00,0x00},
-  {0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x7f,0x00,0x00,0x00},
-  {0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x01,0x7f,0x00,0x00,0x00},
-  {0x20,0x10,0x08,0x04,0x3e,0x10,0x08,0x04,0x02,0x00,0x00,0x00},
-  {0x7f,0x41,0x63,0x55,0x49,0x55,0x63,0x41,0x7f,0x00,0x00,0x00},
-  {0x00,0x01,0x02,0x04,0x48,0x50,0x60,0x40,0x00,0x00,0x00,0x00},
-  {0x1c,0x22,0x41,0x41,0x41,0x7f,0x14,0x14,0x77,0x00,0x00,0x00},
-  {0x10,0x20,0x7c,0x22,0x11,0x01,0x01,0x01,0x01,0x00,0x00,0x00},
-  {0x00,0x08,0x04,0x02,0x7f,0x02,0x04,0x08,0x00,0x00,0x00,0x00},
-  {0x7f,0x00,0x00,0x00,0x7f,0x00,0x00,0x00,0x7f,0x00,0x00,0x00},
-  {0x00,0x08,0x08,0x08,0x49,0x2a,0x1c,0x08,0x00,0x00,0x00,0x00},
-  {0x08,0x08,0x2a,0x1c,0x08,0x49,0x2a,0x1c,0x08,0x00,0x00,0x00},
-  {0x00,0x08,0x10,0x20,0x7f,0x20,0x10,0x08,0x00,0x00,0x00,0x00},
-  {0x1c,0x22,0x63,0x55,0x49,0x55,0x63,0x22,0x1c,0x00,0x00,0x00},
-  {0x1c,0x22,0x41,0x41,0x49,0x41,0x41,0x22,0x1c,0x00,0x00,0x00},
-  {0x7f,0x41,0x41,0x41,0x7f,0x41,0x41,0x41,0x7f,0x00,0x00,0x00},
-  {0x1c,0x2a,0x49,0x49,0x4f,0x41,0x41,0x22,0x1c,0x00,0x00,0x00},
-  {0x1c,0x22,0x41,0x41,0x4f,0x49,0x49,0x2a,0x1c,0x00,0x00,0x00},
-  {0x1c,0x22,0x41,0x41,0x79,0x49,0x49,0x2a,0x1c,0x00,0x00,0x00},
-  {0x1c,0x2a,0x49,0x49,0x79,0x41,0x41,0x22,0x1c,0x00,0x00,0x00},
-  {0x00,0x11,0x0a,0x04,0x4a,0x51,0x60,0x40,0x00,0x00,0x00,0x00},
-  {0x3e,0x22,0x22,0x22,0x22,0x22,0x22,0x22,0x63,0x00,0x00,0x00},
-  {0x01,0x01,0x01,0x01,0x7f,0x01,0x01,0x01,0x01,0x00,0x00,0x00},
-  {0x7f,0x41,0x22,0x14,0x08,0x14,0x22,0x41,0x7f,0x00,0x00,0x00},
-  {0x08,0x08,0x08,0x1c,0x1c,0x08,0x08,0x08,0x08,0x00,0x00,0x00},
-  {0x3c,0x42,0x42,0x40,0x30,0x08,0x08,0x00,0x08,0x00,0x00,0x00},
-  {0x1c,0x22,0x41,0x41,0x7f,0x41,0x41,0x22,0x1c,0x00,0x00,0x00},
-  {0x7f,0x49,0x49,0x49,0x79,0x41,0x41,0x41,0x7f,0x00,0x00,0x00},
-  {0x7f,0x41,0x41,0x41,0x79,0x49,0x49,0x49,0x7f,0x00,0x00,0x00},
-  {0x7f,0x41,0x41,0x41,0x4f,0x49,0x49,0x49,0x7f,0x00,0x00,0x00},
-  {0x7f,0x49,0x49,0x49,0x4f,0x41,0x41,0x41,0x7f,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
-  {0x08,0x08,0x08,0x08,0x08,0x00,0x00,0x08,0x08,0x00,0x00,0x00},
-  {0x24,0x24,0x24,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
-  {0x14,0x14,0x14,0x7f,0x14,0x7f,0x14,0x14,0x14,0x00,0x00,0x00},
-  {0x08,0x3f,0x48,0x48,0x3e,0x09,0x09,0x7e,0x08,0x00,0x00,0x00},
-  {0x20,0x51,0x22,0x04,0x08,0x10,0x22,0x45,0x02,0x00,0x00,0x00},
-  {0x38,0x44,0x44,0x28,0x10,0x29,0x46,0x46,0x39,0x00,0x00,0x00},
-  {0x0c,0x0c,0x08,0x10,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
-  {0x04,0x08,0x10,0x10,0x10,0x10,0x10,0x08,0x04,0x00,0x00,0x00},
-  {0x10,0x08,0x04,0x04,0x04,0x04,0x04,0x08,0x10,0x00,0x00,0x00},
-  {0x00,0x08,0x49,0x2a,0x1c,0x2a,0x49,0x08,0x00,0x00,0x00,0x00},
-  {0x00,0x08,0x08,0x08,0x7f,0x08,0x08,0x08,0x00,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x18,0x18,0x10,0x20,0x00},
-  {0x00,0x00,0x00,0x00,0x7f,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x18,0x18,0x00,0x00,0x00},
-  {0x00,0x01,0x02,0x04,0x08,0x10,0x20,0x40,0x00,0x00,0x00,0x00},
-  {0x3e,0x41,0x43,0x45,0x49,0x51,0x61,0x41,0x3e,0x00,0x00,0x00},
-  {0x08,0x18,0x28,0x08,0x08,0x08,0x08,0x08,0x3e,0x00,0x00,0x00},
-  {0x3e,0x41,0x01,0x02,0x1c,0x20,0x40,0x40,0x7f,0x00,0x00,0x00},
-  {0x3e,0x41,0x01,0x01,0x1e,0x01,0x01,0x41,0x3e,0x00,0x00,0x00},
-  {0x02,0x06,0x0a,0x12,0x22,0x42,0x7f,0x02,0x02,0x00,0x00,0x00},
-  {0x7f,0x40,0x40,0x7c,0x02,0x01,0x01,0x42,0x3c,0x00,0x00,0x00},
-  {0x1e,0x20,0x40,0x40,0x7e,0x41,0x41,0x41,0x3e,0x00,0x00,0x00},
-  {0x7f,0x41,0x02,0x04,0x08,0x10,0x10,0x10,0x10,0x00,0x00,0x00},
-  {0x3e,0x41,0x41,0x41,0x3e,0x41,0x41,0x41,0x3e,0x00,0x00,0x00},
-  {0x3e,0x41,0x41,0x41,0x3f,0x01,0x01,0x02,0x3c,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x18,0x18,0x00,0x00,0x18,0x18,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x18,0x18,0x00,0x00,0x18,0x18,0x10,0x20,0x00},
-  {0x04,0x08,0x10,0x20,0x40,0x20,0x10,0x08,0x04,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x3e,0x00,0x3e,0x00,0x00,0x00,0x00,0x00,0x00},
-  {0x10,0x08,0x04,0x02,0x01,0x02,0x04,0x08,0x10,0x00,0x00,0x00},
-  {0x1e,0x21,0x21,0x01,0x06,0x08,0x08,0x00,0x08,0x00,0x00,0x00},
-  {0x1e,0x21,0x4d,0x55,0x55,0x5e,0x40,0x20,0x1e,0x00,0x00,0x00},
-  {0x1c,0x22,0x41,0x41,0x41,0x7f,0x41,0x41,0x41,0x00,0x00,0x00},
-  {0x7e,0x21,0x21,0x21,0x3e,0x21,0x21,0x21,0x7e,0x00,0x00,0x00},
-  {0x1e,0x21,0x40,0x40,0x40,0x40,0x40,0x21,0x1e,0x00,0x00,0x00},
-  {0x7c,0x22,0x21,0x21,0x21,0x21,0x21,0x22,0x7c,0x00,0x00,0x00},
-  {0x7f,0x40,0x40,0x40,0x78,0x40,0x40,0x40,0x7f,0x00,0x00,0x00},
-  {0x7f,0x40,0x40,0x40,0x78,0x40,0x40,0x40,0x40,0x00,0x00,0x00},
-  {0x1e,0x21,0x40,0x40,0x40,0x4f,0x41,0x21,0x1e,0x00,0x00,0x00},
-  {0x41,0x41,0x41,0x41,0x7f,0x41,0x41,0x41,0x41,0x00,0x00,0x00},
-  {0x3e,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x3e,0x00,0x00,0x00},
-  {0x1f,0x04,0x04,0x04,0x04,0x04,0x04,0x44,0x38,0x00,0x00,0x00},
-  {0x41,0x42,0x44,0x48,0x50,0x68,0x44,0x42,0x41,0x00,0x00,0x00},
-  {0x40,0x40,0x40,0x40,0x40,0x40,0x40,0x40,0x7f,0x00,0x00,0x00},
-  {0x41,0x63,0x55,0x49,0x49,0x41,0x41,0x41,0x41,0x00,0x00,0x00},
-  {0x41,0x61,0x51,0x49,0x45,0x43,0x41,0x41,0x41,0x00,0x00,0x00},
-  {0x1c,0x22,0x41,0x41,0x41,0x41,0x41,0x22,0x1c,0x00,0x00,0x00},
-  {0x7e,0x41,0x41,0x41,0x7e,0x40,0x40,0x40,0x40,0x00,0x00,0x00},
-  {0x1c,0x22,0x41,0x41,0x41,0x49,0x45,0x22,0x1d,0x00,0x00,0x00},
-  {0x7e,0x41,0x41,0x41,0x7e,0x48,0x44,0x42,0x41,0x00,0x00,0x00},
-  {0x3e,0x41,0x40,0x40,0x3e,0x01,0x01,0x41,0x3e,0x00,0x00,0x00},
-  {0x7f,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x00,0x00,0x00},
-  {0x41,0x41,0x41,0x41,0x41,0x41,0x41,0x41,0x3e,0x00,0x00,0x00},
-  {0x41,0x41,0x41,0x22,0x22,0x14,0x14,0x08,0x08,0x00,0x00,0x00},
-  {0x41,0x41,0x41,0x41,0x49,0x49,0x55,0x63,0x41,0x00,0x00,0x00},
-  {0x41,0x41,0x22,0x14,0x08,0x14,0x22,0x41,0x41,0x00,0x00,0x00},
-  {0x41,0x41,0x22,0x14,0x08,0x08,0x08,0x08,0x08,0x00,0x00,0x00},
-  {0x7f,0x01,0x02,0x04,0x08,0x10,0x20,0x40,0x7f,0x00,0x00,0x00},
-  {0x3c,0x20,0x20,0x20,0x20,0x20,0x20,0x20,0x3c,0x00,0x00,0x00},
-  {0x00,0x40,0x20,0x10,0x08,0x04,0x02,0x01,0x00,0x00,0x00,0x00},
-  {0x3c,0x04,0x04,0x04,0x04,0x04,0x04,0x04,0x3c,0x00,0x00,0x00},
-  {0x08,0x14,0x22,0x41,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x7f,0x00,0x00,0x00},
-  {0x18,0x18,0x08,0x04,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x3c,0x02,0x3e,0x42,0x42,0x3d,0x00,0x00,0x00},
-  {0x40,0x40,0x40,0x5c,0x62,0x42,0x42,0x62,0x5c,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x3c,0x42,0x40,0x40,0x42,0x3c,0x00,0x00,0x00},
-  {0x02,0x02,0x02,0x3a,0x46,0x42,0x42,0x46,0x3a,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x3c,0x42,0x7e,0x40,0x40,0x3c,0x00,0x00,0x00},
-  {0x0c,0x12,0x10,0x10,0x7c,0x10,0x10,0x10,0x10,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x3a,0x46,0x42,0x46,0x3a,0x02,0x02,0x42,0x3c},
-  {0x40,0x40,0x40,0x5c,0x62,0x42,0x42,0x42,0x42,0x00,0x00,0x00},
-  {0x00,0x08,0x00,0x18,0x08,0x08,0x08,0x08,0x1c,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x06,0x02,0x02,0x02,0x02,0x02,0x02,0x22,0x1c},
-  {0x40,0x40,0x40,0x44,0x48,0x50,0x68,0x44,0x42,0x00,0x00,0x00},
-  {0x18,0x08,0x08,0x08,0x08,0x08,0x08,0x08,0x1c,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x76,0x49,0x49,0x49,0x49,0x49,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x5c,0x62,0x42,0x42,0x42,0x42,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x3c,0x42,0x42,0x42,0x42,0x3c,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x5c,0x62,0x42,0x42,0x62,0x5c,0x40,0x40,0x40},
-  {0x00,0x00,0x00,0x3a,0x46,0x42,0x42,0x46,0x3a,0x02,0x02,0x02},
-  {0x00,0x00,0x00,0x5c,0x62,0x40,0x40,0x40,0x40,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x3c,0x42,0x30,0x0c,0x42,0x3c,0x00,0x00,0x00},
-  {0x00,0x10,0x10,0x7c,0x10,0x10,0x10,0x12,0x0c,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x42,0x42,0x42,0x42,0x46,0x3a,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x41,0x41,0x41,0x22,0x14,0x08,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x41,0x49,0x49,0x49,0x49,0x36,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x42,0x24,0x18,0x18,0x24,0x42,0x00,0x00,0x00},
-  {0x00,0x00,0x00,0x42,0x42,0x42,0x42,0x46,0x3a,0x02,0x42,0x3c},
-  {0x00,0x00,0x00,0x7e,0x04,0x08,0x10,0x20,0x7e,0x00,0x00,0x00},
-  {0x0e,0x10,0x10,0x10,0x20,0x10,0x10,0x10,0x0e,0x00,0x00,0x00},
-  {0x08,0x08,0x08,0x00,0x00,0x08,0x08,0x08,0x00,0x00,0x00,0x00},
-  {0x18,0x04,0x04,0x04,0x02,0x04,0x04,0x04,0x18,0x00,0x00,0x00},
-  {0x30,0x49,0x06,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
-  {0x24,0x49,0x12,0x24,0x49,0x12,0x24,0x49,0x12,0x00,0x00,0x00}};
-
-
-static HBITMAP create_char_bitmap(HDC hdc, int ch, HBRUSH fg, HBRUSH bg)
+static HBITMAP create_char_bitmap(HDC hdc, int ch, COLORREF fg, COLORREF bg)
 {
-  RECT rct;
-  HBITMAP memBM = CreateCompatibleBitmap(hdc, scaling*9, 2*scaling*13);
-  HGDIOBJ obj = SelectObject(memDC, memBM);
-
-  rct.left   = 0;
-  rct.right  = scaling * 9;
-  rct.top    = 0;
-  rct.bottom = 2 * scaling * 13;
-  FillRect(memDC, &rct, bg);
-
-  // NOTE: top row and two rightmost columns of all characters are blank
-  for(int r=0; r<12; r++)
-    for(int c=0; c<7; c++)
-      {
-        rct.left   = scaling * c;
-        rct.right  = rct.left + scaling;
-        rct.top    = 2*scaling * (r+1);
-        rct.bottom = rct.top + 2*scaling;
-        FillRect(memDC, &rct, (charset_7bit[ch][r] & (1<<(6-c))) ? fg : bg);
-      }
-  
-  SelectObject(memDC, obj);
+  // coverage of each pixel (area-weighted, so fractional scales stay sharp)
+  // blended between background and foreground color
+  uint8_t  *glyph = (uint8_t *) malloc(cell_w*cell_h);
+  uint32_t *bits  = (uint32_t *) malloc(cell_w*cell_h*4);
+  vdm1_render_glyph(ch, cell_w, cell_h, 255, glyph, cell_w);
+
+  for(int i=0; i<cell_w*cell_h; i++)
+    {
+      int v = glyph[i];
+      int r = GetRValue(bg) + (GetRValue(fg)-GetRValue(bg))*v/255;
+      int g = GetGValue(bg) + (GetGValue(fg)-GetGValue(bg))*v/255;
+      int b = GetBValue(bg) + (GetBValue(fg)-GetBValue(bg))*v/255;
+      bits[i] = (r<<16) | (g<<8) | b;
+    }
+
+  BITMAPINFO bmi;
+  memset(&bmi, 0, sizeof(bmi));
+  bmi.bmiHeader.biSize        = sizeof(BITMAPINFOHEADER);
+  bmi.bmiHeader.biWidth       = cell_w;
+  bmi.bmiHeader.biHeight      = -cell_h; // top-down
+  bmi.bmiHeader.biPlanes      = 1;
+  bmi.bmiHeader.biBitCount    = 32;
+  bmi.bmiHeader.biCompression = BI_RGB;
+
+  HBITMAP memBM = CreateCompatibleBitmap(hdc, cell_w, cell_h);
+  SetDIBits(hdc, memBM, 0, cell_h, bits, &bmi, DIB_RGB_COLORS);
+
+  free(bits);
+  free(glyph);
   return memBM;
 }
 
@@ -302,9 +167,9 @@ static void create_char_bitmaps(HDC hdc)
   for(int ch=0; ch<128; ch++)
     {
       if( charsNormal[ch]!=NULL ) DeleteObject(charsNormal[ch]);
-      charsNormal[ch]  = create_char_bitmap(hdc, ch, fgBrush, bgBrush);
+      charsNormal[ch]  = create_char_bitmap(hdc, ch, fgColor, bgColor);
       if( charsInverse[ch]!=NULL ) DeleteObject(charsInverse[ch]);
-      charsInverse[ch] = create_char_bitmap(hdc, ch, bgBrush, fgBrush);
+      charsInverse[ch] = create_char_bitmap(hdc, ch, bgColor, fgColor);
     }
 }
 
@@ -312,183 +177,75 @@ static void create_char_bitmaps(HDC hdc)
 static void draw_rect(HDC dc, int r, int c, int h, int w, HBRUSH color)
 {
   RECT rct;
-  rct.left   = border_left + scaling * c * 9;
-  rct.right  = rct.left + scaling * w * 9;
-  rct.top    = border_top + 2 * scaling * r * 13;
-  rct.bottom = rct.top + 2*scaling * h * 13;
+  rct.left   = border_left + c * cell_w;
+  rct.right  = rct.left + w * cell_w;
+  rct.top    = border_top + r * cell_h;
+  rct.bottom = rct.top + h * cell_h;
   FillRect(dc, &rct, color);
 }
 
 
-static void draw_char(HDC dc, int row, int col, byte ch)
-{
-  bool blank = false;
-  bool inv = false;
-  
-  // DIP switch 5+6 (control character blanking)
-  if( (dip & 0x30)==0x20 )
-    blank = (ch&0x7f)<32;
-  else if( (dip & 0x30)==0x00 )
-    blank = true;
-
-  // DIP switch 3+4 (cursor handling)
-  if( ch & 0x80 )
-    {
-      if( dip & 0x04 )
-        inv = !inv;
-      else if( dip & 0x08 )
-        inv = blinkOn;
-    }
-
-  // DIP switch 1 (whole screen inversion)
-  if( dip & 1 ) inv = !inv;
-
-  if( blank )
-    draw_rect(dc, row, col, 1, 1, inv ? fgBrush: bgBrush);
-  else
-    {
-      HGDIOBJ obj = SelectObject(memDC, inv ? charsInverse[ch&0x7f] : charsNormal[ch&0x7f]);
-      BitBlt(dc, border_left + scaling * col * 9, border_top + 2 * scaling * row * 13, scaling*9, 2*scaling*13, memDC, 0, 0, SRCCOPY);
-      SelectObject(memDC, obj);
-    }
-}
-
-
-static void update_frame(HDC hdc)
+// draws the core's screen into the window, serialized by draw_mutex
+class GDISurface : public VDM1Surface
 {
-  int firstDisplayed = (ctrl & 0xF0)/16;
-  int firstLine      = ctrl & 0x0F;
+ public:
+  GDISurface() { hwnd = NULL; hdc = NULL; depth = 0; }
 
-  // whole screen blanked
-  if( (dip & 3)==0 ) 
-    {
-      draw_rect(hdc, 0, 0, 16, 64, (dip&1) ? fgBrush : bgBrush);
-      return;
-    }
-
-  // curtain blanking
-  if( firstDisplayed>0 )
-    draw_rect(hdc, 0, 0, firstDisplayed, 64, (dip&1) ? fgBrush : bgBrush);
-
-  // reset VT blanking
-  colVT=255; rowVT=255;
-
-  int r, c;
-  for(r=0; r<16 && rowVT==255; r++)
-    {
-      // compute row (with scrolling)
-      int ra = ((r+(ctrl&15))*64) & 0x3ff;
-
-      // reset CR blanking
-      colCR[r] = 255;
-
-      for(c=0; c<64; c++)
-        {
-          char ch = mem[ra+c];
-
-          // the VT-CR logic must happen even within curtain-blanked screen,
-          // so we can't just start the "r" loop above at firstDisplayed
-          if( r>=firstDisplayed )
-            draw_char(hdc, r, c, ch);
-          
-          // VT-CR blanking
-          if( (dip & 0x30)!=0x30 )
-            {
-              if( (ch&0x7f)==11 )
-                {
-                  rowVT = r;
-                  colVT = c++;
-                  break;
-                }
-              else if( (ch&0x7f)==13 )
-                {
-                  colCR[r] = c++;
-                  break;
-                }
-            }
-        }
-      
-      if( c<64 )
-        {
-          // blank end of line
-          draw_rect(hdc, r, c, 1, 64-c, (dip&1) ? fgBrush : bgBrush);
-        }
-    }
+  virtual void begin_update()
+  {
+    WaitForSingleObject(draw_mutex, INFINITE);
+    if( depth++==0 ) hdc = GetDC(hwnd);
+  }
 
-  if( r<16 )
-    {
-      // blank bottom of screen
-      draw_rect(hdc, r, 0, 16-r, 64, (dip&1) ? fgBrush : bgBrush);
-    }
-}
+  virtual void end_update()
+  {
+    if( --depth==0 ) { ReleaseDC(hwnd, hdc); hdc = NULL; }
+    ReleaseMutex(draw_mutex);
+  }
 
+  virtual void draw_char(int row, int col, uint8_t ch, bool inverse)
+  {
+    HGDIOBJ obj = SelectObject(memDC, inverse ? charsInverse[ch] : charsNormal[ch]);
+    BitBlt(hdc, border_left + col * cell_w, border_top + row * cell_h,
+           cell_w, cell_h, memDC, 0, 0, SRCCOPY);
+    SelectObject(memDC, obj);
+  }
 
-static void update_byte(HDC dc, int a)
-{
-  int firstDisplayed = (ctrl & 0xF0)/16;
-  int firstLine      = ctrl & 0x0F;
+  virtual void fill(int row, int col, int h, int w, bool inverse)
+  {
+    draw_rect(hdc, row, col, h, w, inverse ? fgBrush : bgBrush);
+  }
 
-  // if whole screen is blanked then don't display
-  if( (dip & 3)==0 ) return;
-
-  byte ch = mem[a] & 0x7f;
-  if( (ch==10 || ch==12) && (dip & 0x30)!=0x30 )
-    {
-      // if this is a VT or CR character then redraw whole screen
-      update_frame(dc);
-    }
-  else
-    {
-      // compute row/col from memory address
-      int row = (a & 0x03C0) >> 6;
-      int col = a & 0x003F;
-
-      // scrolling
-      row -= firstLine;
-      if( row<0 ) row += 16;
-
-      // if within curtain blanking region then don't display
-      if( row<firstDisplayed )
-        return;
-
-      // if we are changing a CR/VT character then redraw whole screen
-      if( ((row==rowVT && col==colVT ) || col==colCR[row]) && (dip & 0x30)!=0x30 )
-        { update_frame(dc); return; }
-
-      // if within CR/VT blanking region then don't display
-      if( (dip & 0x30)!=0x30 )
-        if( row>rowVT || (row==rowVT && col>colVT) || col>colCR[row] )
-          return;
-      
-      // draw character on screen
-      draw_char(dc, row, col, mem[a]);
-    }
-}
+  HWND hwnd;
 
+ private:
+  HDC hdc;
+  int depth;
+};
 
-static void update_frame(HWND hwnd)
-{
-  WaitForSingleObject(draw_mutex, INFINITE);
-  HDC hdc = GetDC(hwnd);
-  update_frame(hdc);
-  ReleaseDC(hwnd, hdc);
-  ReleaseMutex(draw_mutex);
-}
+GDISurface surface;
 
 
 void set_window_title(HWND hwnd)
 {
   bool connected = (serial_conn!=INVALID_HANDLE_VALUE) || (server_socket!=INVALID_SOCKET);
-  wchar_t buf[100];
+  wchar_t buf[400];
+  int n;
 
+  // the host name comes straight from the command line, cut it short
+  // rather than overrun buf
   if( peer!=NULL )
-    wsprintf(buf, L"VDM-1 Display (%s, %sconnected)",
-             peer, connected ? L"" : L"not ");
+    n = _snwprintf_s(buf, _countof(buf), _TRUNCATE, L"VDM-1 Display (%s, %sconnected)",
+                     peer, connected ? L"" : L"not ");
   else if( g_com_port>0 )
-    wsprintf(buf, L"VDM-1 Display (COM%i, %sconnected)",
-             g_com_port, connected ? L"" : L"not ");
+    n = wsprintf(buf, L"VDM-1 Display (COM%i, %sconnected)",
+                 g_com_port, connected ? L"" : L"not ");
   else
-    wsprintf(buf, L"VDM-1 Display");
+    n = wsprintf(buf, L"VDM-1 Display");
+
+  if( n<0 ) n = (int) wcslen(buf);
+  if( show_stats && metrics!=NULL )
+    _snwprintf_s(buf+n, _countof(buf)-n, _TRUNCATE, L" - %S", metrics->summary(GetTickCount64()/1000.0));
   
   SetWindowText(hwnd, buf);
 }
@@ -496,92 +253,33 @@ void set_window_title(HWND hwnd)
 
 void receive(HWND hwnd, byte *data, int size)
 {
-  static int recv_status = 0, recv_bytes = 0, recv_ptr = 0;
-  static byte buf[10];
-
-  int i = 0;
-  while( i<size )
-    {
-      if( recv_bytes>0 )
-        {
-          int n = recv_bytes > (size-i) ? (size-i) : recv_bytes;
-
-          if( recv_status==VDM_FULLFRAME )
-            memcpy(mem+recv_ptr, data+i, n);
-          else
-            memcpy(buf+recv_ptr, data+i, n);
+  static LARGE_INTEGER freq = { 0 };
+  LARGE_INTEGER start, end;
+  if( freq.QuadPart==0 ) QueryPerformanceFrequency(&freq);
 
-          recv_bytes -= n;
-          recv_ptr   += n;
-          i          += n;
-
-          if( recv_bytes == 0 )
-            {
-              switch( recv_status )
-                {
-                case VDM_FULLFRAME: 
-                  update_frame(hwnd);
-                  break;
-                  
-                case VDM_MEMBYTE:
-                  {
-                    int a = buf[0]*256+buf[1];
-                    mem[a] = buf[2];
-
-                    WaitForSingleObject(draw_mutex, INFINITE);
-                    HDC hdc = GetDC(hwnd);
-                    update_byte(hdc, a);
-                    ReleaseDC(hwnd, hdc);
-                    ReleaseMutex(draw_mutex);
-                    break;
-                  }
-                  
-                case VDM_CTRL:
-                  ctrl = buf[0];
-                  update_frame(hwnd);
-                  set_window_title(hwnd);
-                  break;
-
-                case VDM_DIP:
-                  dip = buf[0];
-                  update_frame(hwnd);
-                  set_window_title(hwnd);
-                  break;
-                }
-
-              recv_status = 0;
-            }
-        }
-      else
-        {
-          recv_status = data[i] & 0xf0;
-          recv_bytes = 0;
-          recv_ptr   = 0;
+  // the surface draws while the data is processed, this is the latency
+  WaitForSingleObject(draw_mutex, INFINITE);
+  QueryPerformanceCounter(&start);
+  core.receive(data, size);
+  QueryPerformanceCounter(&end);
+  ReleaseMutex(draw_mutex);
+  receive_time.add((uint64_t) ((end.QuadPart-start.QuadPart)*1000000/freq.QuadPart));
+}
 
-          switch( recv_status )
-            {
-            case VDM_FULLFRAME: 
-              recv_bytes = 1024;
-              break;
-                  
-            case VDM_MEMBYTE:
-              recv_bytes = 2;
-              buf[recv_ptr++] = data[i]&0x07;
-              break;
 
-            case VDM_CTRL:
-            case VDM_DIP:
-              recv_bytes = 1;
-              break;
+// called by the core for each video memory write
+static void core_write(void *ctx, int addr, uint8_t value)
+{
+  send_queue->observe_write(addr, value);
+}
 
-            default:
-              recv_status = 0;
-              break;
-            }
 
-          i++;
-        }
-    }
+// called by the core when the control register or DIP switches changed,
+// possibly in the serial thread holding draw_mutex: SetWindowText() would
+// wait for the UI thread, which may be waiting for draw_mutex
+static void core_state(void *ctx)
+{
+  PostMessage((HWND) ctx, ID_TITLE, 0, 0);
 }
 
 
@@ -596,41 +294,10 @@ void send(HWND hwnd, byte *data, int size)
 }
 
 
-struct send_text_info {
-  byte *data;
-  int   size;
-  HWND  hwnd;
-};
-
-
-struct send_file_info {
-  HANDLE f;
-  HWND  hwnd;
-};
-
-
-
-DWORD WINAPI send_file_thread(void *data)
+// called from the send queue's writer thread
+static void send_queue_write(void *ctx, const uint8_t *data, int size)
 {
-  DWORD n;
-  struct send_file_info *info = (send_file_info *) data;
-
-  byte buf[1024], cmd[2], prevC=0;
-  cmd[0] = VDM_KEY;
-  
-  while( ReadFile(info->f, &buf, 1024, &n, NULL) && n>0 && goSend )
-    for(DWORD i=0; i<n && goSend; i++)
-      {
-        cmd[1] = buf[i];
-        send(info->hwnd, cmd, 2);
-        if( delay_char>0 ) Sleep(delay_char);
-        if( delay_line>0 && (buf[i]==13 || (buf[i]==10 && prevC!=13)) ) Sleep(delay_line);
-        prevC = buf[i];
-      }
-
-  CloseHandle(info->f);
-  free(info);
-  return 0;
+  send((HWND) ctx, (byte *) data, size);
 }
 
 
@@ -639,52 +306,23 @@ void send_file(HWND hwnd, LPWSTR fname)
   HANDLE f = CreateFile(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
   if( f != INVALID_HANDLE_VALUE ) 
     {
-      DWORD id;
-      send_file_info *info = (send_file_info *) malloc(sizeof(send_file_info));
-      info->f = f;
-      info->hwnd = hwnd;
-      
-      goSend = true;
-      HANDLE h = CreateThread(0, 0, send_file_thread, info, 0, &id);
-      CloseHandle(h);
-    }
-}
-
+      DWORD size = GetFileSize(f, NULL), n = 0;
+      byte *buf = (byte *) malloc(size+1);
+      bool ok = buf!=NULL && size!=INVALID_FILE_SIZE && ReadFile(f, buf, size, &n, NULL);
+      CloseHandle(f);
 
+      if( ok && !send_queue->send_bulk(buf, n) )
+        MessageBox(hwnd, L"Too much data queued for sending.", L"Send File", MB_OK | MB_ICONERROR);
 
-DWORD WINAPI send_text_thread(void *data)
-{
-  struct send_text_info *info = (send_text_info *) data;
-
-  byte buf[2];
-  buf[0] = VDM_KEY;
-
-  for(int i=0; i<info->size && goSend; i++)
-    {
-      buf[1] = info->data[i];
-      send(info->hwnd, buf, 2);
-      if( delay_char>0 ) Sleep(delay_char);
-      if( delay_line>0 && buf[1]==13 ) Sleep(delay_line);
+      free(buf);
     }
-
-  free(info->data);
-  free(info);
-  return 0;
 }
 
 
 void send_text(HWND hwnd, byte *data, int size)
 {
-  DWORD id;
-  send_text_info *info = (send_text_info *) malloc(sizeof(send_text_info));
-  info->data = (byte *) malloc(size);
-  info->size = size;
-  info->hwnd = hwnd;
-  memcpy(info->data, data, size);
-
-  goSend = true;
-  HANDLE h = CreateThread(0, 0, send_text_thread, info, 0, &id);
-  CloseHandle(h);
+  if( !send_queue->send_bulk(data, size) )
+    MessageBox(hwnd, L"Too much data queued for sending.", L"Paste", MB_OK | MB_ICONERROR);
 }
 
 
@@ -976,12 +614,12 @@ DWORD WINAPI serial_thread(void *data)
                   timeouts.WriteTotalTimeoutMultiplier = 0;
                   timeouts.WriteTotalTimeoutConstant = 0;
                   SetCommTimeouts(serial_conn, &timeouts);
+                  num_connects++;
                   set_window_title(hwnd);
                   current_port = g_com_port;
                   current_baud = g_com_baud;
 
-                  byte b = VDM_CONNECT;
-                  send(hwnd, &b, 1);
+                  send_queue->send_connect();
                 }
               else
                 Sleep(200);
@@ -1013,22 +651,26 @@ void calc_pixel_scaling(HWND hwnd)
   GetClientRect(hwnd, &r);
   int h = r.bottom-r.top, w = r.right-r.left;
 
-  double scaleX = double(w)/HPIX;
-  double scaleY = double(h)/VPIX;
+  double scaleX = double(w)/VDM1_HPIX;
+  double scaleY = double(h)/VDM1_VPIX;
+  double scale  = scaleX<scaleY ? scaleX : scaleY;
 
-  int newScaling = int(scaleX<scaleY ? scaleX : scaleY);
-  if( newScaling<1 ) newScaling = 1;
+  // largest whole cell size that fits, the glyphs are only rendered
+  // again when it changes (drawing a character is always one BitBlt)
+  int newW = int(VDM1_CHAR_W*scale + 1e-6), newH = int(VDM1_CHAR_H*scale + 1e-6);
+  if( newW<VDM1_CHAR_W || newH<VDM1_CHAR_H ) { newW = VDM1_CHAR_W; newH = VDM1_CHAR_H; }
 
-  if( newScaling!=scaling )
+  if( newW!=cell_w || newH!=cell_h )
     {
-      scaling = newScaling;
+      cell_w = newW;
+      cell_h = newH;
       HDC hdc = GetDC(hwnd);
       create_char_bitmaps(hdc);
       ReleaseDC(hwnd, hdc);
     }
 
-  border_left = (w-HPIX*scaling)/2;
-  border_top  = (h-VPIX*scaling)/2;
+  border_left = (w-VDM1_COLS*cell_w)/2;
+  border_top  = (h-VDM1_ROWS*cell_h)/2;
 }
 
 
@@ -1118,7 +760,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
             }
 
           case ID_SEND_STOP:
-            goSend = false;
+            send_queue->cancel_bulk();
             break;
 
           case ID_COPY:
@@ -1129,21 +771,9 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
                 if( hglbCopy ) 
                   {
                     LPSTR lpstrCopy = (LPSTR) GlobalLock(hglbCopy); 
-                    int firstDisplayed = (ctrl & 0xF0)/16;
-                    int firstLine      = ctrl & 0x0F;
-
-                    for(int i=0; i<16; i++)
-                      {
-                        if( i >= firstDisplayed )
-                          memcpy(lpstrCopy+i*66, mem+((i+firstLine)&0x0f)*64, 64);
-                        else
-                          memset(lpstrCopy+i*66, ' ', 64);
-                        
-                        lpstrCopy[i*66+64] = 13;
-                        lpstrCopy[i*66+65] = 10;
-                      }
-
-                    lpstrCopy[16*66] = 0;
+                    WaitForSingleObject(draw_mutex, INFINITE);
+                    core.get_text(lpstrCopy, "\r\n");
+                    ReleaseMutex(draw_mutex);
                     GlobalUnlock(hglbCopy); 
                     SetClipboardData(CF_TEXT, hglbCopy); 
                   }
@@ -1173,6 +803,18 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
             toggle_fullscreen(hwnd); 
             break;
 
+          case ID_STATS:
+            {
+              show_stats = !show_stats;
+              CheckMenuItem(GetMenu(hwnd), ID_STATS, show_stats ? MF_CHECKED : MF_UNCHECKED);
+              if( show_stats )
+                SetTimer(hwnd, STATS_TIMER, 1000, NULL);
+              else
+                KillTimer(hwnd, STATS_TIMER);
+              set_window_title(hwnd);
+              break;
+            }
+
           case ID_BAUD_9600:    set_baud_rate(hwnd, 9600); break;
           case ID_BAUD_38400:   set_baud_rate(hwnd, 38400); break;
           case ID_BAUD_115200:  set_baud_rate(hwnd, 115200); break;
@@ -1198,6 +840,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
               delay_char = delay_times[id-ID_DELAY_CHAR_0];
               HMENU menuDelay = GetSubMenu(GetSubMenu(GetMenu(hwnd), 3), 2);
               CheckMenuRadioItem(menuDelay, ID_DELAY_CHAR_0, ID_DELAY_CHAR_500, id, MF_BYCOMMAND);
+              send_queue->set_pacing(delay_char, delay_line);
               write_setting_dword(L"DelayChar", delay_char);
               break;
             }
@@ -1219,10 +862,29 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
               delay_line = delay_times[id-ID_DELAY_LINE_0];
               HMENU menuDelay = GetSubMenu(GetSubMenu(GetMenu(hwnd), 3), 3);
               CheckMenuRadioItem(menuDelay, ID_DELAY_LINE_0, ID_DELAY_LINE_500, id, MF_BYCOMMAND);
+              send_queue->set_pacing(delay_char, delay_line);
               write_setting_dword(L"DelayLine", delay_line);
               break;
             }
 
+          case ID_ECHO_PACING:
+            {
+              echo_pacing = !echo_pacing;
+              CheckMenuItem(GetSubMenu(GetMenu(hwnd), 3), ID_ECHO_PACING, echo_pacing ? MF_CHECKED : MF_UNCHECKED);
+              send_queue->set_echo_pacing(echo_pacing);
+              write_setting_dword(L"EchoPacing", echo_pacing);
+              break;
+            }
+
+          case ID_KEY_BLOCKS:
+            {
+              key_blocks = !key_blocks;
+              CheckMenuItem(GetSubMenu(GetMenu(hwnd), 3), ID_KEY_BLOCKS, key_blocks ? MF_CHECKED : MF_UNCHECKED);
+              send_queue->set_key_blocks(key_blocks);
+              write_setting_dword(L"KeyBlocks", key_blocks);
+              break;
+            }
+
           case ID_COLOR_BG:
           case ID_COLOR_FG:
             {
@@ -1259,8 +921,8 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
                     }
 
                   create_char_bitmaps(hdc);
-                  update_frame(hdc);
                   ReleaseDC(hwnd, hdc);
+                  core.redraw();
                   ReleaseMutex(draw_mutex);
                 }
               break;
@@ -1295,9 +957,8 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
         FillRect(hdc, &r, bgBrush);
         ReleaseDC(hwnd, hdc);
         calc_pixel_scaling(hwnd);
+        core.redraw();
         ReleaseMutex(draw_mutex);
-
-        update_frame(hwnd);
         break;
       }
 
@@ -1308,24 +969,19 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
       
     case WM_CHAR: 
       {
-        byte msg[2];
+        char c;
         WCHAR uc = wParam;
-        if( 1==WideCharToMultiByte(CP_ACP, WC_NO_BEST_FIT_CHARS, &uc, 1, (LPSTR) (msg+1), 1, 0, NULL) )
-          {
-            msg[0] = VDM_KEY;
-            send(hwnd, msg, 2);
-          }
+        if( 1==WideCharToMultiByte(CP_ACP, WC_NO_BEST_FIT_CHARS, &uc, 1, &c, 1, 0, NULL) )
+          send_queue->send_key(c);
         break;
       }
       
     case WM_KEYDOWN:
       {
-        byte msg[2];
-        msg[0] = VDM_KEY;
         switch( wParam )
           {
-          case VK_INSERT: msg[1] = 0x80; send(hwnd, msg, 2); break;
-          case VK_DELETE: msg[1] = 0x7f; send(hwnd, msg, 2); break;
+          case VK_INSERT: send_queue->send_key(0x80); break;
+          case VK_DELETE: send_queue->send_key(0x7f); break;
           }
         break;
       }
@@ -1389,9 +1045,27 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
         break;
       }
 
+    case ID_TITLE:
+      set_window_title(hwnd);
+      break;
+
     case WM_TIMER:
-      blinkOn = !blinkOn;
-      if( (dip & 0x0C)==0x08 ) update_frame(hwnd);
+      if( wParam==STATS_TIMER )
+        set_window_title(hwnd);
+      else
+        {
+          WaitForSingleObject(draw_mutex, INFINITE);
+          if( wParam==FRAME_TIMER )
+            {
+              // changes pending for a whole period: the sender stopped sending VDM_ENDFRAME
+              static uint64_t presents = 0;
+              if( core.frame_pending() && core.stats.presents==presents ) core.set_frame_sync(false);
+              presents = core.stats.presents;
+            }
+          else
+            core.toggle_blink();
+          ReleaseMutex(draw_mutex);
+        }
       break;
       
     default:
@@ -1424,7 +1098,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdShow
     RegisterClass(&wc);
 
     // Create the window.
-    long w = border_left*2 + scaling * HPIX, h = border_top*2 + scaling * VPIX;
+    long w = border_left*2 + VDM1_COLS*cell_w, h = border_top*2 + VDM1_ROWS*cell_h;
     calc_window_size(&w, &h);
     HWND hwnd = CreateWindowEx(0, CLASS_NAME, L"VDM-1 Display", WS_OVERLAPPEDWINDOW,
                                CW_USEDEFAULT, CW_USEDEFAULT, w, h,
@@ -1443,6 +1117,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdShow
     AppendMenu(menuEdit, MF_BYPOSITION | MF_STRING, ID_PASTE, L"&Paste\tCtrl+Alt+V");
     HMENU menuView = CreateMenu();
     AppendMenu(menuView, MF_BYPOSITION | MF_STRING, ID_FULLSCREEN, L"&Full Screen\tCtrl+Alt+F");
+    AppendMenu(menuView, MF_BYPOSITION | MF_STRING, ID_STATS, L"&Statistics\tCtrl+Alt+S");
     HMENU menuPort = CreateMenu();
     AppendMenu(menuPort, MF_BYPOSITION | MF_STRING, ID_PORT_NONE, L"None");
     HMENU menuBaud = CreateMenu();
@@ -1487,6 +1162,8 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdShow
     AppendMenu(menuSettings, MF_POPUP, (UINT_PTR) menuBaud, L"&Baud Rate");
     AppendMenu(menuSettings, MF_POPUP, (UINT_PTR) menuDelayChar, L"&Character Delay");
     AppendMenu(menuSettings, MF_POPUP, (UINT_PTR) menuDelayLine, L"&Line Delay");
+    AppendMenu(menuSettings, MF_BYPOSITION | MF_STRING, ID_ECHO_PACING, L"&Wait for Echo");
+    AppendMenu(menuSettings, MF_BYPOSITION | MF_STRING, ID_KEY_BLOCKS, L"Send &Key Blocks");
     AppendMenu(menuSettings, MF_BYPOSITION | MF_STRING, ID_COLOR_FG, L"Foreground Color...");
     AppendMenu(menuSettings, MF_BYPOSITION | MF_STRING, ID_COLOR_BG, L"Background Color...");
 
@@ -1504,6 +1181,22 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdShow
     delay_line = read_setting_dword(L"DelayLine", delay_line);
     set_delay_menu(menuDelayChar, ID_DELAY_CHAR_0, ID_DELAY_CHAR_500, delay_char);
     set_delay_menu(menuDelayLine, ID_DELAY_LINE_0, ID_DELAY_LINE_500, delay_line);
+    echo_pacing = read_setting_dword(L"EchoPacing", echo_pacing)!=0;
+    CheckMenuItem(menuSettings, ID_ECHO_PACING, echo_pacing ? MF_CHECKED : MF_UNCHECKED);
+    key_blocks = read_setting_dword(L"KeyBlocks", key_blocks)!=0;
+    CheckMenuItem(menuSettings, ID_KEY_BLOCKS, key_blocks ? MF_CHECKED : MF_UNCHECKED);
+
+    // all data sent to the Altair goes through the send queue
+    send_queue = new SendQueue(send_queue_write, hwnd);
+    send_queue->set_pacing(delay_char, delay_line);
+    send_queue->set_echo_pacing(echo_pacing);
+    send_queue->set_key_blocks(key_blocks);
+
+    // statistics for View/Statistics
+    metrics = new VDM1Metrics(&core);
+    metrics->set_send_queue(send_queue);
+    metrics->set_connects(&num_connects);
+    metrics->set_latency(&receive_time);
 
     int p=-1, baud=1050000;
     find_com_ports(hwnd);     
@@ -1530,8 +1223,8 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdShow
         else if( WSAAsyncSelect(server_socket, hwnd, ID_SOCKET, FD_READ)!=0 )
           return 0;
 
-        byte b = VDM_CONNECT;
-        send(hwnd, &b, 1);
+        num_connects++;
+        send_queue->send_connect();
         set_window_title(hwnd);
         RemoveMenu(menu, MF_BYPOSITION, 2);
       }
@@ -1551,19 +1244,23 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdShow
     set_window_title(hwnd);
     ShowWindow(hwnd, SW_SHOW);
 
-    //for(int i=0; i<1024; i++) mem[i] = ~(i & 0xff);
-    //mem[0x00] = mem[0x74] = mem[0xF2] = 32;
-    //for(int i=0; i<16; i++) mem[i*64] = 65+i;
-	
-    for(int i=0; i<1024; i++) mem[i] = ' ';
-	update_frame(hwnd);
+    // show the (blank) screen (the serial thread is running already)
+    WaitForSingleObject(draw_mutex, INFINITE);
+    surface.hwnd = hwnd;
+    core.set_surface(&surface);
+    core.set_write_callback(core_write, NULL);
+    core.set_state_callback(core_state, hwnd);
+    core.redraw();
+    ReleaseMutex(draw_mutex);
     
-    // start "blink" timer
+    // start "blink" and frame sync timeout timers
     SetTimer(hwnd, -1, 500, NULL);
+    SetTimer(hwnd, FRAME_TIMER, 25, NULL);
 
     // create accelerator table
-    struct tagACCEL accel[5] = 
+    struct tagACCEL accel[6] = 
       { { FVIRTKEY|FCONTROL|FALT, 0x46, ID_FULLSCREEN },
+        { FVIRTKEY|FCONTROL|FALT, 0x53, ID_STATS },
         { FVIRTKEY|FCONTROL|FALT, 0x43, ID_COPY },
         { FVIRTKEY|FCONTROL     , 0x2D, ID_COPY },
         { FVIRTKEY|FCONTROL|FALT, 0x56, ID_PASTE },
@@ -1582,6 +1279,11 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE, PWSTR pCmdLine, int nCmdShow
           }
       }
 
+    delete metrics;
+    metrics = NULL;
+    delete send_queue;
+    send_queue = NULL;
+
     if( server_socket!=INVALID_SOCKET )
       {
         shutdown(server_socket, SD_SEND);